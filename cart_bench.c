@@ -0,0 +1,2303 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : cart_bench.c
+//  Description    : This is the benchmark program for the CART driver, it
+//                   runs synthetic workloads against the driver and reports
+//                   the bus operations and time they take.
+//
+//   Author        : Patrick McDaniel
+//   Last Modified : Thu Sep 15 14:49:37 EDT 2016
+//
+
+// Include Files
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/time.h>
+#include <arpa/inet.h>
+
+// Project Includes
+#include <cart_driver.h>
+#include <cart_cache.h>
+#include <cart_crc.h>
+#include <cart_network.h>
+#include <cmpsc311_log.h>
+#include <cmpsc311_util.h>
+
+// Defines
+#define CART_BENCH_ARGUMENTS "hvUl:c:i:p:S:N:m:f:P:n:s:r:"
+#define CART_BENCH_DEFAULT_CACHE 16
+#define CART_BENCH_DEFAULT_FILES 10
+#define CART_BENCH_DEFAULT_SIZE 300
+#define CART_BENCH_DEFAULT_ROUNDS 2000
+#define CART_BENCH_REPORT_ROUNDS 500
+#define CART_BENCH_SPARSE_SPAN (64 * 1024 * 1024)
+#define CART_BENCH_SPARSE_CHUNK (64 * CART_FRAME_SIZE)
+#define CART_BENCH_TEMPLATES 8
+#define CART_BENCH_CRC_ROUNDS 100000
+#define CART_BENCH_PARALLEL_FILE "workload/waldn10.txt"
+#define CART_BENCH_PARALLEL_CHUNK 1000
+#define CART_BENCH_STRIPE_READ 64
+#define CART_BENCH_SHARD_STRIPES 8
+#define CART_BENCH_BUS_BATCH 64
+#define CART_BENCH_PART_MAX 256
+#define USAGE \
+	"USAGE: cart_bench [-h] [-v] [-l <logfile>] [-c <sz>] [-S <servers>] [-N <connections>] [-m <name>] [-f <image>] [-P <depth>] [-U] [-n <files>] [-s <frames>] [-r <rounds>] <benchmark> [<file> ...]\n" \
+	"\n" \
+	"where:\n" \
+	"    -h - help mode (display this message)\n" \
+	"    -v - verbose output\n" \
+	"    -l - write log messages to the filename <logfile>\n" \
+	"    -c - set the cart block cache to size <sz>\n" \
+	"    -i - IP address of server to connect to.\n" \
+	"    -p - port number of server to connect to.\n" \
+	"    -S - spread the cartridges over the host:port,... <servers>\n" \
+	"    -N - open <connections> to every server, the cartridges spread over them\n" \
+	"    -m - reach the server on this host through its shared memory <name>\n" \
+	"    -f - keep the cartridges in this process, in the file <image>\n" \
+	"    -P - keep up to <depth> requests in flight on each connection\n" \
+	"    -U - send the requests through io_uring, the sockets if there is none\n" \
+	"    -n - number of files used by the benchmark\n" \
+	"    -s - size of each file in frames\n" \
+	"    -r - number of rounds, 0 to run until stopped\n" \
+	"\n" \
+	"    <benchmark> - one of:\n" \
+	"        fragment - grow files in turns, defragment and compare scans\n" \
+	"        churn    - create, write, check, truncate and delete files\n" \
+	"        names    - create <files> empty files, timing open and stat as it grows\n" \
+	"        sparse   - <rounds> small writes at scattered offsets of a 64 MB file\n" \
+	"        corpus   - store the <file>s with and without tail packing, compare the frames used\n" \
+	"        appends  - grow the files in turns with small writes, count frame writes per KB\n" \
+	"        compress - store each <file> with and without compression, compare the bus bytes\n" \
+	"        dedup    - write files of zero, template and unique blocks with each dedup mode\n" \
+	"        checksum - write and read the files with frame checksums off and on, time the checks\n" \
+	"        random   - <rounds> reads and writes at random offsets, seek and read/write against pread/pwrite\n" \
+	"        parallel - <files> readers scan parts of <file> (default waldn10.txt) in turns, one handle against a handle each\n" \
+	"        stripe   - write and scan a file of <files> * <frames> frames striped over 1, 2, 4 and 8 cartridges\n" \
+	"        shards   - scan a file striped over 8 cartridges with the cartridges spread over the -S servers\n" \
+	"        pipeline - scan a file of <files> * <frames> frames in long reads with 1 to 64 requests in flight\n" \
+	"        bus      - <rounds> batches of random frame writes, then reads, straight to the server, zeroes every cartridge\n" \
+	"        pool     - the bus benchmark with 1 to 16 connections to every server\n" \
+	"        ranges   - scan a file of <files> * <frames> frames on protocol v1 and v2, 1 and 16 requests in flight\n" \
+	"        partial  - <rounds> pwrites of 1 to 256 bytes with partial frame writes off and on, compare the wire bytes\n" \
+	"\n" \
+
+//
+// Global Data
+int bench_files = CART_BENCH_DEFAULT_FILES;
+int bench_frames = CART_BENCH_DEFAULT_SIZE;
+uint32_t bench_rounds = CART_BENCH_DEFAULT_ROUNDS;
+
+//
+// Functional Prototypes
+
+int bench_fragment(void);                                 // fragmentation benchmark
+int bench_churn(void);                                    // create/delete benchmark
+int bench_names(void);                                    // namespace size benchmark
+int bench_sparse(void);                                   // scattered write benchmark
+int check_sparse(int16_t fh, uint8_t *written, char *label); // read and check the sparse file
+int bench_corpus(int count, char **paths);                // tail packing benchmark
+int store_corpus(int count, char **paths, char *label);   // write and read back the corpus
+int bench_appends(void);                                  // small write benchmark
+int bench_compress(int count, char **paths);              // compression benchmark
+int compress_file(char *data, long size, uint32_t on, double *res); // store and read back a file
+int bench_dedup(void);                                    // deduplication benchmark
+int dedup_run(uint32_t mode, char *label);                // write, rewrite and check with one mode
+int dedup_contents(char *buf, int file, int block, int version); // make a block of a dedup file
+int bench_checksum(void);                                 // frame checksum benchmark
+int checksum_write(int16_t *fh, uint32_t on, char *label); // write the files with checksums on or off
+int checksum_scan(int16_t *fh, uint32_t on, int table, char *label); // read the files from the cartridges
+int bench_random(void);                                   // positional access benchmark
+int random_run(int16_t fh, uint32_t size, int positional, int writes); // one pass of random accesses
+int bench_parallel(int count, char **paths);              // many handles on one file benchmark
+int parallel_run(int16_t *fh, char *data, uint32_t size, int handles); // one pass of the readers
+int bench_stripe(void);                                   // striped layout benchmark
+int stripe_scan(int16_t fh, uint32_t width, int frames);  // read the striped file back
+int bench_shards(void);                                   // sharded servers benchmark
+int bench_pipeline(void);                                 // pipelined requests benchmark
+int bench_bus(void);                                      // server requests per second benchmark
+int bus_run(char *frames, int writes);                    // one pass of random frame requests
+int bench_pool(void);                                     // connection pool benchmark
+int bench_ranges(void);                                   // range request benchmark
+int bench_partial(void);                                  // partial frame write benchmark
+int partial_run(int16_t fh, char *shadow, uint32_t size, uint32_t on); // one pass of small writes
+CartXferRegister bus_register(CartOpCodes op, CartridgeIndex cart, CartFrameIndex frame); // make a request
+long process_memory(void);                                // resident size of the benchmark
+int fill_pattern(char *buf, int file, uint32_t off, int len); // make the contents of a file
+int scan_files(int16_t *fh, char *label);                 // read and check every file
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : main
+// Description  : The main function for the CART benchmark
+//
+// Inputs       : argc - the number of command line parameters
+//                argv - the parameters
+// Outputs      : 0 if successful test, -1 if failure
+
+int main( int argc, char *argv[] ) {
+
+	// Local variables
+	int ch, verbose = 0, log_initialized = 0, ret = 0, depth = 1, pool = 1;
+	uint32_t cache_size = CART_BENCH_DEFAULT_CACHE;
+
+	// Process the command line parameters
+	while ((ch = getopt(argc, argv, CART_BENCH_ARGUMENTS)) != -1) {
+
+		switch (ch) {
+		case 'h': // Help, print usage
+			fprintf( stderr, USAGE );
+			return( -1 );
+
+		case 'v': // Verbose Flag
+			verbose = 1;
+			break;
+
+		case 'l': // Set the log filename
+			initializeLogWithFilename( optarg );
+			log_initialized = 1;
+			break;
+
+		case 'c': // Set cache line size
+			if ( sscanf( optarg, "%u", &cache_size ) != 1 ) {
+			    logMessage( LOG_ERROR_LEVEL, "Bad cache size [%s]", optarg );
+			    return( -1 );
+			}
+			break;
+
+		case 'i': // Get the IP address
+			if (inet_addr(optarg) == INADDR_NONE) {
+			    logMessage( LOG_ERROR_LEVEL, "Bad IP address [%s]", optarg );
+			    return( -1 );
+			}
+			cart_network_address = (unsigned char *)strdup(optarg);
+			break;
+
+		case 'p': // Set the network port number
+			if ( sscanf(optarg, "%hu", &cart_network_port) != 1 ) {
+			    logMessage( LOG_ERROR_LEVEL, "Bad  port number [%s]", optarg );
+			    return( -1 );
+			}
+			break;
+
+		case 'S': // Spread the cartridges over several servers
+			if ( client_cart_set_shards(optarg) == -1 ) {
+			    logMessage( LOG_ERROR_LEVEL, "Bad server list [%s]", optarg );
+			    return( -1 );
+			}
+			break;
+
+		case 'N': // Pool of connections to every server
+			if ( (sscanf(optarg, "%d", &pool) != 1) || (client_cart_set_pool(pool) == -1) ) {
+			    logMessage( LOG_ERROR_LEVEL, "Bad pool size [%s]", optarg );
+			    return( -1 );
+			}
+			break;
+
+		case 'U': // Send the requests through io_uring
+			client_cart_set_uring(1);
+			break;
+
+		case 'm': // Reach the server through shared memory
+			if ( client_cart_set_shm(optarg) == -1 ) {
+			    logMessage( LOG_ERROR_LEVEL, "Bad shared memory name [%s]", optarg );
+			    return( -1 );
+			}
+			break;
+
+		case 'f': // Keep the cartridges in this process
+			if ( client_cart_set_local(optarg) == -1 ) {
+			    logMessage( LOG_ERROR_LEVEL, "Bad cartridge image [%s]", optarg );
+			    return( -1 );
+			}
+			break;
+
+		case 'P': // Pipeline the requests
+			if ( (sscanf(optarg, "%d", &depth) != 1) || (client_cart_set_pipeline(depth) == -1) ) {
+			    logMessage( LOG_ERROR_LEVEL, "Bad pipeline depth [%s]", optarg );
+			    return( -1 );
+			}
+			break;
+
+		case 'n': // Number of files
+			if ( (sscanf(optarg, "%d", &bench_files) != 1) || (bench_files < 1) ) {
+			    logMessage( LOG_ERROR_LEVEL, "Bad number of files [%s]", optarg );
+			    return( -1 );
+			}
+			break;
+
+		case 's': // Size of the files
+			if ( (sscanf(optarg, "%d", &bench_frames) != 1) || (bench_frames < 1) ) {
+			    logMessage( LOG_ERROR_LEVEL, "Bad file size [%s]", optarg );
+			    return( -1 );
+			}
+			break;
+
+		case 'r': // Number of rounds
+			if ( sscanf(optarg, "%u", &bench_rounds) != 1 ) {
+			    logMessage( LOG_ERROR_LEVEL, "Bad number of rounds [%s]", optarg );
+			    return( -1 );
+			}
+			break;
+
+		default:  // Default (unknown)
+			fprintf( stderr, "Unknown command line option (%c), aborting.\n", ch );
+			return( -1 );
+		}
+	}
+
+	// Setup the log as needed
+	if ( ! log_initialized ) {
+		initializeLogWithFilehandle( CMPSC311_LOG_STDERR );
+	}
+	if ( verbose ) {
+		enableLogLevels(LOG_INFO_LEVEL);
+	}
+	set_cart_cache_size(cache_size);
+
+	// The benchmark should be the next option
+	if ( optind >= argc ) {
+		fprintf( stderr, "Missing command line parameters, use -h to see usage, aborting.\n" );
+		return( -1 );
+	}
+
+	// Run the benchmark
+	if ( strcmp(argv[optind], "fragment") == 0 ) {
+		ret = bench_fragment();
+	} else if ( strcmp(argv[optind], "churn") == 0 ) {
+		ret = bench_churn();
+	} else if ( strcmp(argv[optind], "names") == 0 ) {
+		ret = bench_names();
+	} else if ( strcmp(argv[optind], "sparse") == 0 ) {
+		ret = bench_sparse();
+	} else if ( strcmp(argv[optind], "corpus") == 0 ) {
+		ret = bench_corpus(argc - optind - 1, &argv[optind + 1]);
+	} else if ( strcmp(argv[optind], "appends") == 0 ) {
+		ret = bench_appends();
+	} else if ( strcmp(argv[optind], "compress") == 0 ) {
+		ret = bench_compress(argc - optind - 1, &argv[optind + 1]);
+	} else if ( strcmp(argv[optind], "dedup") == 0 ) {
+		ret = bench_dedup();
+	} else if ( strcmp(argv[optind], "checksum") == 0 ) {
+		ret = bench_checksum();
+	} else if ( strcmp(argv[optind], "random") == 0 ) {
+		ret = bench_random();
+	} else if ( strcmp(argv[optind], "parallel") == 0 ) {
+		ret = bench_parallel(argc - optind - 1, &argv[optind + 1]);
+	} else if ( strcmp(argv[optind], "stripe") == 0 ) {
+		ret = bench_stripe();
+	} else if ( strcmp(argv[optind], "shards") == 0 ) {
+		ret = bench_shards();
+	} else if ( strcmp(argv[optind], "pipeline") == 0 ) {
+		ret = bench_pipeline();
+	} else if ( strcmp(argv[optind], "bus") == 0 ) {
+		ret = bench_bus();
+	} else if ( strcmp(argv[optind], "pool") == 0 ) {
+		ret = bench_pool();
+	} else if ( strcmp(argv[optind], "ranges") == 0 ) {
+		ret = bench_ranges();
+	} else if ( strcmp(argv[optind], "partial") == 0 ) {
+		ret = bench_partial();
+	} else {
+		fprintf( stderr, "Unknown benchmark [%s], use -h to see usage, aborting.\n", argv[optind] );
+		return( -1 );
+	}
+
+	if ( ret == 0 ) {
+		logMessage( LOG_OUTPUT_LEVEL, "CART benchmark [%s] completed successfully.", argv[optind] );
+	} else {
+		logMessage( LOG_ERROR_LEVEL, "CART benchmark [%s] failed.", argv[optind] );
+	}
+
+	// Return successfully
+	return( ret );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fill_pattern
+// Description  : Make the contents of part of a benchmark file
+//
+// Inputs       : buf - buffer to fill
+//                file - number of the file
+//                off - offset in the file of the first byte
+//                len - number of bytes
+// Outputs      : 0 if successful
+
+int fill_pattern(char *buf, int file, uint32_t off, int len) {
+	for (int i = 0; i < len; i++) {
+		buf[i] = (char) ((file * 31) + ((off + i) * 7) + ((off + i) / CART_FRAME_SIZE));
+	}
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : scan_files
+// Description  : Read every benchmark file from start to end, check the
+//                contents and log the cartridge loads it took
+//
+// Inputs       : fh - the file handles
+//                label - name of the scan in the log
+// Outputs      : 0 if successful, -1 if failure
+
+int scan_files(int16_t *fh, char *label) {
+
+	// Local variables
+	char buf[CART_FRAME_SIZE], expect[CART_FRAME_SIZE];
+	uint64_t before[CART_OP_MAXVAL], after[CART_OP_MAXVAL];
+	struct timeval start, end;
+
+	cart_bus_counts(before);
+	gettimeofday(&start, NULL);
+	for (int i = 0; i < bench_files; i++) {
+		if ( cart_seek(fh[i], 0) == -1 ) {
+			return( -1 );
+		}
+		for (int j = 0; j < bench_frames; j++) {
+			if ( cart_read(fh[i], buf, CART_FRAME_SIZE) != CART_FRAME_SIZE ) {
+				logMessage( LOG_ERROR_LEVEL, "Read of file %d frame %d failed.", i, j );
+				return( -1 );
+			}
+			fill_pattern(expect, i, j * CART_FRAME_SIZE, CART_FRAME_SIZE);
+			if ( memcmp(buf, expect, CART_FRAME_SIZE) != 0 ) {
+				logMessage( LOG_ERROR_LEVEL, "File %d frame %d has the wrong contents.", i, j );
+				return( -1 );
+			}
+		}
+	}
+	gettimeofday(&end, NULL);
+	cart_bus_counts(after);
+
+	logMessage( LOG_OUTPUT_LEVEL, "%s scan: %lu LDCART for %d files (%.2f per file), %lu RDFRME, %ld usec",
+		label, after[CART_OP_LDCART] - before[CART_OP_LDCART], bench_files,
+		(double) (after[CART_OP_LDCART] - before[CART_OP_LDCART]) / bench_files,
+		after[CART_OP_RDFRME] - before[CART_OP_RDFRME], compareTimes(&start, &end));
+
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_fragment
+// Description  : Grow the files a few frames at a time in turns so that they
+//                spread over the cartridges, then scan them before and after
+//                defragmenting
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int bench_fragment(void) {
+
+	// Local variables
+	char buf[CART_FRAME_SIZE], fname[CART_MAX_PATH_LENGTH];
+	int16_t *fh = NULL;
+	int32_t moved = 0, total = 0;
+	uint64_t before[CART_OP_MAXVAL], after[CART_OP_MAXVAL];
+	struct timeval start, end;
+
+	if ( cart_poweron() == -1 ) {
+		return( -1 );
+	}
+
+	// Create the files
+	fh = malloc(sizeof(int16_t) * bench_files);
+	for (int i = 0; i < bench_files; i++) {
+		snprintf(fname, sizeof(fname), "bench-fragment-%d", i);
+		if ( (fh[i] = cart_open(fname)) == -1 ) {
+			free(fh);
+			return( -1 );
+		}
+	}
+
+	// Append a few frames to each file in turn, the rounds get longer so
+	// that the files cross cartridges at different blocks
+	for (int j = 0, round = 1; j < bench_frames; j += round, round++) {
+		for (int i = 0; i < bench_files; i++) {
+			for (int k = j; (k < j + round) && (k < bench_frames); k++) {
+				fill_pattern(buf, i, k * CART_FRAME_SIZE, CART_FRAME_SIZE);
+				if ( cart_write(fh[i], buf, CART_FRAME_SIZE) != CART_FRAME_SIZE ) {
+					free(fh);
+					return( -1 );
+				}
+			}
+		}
+	}
+
+	// Scan, defragment and scan again
+	cart_fragmentation_report();
+	if ( scan_files(fh, "fragmented") == -1 ) {
+		free(fh);
+		return( -1 );
+	}
+
+	cart_bus_counts(before);
+	gettimeofday(&start, NULL);
+	while ( (moved = cart_defrag(CART_BENCH_DEFAULT_SIZE)) > 0 ) {
+		total += moved;
+	}
+	gettimeofday(&end, NULL);
+	cart_bus_counts(after);
+	if ( moved == -1 ) {
+		free(fh);
+		return( -1 );
+	}
+	logMessage( LOG_OUTPUT_LEVEL, "defragment: %d frames moved, %lu LDCART, %lu RDFRME, %lu WRFRME, %ld usec",
+		total, after[CART_OP_LDCART] - before[CART_OP_LDCART], after[CART_OP_RDFRME] - before[CART_OP_RDFRME],
+		after[CART_OP_WRFRME] - before[CART_OP_WRFRME], compareTimes(&start, &end));
+
+	cart_fragmentation_report();
+	if ( scan_files(fh, "defragmented") == -1 ) {
+		free(fh);
+		return( -1 );
+	}
+
+	for (int i = 0; i < bench_files; i++) {
+		cart_close(fh[i]);
+	}
+	free(fh);
+
+	return( cart_poweroff() );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : process_memory
+// Description  : Get the resident size of the benchmark process
+//
+// Inputs       : none
+// Outputs      : resident size in kilobytes, -1 if failure
+
+long process_memory(void) {
+	FILE *statm = NULL;
+	long size = 0, resident = 0;
+
+	if ( (statm = fopen("/proc/self/statm", "r")) == NULL ) {
+		return( -1 );
+	}
+	if ( fscanf(statm, "%ld %ld", &size, &resident) != 2 ) {
+		resident = -1;
+	}
+	fclose(statm);
+
+	return( (resident == -1) ? -1 : resident * (sysconf(_SC_PAGESIZE) / 1024) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_churn
+// Description  : Keep a window of live files, every round creates and writes
+//                a new file, checks the oldest one, truncates every fourth
+//                file and deletes the oldest, logging the latency and memory
+//                every few hundred rounds
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int bench_churn(void) {
+
+	// Local variables
+	char buf[CART_FRAME_SIZE], expect[CART_FRAME_SIZE], fname[CART_MAX_PATH_LENGTH];
+	uint32_t *length = NULL, round = 0, oldest = 0, len = 0;
+	int32_t count = 0;
+	int16_t fh = 0;
+	long create_usec = 0, unlink_usec = 0, worst_usec = 0, usec = 0;
+	uint64_t bytes = 0;
+	struct timeval start, end;
+
+	if ( cart_poweron() == -1 ) {
+		return( -1 );
+	}
+	length = calloc(bench_files, sizeof(uint32_t));
+	srand(311);
+
+	for (round = 0; (bench_rounds == 0) || (round < bench_rounds); round++) {
+
+		// Create and write the new file, random length
+		len = (rand() % (bench_frames * CART_FRAME_SIZE)) + 1;
+		snprintf(fname, sizeof(fname), "bench-churn-%u", round);
+		gettimeofday(&start, NULL);
+		if ( (fh = cart_open(fname)) == -1 ) {
+			logMessage( LOG_ERROR_LEVEL, "Create of [%s] failed.", fname );
+			free(length);
+			return( -1 );
+		}
+		for (uint32_t off = 0; off < len; off += count) {
+			count = (len - off > CART_FRAME_SIZE) ? CART_FRAME_SIZE : len - off;
+			fill_pattern(buf, round, off, count);
+			if ( cart_write(fh, buf, count) != count ) {
+				logMessage( LOG_ERROR_LEVEL, "Write of [%s] failed.", fname );
+				free(length);
+				return( -1 );
+			}
+		}
+
+		// Cut every fourth file in half
+		if ( round % 4 == 3 ) {
+			len /= 2;
+			if ( cart_truncate(fh, len) == -1 ) {
+				logMessage( LOG_ERROR_LEVEL, "Truncate of [%s] failed.", fname );
+				free(length);
+				return( -1 );
+			}
+		}
+		cart_close(fh);
+		gettimeofday(&end, NULL);
+		usec = compareTimes(&start, &end);
+		create_usec += usec;
+		worst_usec = (usec > worst_usec) ? usec : worst_usec;
+		length[round % bench_files] = len;
+		bytes += len;
+
+		// Once the window is full, check and delete the oldest file
+		if ( round + 1 >= (uint32_t) bench_files ) {
+			oldest = round + 1 - bench_files;
+			snprintf(fname, sizeof(fname), "bench-churn-%u", oldest);
+			if ( (fh = cart_open(fname)) == -1 ) {
+				logMessage( LOG_ERROR_LEVEL, "Open of [%s] failed.", fname );
+				free(length);
+				return( -1 );
+			}
+			for (uint32_t off = 0; off < length[oldest % bench_files]; off += count) {
+				count = cart_read(fh, buf, CART_FRAME_SIZE);
+				fill_pattern(expect, oldest, off, count);
+				if ( (count <= 0) || (memcmp(buf, expect, count) != 0) ) {
+					logMessage( LOG_ERROR_LEVEL, "File [%s] has the wrong contents at offset %u.", fname, off );
+					free(length);
+					return( -1 );
+				}
+			}
+			cart_close(fh);
+
+			gettimeofday(&start, NULL);
+			if ( cart_unlink(fname) == -1 ) {
+				logMessage( LOG_ERROR_LEVEL, "Unlink of [%s] failed.", fname );
+				free(length);
+				return( -1 );
+			}
+			gettimeofday(&end, NULL);
+			usec = compareTimes(&start, &end);
+			unlink_usec += usec;
+			worst_usec = (usec > worst_usec) ? usec : worst_usec;
+		}
+
+		// Report the latency and memory so far
+		if ( (round + 1) % CART_BENCH_REPORT_ROUNDS == 0 ) {
+			logMessage( LOG_OUTPUT_LEVEL, "churn round %u: %lu bytes written, create+write %ld usec/file, "
+				"unlink %ld usec, worst %ld usec, driver %d bytes, process %ld KB",
+				round + 1, bytes, create_usec / CART_BENCH_REPORT_ROUNDS, unlink_usec / CART_BENCH_REPORT_ROUNDS,
+				worst_usec, cart_memory_report(), process_memory() );
+			create_usec = unlink_usec = worst_usec = 0;
+			bytes = 0;
+		}
+	}
+	free(length);
+
+	return( cart_poweroff() );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_names
+// Description  : Create empty files up to the number asked for, and every
+//                time the count grows tenfold time opening new files, opening
+//                existing ones and stat of random ones
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int bench_names(void) {
+
+	// Local variables
+	char fname[CART_MAX_PATH_LENGTH];
+	uint32_t created = 0, first = 0, next = 1000, samples = 1000, pick = 0;
+	int16_t fh = 0;
+	long create_usec = 0, open_usec = 0, stat_usec = 0;
+	CartFileStat stat;
+	struct timeval start, end;
+
+	if ( cart_poweron() == -1 ) {
+		return( -1 );
+	}
+	srand(311);
+
+	while ( created < (uint32_t) bench_files ) {
+
+		// Create files up to the next step, timing the opens
+		if ( next > (uint32_t) bench_files ) {
+			next = bench_files;
+		}
+		create_usec = 0;
+		first = created;
+		for ( ; created < next; created++ ) {
+			snprintf(fname, sizeof(fname), "bench-names-%u", created);
+			gettimeofday(&start, NULL);
+			fh = cart_open(fname);
+			gettimeofday(&end, NULL);
+			if ( fh == -1 ) {
+				logMessage( LOG_ERROR_LEVEL, "Create of [%s] failed.", fname );
+				return( -1 );
+			}
+			create_usec += compareTimes(&start, &end);
+			cart_close(fh);
+		}
+
+		// Open and stat random files that exist
+		open_usec = stat_usec = 0;
+		for (uint32_t i = 0; i < samples; i++) {
+			pick = ((uint32_t) rand() * 2654435761u) % created;
+			snprintf(fname, sizeof(fname), "bench-names-%u", pick);
+			gettimeofday(&start, NULL);
+			fh = cart_open(fname);
+			gettimeofday(&end, NULL);
+			if ( fh == -1 ) {
+				logMessage( LOG_ERROR_LEVEL, "Open of [%s] failed.", fname );
+				return( -1 );
+			}
+			open_usec += compareTimes(&start, &end);
+			cart_close(fh);
+
+			gettimeofday(&start, NULL);
+			if ( cart_stat(fname, &stat) == -1 ) {
+				logMessage( LOG_ERROR_LEVEL, "Stat of [%s] failed.", fname );
+				return( -1 );
+			}
+			gettimeofday(&end, NULL);
+			stat_usec += compareTimes(&start, &end);
+		}
+
+		logMessage( LOG_OUTPUT_LEVEL, "names %u files: create %.3f usec, open %.3f usec, stat %.3f usec, driver %d bytes, process %ld KB",
+			created, (double) create_usec / (created - first),
+			(double) open_usec / samples, (double) stat_usec / samples, cart_memory_report(), process_memory() );
+		next *= 10;
+	}
+
+	return( cart_poweroff() );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : check_sparse
+// Description  : Read the sparse file from start to end, the bytes that were
+//                written must hold the pattern and the rest must be zeros
+//
+// Inputs       : fh - the file handle
+//                written - one bit per byte of the file, set if written
+//                label - name of the check in the log
+// Outputs      : 0 if successful, -1 if failure
+
+int check_sparse(int16_t fh, uint8_t *written, char *label) {
+
+	// Local variables
+	char *buf = NULL, *expect = NULL;
+	uint32_t off = 0;
+	uint64_t before[CART_OP_MAXVAL], after[CART_OP_MAXVAL];
+	CartFileStat stat;
+	struct timeval start, end;
+	int ret = 0;
+
+	buf = malloc(CART_BENCH_SPARSE_CHUNK);
+	expect = malloc(CART_BENCH_SPARSE_CHUNK);
+	if ( (buf == NULL) || (expect == NULL) || (cart_stat("bench-sparse", &stat) == -1) || (cart_seek(fh, 0) == -1) ) {
+		free(buf);
+		free(expect);
+		return( -1 );
+	}
+
+	cart_bus_counts(before);
+	gettimeofday(&start, NULL);
+	for (off = 0; off < stat.length; off += CART_BENCH_SPARSE_CHUNK) {
+		if ( cart_read(fh, buf, CART_BENCH_SPARSE_CHUNK) != CART_BENCH_SPARSE_CHUNK ) {
+			logMessage( LOG_ERROR_LEVEL, "Read of the sparse file at %u failed.", off );
+			ret = -1;
+			break;
+		}
+		fill_pattern(expect, 0, off, CART_BENCH_SPARSE_CHUNK);
+		for (uint32_t i = 0; i < CART_BENCH_SPARSE_CHUNK; i++) {
+			if ( (written[(off + i) / 8] & (1 << ((off + i) % 8))) == 0 ) {
+				expect[i] = 0;
+			}
+		}
+		if ( memcmp(buf, expect, CART_BENCH_SPARSE_CHUNK) != 0 ) {
+			logMessage( LOG_ERROR_LEVEL, "Sparse file has the wrong contents at %u.", off );
+			ret = -1;
+			break;
+		}
+	}
+	gettimeofday(&end, NULL);
+	cart_bus_counts(after);
+
+	if ( ret == 0 ) {
+		logMessage( LOG_OUTPUT_LEVEL, "sparse %s: length %u, %u frames allocated (%u if dense), read %lu RDFRME, %ld usec",
+			label, stat.length, stat.frames, (stat.length + CART_FRAME_SIZE - 1) / CART_FRAME_SIZE,
+			after[CART_OP_RDFRME] - before[CART_OP_RDFRME], compareTimes(&start, &end) );
+	}
+	free(buf);
+	free(expect);
+
+	return( ret );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_sparse
+// Description  : Make small writes at scattered offsets of a file far larger
+//                than all of the cartridges together, check it, then cut it
+//                in half and grow it back
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int bench_sparse(void) {
+
+	// Local variables
+	char buf[2 * CART_FRAME_SIZE];
+	uint8_t *written = NULL;
+	uint32_t off = 0, len = 0;
+	uint64_t before[CART_OP_MAXVAL], after[CART_OP_MAXVAL];
+	int16_t fh = 0;
+	struct timeval start, end;
+
+	if ( (written = calloc(CART_BENCH_SPARSE_SPAN / 8, 1)) == NULL ) {
+		return( -1 );
+	}
+	if ( (cart_poweron() == -1) || ((fh = cart_open("bench-sparse")) == -1) ) {
+		free(written);
+		return( -1 );
+	}
+	srand(321);
+
+	// Write at random offsets, the last write sets the length to the whole span
+	cart_bus_counts(before);
+	gettimeofday(&start, NULL);
+	for (uint32_t i = 0; i < bench_rounds; i++) {
+		len = 1 + (rand() % sizeof(buf));
+		off = (i == bench_rounds - 1) ? CART_BENCH_SPARSE_SPAN - len : ((uint32_t) rand() * 2654435761u) % (CART_BENCH_SPARSE_SPAN - len);
+		fill_pattern(buf, 0, off, len);
+		if ( (cart_seek(fh, off) == -1) || (cart_write(fh, buf, len) != (int32_t) len) ) {
+			logMessage( LOG_ERROR_LEVEL, "Write of %u bytes at %u failed.", len, off );
+			free(written);
+			return( -1 );
+		}
+		for (uint32_t j = off; j < off + len; j++) {
+			written[j / 8] |= 1 << (j % 8);
+		}
+	}
+	gettimeofday(&end, NULL);
+	cart_bus_counts(after);
+	logMessage( LOG_OUTPUT_LEVEL, "sparse writes: %u writes, %lu WRFRME, %lu RDFRME, %.3f usec per write",
+		bench_rounds, after[CART_OP_WRFRME] - before[CART_OP_WRFRME], after[CART_OP_RDFRME] - before[CART_OP_RDFRME],
+		(double) compareTimes(&start, &end) / bench_rounds );
+
+	if ( check_sparse(fh, written, "written") == -1 ) {
+		free(written);
+		return( -1 );
+	}
+
+	// Cut the file in half and grow it back, the second half is a hole again
+	if ( (cart_truncate(fh, CART_BENCH_SPARSE_SPAN / 2 + 100) == -1) || (cart_truncate(fh, CART_BENCH_SPARSE_SPAN) == -1) ) {
+		free(written);
+		return( -1 );
+	}
+	for (off = CART_BENCH_SPARSE_SPAN / 2 + 100; off < CART_BENCH_SPARSE_SPAN; off++) {
+		written[off / 8] &= ~(1 << (off % 8));
+	}
+	if ( check_sparse(fh, written, "regrown") == -1 ) {
+		free(written);
+		return( -1 );
+	}
+
+	free(written);
+	cart_close(fh);
+	return( cart_poweroff() );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : store_corpus
+// Description  : Copy every corpus file into the CART filesystem, then read
+//                them all back and check them, logging the frames they took
+//
+// Inputs       : count - number of files
+//                paths - the files
+//                label - name of the run in the log
+// Outputs      : 0 if successful, -1 if failure
+
+int store_corpus(int count, char **paths, char *label) {
+
+	// Local variables
+	char fname[CART_MAX_PATH_LENGTH], *data = NULL, *back = NULL;
+	long size = 0, bytes = 0;
+	int32_t frames = 0;
+	int16_t fh = 0;
+	uint64_t before[CART_OP_MAXVAL], after[CART_OP_MAXVAL];
+	FILE *in = NULL;
+	struct timeval start, end;
+
+	// Write every file, closing it packs its last block
+	frames = cart_frames_used();
+	for (int i = 0; i < count; i++) {
+		if ( (in = fopen(paths[i], "r")) == NULL ) {
+			logMessage( LOG_ERROR_LEVEL, "Cannot open corpus file [%s].", paths[i] );
+			return( -1 );
+		}
+		fseek(in, 0, SEEK_END);
+		size = ftell(in);
+		fseek(in, 0, SEEK_SET);
+		data = malloc(size + 1);
+		if ( (data == NULL) || (fread(data, 1, size, in) != (size_t) size) ) {
+			fclose(in);
+			free(data);
+			return( -1 );
+		}
+		fclose(in);
+
+		snprintf(fname, sizeof(fname), "corpus-%s-%d", label, i);
+		if ( ((fh = cart_open(fname)) == -1) || (cart_write(fh, data, size) != size) || (cart_close(fh) == -1) ) {
+			logMessage( LOG_ERROR_LEVEL, "Write of corpus file [%s] failed.", paths[i] );
+			free(data);
+			return( -1 );
+		}
+		bytes += size;
+		free(data);
+	}
+	cart_sync();
+	frames = cart_frames_used() - frames;
+
+	// Read them all back
+	cart_bus_counts(before);
+	gettimeofday(&start, NULL);
+	for (int i = 0; i < count; i++) {
+		if ( (in = fopen(paths[i], "r")) == NULL ) {
+			return( -1 );
+		}
+		fseek(in, 0, SEEK_END);
+		size = ftell(in);
+		fseek(in, 0, SEEK_SET);
+		data = malloc(size + 1);
+		back = malloc(size + 1);
+		if ( (data == NULL) || (back == NULL) || (fread(data, 1, size, in) != (size_t) size) ) {
+			fclose(in);
+			free(data);
+			free(back);
+			return( -1 );
+		}
+		fclose(in);
+
+		snprintf(fname, sizeof(fname), "corpus-%s-%d", label, i);
+		if ( ((fh = cart_open(fname)) == -1) || (cart_read(fh, back, size) != size) || (memcmp(data, back, size) != 0) ) {
+			logMessage( LOG_ERROR_LEVEL, "Corpus file [%s] did not read back.", paths[i] );
+			free(data);
+			free(back);
+			return( -1 );
+		}
+		cart_close(fh);
+		free(data);
+		free(back);
+	}
+	gettimeofday(&end, NULL);
+	cart_bus_counts(after);
+
+	logMessage( LOG_OUTPUT_LEVEL, "corpus %s: %d files, %ld bytes in %d frames (%.1f bytes per frame), read back with %lu RDFRME in %ld usec",
+		label, count, bytes, frames, (double) bytes / frames, after[CART_OP_RDFRME] - before[CART_OP_RDFRME],
+		compareTimes(&start, &end) );
+
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_corpus
+// Description  : Store a set of files with tail packing off, delete them and
+//                store them again with it on
+//
+// Inputs       : count - number of files
+//                paths - the files
+// Outputs      : 0 if successful, -1 if failure
+
+int bench_corpus(int count, char **paths) {
+
+	// Local variables
+	char fname[CART_MAX_PATH_LENGTH];
+
+	if ( count < 1 ) {
+		fprintf( stderr, "The corpus benchmark needs files to store, aborting.\n" );
+		return( -1 );
+	}
+	if ( cart_poweron() == -1 ) {
+		return( -1 );
+	}
+
+	cart_set_tail_packing(0);
+	if ( store_corpus(count, paths, "unpacked") == -1 ) {
+		return( -1 );
+	}
+	for (int i = 0; i < count; i++) {
+		snprintf(fname, sizeof(fname), "corpus-unpacked-%d", i);
+		if ( cart_unlink(fname) == -1 ) {
+			return( -1 );
+		}
+	}
+
+	cart_set_tail_packing(CART_FRAME_SIZE / 2);
+	if ( store_corpus(count, paths, "packed") == -1 ) {
+		return( -1 );
+	}
+
+	return( cart_poweroff() );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_appends
+// Description  : Grow every file to its size with writes of 10 to 200 bytes,
+//                taking turns between the files, then check them
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int bench_appends(void) {
+
+	// Local variables
+	char buf[200], fname[CART_MAX_PATH_LENGTH];
+	int16_t *fh = NULL;
+	uint32_t *length = NULL, size = bench_frames * CART_FRAME_SIZE, len = 0, writes = 0;
+	int done = 0;
+	uint64_t before[CART_OP_MAXVAL], after[CART_OP_MAXVAL];
+	struct timeval start, end;
+
+	fh = calloc(bench_files, sizeof(int16_t));
+	length = calloc(bench_files, sizeof(uint32_t));
+	if ( (fh == NULL) || (length == NULL) || (cart_poweron() == -1) ) {
+		free(fh);
+		free(length);
+		return( -1 );
+	}
+	for (int i = 0; i < bench_files; i++) {
+		snprintf(fname, sizeof(fname), "bench-appends-%d", i);
+		if ( (fh[i] = cart_open(fname)) == -1 ) {
+			free(fh);
+			free(length);
+			return( -1 );
+		}
+	}
+	srand(341);
+
+	// Append to the files in turns until they are all full
+	cart_bus_counts(before);
+	gettimeofday(&start, NULL);
+	while ( done < bench_files ) {
+		done = 0;
+		for (int i = 0; i < bench_files; i++) {
+			len = 10 + (rand() % 191);
+			if ( len > size - length[i] ) {
+				len = size - length[i];
+			}
+			if ( len == 0 ) {
+				done++;
+				continue;
+			}
+			fill_pattern(buf, i, length[i], len);
+			if ( cart_write(fh[i], buf, len) != (int32_t) len ) {
+				logMessage( LOG_ERROR_LEVEL, "Append to file %d failed.", i );
+				free(fh);
+				free(length);
+				return( -1 );
+			}
+			length[i] += len;
+			writes++;
+		}
+	}
+	cart_sync();
+	gettimeofday(&end, NULL);
+	cart_bus_counts(after);
+
+	logMessage( LOG_OUTPUT_LEVEL, "appends: %u writes, %d KB, %lu WRFRME (%.2f per KB), %.3f usec per write",
+		writes, bench_files * bench_frames, after[CART_OP_WRFRME] - before[CART_OP_WRFRME],
+		(double) (after[CART_OP_WRFRME] - before[CART_OP_WRFRME]) / (bench_files * bench_frames),
+		(double) compareTimes(&start, &end) / writes );
+
+	if ( scan_files(fh, "appended") == -1 ) {
+		free(fh);
+		free(length);
+		return( -1 );
+	}
+	for (int i = 0; i < bench_files; i++) {
+		cart_close(fh[i]);
+	}
+	free(fh);
+	free(length);
+
+	return( cart_poweroff() );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : compress_file
+// Description  : Write a file with compression on or off, empty the frame
+//                cache and read it back, measuring the bus bytes and time
+//
+// Inputs       : data - contents of the file
+//                size - length of the file
+//                on - 1 to compress the blocks
+//                res - stored bytes, write bus bytes, write usec, read bus
+//                      bytes and read usec of the run
+// Outputs      : 0 if successful, -1 if failure
+
+int compress_file(char *data, long size, uint32_t on, double *res) {
+
+	// Local variables
+	char *back = NULL;
+	int16_t fh = 0;
+	CartFileStat stat;
+	uint64_t before[CART_OP_MAXVAL], after[CART_OP_MAXVAL];
+	struct timeval start, end;
+
+	if ( (back = malloc(size + 1)) == NULL ) {
+		return( -1 );
+	}
+
+	// Write the file and push it all out to the cartridges
+	if ( cart_set_compression(on) == -1 ) {
+		free(back);
+		return( -1 );
+	}
+	cart_bus_counts(before);
+	gettimeofday(&start, NULL);
+	if ( ((fh = cart_open("bench-compress")) == -1) || (cart_write(fh, data, size) != size) ||
+			(cart_close(fh) == -1) || (cart_sync() == -1) ) {
+		logMessage( LOG_ERROR_LEVEL, "Write of compressed file failed." );
+		free(back);
+		return( -1 );
+	}
+	gettimeofday(&end, NULL);
+	cart_bus_counts(after);
+	res[1] = (double) (after[CART_OP_RDFRME] - before[CART_OP_RDFRME] + after[CART_OP_WRFRME] - before[CART_OP_WRFRME]) * CART_FRAME_SIZE;
+	res[2] = compareTimes(&start, &end);
+	cart_stat("bench-compress", &stat);
+	res[0] = stat.stored;
+
+	// Read it back with nothing cached
+	close_cart_cache();
+	init_cart_cache();
+	cart_bus_counts(before);
+	gettimeofday(&start, NULL);
+	if ( ((fh = cart_open("bench-compress")) == -1) || (cart_read(fh, back, size) != size) ||
+			(memcmp(data, back, size) != 0) ) {
+		logMessage( LOG_ERROR_LEVEL, "Compressed file did not read back." );
+		free(back);
+		return( -1 );
+	}
+	gettimeofday(&end, NULL);
+	cart_bus_counts(after);
+	res[3] = (double) (after[CART_OP_RDFRME] - before[CART_OP_RDFRME] + after[CART_OP_WRFRME] - before[CART_OP_WRFRME]) * CART_FRAME_SIZE;
+	res[4] = compareTimes(&start, &end);
+	free(back);
+
+	// Delete it so the next run starts from the same frames
+	if ( (cart_close(fh) == -1) || (cart_unlink("bench-compress") == -1) ) {
+		return( -1 );
+	}
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_compress
+// Description  : Store each file without and with compression, logging the
+//                ratio, the bus bytes saved and the throughput for each
+//
+// Inputs       : count - number of files
+//                paths - the files
+// Outputs      : 0 if successful, -1 if failure
+
+int bench_compress(int count, char **paths) {
+
+	// Local variables
+	char *data = NULL;
+	long size = 0;
+	double off[5], on[5];
+	FILE *in = NULL;
+
+	if ( count < 1 ) {
+		fprintf( stderr, "The compress benchmark needs files to store, aborting.\n" );
+		return( -1 );
+	}
+	if ( cart_poweron() == -1 ) {
+		return( -1 );
+	}
+
+	for (int i = 0; i < count; i++) {
+		if ( (in = fopen(paths[i], "r")) == NULL ) {
+			logMessage( LOG_ERROR_LEVEL, "Cannot open corpus file [%s].", paths[i] );
+			return( -1 );
+		}
+		fseek(in, 0, SEEK_END);
+		size = ftell(in);
+		fseek(in, 0, SEEK_SET);
+		data = malloc(size + 1);
+		if ( (data == NULL) || (size == 0) || (fread(data, 1, size, in) != (size_t) size) ) {
+			fclose(in);
+			free(data);
+			return( -1 );
+		}
+		fclose(in);
+
+		if ( (compress_file(data, size, 0, off) == -1) || (compress_file(data, size, 1, on) == -1) ) {
+			free(data);
+			return( -1 );
+		}
+		free(data);
+
+		logMessage( LOG_OUTPUT_LEVEL, "compress %s: %ld bytes stored in %.0f (ratio %.2f), bus bytes written %.0f -> %.0f (%.1f%% saved), read %.0f -> %.0f (%.1f%% saved)",
+			paths[i], size, on[0], (double) size / on[0], off[1], on[1], 100.0 * (off[1] - on[1]) / off[1],
+			off[3], on[3], 100.0 * (off[3] - on[3]) / off[3] );
+		logMessage( LOG_OUTPUT_LEVEL, "compress %s: write %.2f -> %.2f MB/s, read %.2f -> %.2f MB/s",
+			paths[i], size / off[2], size / on[2], size / off[4], size / on[4] );
+	}
+
+	return( cart_poweroff() );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : dedup_contents
+// Description  : Make the contents of a block of a dedup benchmark file, a
+//                quarter of the blocks are zeros, a third are copies of a few
+//                templates and the rest are unique. Rewritten blocks are unique
+//
+// Inputs       : buf - buffer to fill
+//                file - number of the file
+//                block - block of the file
+//                version - times the block was rewritten
+// Outputs      : 0 if successful
+
+int dedup_contents(char *buf, int file, int block, int version) {
+	uint32_t seed = ((uint32_t) file * 7919u + (uint32_t) block) * 2654435761u + (uint32_t) version * 40503u;
+	uint32_t kind = (seed >> 16) % 100;
+
+	if ( (version == 0) && (kind < 25) ) {
+		memset(buf, 0, CART_FRAME_SIZE);
+		return( 0 );
+	}
+	if ( (version == 0) && (kind < 60) ) {
+		seed = kind % CART_BENCH_TEMPLATES;
+	} else {
+		seed ^= 0x9e3779b9u;
+	}
+	for (int i = 0; i < CART_FRAME_SIZE; i += sizeof(seed)) {
+		seed = seed * 1103515245u + 12345u;
+		memcpy(&buf[i], &seed, sizeof(seed));
+	}
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : dedup_run
+// Description  : Write the dedup files with one mode, rewrite a tenth of the
+//                blocks, check every block and delete the files
+//
+// Inputs       : mode - the CART_DEDUP mode
+//                label - name of the run in the log
+// Outputs      : 0 if successful, -1 if failure
+
+int dedup_run(uint32_t mode, char *label) {
+
+	// Local variables
+	char buf[CART_FRAME_SIZE], back[CART_FRAME_SIZE], fname[CART_MAX_PATH_LENGTH];
+	int16_t *fh = NULL;
+	int32_t frames = 0, rewritten = 0;
+	uint32_t blocks = bench_files * bench_frames;
+	uint64_t before[CART_OP_MAXVAL], after[CART_OP_MAXVAL];
+	CartDedupStat first, last;
+	struct timeval start, end;
+
+	if ( ((fh = calloc(bench_files, sizeof(int16_t))) == NULL) || (cart_set_dedup(mode) == -1) ) {
+		free(fh);
+		return( -1 );
+	}
+
+	// Write every file block by block
+	frames = cart_frames_used();
+	cart_dedup_stats(&first);
+	cart_bus_counts(before);
+	gettimeofday(&start, NULL);
+	for (int i = 0; i < bench_files; i++) {
+		snprintf(fname, sizeof(fname), "bench-dedup-%s-%d", label, i);
+		if ( (fh[i] = cart_open(fname)) == -1 ) {
+			free(fh);
+			return( -1 );
+		}
+		for (int j = 0; j < bench_frames; j++) {
+			dedup_contents(buf, i, j, 0);
+			if ( cart_write(fh[i], buf, CART_FRAME_SIZE) != CART_FRAME_SIZE ) {
+				logMessage( LOG_ERROR_LEVEL, "Write of file %d block %d failed.", i, j );
+				free(fh);
+				return( -1 );
+			}
+		}
+	}
+	cart_sync();
+	gettimeofday(&end, NULL);
+	cart_bus_counts(after);
+	cart_dedup_stats(&last);
+	frames = cart_frames_used() - frames;
+
+	logMessage( LOG_OUTPUT_LEVEL, "dedup %s: %u blocks in %d frames (ratio %.2f), %lu WRFRME, %lu duplicates, %u shared frames",
+		label, blocks, frames, (double) blocks / frames, after[CART_OP_WRFRME] - before[CART_OP_WRFRME],
+		last.duplicates - first.duplicates, last.shared );
+	logMessage( LOG_OUTPUT_LEVEL, "dedup %s: fingerprint %.1f nsec per block, write %.2f usec per block",
+		label, (last.blocks == first.blocks) ? 0.0 : (double) (last.nsec - first.nsec) / (last.blocks - first.blocks),
+		(double) compareTimes(&start, &end) / blocks );
+
+	// Rewrite a tenth of the blocks, a block in a shared frame gets a copy
+	for (int i = 0; i < bench_files; i++) {
+		for (int j = i % 10; j < bench_frames; j += 10) {
+			dedup_contents(buf, i, j, 1);
+			if ( (cart_seek(fh[i], j * CART_FRAME_SIZE) == -1) || (cart_write(fh[i], buf, CART_FRAME_SIZE) != CART_FRAME_SIZE) ) {
+				free(fh);
+				return( -1 );
+			}
+			rewritten++;
+		}
+	}
+	cart_sync();
+
+	// Check every block and delete the files
+	for (int i = 0; i < bench_files; i++) {
+		if ( cart_seek(fh[i], 0) == -1 ) {
+			free(fh);
+			return( -1 );
+		}
+		for (int j = 0; j < bench_frames; j++) {
+			dedup_contents(buf, i, j, (j % 10 == i % 10) ? 1 : 0);
+			if ( (cart_read(fh[i], back, CART_FRAME_SIZE) != CART_FRAME_SIZE) || (memcmp(buf, back, CART_FRAME_SIZE) != 0) ) {
+				logMessage( LOG_ERROR_LEVEL, "File %d block %d has the wrong contents.", i, j );
+				free(fh);
+				return( -1 );
+			}
+		}
+		snprintf(fname, sizeof(fname), "bench-dedup-%s-%d", label, i);
+		if ( (cart_close(fh[i]) == -1) || (cart_unlink(fname) == -1) ) {
+			free(fh);
+			return( -1 );
+		}
+	}
+	free(fh);
+
+	logMessage( LOG_OUTPUT_LEVEL, "dedup %s: rewrote %d blocks, every block checked", label, rewritten );
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_dedup
+// Description  : Write files holding zero, template and unique blocks with
+//                dedup off, on and verifying, comparing frames and writes
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int bench_dedup(void) {
+	if ( cart_poweron() == -1 ) {
+		return( -1 );
+	}
+
+	if ( (dedup_run(CART_DEDUP_OFF, "off") == -1) || (dedup_run(CART_DEDUP_ON, "on") == -1) ||
+			(dedup_run(CART_DEDUP_VERIFY, "verify") == -1) ) {
+		return( -1 );
+	}
+
+	return( cart_poweroff() );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : checksum_write
+// Description  : Create the benchmark files and write them frame by frame
+//                with checksums on or off
+//
+// Inputs       : fh - where the file handles go
+//                on - 1 to checksum the frames
+//                label - name of the run in the log
+// Outputs      : 0 if successful, -1 if failure
+
+int checksum_write(int16_t *fh, uint32_t on, char *label) {
+
+	// Local variables
+	char buf[CART_FRAME_SIZE], fname[CART_MAX_PATH_LENGTH];
+	uint64_t before[CART_OP_MAXVAL], after[CART_OP_MAXVAL];
+	CartChecksumStat first, last;
+	struct timeval start, end;
+
+	cart_set_checksums(on);
+	cart_checksum_stats(&first);
+	cart_bus_counts(before);
+	gettimeofday(&start, NULL);
+	for (int i = 0; i < bench_files; i++) {
+		snprintf(fname, sizeof(fname), "bench-checksum-%d", i);
+		if ( (fh[i] = cart_open(fname)) == -1 ) {
+			return( -1 );
+		}
+		for (int j = 0; j < bench_frames; j++) {
+			fill_pattern(buf, i, j * CART_FRAME_SIZE, CART_FRAME_SIZE);
+			if ( cart_write(fh[i], buf, CART_FRAME_SIZE) != CART_FRAME_SIZE ) {
+				logMessage( LOG_ERROR_LEVEL, "Write of file %d frame %d failed.", i, j );
+				return( -1 );
+			}
+		}
+	}
+	cart_sync();
+	gettimeofday(&end, NULL);
+	cart_bus_counts(after);
+	cart_checksum_stats(&last);
+
+	logMessage( LOG_OUTPUT_LEVEL, "checksum %s write: %d frames, %lu WRFRME, %lu LDCART, %.2f usec per frame, %lu checksums",
+		label, bench_files * bench_frames, after[CART_OP_WRFRME] - before[CART_OP_WRFRME],
+		after[CART_OP_LDCART] - before[CART_OP_LDCART], (double) compareTimes(&start, &end) / (bench_files * bench_frames),
+		last.computed - first.computed );
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : checksum_scan
+// Description  : Empty the frame cache and read every file back, checking
+//                the frames with the table, the processor or not at all
+//
+// Inputs       : fh - the file handles
+//                on - 1 to check the frames
+//                table - 1 to compute the checksums with the table
+//                label - name of the scan in the log
+// Outputs      : 0 if successful, -1 if failure
+
+int checksum_scan(int16_t *fh, uint32_t on, int table, char *label) {
+
+	// Local variables
+	CartChecksumStat first, last;
+	struct timeval start, end;
+
+	cart_set_checksums(on);
+	cart_crc_force_table(table);
+	close_cart_cache();
+	init_cart_cache();
+	cart_checksum_stats(&first);
+	gettimeofday(&start, NULL);
+	if ( scan_files(fh, label) == -1 ) {
+		return( -1 );
+	}
+	gettimeofday(&end, NULL);
+	cart_checksum_stats(&last);
+	cart_crc_force_table(0);
+
+	logMessage( LOG_OUTPUT_LEVEL, "checksum %s read: %.2f usec per frame, %lu frames checked, %.1f nsec per check, %lu failed",
+		label, (double) compareTimes(&start, &end) / (bench_files * bench_frames), last.verified - first.verified,
+		(last.verified == first.verified) ? 0.0 : (double) (last.nsec - first.nsec) / (last.verified - first.verified),
+		last.failed - first.failed );
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_checksum
+// Description  : Time the checksum of a frame both ways, then write the
+//                files without and with checksums and read them back with
+//                every way of checking
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int bench_checksum(void) {
+
+	// Local variables
+	char buf[CART_FRAME_SIZE], fname[CART_MAX_PATH_LENGTH];
+	int16_t *fh = NULL;
+	uint32_t crc = 0;
+	struct timeval start, end;
+
+	// The cost of one frame, with the table and with the processor if it can
+	fill_pattern(buf, 0, 0, CART_FRAME_SIZE);
+	for (int table = 1; table >= 0; table--) {
+		cart_crc_force_table(table);
+		gettimeofday(&start, NULL);
+		for (int i = 0; i < CART_BENCH_CRC_ROUNDS; i++) {
+			crc = cart_crc32c(buf, CART_FRAME_SIZE, crc);
+		}
+		gettimeofday(&end, NULL);
+		logMessage( LOG_OUTPUT_LEVEL, "checksum %s: %.1f nsec per frame, %.2f GB/s (%08x)",
+			cart_crc_hardware() ? "sse4.2" : "table", (double) compareTimes(&start, &end) * 1000 / CART_BENCH_CRC_ROUNDS,
+			(double) CART_BENCH_CRC_ROUNDS * CART_FRAME_SIZE / compareTimes(&start, &end) / 1000, crc );
+	}
+	cart_crc_force_table(0);
+
+	if ( ((fh = calloc(bench_files, sizeof(int16_t))) == NULL) || (cart_poweron() == -1) ) {
+		free(fh);
+		return( -1 );
+	}
+
+	// Write the files without checksums and delete them, then with
+	if ( checksum_write(fh, 0, "off") == -1 ) {
+		free(fh);
+		return( -1 );
+	}
+	for (int i = 0; i < bench_files; i++) {
+		snprintf(fname, sizeof(fname), "bench-checksum-%d", i);
+		if ( (cart_close(fh[i]) == -1) || (cart_unlink(fname) == -1) ) {
+			free(fh);
+			return( -1 );
+		}
+	}
+	if ( checksum_write(fh, 1, "on") == -1 ) {
+		free(fh);
+		return( -1 );
+	}
+
+	// Read them back from the cartridges every way
+	if ( (checksum_scan(fh, 0, 0, "off") == -1) || (checksum_scan(fh, 1, 1, "table") == -1) ||
+			(checksum_scan(fh, 1, 0, cart_crc_hardware() ? "sse4.2" : "table") == -1) ) {
+		free(fh);
+		return( -1 );
+	}
+	free(fh);
+
+	return( cart_poweroff() );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : random_run
+// Description  : Read or write the benchmark file at random offsets, either
+//                seeking then reading or writing, or with pread and pwrite,
+//                reads are checked against the pattern
+//
+// Inputs       : fh - the file handle
+//                size - length of the file
+//                positional - 1 to use pread and pwrite
+//                writes - 1 to write, 0 to read
+// Outputs      : 0 if successful, -1 if failure
+
+int random_run(int16_t fh, uint32_t size, int positional, int writes) {
+
+	// Local variables
+	char buf[2 * CART_FRAME_SIZE], expect[2 * CART_FRAME_SIZE];
+	uint32_t off = 0, calls = 0;
+	int32_t len = 0, done = 0;
+	uint64_t before[CART_OP_MAXVAL], after[CART_OP_MAXVAL];
+	struct timeval start, end;
+
+	// Same offsets for every run
+	srand(38);
+	cart_bus_counts(before);
+	gettimeofday(&start, NULL);
+	for (uint32_t i = 0; i < bench_rounds; i++) {
+		len = 1 + rand() % (int) sizeof(buf);
+		off = ((uint32_t) rand() * 2654435761u) % (size - len);
+		if ( writes ) {
+			fill_pattern(buf, 0, off, len);
+		}
+
+		if ( positional ) {
+			done = writes ? cart_pwrite(fh, buf, len, off) : cart_pread(fh, buf, len, off);
+			calls++;
+		} else {
+			if ( cart_seek(fh, off) == -1 ) {
+				return( -1 );
+			}
+			done = writes ? cart_write(fh, buf, len) : cart_read(fh, buf, len);
+			calls += 2;
+		}
+		if ( done != len ) {
+			logMessage( LOG_ERROR_LEVEL, "Random %s of %d bytes at %u failed.", writes ? "write" : "read", len, off );
+			return( -1 );
+		}
+
+		if ( ! writes ) {
+			fill_pattern(expect, 0, off, len);
+			if ( memcmp(buf, expect, len) != 0 ) {
+				logMessage( LOG_ERROR_LEVEL, "Random read of %d bytes at %u has the wrong contents.", len, off );
+				return( -1 );
+			}
+		}
+	}
+	cart_flush(fh);
+	gettimeofday(&end, NULL);
+	cart_bus_counts(after);
+
+	logMessage( LOG_OUTPUT_LEVEL, "random %s %s: %u ops in %u driver calls, %.2f usec per op, %lu RDFRME, %lu WRFRME",
+		positional ? (writes ? "pwrite" : "pread") : (writes ? "seek+write" : "seek+read"), writes ? "writes" : "reads",
+		bench_rounds, calls, (double) compareTimes(&start, &end) / bench_rounds,
+		after[CART_OP_RDFRME] - before[CART_OP_RDFRME], after[CART_OP_WRFRME] - before[CART_OP_WRFRME] );
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_random
+// Description  : Write one file of <files> * <frames> frames, then read and
+//                write it at random offsets with seek and read/write and
+//                with pread/pwrite, the file position is checked to not move
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int bench_random(void) {
+
+	// Local variables
+	char buf[CART_FRAME_SIZE];
+	uint32_t size = bench_files * bench_frames * CART_FRAME_SIZE;
+	int16_t fh = 0;
+
+	if ( (cart_poweron() == -1) || ((fh = cart_open("bench-random")) == -1) ) {
+		return( -1 );
+	}
+
+	// Write the file front to back
+	for (uint32_t off = 0; off < size; off += CART_FRAME_SIZE) {
+		fill_pattern(buf, 0, off, CART_FRAME_SIZE);
+		if ( cart_write(fh, buf, CART_FRAME_SIZE) != CART_FRAME_SIZE ) {
+			return( -1 );
+		}
+	}
+	cart_sync();
+
+	// Reads then writes, each way, from the same cache state
+	for (int writes = 0; writes < 2; writes++) {
+		for (int positional = 0; positional < 2; positional++) {
+			close_cart_cache();
+			init_cart_cache();
+			if ( random_run(fh, size, positional, writes) == -1 ) {
+				return( -1 );
+			}
+		}
+	}
+
+	// pread and pwrite leave the position alone, the next read is at the start
+	if ( (cart_seek(fh, 0) == -1) || (cart_pread(fh, buf, 10, size / 2) != 10) || (cart_pwrite(fh, buf, 10, size / 2) != 10) ||
+			(cart_read(fh, buf, CART_FRAME_SIZE) != CART_FRAME_SIZE) ) {
+		return( -1 );
+	}
+	fill_pattern(buf + CART_FRAME_SIZE / 2, 0, 0, CART_FRAME_SIZE / 2);
+	if ( memcmp(buf, buf + CART_FRAME_SIZE / 2, CART_FRAME_SIZE / 2) != 0 ) {
+		logMessage( LOG_ERROR_LEVEL, "The file position moved with pread or pwrite." );
+		return( -1 );
+	}
+
+	// A pwrite across a frame boundary reads back with pread, and with seek and read
+	fill_pattern(buf, 1, size / 3, CART_FRAME_SIZE / 2);
+	if ( (cart_pwrite(fh, buf, CART_FRAME_SIZE / 2, size / 3 + CART_FRAME_SIZE - 100) != CART_FRAME_SIZE / 2) ||
+			(cart_pread(fh, buf + CART_FRAME_SIZE / 2, CART_FRAME_SIZE / 2, size / 3 + CART_FRAME_SIZE - 100) != CART_FRAME_SIZE / 2) ||
+			(memcmp(buf, buf + CART_FRAME_SIZE / 2, CART_FRAME_SIZE / 2) != 0) ) {
+		logMessage( LOG_ERROR_LEVEL, "pread does not see what pwrite wrote." );
+		return( -1 );
+	}
+	if ( (cart_seek(fh, size / 3 + CART_FRAME_SIZE - 100) == -1) ||
+			(cart_read(fh, buf + CART_FRAME_SIZE / 2, CART_FRAME_SIZE / 2) != CART_FRAME_SIZE / 2) ||
+			(memcmp(buf, buf + CART_FRAME_SIZE / 2, CART_FRAME_SIZE / 2) != 0) ) {
+		logMessage( LOG_ERROR_LEVEL, "Seek and read do not see what pwrite wrote." );
+		return( -1 );
+	}
+
+	if ( (cart_close(fh) == -1) || (cart_unlink("bench-random") == -1) ) {
+		return( -1 );
+	}
+	return( cart_poweroff() );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : parallel_run
+// Description  : Let <files> readers each scan their own part of the file a
+//                chunk at a time in turns, either through one handle that is
+//                moved to the reader before each read or through a handle
+//                per reader, and check the chunks against the file
+//
+// Inputs       : fh - the file handles, one per reader
+//                data - the contents of the file
+//                size - length of the file
+//                handles - use a handle per reader
+// Outputs      : 0 if successful, -1 if failure
+
+int parallel_run(int16_t *fh, char *data, uint32_t size, int handles) {
+
+	// Local variables
+	char buf[CART_BENCH_PARALLEL_CHUNK];
+	uint32_t span = (size + bench_files - 1) / bench_files, chunks = 0, calls = 0, done = 0;
+	uint32_t *pos = NULL, *end = NULL;
+	int32_t len = 0;
+	uint64_t before[CART_OP_MAXVAL], after[CART_OP_MAXVAL];
+	struct timeval start, stop;
+
+	if ( ((pos = calloc(bench_files, sizeof(uint32_t))) == NULL) || ((end = calloc(bench_files, sizeof(uint32_t))) == NULL) ) {
+		free(pos);
+		return( -1 );
+	}
+	for (int r = 0; r < bench_files; r++) {
+		pos[r] = (r * span < size) ? r * span : size;
+		end[r] = (pos[r] + span < size) ? pos[r] + span : size;
+		if ( handles && (cart_seek(fh[r], pos[r]) == -1) ) {
+			free(pos);
+			free(end);
+			return( -1 );
+		}
+		calls += handles;
+	}
+
+	// Every reader takes a turn until they all reach the end of their part
+	cart_bus_counts(before);
+	gettimeofday(&start, NULL);
+	while ( done < size ) {
+		for (int r = 0; r < bench_files; r++) {
+			if ( pos[r] == end[r] ) {
+				continue;
+			}
+			len = (end[r] - pos[r] < CART_BENCH_PARALLEL_CHUNK) ? end[r] - pos[r] : CART_BENCH_PARALLEL_CHUNK;
+			if ( ! handles ) {
+				if ( cart_seek(fh[0], pos[r]) == -1 ) {
+					free(pos);
+					free(end);
+					return( -1 );
+				}
+				calls++;
+			}
+			if ( (cart_read(fh[handles ? r : 0], buf, len) != len) || (memcmp(buf, &data[pos[r]], len) != 0) ) {
+				logMessage( LOG_ERROR_LEVEL, "Reader %d read the wrong data at offset %u.", r, pos[r] );
+				free(pos);
+				free(end);
+				return( -1 );
+			}
+			calls++;
+			chunks++;
+			pos[r] += len;
+			done += len;
+		}
+	}
+	gettimeofday(&stop, NULL);
+	cart_bus_counts(after);
+	free(pos);
+	free(end);
+
+	logMessage( LOG_OUTPUT_LEVEL, "parallel %s: %d readers, %u chunks in %u driver calls, %.2f usec per chunk, %lu RDFRME, %lu LDCART",
+		handles ? "handle per reader" : "one handle", bench_files, chunks, calls, (double) compareTimes(&start, &stop) / chunks,
+		after[CART_OP_RDFRME] - before[CART_OP_RDFRME], after[CART_OP_LDCART] - before[CART_OP_LDCART] );
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_parallel
+// Description  : Store a file, open it once per reader and scan it with the
+//                readers in turns, then check a write through one handle is
+//                seen through another
+//
+// Inputs       : count - number of files given, only the first is used
+//                paths - the file to store, waldn10.txt if none is given
+// Outputs      : 0 if successful, -1 if failure
+
+int bench_parallel(int count, char **paths) {
+
+	// Local variables
+	char *path = (count > 0) ? paths[0] : CART_BENCH_PARALLEL_FILE, *data = NULL, back[8];
+	long size = 0;
+	int16_t *fh = NULL;
+	FILE *in = NULL;
+
+	// Load the file to store
+	if ( (in = fopen(path, "r")) == NULL ) {
+		logMessage( LOG_ERROR_LEVEL, "Cannot open file [%s].", path );
+		return( -1 );
+	}
+	fseek(in, 0, SEEK_END);
+	size = ftell(in);
+	fseek(in, 0, SEEK_SET);
+	data = malloc(size + 1);
+	if ( (data == NULL) || (size == 0) || (fread(data, 1, size, in) != (size_t) size) ) {
+		fclose(in);
+		free(data);
+		return( -1 );
+	}
+	fclose(in);
+
+	if ( ((fh = calloc(bench_files, sizeof(int16_t))) == NULL) || (cart_poweron() == -1) ||
+			((fh[0] = cart_open("bench-parallel")) == -1) || (cart_write(fh[0], data, size) != size) ) {
+		free(data);
+		free(fh);
+		return( -1 );
+	}
+	cart_sync();
+
+	// The other readers open the file again, each handle has its own position
+	for (int r = 1; r < bench_files; r++) {
+		if ( (fh[r] = cart_open("bench-parallel")) == -1 ) {
+			logMessage( LOG_ERROR_LEVEL, "Cannot open the file for reader %d.", r );
+			free(data);
+			free(fh);
+			return( -1 );
+		}
+	}
+
+	// Both ways from an empty cache
+	for (int handles = 0; handles < 2; handles++) {
+		close_cart_cache();
+		init_cart_cache();
+		if ( parallel_run(fh, data, size, handles) == -1 ) {
+			free(data);
+			free(fh);
+			return( -1 );
+		}
+	}
+
+	// A small write still buffered in one handle is read through another
+	if ( (bench_files > 1) && ((cart_pwrite(fh[0], "parallel", 8, size / 2) != 8) ||
+			(cart_pread(fh[1], back, 8, size / 2) != 8) || (memcmp(back, "parallel", 8) != 0)) ) {
+		logMessage( LOG_ERROR_LEVEL, "A write through one handle was not seen through another." );
+		free(data);
+		free(fh);
+		return( -1 );
+	}
+	free(data);
+
+	for (int r = 0; r < bench_files; r++) {
+		if ( cart_close(fh[r]) == -1 ) {
+			free(fh);
+			return( -1 );
+		}
+	}
+	free(fh);
+	if ( cart_unlink("bench-parallel") == -1 ) {
+		return( -1 );
+	}
+	return( cart_poweroff() );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : stripe_scan
+// Description  : Read the striped file front to back from an empty cache,
+//                check it and log the bus operations and time it took
+//
+// Inputs       : fh - the file handle
+//                width - stripe width the file was written with
+//                frames - frames asked for by each read
+// Outputs      : 0 if successful, -1 if failure
+
+int stripe_scan(int16_t fh, uint32_t width, int frames) {
+
+	// Local variables
+	char *buf = NULL, check[CART_FRAME_SIZE];
+	uint32_t size = bench_files * bench_frames * CART_FRAME_SIZE;
+	uint64_t before[CART_OP_MAXVAL], after[CART_OP_MAXVAL];
+	struct timeval start, end;
+	long usec = 0;
+	int count = 0;
+
+	if ( ((buf = malloc(frames * CART_FRAME_SIZE)) == NULL) || (cart_seek(fh, 0) == -1) ) {
+		free(buf);
+		return( -1 );
+	}
+	close_cart_cache();
+	init_cart_cache();
+
+	cart_bus_counts(before);
+	gettimeofday(&start, NULL);
+	for (uint32_t off = 0; off < size; off += count * CART_FRAME_SIZE) {
+		count = ((size - off) / CART_FRAME_SIZE < (uint32_t) frames) ? (int) ((size - off) / CART_FRAME_SIZE) : frames;
+		if ( cart_read(fh, buf, count * CART_FRAME_SIZE) != count * CART_FRAME_SIZE ) {
+			free(buf);
+			return( -1 );
+		}
+		for (int i = 0; i < count; i++) {
+			fill_pattern(check, 0, off + i * CART_FRAME_SIZE, CART_FRAME_SIZE);
+			if ( memcmp(check, &buf[i * CART_FRAME_SIZE], CART_FRAME_SIZE) != 0 ) {
+				logMessage( LOG_ERROR_LEVEL, "Striped file has the wrong data at offset %u.", off + i * CART_FRAME_SIZE );
+				free(buf);
+				return( -1 );
+			}
+		}
+	}
+	gettimeofday(&end, NULL);
+	cart_bus_counts(after);
+	free(buf);
+
+	usec = compareTimes(&start, &end);
+	logMessage( LOG_OUTPUT_LEVEL, "stripe width %u, %d frame reads: %lu LDCART, %lu RDFRME, %ld usec, %.2f MB/s",
+		width, frames, after[CART_OP_LDCART] - before[CART_OP_LDCART], after[CART_OP_RDFRME] - before[CART_OP_RDFRME],
+		usec, (double) size / usec );
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_stripe
+// Description  : Write one file of <files> * <frames> frames with each stripe
+//                width and scan it a frame at a time and in long reads
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int bench_stripe(void) {
+
+	// Local variables
+	char buf[CART_FRAME_SIZE];
+	uint32_t size = bench_files * bench_frames * CART_FRAME_SIZE;
+	uint32_t widths[] = { 1, 2, 4, 8 };
+	int16_t fh = 0;
+	CartFileStat stat;
+
+	if ( cart_poweron() == -1 ) {
+		return( -1 );
+	}
+
+	for (int w = 0; w < (int) (sizeof(widths) / sizeof(widths[0])); w++) {
+		if ( (cart_set_stripes(widths[w]) == -1) || ((fh = cart_open("bench-stripe")) == -1) ) {
+			return( -1 );
+		}
+		for (uint32_t off = 0; off < size; off += CART_FRAME_SIZE) {
+			fill_pattern(buf, 0, off, CART_FRAME_SIZE);
+			if ( cart_write(fh, buf, CART_FRAME_SIZE) != CART_FRAME_SIZE ) {
+				return( -1 );
+			}
+		}
+		cart_sync();
+		if ( cart_stat("bench-stripe", &stat) == -1 ) {
+			return( -1 );
+		}
+		logMessage( LOG_OUTPUT_LEVEL, "stripe width %u: %u frames on %u cartridges", widths[w], stat.frames, stat.carts );
+
+		if ( (stripe_scan(fh, widths[w], 1) == -1) || (stripe_scan(fh, widths[w], CART_BENCH_STRIPE_READ) == -1) ) {
+			return( -1 );
+		}
+		if ( (cart_close(fh) == -1) || (cart_unlink("bench-stripe") == -1) ) {
+			return( -1 );
+		}
+	}
+
+	cart_set_stripes(1);
+	return( cart_poweroff() );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_shards
+// Description  : Write one file of <files> * <frames> frames striped over 8
+//                cartridges and scan it a frame at a time and in long reads,
+//                the cartridges are spread over the servers given with -S
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int bench_shards(void) {
+
+	// Local variables
+	char buf[CART_FRAME_SIZE];
+	uint32_t size = bench_files * bench_frames * CART_FRAME_SIZE;
+	int16_t fh = 0;
+
+	if ( (cart_poweron() == -1) || (cart_set_stripes(CART_BENCH_SHARD_STRIPES) == -1) ||
+			((fh = cart_open("bench-shards")) == -1) ) {
+		return( -1 );
+	}
+	for (uint32_t off = 0; off < size; off += CART_FRAME_SIZE) {
+		fill_pattern(buf, 0, off, CART_FRAME_SIZE);
+		if ( cart_write(fh, buf, CART_FRAME_SIZE) != CART_FRAME_SIZE ) {
+			return( -1 );
+		}
+	}
+	cart_sync();
+
+	logMessage( LOG_OUTPUT_LEVEL, "shards: %d servers, %u frames striped over %d cartridges",
+		client_cart_shards(), size / CART_FRAME_SIZE, CART_BENCH_SHARD_STRIPES );
+	if ( (stripe_scan(fh, CART_BENCH_SHARD_STRIPES, 1) == -1) ||
+			(stripe_scan(fh, CART_BENCH_SHARD_STRIPES, CART_BENCH_STRIPE_READ) == -1) ) {
+		return( -1 );
+	}
+
+	if ( (cart_close(fh) == -1) || (cart_unlink("bench-shards") == -1) ) {
+		return( -1 );
+	}
+	cart_set_stripes(1);
+	return( cart_poweroff() );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_pipeline
+// Description  : Write one file of <files> * <frames> frames and scan it in
+//                long reads with more and more requests in flight on each
+//                connection
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int bench_pipeline(void) {
+
+	// Local variables
+	char buf[CART_FRAME_SIZE];
+	uint32_t size = bench_files * bench_frames * CART_FRAME_SIZE;
+	int depths[] = { 1, 2, 4, 8, 16, 32, 64 };
+	int16_t fh = 0;
+
+	if ( (cart_poweron() == -1) || ((fh = cart_open("bench-pipeline")) == -1) ) {
+		return( -1 );
+	}
+	for (uint32_t off = 0; off < size; off += CART_FRAME_SIZE) {
+		fill_pattern(buf, 0, off, CART_FRAME_SIZE);
+		if ( cart_write(fh, buf, CART_FRAME_SIZE) != CART_FRAME_SIZE ) {
+			return( -1 );
+		}
+	}
+	cart_sync();
+
+	for (int d = 0; d < (int) (sizeof(depths) / sizeof(depths[0])); d++) {
+		client_cart_set_pipeline(depths[d]);
+		logMessage( LOG_OUTPUT_LEVEL, "pipeline depth %d, %d servers:", depths[d], client_cart_shards() );
+		if ( stripe_scan(fh, 1, CART_BENCH_STRIPE_READ) == -1 ) {
+			client_cart_set_pipeline(1);
+			return( -1 );
+		}
+	}
+	client_cart_set_pipeline(1);
+
+	if ( (cart_close(fh) == -1) || (cart_unlink("bench-pipeline") == -1) ) {
+		return( -1 );
+	}
+	return( cart_poweroff() );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bus_register
+// Description  : Make the registers of a request sent straight to the server
+//
+// Inputs       : op - the opcode
+//                cart - cartridge register
+//                frame - frame register
+// Outputs      : the registers
+
+CartXferRegister bus_register(CartOpCodes op, CartridgeIndex cart, CartFrameIndex frame) {
+	return( (((CartXferRegister) op) << 56) | (((CartXferRegister) cart) << 31) | (((CartXferRegister) frame) << 15) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bus_run
+// Description  : Send <rounds> batches of requests for random frames, each
+//                one loading its cartridge first, check what comes back and
+//                log the requests per second
+//
+// Inputs       : frames - room for a batch of frames
+//                writes - 1 to write the frames, 0 to read and check them
+// Outputs      : 0 if successful, -1 if failure
+
+int bus_run(char *frames, int writes) {
+
+	// Local variables
+	CartXferRegister regs[2 * CART_BENCH_BUS_BATCH], resps[2 * CART_BENCH_BUS_BATCH];
+	void *bufs[2 * CART_BENCH_BUS_BATCH];
+	CartridgeIndex carts[CART_BENCH_BUS_BATCH];
+	CartFrameIndex frms[CART_BENCH_BUS_BATCH];
+	char check[CART_FRAME_SIZE];
+	struct timeval start, end;
+	uint64_t requests = 0;
+	long usec = 0;
+
+	gettimeofday(&start, NULL);
+	for (uint32_t r = 0; r < bench_rounds; r++) {
+		for (int i = 0; i < CART_BENCH_BUS_BATCH; i++) {
+			carts[i] = rand() % CART_MAX_CARTRIDGES;
+			frms[i] = rand() % bench_frames;
+			regs[2 * i] = bus_register(CART_OP_LDCART, carts[i], 0);
+			bufs[2 * i] = NULL;
+			regs[2 * i + 1] = bus_register(writes ? CART_OP_WRFRME : CART_OP_RDFRME, carts[i], frms[i]);
+			bufs[2 * i + 1] = &frames[i * CART_FRAME_SIZE];
+			if ( writes ) {
+				fill_pattern(bufs[2 * i + 1], carts[i], frms[i] * CART_FRAME_SIZE, CART_FRAME_SIZE);
+			}
+		}
+		if ( client_cart_bus_batch(regs, bufs, resps, 2 * CART_BENCH_BUS_BATCH) == -1 ) {
+			return( -1 );
+		}
+		for (int i = 0; i < 2 * CART_BENCH_BUS_BATCH; i++) {
+			if ( (resps[i] >> 47) & 1 ) {
+				logMessage( LOG_ERROR_LEVEL, "Server failed request %d of round %u.", i, r );
+				return( -1 );
+			}
+		}
+		for (int i = 0; (! writes) && (i < CART_BENCH_BUS_BATCH); i++) {
+			fill_pattern(check, carts[i], frms[i] * CART_FRAME_SIZE, CART_FRAME_SIZE);
+			if ( memcmp(check, &frames[i * CART_FRAME_SIZE], CART_FRAME_SIZE) != 0 ) {
+				logMessage( LOG_ERROR_LEVEL, "Frame %u of cartridge %u came back wrong.", frms[i], carts[i] );
+				return( -1 );
+			}
+		}
+		requests += 2 * CART_BENCH_BUS_BATCH;
+	}
+	gettimeofday(&end, NULL);
+
+	usec = compareTimes(&start, &end);
+	logMessage( LOG_OUTPUT_LEVEL, "bus %s: %lu requests in %ld usec, %.0f requests/s, %.2f usec/request, %.2f MB/s",
+		writes ? "writes" : "reads", requests, usec, requests * 1000000.0 / usec, (double) usec / requests,
+		(double) (requests / 2) * CART_FRAME_SIZE / usec );
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_bus
+// Description  : Measure the requests per second of the server without the
+//                driver: write the first <frames> frames of every cartridge,
+//                time random writes and reads of them, then zero the
+//                cartridges so the next user formats them
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int bench_bus(void) {
+
+	// Local variables
+	CartXferRegister regs[2 * CART_BENCH_BUS_BATCH], resps[2 * CART_BENCH_BUS_BATCH];
+	void *bufs[2 * CART_BENCH_BUS_BATCH];
+	char *frames = NULL;
+	int n = 0, ret = 0;
+
+	if ( bench_frames > CART_CARTRIDGE_SIZE ) {
+		bench_frames = CART_CARTRIDGE_SIZE;
+	}
+	if ( ((frames = malloc(2 * CART_BENCH_BUS_BATCH * CART_FRAME_SIZE)) == NULL) ||
+			((client_cart_bus_request(bus_register(CART_OP_INITMS, 0, 0), NULL) >> 47) & 1) ) {
+		free(frames);
+		return( -1 );
+	}
+	logMessage( LOG_OUTPUT_LEVEL, "bus: %d connections, %d requests per batch", client_cart_shards(), 2 * CART_BENCH_BUS_BATCH );
+
+	// Fill the frames the runs use, a cartridge at a time
+	for (int c = 0; (ret == 0) && (c < CART_MAX_CARTRIDGES); c++) {
+		for (int f = 0; (ret == 0) && (f < bench_frames); f += n - 1) {
+			n = 0;
+			regs[n] = bus_register(CART_OP_LDCART, c, 0);
+			bufs[n++] = NULL;
+			for (int i = f; (i < bench_frames) && (n < 2 * CART_BENCH_BUS_BATCH); i++) {
+				regs[n] = bus_register(CART_OP_WRFRME, c, i);
+				bufs[n] = &frames[n * CART_FRAME_SIZE];
+				fill_pattern(bufs[n++], c, i * CART_FRAME_SIZE, CART_FRAME_SIZE);
+			}
+			ret = client_cart_bus_batch(regs, bufs, resps, n);
+		}
+	}
+
+	if ( (ret == -1) || (bus_run(frames, 1) == -1) || (bus_run(frames, 0) == -1) ) {
+		free(frames);
+		return( -1 );
+	}
+	free(frames);
+
+	// Leave the cartridges empty
+	for (int c = 0; c < CART_MAX_CARTRIDGES; c++) {
+		regs[2 * c] = bus_register(CART_OP_LDCART, c, 0);
+		regs[2 * c + 1] = bus_register(CART_OP_BZERO, c, 0);
+		bufs[2 * c] = bufs[2 * c + 1] = NULL;
+	}
+	if ( client_cart_bus_batch(regs, bufs, resps, 2 * CART_MAX_CARTRIDGES) == -1 ) {
+		return( -1 );
+	}
+	return( ((client_cart_bus_request(bus_register(CART_OP_POWOFF, 0, 0), NULL) >> 47) & 1) ? -1 : 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_pool
+// Description  : Run the bus benchmark with pools of 1 to 16 connections
+//                to every server, the server has to take several
+//                connections at the same time
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int bench_pool(void) {
+
+	// Local variables
+	int sizes[] = { 1, 2, 4, 8, 16 };
+	int ret = 0;
+
+	for (int p = 0; (ret == 0) && (p < (int) (sizeof(sizes) / sizeof(sizes[0]))); p++) {
+		if ( client_cart_set_pool(sizes[p]) == -1 ) {
+			break;
+		}
+		logMessage( LOG_OUTPUT_LEVEL, "pool of %d connections to every server:", sizes[p] );
+		ret = bench_bus();
+	}
+	client_cart_set_pool(1);
+
+	return( ret );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_ranges
+// Description  : Write one file of <files> * <frames> frames and scan it in
+//                long reads, asking the server for protocol v1 and then v2,
+//                with 1 and 16 requests in flight. A v1 server keeps both
+//                runs on v1, the bundled server takes one power on only so
+//                it runs the first
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int bench_ranges(void) {
+
+	// Local variables
+	char buf[CART_FRAME_SIZE];
+	uint32_t size = bench_files * bench_frames * CART_FRAME_SIZE;
+	int versions[] = { CART_PROTOCOL_V1, CART_PROTOCOL_V2 };
+	int depths[] = { 1, 16 };
+	int16_t fh = 0;
+	int ret = 0;
+
+	for (int v = 0; (ret == 0) && (v < (int) (sizeof(versions) / sizeof(versions[0]))); v++) {
+		client_cart_set_protocol(versions[v]);
+		if ( (cart_poweron() == -1) || ((fh = cart_open("bench-ranges")) == -1) ) {
+			ret = -1;
+			break;
+		}
+		for (uint32_t off = 0; (ret == 0) && (off < size); off += CART_FRAME_SIZE) {
+			fill_pattern(buf, 0, off, CART_FRAME_SIZE);
+			if ( cart_write(fh, buf, CART_FRAME_SIZE) != CART_FRAME_SIZE ) {
+				ret = -1;
+			}
+		}
+		cart_sync();
+
+		for (int d = 0; (ret == 0) && (d < (int) (sizeof(depths) / sizeof(depths[0]))); d++) {
+			client_cart_set_pipeline(depths[d]);
+			logMessage( LOG_OUTPUT_LEVEL, "protocol v%d asked for, pipeline depth %d:", versions[v], depths[d] );
+			ret = stripe_scan(fh, 1, CART_BENCH_STRIPE_READ);
+		}
+		client_cart_set_pipeline(1);
+
+		if ( (ret == -1) || (cart_close(fh) == -1) || (cart_unlink("bench-ranges") == -1) || (cart_poweroff() == -1) ) {
+			ret = -1;
+		}
+	}
+	client_cart_set_protocol(CART_PROTOCOL_V2);
+
+	return( ret );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : partial_run
+// Description  : Make <rounds> pwrites of 1 to 256 bytes at random offsets
+//                of the file from an empty cache, then read the file back
+//                and check it against what was written
+//
+// Inputs       : fh - the file handle
+//                shadow - contents the file should have, kept up to date
+//                size - length of the file
+//                on - 1 to send only the bytes written when it can
+// Outputs      : 0 if successful, -1 if failure
+
+int partial_run(int16_t fh, char *shadow, uint32_t size, uint32_t on) {
+
+	// Local variables
+	char buf[CART_FRAME_SIZE];
+	uint32_t off = 0;
+	int32_t len = 0;
+	uint64_t before[CART_OP_MAXVAL], after[CART_OP_MAXVAL];
+	uint64_t sent = 0, received = 0, sent_after = 0, received_after = 0;
+	struct timeval start, end;
+
+	// Same offsets for both runs, different bytes
+	cart_set_partial_writes(on);
+	close_cart_cache();
+	init_cart_cache();
+	srand(51);
+	cart_bus_counts(before);
+	client_cart_traffic(&sent, &received);
+	gettimeofday(&start, NULL);
+	for (uint32_t i = 0; i < bench_rounds; i++) {
+		len = 1 + rand() % CART_BENCH_PART_MAX;
+		off = ((uint32_t) rand() * 2654435761u) % (size - len);
+		fill_pattern(buf, 1 + on, off, len);
+		if ( cart_pwrite(fh, buf, len, off) != len ) {
+			logMessage( LOG_ERROR_LEVEL, "Partial write of %d bytes at %u failed.", len, off );
+			return( -1 );
+		}
+		memcpy(&shadow[off], buf, len);
+	}
+	cart_flush(fh);
+	gettimeofday(&end, NULL);
+	cart_bus_counts(after);
+	client_cart_traffic(&sent_after, &received_after);
+
+	logMessage( LOG_OUTPUT_LEVEL, "partial writes %s: %u pwrites, %.2f usec per op, %lu RDFRME, %lu WRFRME, %lu bytes sent, %lu received, %.1f wire bytes per op",
+		on ? "on" : "off", bench_rounds, (double) compareTimes(&start, &end) / bench_rounds,
+		after[CART_OP_RDFRME] - before[CART_OP_RDFRME], after[CART_OP_WRFRME] - before[CART_OP_WRFRME],
+		sent_after - sent, received_after - received,
+		(double) ((sent_after - sent) + (received_after - received)) / bench_rounds );
+
+	// Read it all back past the cache
+	close_cart_cache();
+	init_cart_cache();
+	for (off = 0; off < size; off += CART_FRAME_SIZE) {
+		if ( (cart_pread(fh, buf, CART_FRAME_SIZE, off) != CART_FRAME_SIZE) || (memcmp(buf, &shadow[off], CART_FRAME_SIZE) != 0) ) {
+			logMessage( LOG_ERROR_LEVEL, "Partial write check of the frame at %u failed.", off );
+			return( -1 );
+		}
+	}
+
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_partial
+// Description  : Write one file of <files> * <frames> frames with checksums
+//                off, then make small writes to it with partial frame writes
+//                off and on. A server on protocol v1 takes no partial writes,
+//                both runs read the frames then
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int bench_partial(void) {
+
+	// Local variables
+	uint32_t size = bench_files * bench_frames * CART_FRAME_SIZE;
+	char *shadow = malloc(size);
+	int16_t fh = 0;
+	int ret = 0;
+
+	// Checksums need the whole frame, partial writes are only made without them
+	cart_set_checksums(0);
+	if ( (shadow == NULL) || (cart_poweron() == -1) || ((fh = cart_open("bench-partial")) == -1) ) {
+		free(shadow);
+		return( -1 );
+	}
+
+	// Write the file front to back
+	for (uint32_t off = 0; (ret == 0) && (off < size); off += CART_FRAME_SIZE) {
+		fill_pattern(&shadow[off], 0, off, CART_FRAME_SIZE);
+		if ( cart_write(fh, &shadow[off], CART_FRAME_SIZE) != CART_FRAME_SIZE ) {
+			ret = -1;
+		}
+	}
+	cart_sync();
+
+	if ( (ret == -1) || (partial_run(fh, shadow, size, 0) == -1) || (partial_run(fh, shadow, size, 1) == -1) ) {
+		ret = -1;
+	}
+	cart_set_partial_writes(1);
+	cart_set_checksums(1);
+	free(shadow);
+
+	if ( (cart_close(fh) == -1) || (cart_unlink("bench-partial") == -1) || (cart_poweroff() == -1) ) {
+		return( -1 );
+	}
+
+	return( ret );
+}
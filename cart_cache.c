@@ -207,7 +207,7 @@ int update_cache(CartridgeIndex cart, CartFrameIndex frm, void *buf) {
 			//update the time variable of the frame to cache
 			cache_structure.frames[i].time = global_time;
 			//update the buffer of the frame to cache
-			strncpy(cache_structure.frames[i].framebuf, buf, 1024);
+			memmove(cache_structure.frames[i].framebuf, buf, CART_FRAME_SIZE);
 			//increment time
 			global_time++;
 			break;
@@ -299,7 +299,7 @@ int put_cart_cache(CartridgeIndex cart, CartFrameIndex frm, void *buf)  {
 	for(int i = 0; i < cache_structure.size; i++) {
 		//find a cache frame that is not used
 		if(cache_structure.frames[i].time == -1) {
-			strncpy(cache_structure.frames[i].framebuf, (char *) buf, 1024);
+			memcpy(cache_structure.frames[i].framebuf, buf, CART_FRAME_SIZE);
 			cache_structure.frames[i].time = global_time;
 			cache_structure.frames[i].cart_num = cart;
 			cache_structure.frames[i].frame_num = frm;
@@ -376,6 +376,36 @@ void * delete_cart_cache(CartridgeIndex cart, CartFrameIndex blk) {
 	return &(cache_structure.frames[index_of_frame].framebuf);
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : delete_cart_cache_marked
+// Description  : Remove every frame marked in a bitmap from the cache in one
+//                pass, used when a lot of frames are freed at once
+//
+// Inputs       : marked - one bit per frame, cart * CART_CARTRIDGE_SIZE + frame
+// Outputs      : number of frames removed
+
+int delete_cart_cache_marked(uint64_t *marked) {
+	uint32_t frame = 0;
+	int removed = 0;
+
+	for(int i = 0; i < cache_structure.size; i++) {
+		if(cache_structure.frames[i].time == -1) {
+			continue;
+		}
+		frame = cache_structure.frames[i].cart_num * CART_CARTRIDGE_SIZE + cache_structure.frames[i].frame_num;
+		if((marked[frame / 64] >> (frame % 64)) & 1) {
+			cache_structure.frames[i].frame_num = -1;
+			cache_structure.frames[i].cart_num = -1;
+			cache_structure.frames[i].time = -1;
+			cache_structure.num_occupied--;
+			removed++;
+		}
+	}
+
+	return (removed);
+}
+
 //
 // Unit test
 
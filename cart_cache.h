@@ -24,6 +24,8 @@ int update_cache(CartridgeIndex cart, CartFrameIndex frm, void *buf);
 
 void * delete_cart_cache(CartridgeIndex cart, CartFrameIndex blk);
 	//Delete a frame from the cache
+int delete_cart_cache_marked(uint64_t *marked);
+	//Delete every frame whose bit is set, one bit per cart * CART_CARTRIDGE_SIZE + frame
 
 int get_cache_size(void);
 	//Get the cache size
@@ -2,6 +2,19 @@
 //
 //  File          : cart_client.c
 //  Description   : This is the client side of the CART communication protocol.
+//                  The cartridges can be spread over several servers with a
+//                  pool of connections to each, cartridge c is used through
+//                  shard c % shards, shard s is a connection to server
+//                  s % servers, so a cartridge stays on its server whatever
+//                  the pool size. The connections are waited on together
+//                  with one epoll, or the batches can go through an
+//                  io_uring (see cart_uring.c). A connection agreeing on
+//                  protocol v2 at INITMS takes a run of reads or writes of
+//                  the next frames of the loaded cartridge as one range
+//                  request, and a write of part of a frame. A server on the
+//                  same host can be reached through shared memory instead
+//                  (see cart_shm.c), or the cartridges can be kept in this
+//                  process (cart_io_bus).
 //
 //   Author       : Jason Ling
 //  Last Modified : Friday, December 9
@@ -9,18 +22,31 @@
 
 // Include Files
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 // Project Include Files
 #include <cart_network.h>
+#include <cart_shm.h>
+#include <cart_memsys.h>
+#include <cart_uring.h>
 #include <cmpsc311_util.h>
 #include <cmpsc311_log.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <unistd.h>
+#include <sys/epoll.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+
+// Defines
+#define CART_WIRE_BATCH 256 // Requests of a batch put on the wire at a time
 
 //
 //  Global data
-int client_socket = -1;
 int                cart_network_shutdown = 0;   // Flag indicating shutdown
 unsigned char     *cart_network_address = NULL; // Address of CART server
 unsigned short     cart_network_port = 0;       // Port of CART serve
@@ -28,6 +54,73 @@ unsigned long      CartControllerLLevel = LOG_INFO_LEVEL; // Controller log leve
 unsigned long      CartDriverLLevel = 0;     // Driver log level (global)
 unsigned long      CartSimulatorLLevel = 0;  // Driver log level (global)
 
+//A server holding part of the cartridges
+struct CartServer {
+	char address[INET_ADDRSTRLEN]; //address of the server
+	unsigned short port; //port of the server
+};
+
+//A connection to a server, the cartridges used through it stay loaded on it
+struct CartShard {
+	int server; //index of the server
+	int socket; //connection to the server, -1 if there is none
+	int ranges; //most frames of a range request, 0 on protocol v1
+	CartridgeIndex loaded; //cartridge loaded on the server, CART_NO_CARTRIDGE if not known
+};
+
+struct CartServer servers[CART_MAX_SERVERS];
+int num_servers = 0; //servers of client_cart_set_shards, 0 for the one of the command line
+struct CartShard shards[CART_MAX_SHARDS];
+int num_shards = 0; //num_servers * pool_size, 0 until the first request
+int pool_size = 1; //connections to every server
+int pool_epoll = -1; //the connections made so far
+int pipeline_depth = 1; //requests of a batch in flight on a connection
+int protocol_version = CART_PROTOCOL_V2; //asked for at INITMS
+uint64_t wire_sent = 0; //bytes sent to the servers
+uint64_t wire_received = 0; //bytes received from them
+
+//The requests of a batch as they go on the wire, those of a shard one
+//after another, a wire request carries one request of the batch or a
+//range of them
+struct CartWire {
+	int count; //wire requests
+	CartXferRegister regs[CART_WIRE_BATCH];
+	CartXferRegister resps[CART_WIRE_BATCH];
+	int first[CART_WIRE_BATCH]; //first of their requests in order
+	int frames[CART_WIRE_BATCH]; //requests of the batch they carry
+	int order[CART_WIRE_BATCH]; //the requests of the batch, those of a wire request together
+	void *bufs[CART_WIRE_BATCH]; //and their frames
+};
+
+struct CartWire wire;
+
+//the shared memory channel to the server, used instead of the shards
+char shm_name[CART_SHM_NAME_SIZE] = ""; //region of the server, empty for TCP
+CartShmRegion *shm_region = NULL; //NULL until the first request
+CartShmChannel *shm_channel = NULL;
+uint32_t shm_posted = 0; //requests put in the channel
+uint32_t shm_answered = 0; //answers taken from the channel
+
+int local_bus = 0; //the cartridges are kept in this process, no server
+
+//The requests of one connection in a round of an io_uring batch
+struct CartUringRound {
+	int taken; //requests of the round
+	int index[CART_MAX_PIPELINE]; //where they are in the batch
+	uint32_t sent; //bytes of the requests written
+	uint32_t to_send;
+	uint32_t got; //bytes of the answers read
+	uint32_t to_get;
+};
+
+//the batches go through an io_uring instead of the sockets one call at a time
+int uring_wanted = 0;
+CartUring uring = {.fd = -1};
+char *uring_buffers = NULL; //registered, a send and a receive area for every shard
+size_t uring_area = 0; //size of an area
+int uring_shards = 0; //shards and pipeline depth the ring was set up for
+int uring_depth = 0;
+
 //
 // Functions
 
@@ -47,170 +140,1294 @@ int8_t extract_reg(CartXferRegister reg) {
 	return decision;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : extract_cart
+// Description  : Get the cartridge register ct1 of a request
+//
+// Inputs       : reg - the request reqisters for the command
+// Outputs      : the cartridge
+
+CartridgeIndex extract_cart(CartXferRegister reg) {
+	return ((CartridgeIndex) ((reg >> 31) & 0xffff));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : pool_connections
+// Description  : Drop the connections, the pool is laid out again from the
+//                options by the next request
+//
+// Inputs       : none
+// Outputs      : 0 if successful
+
+int pool_connections(void) {
+	for(int s = 0; s < num_shards; s++) {
+		if(shards[s].socket != -1) {
+			close(shards[s].socket);
+			shards[s].socket = -1;
+		}
+	}
+	num_shards = 0;
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : pool_setup
+// Description  : Lay out the servers and the connections the options asked
+//                for, done on first use so the options can be given in any
+//                order, every server gets pool_size connections, connected
+//                on first use
+//
+// Inputs       : none
+// Outputs      : number of shards if successful, -1 if the options do not
+//                go together
+
+int pool_setup(void) {
+	int servers_used = (num_servers == 0) ? 1 : num_servers;
+
+	if(num_shards > 0) {
+		return (num_shards);
+	}
+
+	//shared memory reaches one server, the process holds one set of
+	//cartridges, both have one of them loaded
+	if(shm_name[0] != '\0' && local_bus == 1) {
+		printf("Shared memory and a cartridge image cannot be used together\n");
+		return (-1);
+	}
+	if((shm_name[0] != '\0' || local_bus == 1) && (servers_used > 1 || pool_size > 1)) {
+		printf("Shared memory and a cartridge image take one server and one connection\n");
+		return (-1);
+	}
+	if(servers_used * pool_size > CART_MAX_SHARDS) {
+		printf("Too many connections, %d servers with %d each\n", servers_used, pool_size);
+		return (-1);
+	}
+
+	//the single server of the command line
+	if(num_servers == 0) {
+		strncpy(servers[0].address, (cart_network_address == NULL) ? CART_DEFAULT_IP : (char *) cart_network_address,
+			INET_ADDRSTRLEN - 1);
+		servers[0].address[INET_ADDRSTRLEN - 1] = '\0';
+		servers[0].port = (cart_network_port == 0) ? CART_DEFAULT_PORT : cart_network_port;
+	}
+
+	num_shards = servers_used * pool_size;
+	for(int s = 0; s < num_shards; s++) {
+		shards[s].server = s % servers_used;
+		shards[s].socket = -1;
+		shards[s].ranges = 0;
+		shards[s].loaded = CART_NO_CARTRIDGE;
+	}
+
+	return (num_shards);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : client_cart_set_shards
+// Description  : Spread the cartridges over the servers in a list, this has
+//                to be the same list every time the cartridges are used
+//
+// Inputs       : list - "host:port,host:port,...", NULL for the one server
+//                       given by cart_network_address and cart_network_port
+// Outputs      : 0 if successful, -1 if failure
+
+int client_cart_set_shards(char *list) {
+	struct in_addr addr;
+	char spec[64];
+	char *colon = NULL;
+	int count = 0;
+	int len = 0;
+	unsigned int port = 0;
+
+	//connections to the old servers are dropped
+	num_servers = 0;
+	pool_connections();
+
+	//the single server of the command line, looked up on first use
+	if(list == NULL) {
+		return (0);
+	}
+
+	while(*list != '\0') {
+		len = strcspn(list, ",");
+		if(count == CART_MAX_SERVERS || len == 0 || len >= (int) sizeof(spec)) {
+			return (-1);
+		}
+		memcpy(spec, list, len);
+		spec[len] = '\0';
+		list += (list[len] == ',') ? len + 1 : len;
+
+		//a shard is host:port, a missing host is the default one
+		colon = strrchr(spec, ':');
+		if(colon == NULL || sscanf(colon + 1, "%u", &port) != 1 || port == 0 || port > 0xffff) {
+			return (-1);
+		}
+		*colon = '\0';
+		if(spec[0] == '\0') {
+			strcpy(spec, CART_DEFAULT_IP);
+		}
+		if(inet_aton(spec, &addr) == 0) {
+			return (-1);
+		}
+		strcpy(servers[count].address, spec);
+		servers[count].port = port;
+		count++;
+	}
+	if(count == 0) {
+		return (-1);
+	}
+
+	num_servers = count;
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : client_cart_set_pool
+// Description  : Open a pool of connections to every server, the
+//                cartridges of a server are spread over its connections so
+//                requests for different cartridges are answered side by side
+//                on a server that takes several connections
+//
+// Inputs       : size - connections to every server
+// Outputs      : 0 if successful, -1 if failure
+
+int client_cart_set_pool(int size) {
+	if(size < 1) {
+		return (-1);
+	}
+
+	pool_size = size;
+	return (pool_connections());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : client_cart_shards
+// Description  : Get the number of servers the cartridges are spread over
+//
+// Inputs       : none
+// Outputs      : number of shards, -1 if the options do not go together
+
+int client_cart_shards(void) {
+	return (pool_setup());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : client_cart_shard
+// Description  : Find the connection a cartridge is used through,
+//                neighbouring cartridges are on different connections so a
+//                striped file uses all of them
+//
+// Inputs       : cart - the cartridge
+// Outputs      : index of the shard
+
+int client_cart_shard(CartridgeIndex cart) {
+	return (cart % client_cart_shards());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shard_connect
+// Description  : Connect to the server of a shard if it is not connected,
+//                the connection joins the ones the batches wait on
+//
+// Inputs       : s - index of the shard
+// Outputs      : the socket if successful, -1 if failure
+
+int shard_connect(int s) {
+	struct CartServer *server = &servers[shards[s].server];
+	struct sockaddr_in caddr;
+	struct epoll_event event;
+	int one = 1;
+
+	//there is a connection already
+	if(shards[s].socket != -1) {
+		return (shards[s].socket);
+	}
+
+	//a new connection is on protocol v1 with nothing loaded until INITMS
+	shards[s].ranges = 0;
+	shards[s].loaded = CART_NO_CARTRIDGE;
+
+	caddr.sin_family = AF_INET;
+	caddr.sin_port = htons(server->port);
+
+	//setup address
+	if(inet_aton(server->address, &(caddr.sin_addr)) == 0) {
+		printf("Setting up an address caused an error");
+		return (-1);
+	}
+	//create a socket
+	shards[s].socket = socket(PF_INET, SOCK_STREAM, 0);
+
+	if(shards[s].socket == -1) {
+		printf("Creating a socket caused an error\n");
+		return (-1);
+	}
+	//connect socket and address
+	if(connect(shards[s].socket, (const struct sockaddr *) &caddr, sizeof(caddr)) == -1) {
+		printf("Connecting a socket caused an error\n");
+		close(shards[s].socket);
+		shards[s].socket = -1;
+		return (-1);
+	}
+
+	//every request is a few bytes waiting on its answer, do not hold them back
+	setsockopt(shards[s].socket, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	//a closed socket leaves the epoll by itself
+	if(pool_epoll == -1) {
+		pool_epoll = epoll_create1(0);
+	}
+	event.events = EPOLLIN;
+	event.data.u32 = s;
+	if(pool_epoll == -1 || epoll_ctl(pool_epoll, EPOLL_CTL_ADD, shards[s].socket, &event) == -1) {
+		printf("Watching a socket caused an error\n");
+		close(shards[s].socket);
+		shards[s].socket = -1;
+		return (-1);
+	}
+
+	return (shards[s].socket);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : transfer_all
+// Description  : Send or receive every byte of a set of buffers, a short
+//                transfer carries on from where it stopped
+//
+// Inputs       : sock - the socket
+//                iov - the buffers, moved past what was transferred
+//                count - number of buffers
+//                sending - 1 to write them, 0 to read them
+// Outputs      : 0 if successful, -1 if failure or the connection closed
+
+int transfer_all(int sock, struct iovec *iov, int count, int sending) {
+	ssize_t done = 0;
+
+	while(count > 0) {
+		done = (sending == 1) ? writev(sock, iov, count) : readv(sock, iov, count);
+		if(done == -1 && errno == EINTR) {
+			continue;
+		}
+		if(done <= 0) {
+			return (-1);
+		}
+		if(sending == 1) {
+			wire_sent += done;
+		}
+		else {
+			wire_received += done;
+		}
+
+		//skip the buffers that are done and move into the one that is not
+		while(count > 0 && (size_t) done >= iov->iov_len) {
+			done -= iov->iov_len;
+			iov++;
+			count--;
+		}
+		if(count > 0) {
+			iov->iov_base = (char *) iov->iov_base + done;
+			iov->iov_len -= done;
+		}
+	}
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shard_send
+// Description  : Send a request to the server of a shard, the frames go
+//                with it for a write
+//
+// Inputs       : s - index of the shard
+//                reg - the request registers
+//                bufs - the frame for WRFRME, the frames for WRRANGE, the
+//                       offset and the bytes for WRPART
+// Outputs      : 0 if successful, -1 if failure
+
+int shard_send(int s, CartXferRegister reg, void **bufs) {
+	uint64_t value = htonll64(reg);
+	int sock = shard_connect(s);
+	struct iovec iov[CART_RANGE_MAX + 1] = {{&value, sizeof(value)}};
+	int frames = (extract_reg(reg) == CART_OP_WRFRME) ? 1 : ((extract_reg(reg) == CART_OP_WRRANGE) ? reg & CART_RANGE_MASK : 0);
+
+	if(sock == -1) {
+		return (-1);
+	}
+
+	//the register and the frames of a write go out together
+	for(int i = 0; i < frames; i++) {
+		iov[i + 1].iov_base = bufs[i];
+		iov[i + 1].iov_len = CART_FRAME_SIZE;
+	}
+	if(extract_reg(reg) == CART_OP_WRPART) {
+		iov[1].iov_base = bufs[0];
+		iov[1].iov_len = CART_PART_HEADER + (reg & CART_RANGE_MASK);
+		frames = 1;
+	}
+	if(transfer_all(sock, iov, frames + 1, 1) == -1) {
+		printf("Error writing to the network\n");
+		return (-1);
+	}
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shard_receive
+// Description  : Get the answer to a request from the server of a shard, the
+//                frames come with it for a read, the connection is closed
+//                after a power off
+//
+// Inputs       : s - index of the shard
+//                reg - the request registers
+//                bufs - where the frame goes for RDFRME, the frames for RDRANGE
+// Outputs      : the response registers
+
+CartXferRegister shard_receive(int s, CartXferRegister reg, void **bufs) {
+	uint64_t value = 0;
+	int one = 1;
+	struct iovec iov[CART_RANGE_MAX + 1] = {{&value, sizeof(value)}};
+	int frames = (extract_reg(reg) == CART_OP_RDFRME) ? 1 : ((extract_reg(reg) == CART_OP_RDRANGE) ? reg & CART_RANGE_MASK : 0);
+
+	//the answer and the frames of a read come in together
+	for(int i = 0; i < frames; i++) {
+		iov[i + 1].iov_base = bufs[i];
+		iov[i + 1].iov_len = CART_FRAME_SIZE;
+	}
+	//an answer cut short leaves the stream out of step, the connection is dropped
+	if(transfer_all(shards[s].socket, iov, frames + 1, 0) == -1) {
+		printf("Error reading from the network\n");
+		close(shards[s].socket);
+		shards[s].socket = -1;
+		return (((CartXferRegister) 1) << 47);
+	}
+
+	//with requests in flight no new request carries the ack of this answer,
+	//the server holds its next answer back until one comes
+	if(pipeline_depth > 1) {
+		setsockopt(shards[s].socket, IPPROTO_TCP, TCP_QUICKACK, &one, sizeof(one));
+	}
+
+	//convert to host format
+	value = ntohll64(value);
+
+	//the cartridge loaded on the server, ranges stand in for reads and
+	//writes of it only
+	if(extract_reg(reg) == CART_OP_LDCART) {
+		shards[s].loaded = ((value >> 47) & 1) ? CART_NO_CARTRIDGE : extract_cart(reg);
+	}
+	if(extract_reg(reg) == CART_OP_INITMS) {
+		shards[s].loaded = CART_NO_CARTRIDGE;
+	}
+
+	//close the client socket
+	if(extract_reg(reg) == CART_OP_POWOFF) {
+		close(shards[s].socket);
+		shards[s].socket = -1;
+	}
+
+	return (value);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shm_disconnect
+// Description  : Give the channel back and unmap the server region
+//
+// Inputs       : none
+// Outputs      : 0 if successful
+
+int shm_disconnect(void) {
+	if(shm_channel != NULL) {
+		cart_shm_release(shm_channel);
+		shm_channel = NULL;
+	}
+	if(shm_region != NULL) {
+		cart_shm_detach(shm_region);
+		shm_region = NULL;
+	}
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : client_cart_set_shm
+// Description  : Reach the server through its shared memory region instead
+//                of TCP, the server has to be on the same host
+//
+// Inputs       : name - the name the server was given with -m, NULL to go
+//                       back to TCP
+// Outputs      : 0 if successful, -1 if failure
+
+int client_cart_set_shm(char *name) {
+	shm_disconnect();
+	shm_name[0] = '\0';
+	if(name == NULL) {
+		return (0);
+	}
+
+	if(name[0] == '\0' || strchr(name, '/') != NULL || strlen(name) + 1 >= sizeof(shm_name)) {
+		return (-1);
+	}
+
+	//the channel holds one loaded cartridge, the pool is checked on first use
+	snprintf(shm_name, sizeof(shm_name), "/%s", name);
+	return (pool_connections());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shm_wait_answers
+// Description  : Wait until the server has answered past the answers taken,
+//                checking now and then that the server is still running
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if the server is gone
+
+int shm_wait_answers(void) {
+	while(__atomic_load_n(&shm_channel->answered, __ATOMIC_ACQUIRE) == shm_answered) {
+		if(cart_shm_wait(&shm_channel->answered, shm_answered, &shm_channel->client_sleeping, 500) == -1 &&
+				kill(shm_region->server, 0) == -1 && errno == ESRCH) {
+			printf("The shared memory server is gone\n");
+			shm_disconnect();
+			return (-1);
+		}
+	}
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shm_connect
+// Description  : Claim a channel of the server region if there is none, the
+//                requests a client that died left in it are answered first
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int shm_connect(void) {
+	if(shm_channel != NULL) {
+		return (0);
+	}
+
+	shm_region = cart_shm_attach(shm_name);
+	if(shm_region == NULL) {
+		return (-1);
+	}
+	shm_channel = cart_shm_claim(shm_region);
+	if(shm_channel == NULL) {
+		printf("Every shared memory channel of the server is in use\n");
+		shm_disconnect();
+		return (-1);
+	}
+
+	shm_posted = __atomic_load_n(&shm_channel->posted, __ATOMIC_ACQUIRE);
+	shm_answered = __atomic_load_n(&shm_channel->answered, __ATOMIC_ACQUIRE);
+	while(shm_answered != shm_posted) {
+		if(shm_wait_answers() == -1) {
+			return (-1);
+		}
+		shm_answered = __atomic_load_n(&shm_channel->answered, __ATOMIC_ACQUIRE);
+	}
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shm_send
+// Description  : Put a request in the next slot of the channel, the frame
+//                goes in the slot with it for a write
+//
+// Inputs       : reg - the request registers
+//                buf - the frame for WRFRME
+// Outputs      : 0 if successful, -1 if failure
+
+int shm_send(CartXferRegister reg, void *buf) {
+	CartShmSlot *slot = NULL;
+
+	if(shm_connect() == -1) {
+		return (-1);
+	}
+
+	slot = &shm_channel->slot[shm_posted % CART_SHM_SLOTS];
+	slot->reg = reg;
+	if(extract_reg(reg) == CART_OP_WRFRME) {
+		memcpy(slot->frame, buf, CART_FRAME_SIZE);
+	}
+	shm_posted++;
+	cart_shm_post(&shm_channel->posted, shm_posted, &shm_channel->server_sleeping);
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shm_receive
+// Description  : Take the answer to the oldest request in the channel, the
+//                frame comes out of the slot for a read, the channel is
+//                given back after a power off
+//
+// Inputs       : reg - the request registers
+//                buf - where the frame goes for RDFRME
+// Outputs      : the response registers
+
+CartXferRegister shm_receive(CartXferRegister reg, void *buf) {
+	CartShmSlot *slot = NULL;
+	CartXferRegister value = 0;
+
+	if(shm_wait_answers() == -1) {
+		return (((CartXferRegister) 1) << 47);
+	}
+
+	slot = &shm_channel->slot[shm_answered % CART_SHM_SLOTS];
+	value = slot->reg;
+	if(extract_reg(reg) == CART_OP_RDFRME) {
+		memcpy(buf, slot->frame, CART_FRAME_SIZE);
+	}
+	shm_answered++;
+
+	if(extract_reg(reg) == CART_OP_POWOFF) {
+		shm_disconnect();
+	}
+
+	return (value);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : client_cart_set_local
+// Description  : Keep the cartridges in this process instead of on a
+//                server, in an image file mapped into memory that holds
+//                them from one run to the next
+//
+// Inputs       : image - the image file, NULL to go back to the server
+// Outputs      : 0 if successful, -1 if failure
+
+int client_cart_set_local(char *image) {
+	if(image == NULL) {
+		local_bus = 0;
+		return (0);
+	}
+
+	if(cart_memsys_set_image(image) == -1) {
+		return (-1);
+	}
+
+	//one set of cartridges with one of them loaded, the pool is checked on first use
+	local_bus = 1;
+	return (pool_connections());
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : client_cart_bus_request
 // Description  : This the client operation that sends a request to the CART
 //                server process.   It will:
 //
-//                1) if INIT make a connection to the server
+//                1) if there is no connection to the shard make one
 //                2) send any request to the server, returning results
 //                3) if CLOSE, will close the connection
 //
+//                INITMS and POWOFF go to every shard, the other requests to
+//                the shard of the cartridge in ct1
+//
 // Inputs       : reg - the request reqisters for the command
 //                buf - the block to be read/written from (READ/WRITE)
 // Outputs      : the response structure encoded as needed
 
 CartXferRegister client_cart_bus_request(CartXferRegister reg, void *buf) {
-	char *ip = CART_DEFAULT_IP;
-	struct sockaddr_in caddr;
-	uint64_t value = 0;
-	int8_t opcode;
+	CartXferRegister value = 0;
+	CartXferRegister resp = 0;
+	int8_t opcode = extract_reg(reg);
+	int s = 0;
 
-	//if socket handle == -1, there is no connection
-	if(client_socket == -1) {
+	//the servers and connections are laid out the first time they are used
+	if(pool_setup() == -1) {
+		return (-1);
+	}
 
-		caddr.sin_family = AF_INET;
-		caddr.sin_port = htons(CART_DEFAULT_PORT);
+	//no server, the request is carried out here
+	if(local_bus == 1) {
+		return (cart_io_bus(reg, buf));
+	}
 
-		//setup address
-		if(inet_aton(ip, &(caddr.sin_addr)) == 0) {
-			printf("Setting up an address caused an error");
+	//the one server on this host
+	if(shm_name[0] != '\0') {
+		if(shm_send(reg, buf) == -1) {
 			return (-1);
 		}
-		//create a socket
-		client_socket = socket(PF_INET, SOCK_STREAM, 0);
+		return (shm_receive(reg, buf));
+	}
 
-		if(client_socket == -1) {
-			printf("Creating a socket caused an error\n");
-			return (-1);
+	//every server is started and stopped, a failure on one of them is
+	//returned. INITMS asks for protocol v2, a server that only knows v1
+	//answers with no range length and stays on v1
+	if(opcode == CART_OP_INITMS || opcode == CART_OP_POWOFF) {
+		if(opcode == CART_OP_INITMS && protocol_version == CART_PROTOCOL_V2) {
+			reg |= ((CartXferRegister) CART_PROTOCOL_V2) << 48;
 		}
-		//connect socket and address
-		if(connect(client_socket, (const struct sockaddr *) &caddr, sizeof(caddr)) == -1) {
-			printf("Connecting a socket caused an error\n");
+		for(s = 0; s < client_cart_shards(); s++) {
+			if(shard_send(s, reg, &buf) == -1) {
+				return (-1);
+			}
+			value = shard_receive(s, reg, &buf);
+			if(opcode == CART_OP_INITMS) {
+				shards[s].ranges = 0;
+				if(((value >> 47) & 1) == 0 && ((value >> 48) & 0xff) == CART_PROTOCOL_V2) {
+					shards[s].ranges = ((value & CART_RANGE_MASK) < CART_RANGE_MAX) ? value & CART_RANGE_MASK : CART_RANGE_MAX;
+				}
+			}
+			if(s == 0 || ((value >> 47) & 1)) {
+				resp = value;
+			}
 		}
+		return (resp);
+	}
+
+	//a write and its linked read in one io_uring_enter
+	if(uring_wanted == 1) {
+		return ((client_cart_bus_batch(&reg, &buf, &resp, 1) == -1) ? (CartXferRegister) -1 : resp);
+	}
+
+	s = client_cart_shard(extract_cart(reg));
+	if(shard_send(s, reg, &buf) == -1) {
+		return (-1);
+	}
+
+	//return register
+	return (shard_receive(s, reg, &buf));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : next_for_shard
+// Description  : Find the next request of a batch that goes to a shard
+//
+// Inputs       : regs - the requests
+//                count - number of requests
+//                from - first request to look at
+//                s - index of the shard
+// Outputs      : index of the request, count if there is none
+
+int next_for_shard(CartXferRegister *regs, int count, int from, int s) {
+	while(from < count && client_cart_shard(extract_cart(regs[from])) != s) {
+		from++;
 	}
 
-	//get the ky1
-	opcode = extract_reg(reg);
-	//convert value to network format
-	value = htonll64(reg);
+	return (from);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : client_cart_set_pipeline
+// Description  : Set how many requests of a batch a shard is sent before
+//                its first answer is taken, the server answers them in the
+//                order they were sent so the round trips overlap
+//
+// Inputs       : depth - requests in flight on a connection, 1 sends them
+//                        one at a time
+// Outputs      : the depth if successful, -1 if failure
+
+int client_cart_set_pipeline(int depth) {
+	if(depth < 1 || depth > CART_MAX_PIPELINE) {
+		return (-1);
+	}
+
+	pipeline_depth = depth;
+	return (pipeline_depth);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : client_cart_set_protocol
+// Description  : Set the protocol version asked for at the next INITMS, a
+//                server that only speaks v1 keeps its connections on v1
+//
+// Inputs       : version - CART_PROTOCOL_V1 or CART_PROTOCOL_V2
+// Outputs      : the version if successful, -1 if failure
+
+int client_cart_set_protocol(int version) {
+	if(version != CART_PROTOCOL_V1 && version != CART_PROTOCOL_V2) {
+		return (-1);
+	}
+
+	protocol_version = version;
+	return (protocol_version);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : client_cart_partial
+// Description  : Check if the connection a cartridge is used through takes
+//                partial frame writes, it has to be a socket that agreed on
+//                protocol v2
+//
+// Inputs       : cart - the cartridge
+// Outputs      : 1 if it does, 0 if not
+
+int client_cart_partial(CartridgeIndex cart) {
+	if(local_bus == 1 || shm_name[0] != '\0' || uring_wanted == 1) {
+		return (0);
+	}
+
+	return (shards[client_cart_shard(cart)].ranges > 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : client_cart_traffic
+// Description  : Get the bytes that went over the connections to the
+//                servers, the registers and the frames
+//
+// Inputs       : sent - where the bytes sent go
+//                received - where the bytes received go
+// Outputs      : 0 if successful
+
+int client_cart_traffic(uint64_t *sent, uint64_t *received) {
+	*sent = wire_sent;
+	*received = wire_received;
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : uring_teardown
+// Description  : Close the io_uring and free its buffers
+//
+// Inputs       : none
+// Outputs      : 0 if successful
+
+int uring_teardown(void) {
+	if(uring.fd != -1) {
+		cart_uring_close(&uring);
+	}
+	if(uring_buffers != NULL) {
+		munmap(uring_buffers, 2 * uring_area * uring_shards);
+		uring_buffers = NULL;
+	}
+	uring_shards = 0;
+	uring_depth = 0;
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : client_cart_set_uring
+// Description  : Send the requests through an io_uring, the sockets are
+//                used one call at a time if the kernel has no io_uring
+//
+// Inputs       : on - 1 for io_uring, 0 for the sockets
+// Outputs      : 0 if successful
+
+int client_cart_set_uring(int on) {
+	uring_teardown();
+	uring_wanted = (on != 0);
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : uring_prepare
+// Description  : Set the io_uring up for the shards and pipeline depth, with
+//                a send and a receive area for every shard registered with
+//                the kernel. If that fails the sockets are used from then on
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if io_uring is not available
+
+int uring_prepare(void) {
+	if(uring.fd != -1 && uring_shards == client_cart_shards() && uring_depth == pipeline_depth) {
+		return (0);
+	}
+
+	uring_teardown();
+	uring_shards = client_cart_shards();
+	uring_depth = pipeline_depth;
+	uring_area = pipeline_depth * (CART_NET_HEADER_SIZE + CART_FRAME_SIZE);
+	uring_buffers = mmap(NULL, 2 * uring_area * uring_shards, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(uring_buffers == MAP_FAILED) {
+		uring_buffers = NULL;
+	}
+
+	//a shard has at most a write and a read in the ring
+	if(uring_buffers == NULL || cart_uring_setup(&uring, 2 * uring_shards) == -1 ||
+			cart_uring_register(&uring, uring_buffers, 2 * uring_area * uring_shards) == -1) {
+		printf("io_uring is not available, using the sockets\n");
+		uring_teardown();
+		uring_wanted = 0;
+		return (-1);
+	}
+
+	return (0);
+}
 
-	switch(opcode) {
-		//if reading
-		case CART_OP_RDFRME:
-			//write to the network
-			if(write(client_socket, &value, sizeof(value)) != sizeof(value)) {
-				printf("Error writing to the network");
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : uring_queue
+// Description  : Queue the rest of the answers of a shard to be read, after
+//                the rest of its requests if there are any, the read is
+//                linked to the write so it only starts once they are sent
+//
+// Inputs       : s - index of the shard
+//                round - the requests of the shard in the round
+// Outputs      : number of operations queued, -1 if failure
+
+int uring_queue(int s, struct CartUringRound *round) {
+	struct io_uring_sqe *sqe = NULL;
+	char *area = &uring_buffers[2 * s * uring_area];
+	int queued = 0;
+
+	if(round->sent < round->to_send) {
+		sqe = cart_uring_sqe(&uring);
+		if(sqe == NULL) {
+			return (-1);
+		}
+		sqe->opcode = IORING_OP_WRITE_FIXED;
+		sqe->flags = IOSQE_IO_LINK;
+		sqe->fd = shards[s].socket;
+		sqe->addr = (uintptr_t) &area[round->sent];
+		sqe->len = round->to_send - round->sent;
+		sqe->buf_index = 0;
+		sqe->user_data = s << 1;
+		queued++;
+	}
+
+	sqe = cart_uring_sqe(&uring);
+	if(sqe == NULL) {
+		return (-1);
+	}
+	sqe->opcode = IORING_OP_READ_FIXED;
+	sqe->fd = shards[s].socket;
+	sqe->addr = (uintptr_t) &area[uring_area + round->got];
+	sqe->len = round->to_get - round->got;
+	sqe->buf_index = 0;
+	sqe->user_data = (s << 1) | 1;
+	queued++;
+
+	return (queued);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : uring_round
+// Description  : Carry out a round of a batch: every shard with requests
+//                left gets up to the pipeline depth of them written in one
+//                go, linked to the read of their answers, all handed to the
+//                kernel with one io_uring_enter that waits for them. A short
+//                write or read is queued again for the rest
+//
+// Inputs       : regs - the requests
+//                bufs - the frame of each request
+//                next - next request of every shard, moved past the round
+//                rounds - the requests of every shard in the round
+//                count - number of requests
+// Outputs      : 0 if successful, -1 if failure
+
+int uring_round(CartXferRegister *regs, void **bufs, int *next, struct CartUringRound *rounds, int count) {
+	struct CartUringRound *round = NULL;
+	struct io_uring_cqe cqe;
+	uint64_t value = 0;
+	char *area = NULL;
+	int pending = 0;
+	int queued = 0;
+	int i = 0;
+	int s = 0;
+
+	for(s = 0; s < uring_shards; s++) {
+		round = &rounds[s];
+		area = &uring_buffers[2 * s * uring_area];
+		memset(round, 0, sizeof(struct CartUringRound));
+		while(round->taken < pipeline_depth && next[s] < count) {
+			i = next[s];
+			value = htonll64(regs[i]);
+			memcpy(&area[round->to_send], &value, sizeof(value));
+			round->to_send += sizeof(value);
+			if(extract_reg(regs[i]) == CART_OP_WRFRME) {
+				memcpy(&area[round->to_send], bufs[i], CART_FRAME_SIZE);
+				round->to_send += CART_FRAME_SIZE;
+			}
+			round->to_get += CART_NET_HEADER_SIZE + ((extract_reg(regs[i]) == CART_OP_RDFRME) ? CART_FRAME_SIZE : 0);
+			round->index[round->taken++] = i;
+			next[s] = next_for_shard(regs, count, i + 1, s);
+		}
+		if(round->taken > 0) {
+			if(shard_connect(s) == -1 || (queued = uring_queue(s, round)) == -1) {
 				return (-1);
 			}
+			pending += queued;
+		}
+	}
+
+	while(pending > 0) {
+		if(cart_uring_submit(&uring, pending) == -1) {
+			return (-1);
+		}
+		while(cart_uring_reap(&uring, &cqe) == 1) {
+			pending--;
+			s = cqe.user_data >> 1;
+			round = &rounds[s];
 
-			//read to the network
-			if(read(client_socket, &value, sizeof(value)) != sizeof(value)) {
-				printf("Error reading from the network");
+			//a read cut off by a short write is queued again with the write
+			if(cqe.user_data & 1) {
+				if(cqe.res == -ECANCELED) {
+					continue;
+				}
+				if(cqe.res <= 0) {
+					printf("Error reading from the network\n");
+					return (-1);
+				}
+				round->got += cqe.res;
+				wire_received += cqe.res;
+				if(round->got < round->to_get) {
+					if((queued = uring_queue(s, round)) == -1) {
+						return (-1);
+					}
+					pending += queued;
+				}
 			}
+			else {
+				if(cqe.res <= 0) {
+					printf("Error writing to the network\n");
+					return (-1);
+				}
+				round->sent += cqe.res;
+				wire_sent += cqe.res;
+				if(round->sent < round->to_send) {
+					if((queued = uring_queue(s, round)) == -1) {
+						return (-1);
+					}
+					pending += queued;
+				}
+			}
+		}
+	}
 
-			//convert to host format
-			value = ntohll64(value);
+	return (0);
+}
 
-			//read the buffer
-			if(read(client_socket, buf, 1024) != 1024) {
-				printf("Did not read 1024 bytes\n");
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : uring_batch
+// Description  : Send a batch of requests through the io_uring, a round at
+//                a time, and take the answers out of the receive areas
+//
+// Inputs       : regs - the requests, none of them INITMS or POWOFF
+//                bufs - the frame of each request, NULL if it has none
+//                resps - where the response of each request goes
+//                count - number of requests
+// Outputs      : 0 if every request was answered, -1 if failure
+
+int uring_batch(CartXferRegister *regs, void **bufs, CartXferRegister *resps, int count) {
+	struct CartUringRound rounds[CART_MAX_SHARDS];
+	int next[CART_MAX_SHARDS]; //next request of the shard to send
+	uint64_t value = 0;
+	char *area = NULL;
+	uint32_t pos = 0;
+	int done = 0;
+	int i = 0;
+
+	//the ring does not follow the cartridges loaded, no range stands in for
+	//reads after it until the next load
+	for(int s = 0; s < uring_shards; s++) {
+		next[s] = next_for_shard(regs, count, 0, s);
+		shards[s].loaded = CART_NO_CARTRIDGE;
+	}
+
+	while(done < count) {
+		//the operations still in the ring go with it, the connections are
+		//out of step with their servers
+		if(uring_round(regs, bufs, next, rounds, count) == -1) {
+			uring_teardown();
+			for(int s = 0; s < num_shards; s++) {
+				if(shards[s].socket != -1) {
+					close(shards[s].socket);
+					shards[s].socket = -1;
+				}
 			}
+			return (-1);
+		}
 
-			break;
-		//if writing
-		case CART_OP_WRFRME:
-			//write to the network
-			if(write(client_socket, &value, sizeof(value)) != sizeof(value)) {
-				printf("Error writing network data in write condition");
+		for(int s = 0; s < uring_shards; s++) {
+			area = &uring_buffers[(2 * s + 1) * uring_area];
+			pos = 0;
+			for(int r = 0; r < rounds[s].taken; r++) {
+				i = rounds[s].index[r];
+				memcpy(&value, &area[pos], sizeof(value));
+				resps[i] = ntohll64(value);
+				pos += sizeof(value);
+				if(extract_reg(regs[i]) == CART_OP_RDFRME) {
+					memcpy(bufs[i], &area[pos], CART_FRAME_SIZE);
+					pos += CART_FRAME_SIZE;
+				}
+				done++;
 			}
+		}
+	}
 
-			//write the buffer to the network
-			if(write(client_socket, buf, 1024) != 1024) {
-				printf("Error 2nd writing network data in write condition\n");
-			}	
+	return (0);
+}
 
-			//read to the buffer
-			if(read(client_socket, &value, sizeof(value)) != sizeof(value)) {
-				printf("Error reading network data in write condition\n");
-			}
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : wire_joins
+// Description  : Check if a request can join the wire request of its shard
+//                before it: a read or write of the next frame of the
+//                cartridge loaded, going the same way, with room left in
+//                the range
+//
+// Inputs       : s - index of the shard
+//                k - the wire request
+//                reg - the request
+//                loaded - cartridge loaded on the server when it comes
+// Outputs      : 1 if it joins, 0 if not
 
-			//convert reg to host format
-			value = ntohll64(value);
+int wire_joins(int s, int k, CartXferRegister reg, CartridgeIndex loaded) {
+	CartXferRegister run = wire.regs[k];
+	int8_t op = extract_reg(reg);
 
-			break;
-		//if powering off
-		case CART_OP_POWOFF:
-			//write to the network
-			if(write(client_socket, &value, sizeof(value)) != sizeof(value)) {
-				printf("Error writing in power off\n");
-			}
+	if((op != CART_OP_RDFRME && op != CART_OP_WRFRME) || op != extract_reg(run) || wire.frames[k] >= shards[s].ranges) {
+		return (0);
+	}
 
-			//read to the network
-			if(read(client_socket, &value, sizeof(value)) != sizeof(value)) {
-				printf("Error reading in power off");
-			}
+	return (extract_cart(reg) == loaded && extract_cart(run) == loaded &&
+		((reg >> 15) & 0xffff) == ((run >> 15) & 0xffff) + wire.frames[k]);
+}
 
-			//convert reg to host format
-			value = ntohll64(value);
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : wire_build
+// Description  : Lay a batch out on the wire, the requests of every shard
+//                in order, runs of them joined into range requests on
+//                connections that agreed on protocol v2
+//
+// Inputs       : regs - the requests
+//                bufs - the frame of each request
+//                count - number of requests, up to CART_WIRE_BATCH
+// Outputs      : number of wire requests
 
-			//close the client socket
-			close(client_socket);
+int wire_build(CartXferRegister *regs, void **bufs, int count) {
+	CartridgeIndex loaded = CART_NO_CARTRIDGE;
+	int placed = 0;
+	int last = -1;
+	int op = 0;
 
-			//change socket handle
-			client_socket = -1;
-			break;
-		//if initializing cart
-		case CART_OP_INITMS:
-			//writing to the network
-			if(write(client_socket, &value, sizeof(value)) != sizeof(value)) {
-				printf("Error in writing init case\n");
+	wire.count = 0;
+	for(int s = 0; s < client_cart_shards(); s++) {
+		last = -1;
+		loaded = shards[s].loaded;
+		for(int i = next_for_shard(regs, count, 0, s); i < count; i = next_for_shard(regs, count, i + 1, s)) {
+			if(last != -1 && wire_joins(s, last, regs[i], loaded) == 1) {
+				wire.frames[last]++;
 			}
-
-			//read the network
-			if(read(client_socket, &value, sizeof(value)) != sizeof(value)) {
-				printf("Error in reading init case");
+			else {
+				last = wire.count++;
+				wire.regs[last] = regs[i];
+				wire.first[last] = placed;
+				wire.frames[last] = 1;
+			}
+			wire.order[placed] = i;
+			wire.bufs[placed++] = bufs[i];
+			if(extract_reg(regs[i]) == CART_OP_LDCART) {
+				loaded = extract_cart(regs[i]);
 			}
+		}
+	}
+
+	//a run of more than one frame goes as one range request
+	for(int k = 0; k < wire.count; k++) {
+		if(wire.frames[k] > 1) {
+			op = (extract_reg(wire.regs[k]) == CART_OP_RDFRME) ? CART_OP_RDRANGE : CART_OP_WRRANGE;
+			wire.regs[k] = (wire.regs[k] & ~((((CartXferRegister) 0xff) << 56) | CART_RANGE_MASK)) |
+				(((CartXferRegister) op) << 56) | wire.frames[k];
+		}
+	}
+
+	return (wire.count);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : wire_abort
+// Description  : Drop the connections of the shards with requests still in
+//                flight when a batch fails, their answers would otherwise be
+//                taken as the answers of the next batch
+//
+// Inputs       : inflight - requests sent to every shard and not answered
+//                shards_used - number of shards
+// Outputs      : -1
+
+int wire_abort(int *inflight, int shards_used) {
+	for(int s = 0; s < shards_used; s++) {
+		if(inflight[s] > 0 && shards[s].socket != -1) {
+			close(shards[s].socket);
+			shards[s].socket = -1;
+		}
+	}
+
+	return (-1);
+}
 
-			//convert reg to host format
-			value = ntohll64(value);
-			break;
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : wire_batch
+// Description  : Send the wire requests, every shard is kept up to the
+//                pipeline depth of its requests ahead, in order, while the
+//                other shards work on theirs, the answers are taken as the
+//                epoll of the connections reports them
+//
+// Inputs       : none
+// Outputs      : 0 if every wire request was answered, -1 if failure
+
+int wire_batch(void) {
+	int next[CART_MAX_SHARDS]; //next request of the shard to send
+	int oldest[CART_MAX_SHARDS]; //oldest request the shard has not answered
+	int inflight[CART_MAX_SHARDS]; //requests sent to the shard and not answered
+	struct epoll_event events[CART_MAX_SHARDS];
+	int shards_used = client_cart_shards();
+	int count = wire.count;
+	int done = 0;
+	int busy = 0;
+	int n = 0;
+	int s = 0;
+
+	for(s = 0; s < shards_used; s++) {
+		next[s] = next_for_shard(wire.regs, count, 0, s);
+		oldest[s] = next[s];
+		inflight[s] = 0;
+	}
 
-		//if zeroing out the cart
-		case CART_OP_BZERO:
-			//write to the network
-			if(write(client_socket, &value, sizeof(value)) != sizeof(value)) {
-				printf("Error in writing bzero case\n");
+	while(done < count) {
+		//every shard is topped up to the pipeline depth
+		busy = 0;
+		for(s = 0; s < shards_used; s++) {
+			while(inflight[s] < pipeline_depth && next[s] < count) {
+				//a request cut short is in flight as much as the ones before it
+				if(shard_send(s, wire.regs[next[s]], &wire.bufs[wire.first[next[s]]]) == -1) {
+					inflight[s]++;
+					return (wire_abort(inflight, shards_used));
+				}
+				inflight[s]++;
+				next[s] = next_for_shard(wire.regs, count, next[s] + 1, s);
 			}
+			if(inflight[s] > 0) {
+				busy++;
+				events[0].data.u32 = s;
+			}
+		}
 
-			//read the network
-			if(read(client_socket, &value, sizeof(value)) != sizeof(value)) {
-			 	printf("Error in reading bzero case");
+		//a single shard busy just waits for its answer
+		n = 1;
+		if(busy > 1) {
+			n = epoll_wait(pool_epoll, events, CART_MAX_SHARDS, -1);
+			if(n == -1 && errno != EINTR) {
+				return (wire_abort(inflight, shards_used));
 			}
-			//convert reg to host format
-			value = ntohll64(value);
+		}
 
-			break;
-		//default statement
-		default:
-			//write to the network
-			if(write(client_socket, &value, sizeof(value)) != sizeof(value)) {
-				printf("Error in writing default case\n");
+		//take the oldest answer of every shard that has one, a connection
+		//ready with nothing asked of it was closed by its server
+		for(int i = 0; i < n; i++) {
+			s = events[i].data.u32;
+			if(inflight[s] == 0) {
+				close(shards[s].socket);
+				shards[s].socket = -1;
+				continue;
 			}
+			wire.resps[oldest[s]] = shard_receive(s, wire.regs[oldest[s]], &wire.bufs[wire.first[oldest[s]]]);
+			oldest[s] = next_for_shard(wire.regs, count, oldest[s] + 1, s);
+			inflight[s]--;
+			done++;
 
-			//read from the network
-			if(read(client_socket, &value, sizeof(value)) != sizeof(value)) {
-				printf("Error in reading default case");
+			//the answer was lost with the connection, so are the ones behind it
+			if(shards[s].socket == -1) {
+				return (wire_abort(inflight, shards_used));
 			}
+		}
+	}
 
-			//convert to host format
-			value = ntohll64(value);
+	return (0);
+}
 
-			break;
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : client_cart_bus_batch
+// Description  : Send a batch of requests, every shard is kept up to the
+//                pipeline depth of its requests ahead while the other
+//                shards work on theirs. On protocol v2 a run of reads or
+//                writes of the next frames goes as one range request, its
+//                answer is the answer of every request in it
+//
+// Inputs       : regs - the requests, none of them INITMS or POWOFF
+//                bufs - the frame of each request, NULL if it has none
+//                resps - where the response of each request goes
+//                count - number of requests
+// Outputs      : 0 if every request was answered, -1 if failure
+
+int client_cart_bus_batch(CartXferRegister *regs, void **bufs, CartXferRegister *resps, int count) {
+	int done = 0;
+	int n = 0;
 
+	if(pool_setup() == -1) {
+		return (-1);
 	}
 
-	//return register
-	return value;
+	//nothing to wait for without a server
+	if(local_bus == 1) {
+		for(int i = 0; i < count; i++) {
+			resps[i] = cart_io_bus(regs[i], bufs[i]);
+		}
+		return (0);
+	}
+
+	//the server on this host takes up to the pipeline depth of requests
+	//ahead, it is woken up only when it has run out of them
+	if(shm_name[0] != '\0') {
+		for(n = 0; done < count; done++) {
+			while(n < count && n - done < pipeline_depth) {
+				if(shm_send(regs[n], bufs[n]) == -1) {
+					return (-1);
+				}
+				n++;
+			}
+			resps[done] = shm_receive(regs[done], bufs[done]);
+		}
+		return (0);
+	}
+
+	//the kernel works through the batch with a system call a round
+	if(uring_wanted == 1 && uring_prepare() == 0) {
+		return (uring_batch(regs, bufs, resps, count));
+	}
+
+	for(done = 0; done < count; done += n) {
+		n = (count - done < CART_WIRE_BATCH) ? count - done : CART_WIRE_BATCH;
+		wire_build(&regs[done], &bufs[done], n);
+		if(wire_batch() == -1) {
+			return (-1);
+		}
+		for(int k = 0; k < wire.count; k++) {
+			for(int j = wire.first[k]; j < wire.first[k] + wire.frames[k]; j++) {
+				resps[done + wire.order[j]] = wire.resps[k];
+			}
+		}
+	}
+
+	return (0);
 }
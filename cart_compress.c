@@ -0,0 +1,433 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : cart_compress.c
+//  Description    : This is the implementation of the block compressor for
+//                   the CART driver, a small LZ77 coder in the style of LZ4.
+//                   The output is a list of sequences, each one a token byte,
+//                   some literal bytes copied as they are, then a match: an
+//                   offset back into the output and a length to copy from
+//                   there. The last sequence only has literals.
+//
+//  Author         : [**Jason Ling**]
+//  Last Modified  : [**December 2, 2016**]
+//
+
+// Includes
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Project includes
+#include <cmpsc311_log.h>
+#include <cart_compress.h>
+
+// Defines
+//the match finder remembers the last place every hash of 4 bytes was seen
+#define HASH_BITS 10
+
+//longest distance a match can reach back, offsets are 16 bits
+#define MAX_OFFSET 0xffff
+
+//a length of 15 in either half of the token is continued in extra bytes
+#define RUN_MASK 15
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : read32
+// Description  : Get 4 bytes from anywhere in a buffer
+//
+// Inputs       : p - where the bytes start
+// Outputs      : the bytes as an integer
+
+static inline uint32_t read32(const char *p) {
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return (v);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hash4
+// Description  : Hash the 4 bytes at a position for the match finder
+//
+// Inputs       : p - where the bytes start
+// Outputs      : slot in the hash table
+
+static inline uint32_t hash4(const char *p) {
+	return ((read32(p) * 2654435761U) >> (32 - HASH_BITS));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : match_length
+// Description  : Count how many bytes two places in the input have in
+//                common, comparing 16 bytes at a time with SSE2 when it is
+//                there and 8 at a time otherwise
+//
+// Inputs       : a - the earlier place
+//                b - the later place
+//                end - end of the input, b never reads past it
+// Outputs      : number of equal bytes
+
+static int32_t match_length(const char *a, const char *b, const char *end) {
+	const char *start = b;
+	uint64_t x = 0, y = 0;
+
+#ifdef __SSE2__
+	while(end - b >= 16) {
+		__m128i va = _mm_loadu_si128((const __m128i *) a);
+		__m128i vb = _mm_loadu_si128((const __m128i *) b);
+		uint32_t same = _mm_movemask_epi8(_mm_cmpeq_epi8(va, vb));
+		if(same != 0xffff) {
+			return (b - start + __builtin_ctz(~same));
+		}
+		a += 16;
+		b += 16;
+	}
+#endif
+	while(end - b >= 8) {
+		memcpy(&x, a, sizeof(x));
+		memcpy(&y, b, sizeof(y));
+		if(x != y) {
+			return (b - start + __builtin_ctzll(x ^ y) / 8);
+		}
+		a += 8;
+		b += 8;
+	}
+	while(b < end && *a == *b) {
+		a++;
+		b++;
+	}
+
+	return (b - start);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : put_length
+// Description  : Write the extra bytes of a length that did not fit in the
+//                token, 255 for every full 255 and then what is left
+//
+// Inputs       : dst - output buffer
+//                out - where the bytes go, moved past them
+//                cap - size of the output buffer
+//                length - what is left of the length after the token
+// Outputs      : 0 if successful, -1 if the output is full
+
+static int put_length(char *dst, int32_t *out, int32_t cap, int32_t length) {
+	while(length >= 255) {
+		if(*out >= cap) {
+			return (-1);
+		}
+		dst[(*out)++] = (char) 255;
+		length -= 255;
+	}
+	if(*out >= cap) {
+		return (-1);
+	}
+	dst[(*out)++] = (char) length;
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : put_sequence
+// Description  : Write one sequence, the literals and the match after them
+//
+// Inputs       : dst - output buffer
+//                out - where the sequence goes, moved past it
+//                cap - size of the output buffer
+//                literals - the bytes copied as they are
+//                num_literals - number of literal bytes
+//                offset - how far back the match starts, 0 for the last sequence
+//                length - length of the match
+// Outputs      : 0 if successful, -1 if the output is full
+
+static int put_sequence(char *dst, int32_t *out, int32_t cap, const char *literals, int32_t num_literals,
+		int32_t offset, int32_t length) {
+	int lit_code = (num_literals >= RUN_MASK) ? RUN_MASK : num_literals;
+	int match_code = 0;
+
+	if(offset != 0) {
+		length -= CART_COMPRESS_MIN_MATCH;
+		match_code = (length >= RUN_MASK) ? RUN_MASK : length;
+	}
+
+	if(*out >= cap) {
+		return (-1);
+	}
+	dst[(*out)++] = (char) ((lit_code << 4) | match_code);
+	if(lit_code == RUN_MASK && put_length(dst, out, cap, num_literals - RUN_MASK) == -1) {
+		return (-1);
+	}
+	if(*out + num_literals > cap) {
+		return (-1);
+	}
+	memcpy(&dst[*out], literals, num_literals);
+	*out += num_literals;
+
+	//the last sequence ends with its literals
+	if(offset == 0) {
+		return (0);
+	}
+	if(*out + 2 > cap) {
+		return (-1);
+	}
+	dst[(*out)++] = (char) (offset & 0xff);
+	dst[(*out)++] = (char) (offset >> 8);
+	if(match_code == RUN_MASK && put_length(dst, out, cap, length - RUN_MASK) == -1) {
+		return (-1);
+	}
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_compress
+// Description  : Compress a buffer, looking up every position in a hash of
+//                the 4 bytes there for the last place they were seen
+//
+// Inputs       : src - the bytes to compress
+//                size - number of bytes
+//                dst - where the compressed bytes go
+//                cap - size of dst
+// Outputs      : compressed size if successful, -1 if it does not fit
+
+int32_t cart_compress(const char *src, int32_t size, char *dst, int32_t cap) {
+	int32_t table[1 << HASH_BITS];
+	int32_t pos = 0; //position being looked at
+	int32_t anchor = 0; //first byte not written out yet
+	int32_t out = 0;
+	int32_t candidate = 0;
+	int32_t length = 0;
+	uint32_t h = 0;
+
+	memset(table, 0xff, sizeof(table));
+
+	//a match needs 4 bytes to start at
+	while(pos + CART_COMPRESS_MIN_MATCH <= size) {
+		h = hash4(&src[pos]);
+		candidate = table[h];
+		table[h] = pos;
+
+		if(candidate < 0 || pos - candidate > MAX_OFFSET || read32(&src[candidate]) != read32(&src[pos])) {
+			//step faster through bytes that do not repeat
+			pos += 1 + ((pos - anchor) >> 6);
+			continue;
+		}
+
+		length = CART_COMPRESS_MIN_MATCH + match_length(&src[candidate + CART_COMPRESS_MIN_MATCH],
+			&src[pos + CART_COMPRESS_MIN_MATCH], &src[size]);
+		if(put_sequence(dst, &out, cap, &src[anchor], pos - anchor, pos - candidate, length) == -1) {
+			return (-1);
+		}
+		pos += length;
+		anchor = pos;
+
+		//remember the end of the match so the next one can follow it
+		if(pos - 2 + CART_COMPRESS_MIN_MATCH <= size) {
+			table[hash4(&src[pos - 2])] = pos - 2;
+		}
+	}
+
+	//whatever is left is written as it is
+	if(put_sequence(dst, &out, cap, &src[anchor], size - anchor, 0, 0) == -1) {
+		return (-1);
+	}
+
+	return (out);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : get_length
+// Description  : Read the extra bytes of a length that did not fit in the token
+//
+// Inputs       : src - compressed bytes
+//                in - where the bytes start, moved past them
+//                size - number of compressed bytes
+// Outputs      : the extra length, -1 if the input ends first
+
+static int32_t get_length(const char *src, int32_t *in, int32_t size) {
+	int32_t length = 0;
+	uint8_t b = 0;
+
+	do {
+		if(*in >= size) {
+			return (-1);
+		}
+		b = (uint8_t) src[(*in)++];
+		length += b;
+	} while(b == 255);
+
+	return (length);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_decompress
+// Description  : Decompress a buffer, checking every length and offset so a
+//                damaged input can not write outside of dst
+//
+// Inputs       : src - the compressed bytes
+//                size - number of compressed bytes
+//                dst - where the bytes go
+//                cap - size of dst
+// Outputs      : decompressed size if successful, -1 if the input is damaged
+
+int32_t cart_decompress(const char *src, int32_t size, char *dst, int32_t cap) {
+	int32_t in = 0;
+	int32_t out = 0;
+	int32_t literals = 0;
+	int32_t length = 0;
+	int32_t offset = 0;
+	int32_t extra = 0;
+	uint8_t token = 0;
+
+	while(in < size) {
+		token = (uint8_t) src[in++];
+
+		//literals
+		literals = token >> 4;
+		if(literals == RUN_MASK) {
+			if((extra = get_length(src, &in, size)) == -1) {
+				return (-1);
+			}
+			literals += extra;
+		}
+		if(literals > size - in || literals > cap - out) {
+			return (-1);
+		}
+		memcpy(&dst[out], &src[in], literals);
+		in += literals;
+		out += literals;
+
+		//the last sequence has no match
+		if(in == size) {
+			break;
+		}
+
+		//match
+		if(size - in < 2) {
+			return (-1);
+		}
+		offset = (uint8_t) src[in] | ((uint8_t) src[in + 1] << 8);
+		in += 2;
+		length = (token & RUN_MASK);
+		if(length == RUN_MASK) {
+			if((extra = get_length(src, &in, size)) == -1) {
+				return (-1);
+			}
+			length += extra;
+		}
+		length += CART_COMPRESS_MIN_MATCH;
+		if(offset == 0 || offset > out || length > cap - out) {
+			return (-1);
+		}
+
+		//a match closer than its length repeats the bytes it is copying
+		if(offset >= length) {
+			memcpy(&dst[out], &dst[out - offset], length);
+		}
+		else {
+			for(int32_t i = 0; i < length; i++) {
+				dst[out + i] = dst[out - offset + i];
+			}
+		}
+		out += length;
+	}
+
+	return (out);
+}
+
+//
+// Unit test
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cartCompressUnitTest
+// Description  : Run a UNIT test checking the compressor, buffers of every
+//                kind go through and back, damaged ones are turned down
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int cartCompressUnitTest(void) {
+	static const char *words[] = {"the ", "rabbit ", "Alice ", "said ", "and ", "of ", "\n", "queen ", ", ", "hole "};
+	char src[4096], packed[4096 + 4096 / 255 + 16], back[4096];
+	int32_t size = 0, cap = 0, bytes = 0, got = 0, pos = 0;
+	int kind = 0;
+
+	for(int i = 0; i < 2000; i++) {
+		//make a buffer: zeros, random, text or runs of random bytes
+		size = rand() % (int) sizeof(src);
+		kind = i % 4;
+		for(pos = 0; pos < size; ) {
+			if(kind == 0) {
+				src[pos++] = 0;
+			}
+			else if(kind == 1) {
+				src[pos++] = (char) rand();
+			}
+			else if(kind == 2) {
+				const char *w = words[rand() % 10];
+				for(int j = 0; w[j] != 0 && pos < size; j++) {
+					src[pos++] = w[j];
+				}
+			}
+			else {
+				char c = (char) rand();
+				for(int j = rand() % 40; j >= 0 && pos < size; j--) {
+					src[pos++] = c;
+				}
+			}
+		}
+
+		//it always fits in the worst case size and comes back the same
+		cap = size + size / 255 + 16;
+		bytes = cart_compress(src, size, packed, cap);
+		if(bytes == -1) {
+			logMessage(LOG_ERROR_LEVEL, "Compress unit test: %d bytes of kind %d did not fit in %d", size, kind, cap);
+			return (-1);
+		}
+		got = cart_decompress(packed, bytes, back, sizeof(back));
+		if(got != size || memcmp(src, back, size) != 0) {
+			logMessage(LOG_ERROR_LEVEL, "Compress unit test: %d bytes of kind %d came back as %d", size, kind, got);
+			return (-1);
+		}
+
+		//repeats have to shrink
+		if(kind != 1 && size > 1024 && bytes > size * 3 / 4) {
+			logMessage(LOG_ERROR_LEVEL, "Compress unit test: %d bytes of kind %d only went to %d", size, kind, bytes);
+			return (-1);
+		}
+
+		//a short output buffer is turned down, not overrun
+		if(bytes > 1 && cart_compress(src, size, packed, bytes - 1) != -1) {
+			logMessage(LOG_ERROR_LEVEL, "Compress unit test: %d bytes fit in less than %d", size, bytes);
+			return (-1);
+		}
+		if(size > 0 && cart_decompress(packed, bytes, back, size - 1) != -1) {
+			logMessage(LOG_ERROR_LEVEL, "Compress unit test: %d bytes came back in a smaller buffer", size);
+			return (-1);
+		}
+
+		//damaged input never writes past the end of the output
+		if(bytes > 0) {
+			bytes = cart_compress(src, size, packed, cap);
+			packed[rand() % bytes] ^= (char) (1 + rand() % 255);
+			if(cart_decompress(packed, bytes, back, size) > size) {
+				logMessage(LOG_ERROR_LEVEL, "Compress unit test: damaged input overran the output");
+				return (-1);
+			}
+		}
+	}
+
+	// Return successfully
+	logMessage(LOG_OUTPUT_LEVEL, "Compress unit test completed successfully.");
+	return (0);
+}
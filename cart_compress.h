@@ -0,0 +1,35 @@
+#ifndef CART_COMPRESS_INCLUDED
+#define CART_COMPRESS_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : cart_compress.h
+//  Description    : This is the header file for the block compressor used by
+//                   the CART driver to store frames in less space.
+//
+//  Author         : [**Jason Ling**]
+//  Last Modified  : [**December 2, 2016**]
+//
+
+// Includes
+#include <stdint.h>
+
+// Defines
+#define CART_COMPRESS_MIN_MATCH 4 // Shortest repeat encoded as a match
+
+//
+// Interface functions
+
+int32_t cart_compress(const char *src, int32_t size, char *dst, int32_t cap);
+	// Compress a buffer, returns the compressed size or -1 if it does not fit in "cap"
+
+int32_t cart_decompress(const char *src, int32_t size, char *dst, int32_t cap);
+	// Decompress a buffer, returns the original size or -1 if the input is damaged
+
+//
+// Unit test
+
+int cartCompressUnitTest(void);
+	// Run a UNIT test checking the compressor
+
+#endif
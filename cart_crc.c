@@ -0,0 +1,238 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : cart_crc.c
+//  Description    : This is the implementation of the CRC32C (Castagnoli)
+//                   checksum for the CART driver. On x86 processors with
+//                   SSE4.2 the crc32 instruction does 8 bytes at a time, it
+//                   is picked when the program starts. Everywhere else a
+//                   slice-by-8 table gives the same result.
+//
+//  Author         : [**Jason Ling**]
+//  Last Modified  : [**December 3, 2016**]
+//
+
+// Includes
+#include <string.h>
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <nmmintrin.h>
+#define CRC_HAVE_SSE42 1
+#endif
+
+// Project includes
+#include <cmpsc311_log.h>
+#include <cart_crc.h>
+
+// Defines
+//reflected Castagnoli polynomial
+#define CRC32C_POLY 0x82f63b78
+
+//
+// Global data
+
+//slice-by-8 tables, built the first time they are needed
+static uint32_t crc_table[8][256];
+static int crc_table_ready = 0;
+
+//-1 until the processor was checked, then 1 if it has the instruction
+static int crc_hw = -1;
+
+//measuring can turn the instruction off
+static int crc_force_table = 0;
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crc_build_table
+// Description  : Fill the slice-by-8 tables
+//
+// Inputs       : none
+// Outputs      : none
+
+static void crc_build_table(void) {
+	uint32_t crc = 0;
+
+	for(uint32_t i = 0; i < 256; i++) {
+		crc = i;
+		for(int j = 0; j < 8; j++) {
+			crc = (crc >> 1) ^ (CRC32C_POLY & (0 - (crc & 1)));
+		}
+		crc_table[0][i] = crc;
+	}
+	for(uint32_t i = 0; i < 256; i++) {
+		crc = crc_table[0][i];
+		for(int k = 1; k < 8; k++) {
+			crc = crc_table[0][crc & 0xff] ^ (crc >> 8);
+			crc_table[k][i] = crc;
+		}
+	}
+	crc_table_ready = 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crc_table_update
+// Description  : CRC32C of a buffer with the tables, 8 bytes a step
+//
+// Inputs       : p - the bytes
+//                size - how many
+//                crc - the running value, inverted
+// Outputs      : the running value, inverted
+
+static uint32_t crc_table_update(const unsigned char *p, uint32_t size, uint32_t crc) {
+	uint32_t lo = 0, hi = 0;
+
+	if(crc_table_ready == 0) {
+		crc_build_table();
+	}
+	while(size >= 8) {
+		memcpy(&lo, p, sizeof(lo));
+		memcpy(&hi, p + 4, sizeof(hi));
+		lo ^= crc;
+		crc = crc_table[7][lo & 0xff] ^ crc_table[6][(lo >> 8) & 0xff] ^
+			crc_table[5][(lo >> 16) & 0xff] ^ crc_table[4][lo >> 24] ^
+			crc_table[3][hi & 0xff] ^ crc_table[2][(hi >> 8) & 0xff] ^
+			crc_table[1][(hi >> 16) & 0xff] ^ crc_table[0][hi >> 24];
+		p += 8;
+		size -= 8;
+	}
+	while(size-- > 0) {
+		crc = crc_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+	}
+	return (crc);
+}
+
+#ifdef CRC_HAVE_SSE42
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crc_hw_update
+// Description  : CRC32C of a buffer with the SSE4.2 crc32 instruction, the
+//                file is not built for SSE4.2 so only this function is
+//
+// Inputs       : p - the bytes
+//                size - how many
+//                crc - the running value, inverted
+// Outputs      : the running value, inverted
+
+__attribute__((target("sse4.2")))
+static uint32_t crc_hw_update(const unsigned char *p, uint32_t size, uint32_t crc) {
+	uint64_t crc64 = crc, word = 0;
+
+	while(size >= 8) {
+		memcpy(&word, p, sizeof(word));
+		crc64 = _mm_crc32_u64(crc64, word);
+		p += 8;
+		size -= 8;
+	}
+	crc = (uint32_t) crc64;
+	while(size-- > 0) {
+		crc = _mm_crc32_u8(crc, *p++);
+	}
+	return (crc);
+}
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_crc_hardware
+// Description  : Tell if the processor computes the CRC
+//
+// Inputs       : none
+// Outputs      : 1 if the crc32 instruction is used, 0 if the table is
+
+int cart_crc_hardware(void) {
+	if(crc_hw == -1) {
+#ifdef CRC_HAVE_SSE42
+		__builtin_cpu_init();
+		crc_hw = __builtin_cpu_supports("sse4.2") ? 1 : 0;
+#else
+		crc_hw = 0;
+#endif
+	}
+	return (crc_hw == 1 && crc_force_table == 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_crc_force_table
+// Description  : Use the table even when the processor has the instruction
+//
+// Inputs       : on - 1 to use the table, 0 to go back to the fastest way
+// Outputs      : none
+
+void cart_crc_force_table(int on) {
+	crc_force_table = on;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_crc32c
+// Description  : Continue a CRC32C over a buffer
+//
+// Inputs       : buf - the bytes
+//                size - how many
+//                crc - CRC of the bytes before, 0 to start
+// Outputs      : CRC of everything so far
+
+uint32_t cart_crc32c(const void *buf, uint32_t size, uint32_t crc) {
+	crc = ~crc;
+#ifdef CRC_HAVE_SSE42
+	if(cart_crc_hardware()) {
+		return (~crc_hw_update(buf, size, crc));
+	}
+#endif
+	return (~crc_table_update(buf, size, crc));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cartCrcUnitTest
+// Description  : Run a UNIT test checking the checksum, the known value
+//                comes out and both ways agree on every length and split
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int cartCrcUnitTest(void) {
+	unsigned char buf[1024 + 7];
+	uint32_t table = 0, fast = 0, split = 0, size = 0, cut = 0;
+	int saved = crc_force_table;
+
+	//the check value from the CRC catalogue
+	if(cart_crc32c("123456789", 9, 0) != 0xe3069283) {
+		logMessage(LOG_ERROR_LEVEL, "CRC unit test: check value is %08x", cart_crc32c("123456789", 9, 0));
+		return (-1);
+	}
+
+	for(int i = 0; i < 1000; i++) {
+		size = rand() % 1025;
+		cut = (size > 0) ? rand() % size : 0;
+		for(uint32_t j = 0; j < sizeof(buf); j++) {
+			buf[j] = (unsigned char) rand();
+		}
+
+		//unaligned starts, the table, the fastest way and a split buffer agree
+		cart_crc_force_table(1);
+		table = cart_crc32c(&buf[i % 8], size, 0);
+		cart_crc_force_table(0);
+		fast = cart_crc32c(&buf[i % 8], size, 0);
+		split = cart_crc32c(&buf[i % 8 + cut], size - cut, cart_crc32c(&buf[i % 8], cut, 0));
+		if(table != fast || table != split) {
+			logMessage(LOG_ERROR_LEVEL, "CRC unit test: %u bytes gave %08x, %08x and %08x", size, table, fast, split);
+			cart_crc_force_table(saved);
+			return (-1);
+		}
+
+		//a flipped bit is always caught
+		if(size > 0) {
+			buf[i % 8 + rand() % size] ^= 1 << (rand() % 8);
+			if(cart_crc32c(&buf[i % 8], size, 0) == fast) {
+				logMessage(LOG_ERROR_LEVEL, "CRC unit test: a flipped bit in %u bytes was missed", size);
+				cart_crc_force_table(saved);
+				return (-1);
+			}
+		}
+	}
+	cart_crc_force_table(saved);
+
+	logMessage(LOG_OUTPUT_LEVEL, "CRC unit test completed successfully (%s).", cart_crc_hardware() ? "sse4.2" : "table");
+	return (0);
+}
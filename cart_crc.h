@@ -0,0 +1,35 @@
+#ifndef CART_CRC_INCLUDED
+#define CART_CRC_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : cart_crc.h
+//  Description    : This is the header file for the CRC32C checksum the CART
+//                   driver keeps for every data frame.
+//
+//  Author         : [**Jason Ling**]
+//  Last Modified  : [**December 3, 2016**]
+//
+
+// Includes
+#include <stdint.h>
+
+//
+// Interface functions
+
+uint32_t cart_crc32c(const void *buf, uint32_t size, uint32_t crc);
+	// Continue a CRC32C over a buffer, start with crc 0
+
+int cart_crc_hardware(void);
+	// Tell if the processor computes the CRC, 0 if the table is used
+
+void cart_crc_force_table(int on);
+	// Use the table even when the processor could do it, for measuring
+
+//
+// Unit test
+
+int cartCrcUnitTest(void);
+	// Run a UNIT test checking the checksum
+
+#endif
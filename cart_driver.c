@@ -12,12 +12,17 @@
 #include <stdlib.h>
 #include <cmpsc311_log.h>
 #include <string.h>
+#include <sys/time.h>
+#include <time.h>
 
 // Project Includes
 #include <cart_driver.h>
 #include <cart_controller.h>
 #include <cart_cache.h>
+#include <cart_compress.h>
+#include <cart_crc.h>
 #include <cart_network.h>
+#include <cmpsc311_util.h>
 //
 // Implementation
 
@@ -25,36 +30,351 @@ typedef int bool;
 #define true 1
 #define false 0
 
-//Data structure that will have information about the cart and frame
-struct Table {
-	int16_t handle;
-	uint32_t bytesUsed; //number of bytes used in frame
-	CartXferRegister frame_num;
-	CartXferRegister cart_num;
-	struct Table *nextFrame;
+//Number of frames across all of the cartridges
+#define CART_TOTAL_FRAMES (CART_MAX_CARTRIDGES*CART_CARTRIDGE_SIZE)
+
+//Global frame numbers are stored in 16 bits, cart = frame / CART_CARTRIDGE_SIZE
+#define FRAME_CART(f) ((CartridgeIndex) ((f) / CART_CARTRIDGE_SIZE))
+#define FRAME_NUM(f) ((CartFrameIndex) ((f) % CART_CARTRIDGE_SIZE))
+#define GLOBAL_FRAME(c, f) ((uint16_t) ((c) * CART_CARTRIDGE_SIZE + (f)))
+
+//Frame map entry of a block that was never written, it reads as zeros. It is
+//the last frame of the journal ring, frame maps and the dedup chains only name
+//data frames so it is never taken for one of theirs
+#define FRAME_HOLE ((uint16_t) 0xffff)
+
+//The last cartridge holds the filesystem metadata, the rest hold file data
+#define CART_META_CARTRIDGES 1
+#define CART_DATA_CARTRIDGES (CART_MAX_CARTRIDGES - CART_META_CARTRIDGES)
+#define META_FRAME(m) ((uint16_t) (CART_DATA_CARTRIDGES * CART_CARTRIDGE_SIZE + (m)))
+
+//A file frame is a hole or a frame of a data cartridge
+#define FILE_FRAME_OK(f) ((f) == FRAME_HOLE || (f) < META_FRAME(0))
+
+//Most file entries, and most blocks a file of 32 bit length has, an index or a
+//block past them in the metadata means it is damaged
+#define CART_MAX_FILE_ENTRIES ((uint32_t) 1 << 24)
+#define CART_MAX_FILE_BLOCKS ((uint32_t) (((uint64_t) UINT32_MAX + 1) / CART_FRAME_SIZE))
+
+//Layout of the metadata frames: superblock, two checkpoint areas, journal ring,
+//a checkpoint area lists the data frames the checkpoint was written to
+#define META_SUPERBLOCK 0
+#define META_CKPT_FRAMES 132
+#define META_CKPT_START(area) (1 + (area) * META_CKPT_FRAMES)
+#define META_JOURNAL_START (1 + 2 * META_CKPT_FRAMES)
+#define META_JOURNAL_FRAMES (CART_CARTRIDGE_SIZE - META_JOURNAL_START)
+#define CART_FS_MAGIC 0x0035534654524143ULL //"CARTFS5"
+#define CART_JOURNAL_MAGIC 0x4c4e524a //"JRNL"
+
+//frames the defragmenter reads before writing them to their new cartridge
+#define DEFRAG_BATCH 64
+
+//blocks of a long read fetched at a time, one cartridge after another
+#define READ_BATCH 64
+
+//frames handed to the client as one batch of requests
+#define BUS_BATCH 64
+
+//longest last block of a file packed into a shared frame when it is closed
+#define TAIL_PACK_MAX (CART_FRAME_SIZE / 2)
+
+//Place of a compressed block in its shared frame, offset << 16 | compressed
+//size, a block that runs past the end of the frame goes on in the next frame
+#define SLOT(offset, bytes) (((uint32_t) (offset) << 16) | (bytes))
+#define SLOT_OFFSET(s) ((uint16_t) ((s) >> 16))
+#define SLOT_BYTES(s) ((uint16_t) ((s) & 0xffff))
+#define BLOCK_PACKED(file, b) ((file)->slots != NULL && (file)->slots[b] != 0)
+
+//blocks that do not compress below this keep a frame of their own
+#define PACK_MAX_BYTES (CART_FRAME_SIZE - CART_FRAME_SIZE / 8)
+
+//most compressed blocks waiting in the pack frame, a block takes at least 8 bytes
+#define PACK_MAX_BLOCKS (CART_FRAME_SIZE / 8 + 1)
+
+//pending entry of the pack frame for a block that was stored again since
+#define PACK_CANCELLED 0xffffffff
+
+//Fingerprint index of the deduplicated frames, chained by frame number
+#define DEDUP_BUCKETS (1 << 14)
+#define DEDUP_SIG_SIZE 20 //room generate_md5_signature asks for
+#define FRAME_SHARED(f) (mainStructure.frameShares != NULL && mainStructure.frameShares[f] != 0)
+#define DEDUP_PRIME1 0x9e3779b185ebca87ULL
+#define DEDUP_PRIME2 0xc2b2ae3d27d4eb4fULL
+#define DEDUP_PRIME3 0x165667b19e3779f9ULL
+#define ROTL64(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
+
+//Bits of the frame checksum bitmaps
+#define FRAME_BIT(bits, f) (((bits)[(f) / 64] >> ((f) % 64)) & 1)
+#define SET_FRAME_BIT(bits, f) ((bits)[(f) / 64] |= ((uint64_t) 1) << ((f) % 64))
+#define CLEAR_FRAME_BIT(bits, f) ((bits)[(f) / 64] &= ~(((uint64_t) 1) << ((f) % 64)))
+
+//A frame has a checksum, none does until the checksum table is allocated
+#define FRAME_SUM_KNOWN(f) (sums.known != NULL && FRAME_BIT(sums.known, (f)))
+
+//Journal records, replaying a record sets state so it can be applied twice
+typedef enum {
+	JREC_CREATE = 1, //file index, name length, name
+	JREC_MAP    = 2, //file index, block, global frame
+	JREC_LENGTH = 3, //file index, length
+	JREC_ZEROED = 4, //cartridge
+	JREC_UNLINK = 5, //file index
+	JREC_TRUNCATE = 6, //file index, blocks kept, length
+	JREC_TAIL   = 7, //file index, shared frame of the last block or FRAME_HOLE, offset in it
+	JREC_PACK   = 8, //file index, block, shared frame, slot of the compressed block
+	JREC_CRC    = 9, //global frame, checksum of what was written to it
+} JournalRecordType;
+
+//First frame of the metadata cartridge
+struct SuperBlock {
+	uint64_t magic;
+	uint32_t generation; //bumped by every checkpoint, journal frames carry it
+	uint32_t ckptArea; //checkpoint area holding the current checkpoint
+	uint32_t ckptBytes; //size of the serialized checkpoint
+};
+
+//Start of every journal frame
+struct JournalHeader {
+	uint32_t magic;
+	uint32_t generation;
+	uint32_t index; //position of the frame in the journal ring
+	uint16_t used; //bytes used in the frame, including this header
+	uint16_t unused;
+};
+
+//Journal records waiting to be written to the metadata cartridge
+struct Journal {
+	uint32_t generation;
+	uint32_t ckptArea;
+	uint16_t *ckptFrames; //data frames holding the current checkpoint
+	uint32_t numCkptFrames;
+	bool checkpointing; //records added while writing a checkpoint are in it already
+	uint32_t frame; //journal frame being filled
+	uint16_t used; //bytes used in buf, including the header
+	bool dirty; //buf has records that are not on the cartridge yet
+	char buf[CART_FRAME_SIZE];
 };
 
 //Data structure that will have information of the files
 struct FileStructure{
-	char fileName[1024];
-	bool open; //check if file has been opened
-	bool filled; //used to add file into empty space of data structure
-	int16_t handle;
+	uint32_t nameOffset; //where the file name starts in the name arena
 	uint32_t length;
-	uint32_t location;
-	struct Table *tablePtr;
+	uint16_t *frames; //global frame number of every block of the file, in order, FRAME_HOLE if not written
+	uint32_t *slots; //slot of every block stored compressed in a shared frame, 0 if not, NULL if no block is
+	uint32_t numFrames; //number of blocks in the frame map
+	uint32_t capFrames; //number of blocks the frame map has room for
+	uint16_t tailFrame; //shared frame holding the last block when it is packed, FRAME_HOLE if not
+	uint16_t tailOffset; //where the last block starts in the shared frame
+	uint16_t open; //number of handles open on the file
+	uint16_t buffered; //handles holding writes to the file that are not on the cartridge yet
+	uint8_t filled; //used to add file into empty space of data structure
+};
+
+//Small writes to a block gathered by a handle before the frame is written,
+//the metadata for them is only logged once the frame is on the cartridge
+struct WriteBuffer {
+	uint32_t block; //block of the file the buffer holds
+	bool dirty; //data has writes that are not on the cartridge yet
+	bool fresh; //the frame was allocated for the block, its map record is not logged yet
+	bool grew; //the file grew, its new length is not logged yet
+	bool partial; //the frame was not read, only the bytes [from, to) of data are known
+	uint16_t from; //first byte written to a partial block
+	uint16_t to; //end of the bytes written to a partial block
+	char data[CART_FRAME_SIZE]; //contents of the whole block
+};
+
+//State of an open file, the handle is the index in the open table
+struct OpenFile {
+	uint32_t file; //index of the file, or of the next free handle when not used
+	uint32_t location; //where the next read or write starts
+	struct WriteBuffer *wbuf; //allocated by the first small write
+	uint8_t used;
 };
 
 //Our main data structure
 struct CartStructure {
 	bool cart_is_on;
-	struct Table infoTable[CART_MAX_CARTRIDGES][CART_CARTRIDGE_SIZE];
-	struct FileStructure fileTable[CART_MAX_TOTAL_FILES]; //need to initialize all handles to -1
+	bool cart_ready[CART_MAX_CARTRIDGES]; //cartridge zeroed and its frame bits cleared
+	uint32_t files_initialized; //number of fileTable entries initialized since poweron
+	uint64_t frameUsed[CART_TOTAL_FRAMES / 64]; //one bit per frame, set when allocated
+	char *nameArena; //file names, NUL terminated and packed back to back
+	uint32_t arenaUsed;
+	uint32_t arenaSize;
+	uint32_t arenaDead; //bytes of names of unlinked files, reclaimed by compacting
+	uint16_t *pendingFree; //frames released by unlink and truncate, freed once that is committed
+	uint32_t numPending;
+	uint32_t capPending;
+	struct FileStructure *fileTable; //grows as files are created
+	uint32_t fileCap;
+	uint32_t *freeFiles; //entries of unlinked files, reused by creates
+	uint32_t numFreeFiles;
+	uint32_t capFreeFiles;
+	uint32_t *nameHash; //file index + 1 by hash of the name, 0 if empty
+	uint32_t hashCap; //power of two, at least twice the number of files
+	uint32_t numNames;
+	struct OpenFile *openTable; //grows as files are opened
+	uint32_t openCap;
+	int32_t freeHandle; //first unused handle, -1 if every entry is used
+	uint32_t numDirty; //handles with a dirty write buffer
+	uint16_t *tailLive[CART_MAX_CARTRIDGES]; //bytes of packed last blocks and compressed blocks in each frame, allocated per cartridge
+	int32_t tailOpen; //shared frame new last blocks are added to, -1 if none
+	uint16_t tailEnd; //bytes handed out in the open shared frame
+	uint32_t numTailFrames;
+	uint32_t *frameShares; //blocks pointing at every frame besides the first, NULL until a frame is shared
+	uint32_t numSharedFrames;
 };
 
 //Global structure
 struct CartStructure mainStructure;
 
+//Metadata journal
+struct Journal journal;
+
+//Bus operations issued by the driver since poweron, by opcode
+uint64_t bus_ops[CART_OP_MAXVAL];
+
+//Partial frame writes issued since poweron and the bytes they carried
+uint64_t bus_parts = 0;
+uint64_t bus_part_bytes = 0;
+
+//Frames being dropped from the cache, one bit per global frame
+uint64_t frameMarked[CART_TOTAL_FRAMES / 64];
+
+//Cartridge loaded in the controller of every shard, CART_NO_CARTRIDGE if not known
+CartridgeIndex loaded_cart[CART_MAX_SHARDS] = {[0 ... CART_MAX_SHARDS - 1] = CART_NO_CARTRIDGE};
+
+//State of the incremental defragmenter
+struct Defrag {
+	uint32_t budget; //frames moved after every read or write, 0 when off
+	int64_t file; //file being moved, -1 if none
+	uint32_t block; //next block of the file to look at
+	uint32_t segment_end; //end of the run of blocks being gathered on target
+	int32_t target; //cartridge the run is gathered on, -1 to skip the run
+	uint32_t next_file; //where to start looking for the next fragmented file
+	bool clean; //no file was fragmented at the last look
+	uint64_t moved; //frames moved since poweron
+	bool skipped; //a fragmented file was passed over because it had buffered writes
+} defrag = {0, -1, 0, 0, -1, 0, false, 0, false};
+
+//Frames read by the defragmenter and waiting to be written to their new cartridge
+struct DefragBatch {
+	uint32_t file; //file the frames belong to
+	CartridgeIndex target; //cartridge the frames are going to
+	int count; //frames in the batch
+	uint32_t block[DEFRAG_BATCH]; //block of the file of each frame
+	uint16_t old[DEFRAG_BATCH]; //frame each block is moved from
+	bool cached[DEFRAG_BATCH]; //the contents came from the cache, the rest are read at commit
+	char (*data)[CART_FRAME_SIZE]; //contents of the frames, NULL until the first frame is moved
+} batch;
+
+//Longest last block packed into a shared frame at close, 0 when off
+uint32_t tail_pack_max = TAIL_PACK_MAX;
+
+//Blocks are compressed into shared frames when they are written
+bool compress_blocks = false;
+
+//Cartridges the blocks of a file are spread over round-robin, 1 when off
+uint32_t stripe_width = 1;
+
+//Small writes to a block that is not cached send only their bytes instead
+//of reading the frame first, when the server takes partial frame writes
+bool partial_writes = true;
+
+//Frames of a long read fetched in cartridge order, only used by that read
+struct ReadBatch {
+	uint32_t first; //first block of the batch
+	uint32_t count; //blocks the batch covers, 0 when empty
+	bool fetched[READ_BATCH]; //the frame of the block was read into the batch
+	char (*data)[CART_FRAME_SIZE]; //contents of the frames, NULL until a long read
+} fetch;
+
+//Compressed block added to the pack frame, logged once the frame is written
+struct PackedBlock {
+	uint32_t file; //index of the file, PACK_CANCELLED once the block was stored again
+	uint32_t block; //block of the file
+	uint16_t frame; //shared frame the block starts in
+	uint32_t slot; //where the block is in the frame
+	uint16_t oldFrame; //where the block was before, let go once the new place is logged
+	uint32_t oldSlot; //slot of the old place, 0 if it was a frame of its own
+};
+
+//Shared frame compressed blocks are added to, kept in memory so it is
+//written once it is full instead of once for every block
+struct PackFrame {
+	int32_t frame; //frame being filled, -1 if none
+	uint16_t end; //bytes handed out in it
+	int count; //blocks not logged yet
+	struct PackedBlock blocks[PACK_MAX_BLOCKS];
+	char data[CART_FRAME_SIZE]; //contents of the frame
+} pack = {-1, 0, 0};
+
+//How written blocks are deduplicated, one of the CART_DEDUP modes
+uint32_t dedup_mode = CART_DEDUP_OFF;
+
+//Frames written or read with dedup on, by fingerprint, so a block holding
+//the same bytes as one of them points at it instead of being written
+struct DedupIndex {
+	uint16_t *heads; //first frame of every bucket, FRAME_HOLE if empty, NULL until dedup is used
+	uint16_t *next; //next frame in the bucket of every frame
+	uint64_t *prints; //fingerprint of every frame in the index
+	char *sigs; //MD5 signature of every frame in the index when verifying
+	uint64_t indexed[CART_TOTAL_FRAMES / 64]; //one bit per frame in the index
+	uint32_t count; //frames in the index
+	uint64_t blocks; //blocks fingerprinted since poweron
+	uint64_t duplicates; //blocks stored by pointing at a frame
+	uint64_t nsec; //time spent computing fingerprints
+} dedup;
+
+//CRC32C of every data frame, written with the frame and checked every time
+//it is read from the bus, frames found in the cache are not checked again
+struct FrameChecksums {
+	bool on; //checksums are computed and checked
+	uint32_t *crcs; //checksum of every frame that has one, NULL until a frame has one
+	uint64_t *known; //frames with a checksum, the bitmaps are allocated with crcs
+	uint64_t *saved; //frames with a checksum in the checkpoint
+	uint64_t *journaled; //frames written since the checkpoint with a record of that
+	uint64_t *unsettled; //replayed frames a crash may have left newer than their record
+	uint64_t computed; //frames checksummed as they were written since poweron
+	uint64_t verified; //frames checked as they were read
+	uint64_t retried; //frames read again after a mismatch
+	uint64_t failed; //frames still wrong the second time
+	uint64_t adopted; //unsettled frames taken as they are
+	uint64_t nsec; //time spent computing checksums
+} sums = {true};
+
+//
+// Functional Prototypes
+
+int journal_append(JournalRecordType type, void *data, int size);
+	// Add a record to the metadata journal
+
+int journal_map(uint32_t index, uint32_t block, uint16_t frame);
+	// Add a record of the frame of a block of a file to the journal
+
+int journal_length(uint32_t index, uint32_t length);
+	// Add a record of the length of a file to the journal
+
+int journal_flush(void);
+	// Write the journal frame being filled to the metadata cartridge
+
+int store_block(uint32_t index, uint32_t block, char *data, bool fresh);
+	// Write the whole contents of a block, deduplicated or compressed when those are on
+
+int read_packed_block(struct FileStructure *file, uint32_t block, char *buf);
+	// Get the contents of a block stored compressed
+
+int drop_slot(uint16_t frame, uint32_t slot);
+	// Take a compressed block out of the shared frames it is in
+
+int flush_pack_frame(void);
+	// Write the frame compressed blocks are being added to and log them
+
+int dedup_forget(uint16_t frame);
+	// Take a frame about to be written over out of the dedup index
+
+//Time the cart was powered on, used to report time to first I/O
+struct timeval poweron_time;
+bool first_io_done = false;
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : create_cart_opcode
@@ -122,580 +442,5380 @@ int extract_cart_opcode(CartXferRegister resp, CartXferRegister *ky1, CartXferRe
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : cart_poweron
-// Description  : Startup up the CART interface, initialize filesystem
+// Function     : driver_bus_request
+// Description  : Send an operation to the controller and count it
 //
-// Inputs       : none
+// Inputs       : op - the opcode
+//                cart - cartridge register
+//                frm - frame register
+//                buf - frame buffer for RDFRME/WRFRME, NULL otherwise
 // Outputs      : 0 if successful, -1 if failure
 
-int32_t cart_poweron(void) {
- 	//initialize cart
- 	init_cart_cache();
-
- 	//check if the cart is on already
- 	if(mainStructure.cart_is_on == true) {
- 		return (-1);
- 	}
- 	//if it is not on, power it on already
- 	else {
- 		//initialize data structure
- 		for(int i = 0; i < CART_MAX_TOTAL_FILES; i++) {
- 			strncpy(mainStructure.fileTable[i].fileName," ", CART_MAX_PATH_LENGTH);
- 			mainStructure.fileTable[i].open = false;
- 			mainStructure.fileTable[i].filled = false;
- 			mainStructure.fileTable[i].handle = -1;
- 			mainStructure.fileTable[i].length = 0;
- 			mainStructure.fileTable[i].tablePtr = NULL;
- 			mainStructure.fileTable[i].location = 0;
- 		}
- 		//initialize the file structure
- 		for(int i = 0; i < CART_MAX_CARTRIDGES; i++) {
- 			for(int j = 0; j <CART_CARTRIDGE_SIZE; j++) {
- 				mainStructure.infoTable[i][j].handle = -1;
- 				mainStructure.infoTable[i][j].bytesUsed = 0; 
- 				mainStructure.infoTable[i][j].cart_num = i;
- 				mainStructure.infoTable[i][j].frame_num = j;
- 				mainStructure.infoTable[i][j].nextFrame = NULL;
- 			}
- 		}
-
- 		//turn on the cart structure
- 		mainStructure.cart_is_on = true;
+int driver_bus_request(CartOpCodes op, CartridgeIndex cart, CartFrameIndex frm, void *buf) {
+	CartXferRegister resp = 0;
 
- 		//power on the cart
-		//poweron_opcode = create_cart_opcode(CART_OP_INITMS, 0, 0, 0, 0);
-		client_cart_bus_request(create_cart_opcode(CART_OP_INITMS, 0, 0, 0, 0), NULL);
+	bus_ops[op]++;
+	resp = client_cart_bus_request(create_cart_opcode(op, 0, 0, cart, frm), buf);
 
-		//load all the carts and zero it as we load
-		for(int i = 0; i < CART_MAX_CARTRIDGES; i++) {
-			client_cart_bus_request(create_cart_opcode(CART_OP_LDCART, 0, 0, i, 0), NULL);
-			client_cart_bus_request(create_cart_opcode(CART_OP_BZERO, 0, 0, 0 ,0), NULL);
-		}
+	//the return bit is set when the operation failed
+	if((resp >> 47) & 1) {
+		return (-1);
 	}
 
-	// Return successfully
-	return(0);
+	return (0);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : cart_poweroff
-// Description  : Shut down the CART interface, close all files
+// Function     : load_cartridge
+// Description  : Load a cartridge unless it is the one already loaded in
+//                the controller of its shard
 //
-// Inputs       : none
+// Inputs       : cart - the cartridge to load
 // Outputs      : 0 if successful, -1 if failure
 
-int32_t cart_poweroff(void) {
+int load_cartridge(CartridgeIndex cart) {
+	int shard = client_cart_shard(cart);
 
-	//close the cache
-	close_cart_cache();
+	if(loaded_cart[shard] == cart) {
+		return (0);
+	}
 
-	//fail if the cart is not open
-	if(mainStructure.cart_is_on == false) {
+	if(driver_bus_request(CART_OP_LDCART, cart, 0, NULL) == -1) {
+		loaded_cart[shard] = CART_NO_CARTRIDGE;
 		return (-1);
 	}
-	//power off the cart
-	else {
-		//power off the cart
-		CartXferRegister poweroff_opcode = create_cart_opcode(CART_OP_POWOFF, 0, 0, 0 ,0);
-		client_cart_bus_request(poweroff_opcode, NULL);
+	loaded_cart[shard] = cart;
 
-		//close the cart structure
-		mainStructure.cart_is_on = false;
+	return (0);
+}
 
-		//clear the cart table
-		for(int i = 0; i < CART_MAX_TOTAL_FILES; i++) {
- 			strncpy(mainStructure.fileTable[i].fileName," ", CART_MAX_PATH_LENGTH) ;
- 			mainStructure.fileTable[i].open = false;
- 			mainStructure.fileTable[i].filled = false;
- 			mainStructure.fileTable[i].handle = -1;
- 			mainStructure.fileTable[i].length = 0;
- 			mainStructure.fileTable[i].tablePtr = NULL;
- 			mainStructure.fileTable[i].location = 0;
- 		}
-
- 		//clear the file table
- 		for(int i = 0; i < CART_MAX_CARTRIDGES; i++) {
- 			for(int j = 0; j <CART_CARTRIDGE_SIZE; j++) {
- 				mainStructure.infoTable[i][j].handle = -1;
- 				mainStructure.infoTable[i][j].bytesUsed = 0; 
- 				mainStructure.infoTable[i][j].cart_num = i;
- 				mainStructure.infoTable[i][j].frame_num = j;
- 				mainStructure.infoTable[i][j].nextFrame = NULL;
- 			}
- 		}
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : forget_loaded_carts
+// Description  : Forget the cartridges loaded in the controllers, the next
+//                use of each cartridge loads it
+//
+// Inputs       : none
+// Outputs      : 0 if successful
 
+int forget_loaded_carts(void) {
+	for(int s = 0; s < CART_MAX_SHARDS; s++) {
+		loaded_cart[s] = CART_NO_CARTRIDGE;
 	}
 
-	// Return successfully
-	return(0);
+	return (0);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : cart_open
-// Description  : This function opens the file and returns a file handle
+// Function     : sums_release
+// Description  : Free the checksum table, no frame has a checksum after this
 //
-// Inputs       : path - filename of the file to open
-// Outputs      : file handle if successful, -1 if failure
-
-int16_t cart_open(char *path) {
-
-	bool exists = false;
-	int16_t counter = 0;
-	char *name = path;
-	int length_of_path = strlen(path);
-
-	for(int i = 0; i < CART_MAX_TOTAL_FILES; i++) {
-		//check if the file exists and is open already
-		if(strncmp(mainStructure.fileTable[i].fileName, name, length_of_path) == 0 && mainStructure.fileTable[i].open == true) {
-			exists = true;
-			return (-1);
-		}
-		//check if the file exists and not opened
-		if(strncmp(mainStructure.fileTable[i].fileName, name, length_of_path) == 0 && mainStructure.fileTable[i].open == false) {
-			mainStructure.fileTable[i].open = true;
-			mainStructure.fileTable[i].location = 0;
-			exists = true;
-			return (i);
-		}
-	}
+// Inputs       : none
+// Outputs      : 0 if successful
 
-	//if file doesn't exist, then create it in an empty spot
-	if (exists == false) {
-		while(exists == false) {
-			if(mainStructure.fileTable[counter].filled == false) {
-				mainStructure.fileTable[counter].handle = counter;
-				strncpy(mainStructure.fileTable[counter].fileName, name, length_of_path);
-				mainStructure.fileTable[counter].open = true;
-				mainStructure.fileTable[counter].length = 0;
-				mainStructure.fileTable[counter].filled = true;
-				mainStructure.fileTable[counter].location = 0;
-				//mainStructure.fileTable[counter].tablePtr = malloc(sizeof(struct Table)*1024);
-				exists = true;
-				break;
-			}
-			counter++;
-		}
-	}
+int sums_release(void) {
+	free(sums.crcs);
+	free(sums.known);
+	sums.crcs = NULL;
+	sums.known = NULL;
+	sums.saved = NULL;
+	sums.journaled = NULL;
+	sums.unsettled = NULL;
 
-	//return handle
-	return (counter);
+	return (0);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : cart_close
-// Description  : This function closes the file
+// Function     : sums_alloc
+// Description  : Allocate the checksum table and its bitmaps the first time a
+//                frame gets a checksum
 //
-// Inputs       : fd - the file descriptor
+// Inputs       : none
 // Outputs      : 0 if successful, -1 if failure
 
-int16_t cart_close(int16_t fd) {
-	bool handle_is_valid = false;
-	int index_of_file = 0;
-
-	//check if file handle is valid
-	for(int i = 0; i < CART_MAX_TOTAL_FILES; i++) {
-		//handle exists so break loop
-		if(mainStructure.fileTable[i].handle == fd) {
-			handle_is_valid = true;
-			index_of_file = i;
-			break;
-		}
-	}
-	//fail if handle is not valid
-	if (handle_is_valid == false) {
-		return(-1);
-	}
-	//fail if file not open
-	else if (mainStructure.fileTable[index_of_file].open == false) {
-		return(-1);
+int sums_alloc(void) {
+	if(sums.crcs != NULL) {
+		return (0);
 	}
-	//close the file
-	else {
-		mainStructure.fileTable[index_of_file].open = false;
+
+	sums.crcs = malloc(CART_TOTAL_FRAMES * sizeof(uint32_t));
+	sums.known = calloc(4 * (CART_TOTAL_FRAMES / 64), sizeof(uint64_t));
+	if(sums.crcs == NULL || sums.known == NULL) {
+		sums_release();
+		return (-1);
 	}
+	sums.saved = &sums.known[CART_TOTAL_FRAMES / 64];
+	sums.journaled = &sums.known[2 * (CART_TOTAL_FRAMES / 64)];
+	sums.unsettled = &sums.known[3 * (CART_TOTAL_FRAMES / 64)];
 
-	// Return successfully
 	return (0);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : cart_read
-// Description  : Reads "count" bytes from the file handle "fh" into the 
-//                buffer "buf"
+// Function     : checksum_frame
+// Description  : Compute the CRC32C of the contents of a frame and time it
 //
-// Inputs       : fd - filename of the file to read from
-//                buf - pointer to buffer to read into
-//                count - number of bytes to read
-// Outputs      : bytes read if successful, -1 if failure
+// Inputs       : buf - contents of the frame
+// Outputs      : the checksum
 
-int32_t cart_read(int16_t fd, void *buf, int32_t count) {
+uint32_t checksum_frame(void *buf) {
+	struct timespec start, end;
+	uint32_t crc = 0;
 
-	bool handle_is_valid = false;
-	int index_of_file = 0;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	crc = cart_crc32c(buf, CART_FRAME_SIZE, 0);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	sums.nsec += (end.tv_sec - start.tv_sec) * 1000000000LL + (end.tv_nsec - start.tv_nsec);
 
-	//check if file handle is valid
-	for(int i = 0; i < CART_MAX_TOTAL_FILES; i++) {
-		//handle exists so break loop
-		if(mainStructure.fileTable[i].handle == fd) {
-			handle_is_valid = true;
-			index_of_file = i;
-			break;
-		}
-	}
-	//if handle is not valid, fail
-	if(handle_is_valid == false) {
-		return (-1);
-	}
+	return (crc);
+}
 
-	//opcodes used for reading
-	CartXferRegister ky1 = 0;
-	CartXferRegister ky2 = 0;
-	CartXferRegister rt1 = 0;
-	CartXferRegister ct1 = 0;
-	CartXferRegister fm1 = 0;
-	CartXferRegister action_code = 0;
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : verify_frame
+// Description  : Check a frame just read from the bus against its checksum,
+//                reading it once more if it does not match in case the
+//                transfer was damaged
+//
+// Inputs       : frame - global frame number
+//                buf - contents read
+// Outputs      : 0 if the contents are good, -1 if not
 
-	//define variables
-	int counter = 0;
-	int32_t start_read_frame = (mainStructure.fileTable[index_of_file].location)/ 1024; //what frame i start to read from
-	int32_t start_read_bit = (mainStructure.fileTable[index_of_file].location % 1024); //where i wanna start reading in frame
-	int32_t bytes_left_to_read = count; //keep track of how many bytes to read
-	int32_t bytes_reading_now = 0; //keep track of the amount of bytes to read per iteration
-	int start_buf_read_bit = 0; //keep track of what is currently read from the buffer
-	char tempbuf[1024]; //temporary buffer for calculations
-	char *cachebuf = NULL; //buffer used to check cache
-	struct Table *tempPtr = mainStructure.fileTable[index_of_file].tablePtr; //pointer used to point to first frame of the file
-	int bytes_read_already = 0; //keep track of the amount of bytes read already
+int verify_frame(uint16_t frame, void *buf) {
+	uint32_t crc = checksum_frame(buf);
 
-	//if reading past end of the file, read until the end of the file
-	if(count + mainStructure.fileTable[index_of_file].location > mainStructure.fileTable[index_of_file].length) {
-		bytes_left_to_read = mainStructure.fileTable[index_of_file].length - mainStructure.fileTable[index_of_file].location;
-		count = bytes_left_to_read;
+	sums.verified++;
+	if(crc == sums.crcs[frame]) {
+		CLEAR_FRAME_BIT(sums.unsettled, frame);
+		return (0);
 	}
 
-	//point to frame that is being read
-	while(counter != start_read_frame) {
-		tempPtr = tempPtr->nextFrame;
-		counter++;
+	//the frame was written after the checkpoint and before a crash, the
+	//checksum of what it holds now was never saved
+	if(FRAME_BIT(sums.unsettled, frame)) {
+		logMessage(LOG_INFO_LEVEL, "CART driver frame %u was written before the crash, taking its checksum", frame);
+		sums.crcs[frame] = crc;
+		CLEAR_FRAME_BIT(sums.unsettled, frame);
+		sums.adopted++;
+		return (0);
 	}
 
-	//begin reading
-	while(bytes_left_to_read > 0) {
-		//check how many bytes left to read
-		if (start_read_bit + bytes_left_to_read > 1024) {
-			bytes_reading_now = (1024 - start_read_bit);
-		}
-		else {
-			bytes_reading_now = bytes_left_to_read;
-		}
+	sums.retried++;
+	if(load_cartridge(FRAME_CART(frame)) == 0 && driver_bus_request(CART_OP_RDFRME, FRAME_CART(frame), FRAME_NUM(frame), buf) == 0 &&
+			checksum_frame(buf) == sums.crcs[frame]) {
+		return (0);
+	}
 
-		//used to check if the frame is already in the cache
-		cachebuf = get_cart_cache(tempPtr->cart_num, tempPtr->frame_num);
+	sums.failed++;
+	logMessage(LOG_ERROR_LEVEL, "CART driver frame %u of cartridge %u does not match its checksum (%08x, %08x)",
+		FRAME_NUM(frame), FRAME_CART(frame), crc, sums.crcs[frame]);
+	return (-1);
+}
 
-		//if the frame is in the cache, just read it into the buffer
-		if(cachebuf != NULL) {
-			memcpy(&((char *)buf)[start_buf_read_bit], &cachebuf[start_read_bit], bytes_reading_now);
-		}
-		//if the frame is not in the cache, go into memory
-		else {
-			//load the cart
-			ky1 = CART_OP_LDCART;
-			ct1 = tempPtr->cart_num;
-			action_code = create_cart_opcode(ky1, ky2, rt1, ct1, fm1);
-			client_cart_bus_request(action_code, NULL);
-			extract_cart_opcode(action_code, &ky1, &ky2, &rt1, &ct1, &fm1);
-
-			//read frame into temp buffer
-			ky1 = CART_OP_RDFRME;
-			fm1 = tempPtr->frame_num;
-			action_code = create_cart_opcode(ky1, ky2, rt1, ct1, fm1);
-			client_cart_bus_request(action_code, tempbuf); // buf = frame
-			extract_cart_opcode(action_code, &ky1, &ky2, &rt1, &ct1, &fm1);
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : read_frame_from_bus
+// Description  : Load the cartridge holding a frame and read the frame, a
+//                data frame with a checksum is checked
+//
+// Inputs       : frame - global frame number of the frame to read
+//                buf - buffer to read the frame into
+// Outputs      : 0 if successful, -1 if failure
 
-			//read into buf
-			memcpy(&((char *)buf)[start_buf_read_bit], &tempbuf[start_read_bit], bytes_reading_now);
-		}
-		
-		//update variables 
-		start_buf_read_bit += bytes_reading_now;
-		mainStructure.fileTable[index_of_file].location += bytes_reading_now;
-		bytes_read_already = start_read_bit + bytes_reading_now;
-		bytes_left_to_read -= bytes_reading_now;
-		start_read_bit = 0;
+int read_frame_from_bus(uint16_t frame, void *buf) {
+	if(load_cartridge(FRAME_CART(frame)) == -1) {
+		return (-1);
+	}
 
-		//if I reading more than one frame, go to the next frame
-		if(bytes_read_already == 1024 && bytes_left_to_read > 0) {
-			tempPtr = tempPtr->nextFrame;
-		}
+	if(driver_bus_request(CART_OP_RDFRME, FRAME_CART(frame), FRAME_NUM(frame), buf) == -1) {
+		return (-1);
 	}
 
-	// Return successfully
-	return (count);
+	if(sums.on == true && FRAME_SUM_KNOWN(frame)) {
+		return (verify_frame(frame, buf));
+	}
+
+	return (0);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : cart_write
-// Description  : Writes "count" bytes to the file handle "fh" from the 
-//                buffer  "buf"
+// Function     : write_frame_to_bus
+// Description  : Load the cartridge holding a frame and write the frame
 //
-// Inputs       : fd - filename of the file to write to
-//                buf - pointer to buffer to write from
-//                count - number of bytes to write
-// Outputs      : bytes written if successful, -1 if failure
+// Inputs       : frame - global frame number of the frame to write
+//                buf - buffer holding the frame
+// Outputs      : 0 if successful, -1 if failure
 
-int32_t cart_write(int16_t fd, void *buf, int32_t count) {
-	//CHECK IF I CAN WRITE BRO BUT LEMME GET THE INDEX OF MY FILE THO
-	bool handle_is_valid = false;
-	bool done = false;
-	int index_of_file = 0;
-
-	for(int i = 0; i < CART_MAX_TOTAL_FILES; i++) {
-		//handle exists so break loop
-		if(mainStructure.fileTable[i].handle == fd) {
-			handle_is_valid = true;
-			index_of_file = i;
-			break;
-		}
-	}
-	//if handle is not valid, fail
-	if(handle_is_valid == false) {
+int write_frame_to_bus(uint16_t frame, void *buf) {
+	if(load_cartridge(FRAME_CART(frame)) == -1) {
 		return (-1);
 	}
-	//check if length is 0, then point to a frame
-	if(mainStructure.fileTable[index_of_file].tablePtr == NULL) {
-		for(CartFrameIndex i = 0; i < CART_MAX_CARTRIDGES; i++) {
-			for(CartridgeIndex j = 0; j < CART_CARTRIDGE_SIZE; j++) {
-				if(mainStructure.infoTable[i][j].handle == -1) {
-					mainStructure.fileTable[index_of_file].tablePtr = &mainStructure.infoTable[i][j];
-					mainStructure.infoTable[i][j].handle = fd;
-					done = true;
-					break;
-				}
+
+	return (driver_bus_request(CART_OP_WRFRME, FRAME_CART(frame), FRAME_NUM(frame), buf));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bus_frames
+// Description  : Read or write a list of frames as batches of requests, so
+//                a pipelined connection has them in flight together. The
+//                cartridge of a frame is loaded ahead of it when it is not
+//                the one loaded on its shard, the frames of a cartridge
+//                should be next to each other. Checksums are left to the
+//                caller
+//
+// Inputs       : op - CART_OP_RDFRME or CART_OP_WRFRME
+//                frames - global frame numbers
+//                bufs - buffer of each frame
+//                count - number of frames
+// Outputs      : 0 if successful, -1 if failure
+
+int bus_frames(CartOpCodes op, uint16_t *frames, void **bufs, uint32_t count) {
+	CartXferRegister regs[2 * BUS_BATCH]; //a load where the cartridge changes and the frames
+	CartXferRegister resps[2 * BUS_BATCH];
+	void *reqbufs[2 * BUS_BATCH];
+	CartridgeIndex cart = 0;
+	int shard = 0;
+	int nregs = 0;
+
+	for(uint32_t i = 0; i < count; i += BUS_BATCH) {
+		nregs = 0;
+		for(uint32_t j = i; j < count && j < i + BUS_BATCH; j++) {
+			cart = FRAME_CART(frames[j]);
+			shard = client_cart_shard(cart);
+			if(loaded_cart[shard] != cart) {
+				bus_ops[CART_OP_LDCART]++;
+				regs[nregs] = create_cart_opcode(CART_OP_LDCART, 0, 0, cart, 0);
+				reqbufs[nregs++] = NULL;
+				loaded_cart[shard] = cart;
 			}
-			//break when found free frame
-			if(done == true) {
-				break;
+			bus_ops[op]++;
+			regs[nregs] = create_cart_opcode(op, 0, 0, cart, FRAME_NUM(frames[j]));
+			reqbufs[nregs++] = bufs[j];
+		}
+
+		//after a failure the cartridges in the controllers are not known
+		if(client_cart_bus_batch(regs, reqbufs, resps, nregs) == -1) {
+			forget_loaded_carts();
+			return (-1);
+		}
+		for(int k = 0; k < nregs; k++) {
+			if((resps[k] >> 47) & 1) {
+				forget_loaded_carts();
+				return (-1);
 			}
 		}
 	}
 
-	//OPCODES
-	CartXferRegister ky1 = 0;
-	CartXferRegister ky2 = 0;
-	CartXferRegister rt1 = 0;
-	CartXferRegister ct1 = 0;
-	CartXferRegister fm1 = 0;
-	CartXferRegister action_code = 0;
+	return (0);
+}
 
-	//START THE REAL WRITING STUFF
-	int start_write_frame = (mainStructure.fileTable[index_of_file].location)/ 1024; //what frame i start to write in
-	int start_write_bit = (mainStructure.fileTable[index_of_file].location % 1024); //where i wanna start writing in frame
-	int32_t bytes_left_to_write = count; //keep track of bytes left to write
-	int bytes_writing_now = 0; //amount of bytes writing per iteration
-	int buf_starting_point = 0;	//starting of memcpy for the buffer that is getting passed
-	char tempbuf[1024]; //temporary buffer for memcpy
-	struct Table *tempPtr = mainStructure.fileTable[index_of_file].tablePtr; //pointer to first frame of the file
-	int32_t counter = 0; //counter used for traversal to start_write_frame
-	char *cachebuf = NULL; //buffer used to check the cache
-	bool done2 = false; //used for linking to a new carts
-	//temporary variables for eviction
-	int temp_low_cart = 0;
-	int temp_low_frame = 0;
-	//traverse to frame to start writing now ima use ptr to write stuff
-	while(counter != start_write_frame) {
-		tempPtr = tempPtr->nextFrame;
-		counter++;
-	}
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bus_frame_run
+// Description  : Read or write a list of frames whose contents sit one after
+//                another in a buffer
+//
+// Inputs       : op - CART_OP_RDFRME or CART_OP_WRFRME
+//                frames - global frame numbers
+//                data - contents of the frames, CART_FRAME_SIZE each
+//                count - number of frames
+// Outputs      : 0 if successful, -1 if failure
 
-	//begin writing
-	while(bytes_left_to_write > 0) {
+int bus_frame_run(CartOpCodes op, uint16_t *frames, char *data, uint32_t count) {
+	void *bufs[BUS_BATCH];
+	uint32_t n = 0;
 
-		//figure out how many bytes im going to write per iteration
-		if (start_write_bit + bytes_left_to_write > 1024) {
-			bytes_writing_now = (1024 - start_write_bit);
+	for(uint32_t i = 0; i < count; i += n) {
+		n = (count - i < BUS_BATCH) ? count - i : BUS_BATCH;
+		for(uint32_t j = 0; j < n; j++) {
+			bufs[j] = &data[(i + j) * CART_FRAME_SIZE];
 		}
-		else if(start_write_bit + bytes_left_to_write == 1024) {
-			bytes_writing_now = bytes_left_to_write;
-		}	
-		else {
-			bytes_writing_now = bytes_left_to_write;
+		if(bus_frames(op, &frames[i], bufs, n) == -1) {
+			return (-1);
 		}
+	}
 
-		//check if that frame is in the cache already
-		cachebuf = get_cart_cache(tempPtr->cart_num, tempPtr->frame_num);
-
-		//condition if the frame is not in the cache
-		if(cachebuf == NULL) {
-			//cache is full and the frame is not there
-			if(get_cache_size() == get_cache_num_occupied()) {	
-
-				//get the cart number and frame number to evict
-				temp_low_cart = get_lowest_time_cart();
-				temp_low_frame = get_lowest_time_frame();
-
-				//get the frame that will be evicted from the cache
-				cachebuf = delete_cart_cache(temp_low_cart, temp_low_frame);
-
-				//put the new frame into a buffer
-				//load the cart
-				ky1 = CART_OP_LDCART;
-				ct1 = tempPtr->cart_num;
-				action_code = create_cart_opcode(ky1, ky2, rt1, ct1, fm1);
-				client_cart_bus_request(action_code, NULL);
-				extract_cart_opcode(action_code, &ky1, &ky2, &rt1, &ct1, &fm1);
-
-				//read the frame
-				ky1 = CART_OP_RDFRME;
-				fm1 = tempPtr->frame_num;
-				action_code = create_cart_opcode(ky1, ky2, rt1, ct1, fm1);
-				client_cart_bus_request(action_code, tempbuf);
-				extract_cart_opcode(action_code, &ky1, &ky2, &rt1, &ct1, &fm1);
-
-				memcpy(&tempbuf[start_write_bit], &((char *)buf)[buf_starting_point], bytes_writing_now);
-
-				//write to the frame
-				ky1 = CART_OP_WRFRME;
-				fm1 = tempPtr->frame_num;
-				action_code = create_cart_opcode(ky1, ky2, rt1, ct1, fm1);
-				client_cart_bus_request(action_code, tempbuf);
-				extract_cart_opcode(action_code, &ky1, &ky2, &rt1, &ct1, &fm1);
-
-				//insert the new frame into the cache
-				put_cart_cache(tempPtr->cart_num, tempPtr->frame_num, tempbuf);
-			}
-			//cache is not full and frame is not there
-			else {
-				//insert new frame into the cache
-				memcpy(&tempbuf[start_write_bit], &((char *)buf)[buf_starting_point], bytes_writing_now);
-
-				//load the cart
-				ky1 = CART_OP_LDCART;
-				ct1 = tempPtr->cart_num;
-				action_code = create_cart_opcode(ky1, ky2, rt1, ct1, fm1);
-				client_cart_bus_request(action_code, NULL);
-				extract_cart_opcode(action_code, &ky1, &ky2, &rt1, &ct1, &fm1);
-
-				//write to the frame
-				ky1 = CART_OP_WRFRME;
-				fm1 = tempPtr->frame_num;
-				action_code = create_cart_opcode(ky1, ky2, rt1, ct1, fm1);
-				client_cart_bus_request(action_code, tempbuf);
-				extract_cart_opcode(action_code, &ky1, &ky2, &rt1, &ct1, &fm1);
-
-				//insert into the cache
-				put_cart_cache(tempPtr->cart_num, tempPtr->frame_num, tempbuf);
+	return (0);
+}
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : journal_checksum
+// Description  : Add the record of the checksum of a frame to the journal
+//
+// Inputs       : frame - global frame number
+//                crc - checksum of its contents
+// Outputs      : 0 if successful, -1 if failure
+
+int journal_checksum(uint16_t frame, uint32_t crc) {
+	char record[6];
+
+	memcpy(&record[0], &frame, sizeof(frame));
+	memcpy(&record[2], &crc, sizeof(crc));
+
+	return (journal_append(JREC_CRC, record, sizeof(record)));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : log_data_frame
+// Description  : Take the checksum of a frame of file data about to be
+//                written. Only the checkpoint holds checksums, so the first
+//                write since the checkpoint of a frame it has a checksum for
+//                is logged: after a crash the frame may be newer than that
+//                checksum. A frame still holding data is logged and
+//                committed before it is written over, a frame being used
+//                again only needs the record ahead of the ones pointing
+//                blocks at it. Records cannot be added while a checkpoint is
+//                written, a crash in the middle of one can leave a frame it
+//                flushed failing its old checksum
+//
+// Inputs       : frame - global frame number of the frame to write
+//                buf - buffer holding the frame
+//                crc - where the checksum goes
+// Outputs      : 0 if successful, -1 if failure
+
+int log_data_frame(uint16_t frame, void *buf, uint32_t *crc) {
+	bool logged = false, ahead = false;
+
+	*crc = 0;
+	if(sums.on == true) {
+		if(sums_alloc() == -1) {
+			return (-1);
+		}
+		*crc = checksum_frame(buf);
+		sums.computed++;
+	}
+
+	//with no table no frame has a checksum in the checkpoint
+	logged = sums.saved != NULL && FRAME_BIT(sums.saved, frame) && FRAME_BIT(sums.journaled, frame) == 0 &&
+		journal.checkpointing == false;
+	if(logged == true) {
+		//with checksums off the frame may hold data without having one
+		ahead = FRAME_BIT(sums.known, frame) || sums.on == false;
+		if(journal_checksum(frame, *crc) == -1 || (ahead == true && journal_flush() == -1)) {
+			return (-1);
+		}
+		SET_FRAME_BIT(sums.journaled, frame);
+	}
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : settle_data_frame
+// Description  : Keep the checksum of a frame of file data once it is written
+//
+// Inputs       : frame - global frame number of the frame written
+//                crc - checksum from log_data_frame
+// Outputs      : 0 if successful
+
+int settle_data_frame(uint16_t frame, uint32_t crc) {
+	//log_data_frame allocated the table if checksums are on
+	if(sums.known == NULL) {
+		return (0);
+	}
+
+	if(sums.on == true) {
+		sums.crcs[frame] = crc;
+		SET_FRAME_BIT(sums.known, frame);
+	}
+	else {
+		CLEAR_FRAME_BIT(sums.known, frame);
+	}
+	CLEAR_FRAME_BIT(sums.unsettled, frame);
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : write_data_frame
+// Description  : Write a frame of file data and keep its checksum
+//
+// Inputs       : frame - global frame number of the frame to write
+//                buf - buffer holding the frame
+// Outputs      : 0 if successful, -1 if failure
+
+int write_data_frame(uint16_t frame, void *buf) {
+	uint32_t crc = 0;
+
+	if(log_data_frame(frame, buf, &crc) == -1 || write_frame_to_bus(frame, buf) == -1) {
+		return (-1);
+	}
+
+	return (settle_data_frame(frame, crc));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : part_write_ok
+// Description  : Check if a block can be written by sending only the bytes
+//                written, without reading its frame. The frame has to be the
+//                block's own and stay where it is, and nothing may need the
+//                whole frame: no checksum, compression or dedup
+//
+// Inputs       : file - the file
+//                block - block of the file
+// Outputs      : true if it can, false if not
+
+bool part_write_ok(struct FileStructure *file, uint32_t block) {
+	uint16_t frame = (block < file->numFrames) ? file->frames[block] : FRAME_HOLE;
+
+	if(partial_writes == false || sums.on == true || compress_blocks == true || dedup_mode != CART_DEDUP_OFF) {
+		return (false);
+	}
+	if(frame == FRAME_HOLE || BLOCK_PACKED(file, block) == true || FRAME_SHARED(frame) == true) {
+		return (false);
+	}
+
+	return (client_cart_partial(FRAME_CART(frame)) == 1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : write_data_part
+// Description  : Write the bytes [from, to) of a frame of file data, the
+//                server puts them over what the frame holds. A cached copy
+//                of the frame would be stale and is dropped
+//
+// Inputs       : frame - global frame number of the frame to write
+//                data - contents of the block, only [from, to) are sent
+//                from - first byte written
+//                to - end of the bytes written
+// Outputs      : 0 if successful, -1 if failure
+
+int write_data_part(uint16_t frame, char *data, uint16_t from, uint16_t to) {
+	char part[CART_PART_HEADER + CART_FRAME_SIZE];
+	CartXferRegister resp = 0;
+	uint32_t crc = 0;
+
+	//the offset goes first, most significant byte first
+	part[0] = (char) (from >> 8);
+	part[1] = (char) (from & 0xff);
+	memcpy(&part[CART_PART_HEADER], &data[from], to - from);
+
+	dedup_forget(frame);
+	if(log_data_frame(frame, data, &crc) == -1) {
+		return (-1);
+	}
+
+	//the cartridge and frame are in the request, nothing has to be loaded
+	bus_parts++;
+	bus_part_bytes += to - from;
+	resp = client_cart_bus_request(create_cart_opcode(CART_OP_WRPART, 0, 0, FRAME_CART(frame), FRAME_NUM(frame)) | (to - from), part);
+	if((resp >> 47) & 1) {
+		return (-1);
+	}
+
+	if(get_cart_cache(FRAME_CART(frame), FRAME_NUM(frame)) != NULL) {
+		delete_cart_cache(FRAME_CART(frame), FRAME_NUM(frame));
+	}
+
+	return (settle_data_frame(frame, crc));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : insert_into_cache
+// Description  : Put a frame in the cache, evicting the least recently used
+//                frame when the cache is full
+//
+// Inputs       : frame - global frame number
+//                buf - contents of the frame
+// Outputs      : 0 if successful
+
+int insert_into_cache(uint16_t frame, void *buf) {
+	//cache is full, evict the least recently used frame
+	if(get_cache_size() == get_cache_num_occupied()) {
+		CartridgeIndex low_cart = get_lowest_time_cart();
+		CartFrameIndex low_frame = get_lowest_time_frame();
+		delete_cart_cache(low_cart, low_frame);
+	}
+
+	return (put_cart_cache(FRAME_CART(frame), FRAME_NUM(frame), buf));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : prepare_cartridge
+// Description  : Zero a cartridge and clear its frame bits the first time a
+//                frame is needed from it after poweron
+//
+// Inputs       : cart - the cartridge to prepare
+// Outputs      : 0 if successful, -1 if failure
+
+int prepare_cartridge(CartridgeIndex cart) {
+	//nothing to do if it was already prepared
+	if(mainStructure.cart_ready[cart] == true) {
+		return (0);
+	}
+
+	//load the cart and zero it, it is not ready until the bus did both
+	if(load_cartridge(cart) == -1 || driver_bus_request(CART_OP_BZERO, cart, 0, NULL) == -1) {
+		return (-1);
+	}
+
+	//mark every frame of the cartridge as free
+	memset(&mainStructure.frameUsed[cart * (CART_CARTRIDGE_SIZE / 64)], 0, CART_CARTRIDGE_SIZE / 8);
+
+	//remember across poweroff that the cartridge is in use, it is zeroed again
+	//later if that cannot be logged
+	if(journal_append(JREC_ZEROED, &cart, sizeof(cart)) == -1) {
+		return (-1);
+	}
+	mainStructure.cart_ready[cart] = true;
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : alloc_frame_in_cart
+// Description  : Find a free frame in a cartridge and mark it as used
+//
+// Inputs       : cart - the cartridge to look in
+// Outputs      : global frame number if successful, -1 if the cart is full
+//                or could not be prepared
+
+int32_t alloc_frame_in_cart(CartridgeIndex cart) {
+	uint64_t *words = NULL;
+
+	if(prepare_cartridge(cart) == -1) {
+		return (-1);
+	}
+
+	//look for a word of the bitmap with a clear bit
+	words = &mainStructure.frameUsed[cart * (CART_CARTRIDGE_SIZE / 64)];
+	for(int j = 0; j < CART_CARTRIDGE_SIZE / 64; j++) {
+		if(words[j] != ~((uint64_t) 0)) {
+			int bit = __builtin_ctzll(~words[j]);
+			words[j] |= ((uint64_t) 1) << bit;
+			return (GLOBAL_FRAME(cart, j * 64 + bit));
+		}
+	}
+
+	return (-1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : alloc_frame
+// Description  : Find a free frame, starting at a given cartridge so that the
+//                frames of a file stay together, and mark it as used
+//
+// Inputs       : start_cart - the cartridge to look in first
+// Outputs      : global frame number if successful, -1 if failure
+
+int32_t alloc_frame(CartridgeIndex start_cart) {
+	int32_t frame = -1;
+
+	for(int i = 0; i < CART_DATA_CARTRIDGES; i++) {
+		frame = alloc_frame_in_cart((start_cart + i) % CART_DATA_CARTRIDGES);
+		if(frame != -1) {
+			return (frame);
+		}
+	}
+
+	//every frame is in use
+	return (-1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : free_frame
+// Description  : Mark a frame as free
+//
+// Inputs       : frame - global frame number
+// Outputs      : 0 if successful
+
+int free_frame(uint16_t frame) {
+	mainStructure.frameUsed[frame / 64] &= ~(((uint64_t) 1) << (frame % 64));
+	if(sums.known != NULL) {
+		CLEAR_FRAME_BIT(sums.known, frame);
+	}
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : free_frames_in_cart
+// Description  : Count the free frames of a cartridge
+//
+// Inputs       : cart - the cartridge
+// Outputs      : number of free frames
+
+int free_frames_in_cart(CartridgeIndex cart) {
+	int used = 0;
+
+	//a cartridge that was never used is all free
+	if(mainStructure.cart_ready[cart] == false) {
+		return (CART_CARTRIDGE_SIZE);
+	}
+
+	for(int j = 0; j < CART_CARTRIDGE_SIZE / 64; j++) {
+		used += __builtin_popcountll(mainStructure.frameUsed[cart * (CART_CARTRIDGE_SIZE / 64) + j]);
+	}
+
+	return (CART_CARTRIDGE_SIZE - used);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : append_frame
+// Description  : Add a frame to the end of the frame map of a file
+//
+// Inputs       : file - the file entry
+//                frame - the global frame number to add
+// Outputs      : 0 if successful, -1 if failure
+
+int append_frame(struct FileStructure *file, uint16_t frame) {
+	uint16_t *grown = NULL;
+	uint32_t *grown_slots = NULL;
+	uint32_t new_cap = 0;
+
+	//double the frame map when it is full
+	if(file->numFrames == file->capFrames) {
+		new_cap = (file->capFrames == 0) ? 8 : file->capFrames * 2;
+		grown = realloc(file->frames, new_cap * sizeof(uint16_t));
+		if(grown == NULL) {
+			return (-1);
+		}
+		file->frames = grown;
+		if(file->slots != NULL) {
+			grown_slots = realloc(file->slots, new_cap * sizeof(uint32_t));
+			if(grown_slots == NULL) {
+				return (-1);
+			}
+			file->slots = grown_slots;
+		}
+		file->capFrames = new_cap;
+	}
+
+	file->frames[file->numFrames] = frame;
+	if(file->slots != NULL) {
+		file->slots[file->numFrames] = 0;
+	}
+	file->numFrames++;
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : compact_names
+// Description  : Copy the names of the files that still exist to a new arena
+//                of the same size, dropping the names of unlinked files
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int compact_names(void) {
+	char *arena = NULL;
+	uint32_t used = 0;
+	uint32_t size = 0;
+	struct FileStructure *file = NULL;
+
+	arena = malloc(mainStructure.arenaSize);
+	if(arena == NULL) {
+		return (-1);
+	}
+
+	for(uint32_t i = 0; i < mainStructure.files_initialized; i++) {
+		file = &mainStructure.fileTable[i];
+		if(file->filled == false) {
+			continue;
+		}
+		size = strlen(&mainStructure.nameArena[file->nameOffset]) + 1;
+		memcpy(&arena[used], &mainStructure.nameArena[file->nameOffset], size);
+		file->nameOffset = used;
+		used += size;
+	}
+
+	free(mainStructure.nameArena);
+	mainStructure.nameArena = arena;
+	mainStructure.arenaUsed = used;
+	mainStructure.arenaDead = 0;
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : add_name
+// Description  : Copy a file name into the name arena
+//
+// Inputs       : name - the file name
+// Outputs      : offset of the name in the arena if successful, -1 if failure
+
+int64_t add_name(char *name) {
+	uint32_t size = strlen(name) + 1;
+	uint32_t new_size = mainStructure.arenaSize;
+	char *grown = NULL;
+	uint32_t offset = 0;
+
+	//make room from the names of unlinked files before growing
+	if(mainStructure.arenaUsed + size > new_size && mainStructure.arenaDead >= mainStructure.arenaUsed / 2) {
+		if(compact_names() == -1) {
+			return (-1);
+		}
+	}
+
+	//grow the arena until the name fits
+	while(mainStructure.arenaUsed + size > new_size) {
+		new_size = (new_size == 0) ? 4096 : new_size * 2;
+	}
+	if(new_size != mainStructure.arenaSize) {
+		grown = realloc(mainStructure.nameArena, new_size);
+		if(grown == NULL) {
+			return (-1);
+		}
+		mainStructure.nameArena = grown;
+		mainStructure.arenaSize = new_size;
+	}
+
+	offset = mainStructure.arenaUsed;
+	memcpy(&mainStructure.nameArena[offset], name, size);
+	mainStructure.arenaUsed += size;
+
+	return (offset);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hash_name
+// Description  : Hash a file name (FNV-1a)
+//
+// Inputs       : name - the file name
+// Outputs      : the hash
+
+uint32_t hash_name(char *name) {
+	uint32_t hash = 2166136261u;
+
+	for(int i = 0; name[i] != 0x0; i++) {
+		hash = (hash ^ (uint8_t) name[i]) * 16777619u;
+	}
+
+	return (hash);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hash_slot
+// Description  : Find the slot of the name hash table holding a name, or the
+//                empty slot where it would go
+//
+// Inputs       : name - the file name
+// Outputs      : index of the slot
+
+uint32_t hash_slot(char *name) {
+	uint32_t mask = mainStructure.hashCap - 1;
+	uint32_t slot = hash_name(name) & mask;
+	uint32_t entry = 0;
+
+	//linear probing, the table is never more than half full
+	while((entry = mainStructure.nameHash[slot]) != 0) {
+		if(strcmp(&mainStructure.nameArena[mainStructure.fileTable[entry - 1].nameOffset], name) == 0) {
+			break;
+		}
+		slot = (slot + 1) & mask;
+	}
+
+	return (slot);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hash_insert
+// Description  : Add a file to the name hash table, doubling it when it
+//                would be more than half full
+//
+// Inputs       : index - index of the file entry, its name is set already
+// Outputs      : 0 if successful, -1 if failure
+
+int hash_insert(uint32_t index) {
+	uint32_t *old = mainStructure.nameHash;
+	uint32_t old_cap = mainStructure.hashCap;
+	uint32_t new_cap = (old_cap == 0) ? 64 : old_cap;
+
+	while((mainStructure.numNames + 1) * 2 > new_cap) {
+		new_cap *= 2;
+	}
+
+	//rehash every name into a bigger table
+	if(new_cap != old_cap) {
+		mainStructure.nameHash = calloc(new_cap, sizeof(uint32_t));
+		if(mainStructure.nameHash == NULL) {
+			mainStructure.nameHash = old;
+			return (-1);
+		}
+		mainStructure.hashCap = new_cap;
+		for(uint32_t i = 0; i < old_cap; i++) {
+			if(old[i] != 0) {
+				mainStructure.nameHash[hash_slot(&mainStructure.nameArena[mainStructure.fileTable[old[i] - 1].nameOffset])] = old[i];
+			}
+		}
+		free(old);
+	}
+
+	mainStructure.nameHash[hash_slot(&mainStructure.nameArena[mainStructure.fileTable[index].nameOffset])] = index + 1;
+	mainStructure.numNames++;
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hash_remove
+// Description  : Take a file out of the name hash table, moving back the
+//                entries after it so that no probe sequence is broken
+//
+// Inputs       : index - index of the file entry, its name is still set
+// Outputs      : 0 if successful, -1 if the file is not in the table
+
+int hash_remove(uint32_t index) {
+	uint32_t mask = mainStructure.hashCap - 1;
+	uint32_t hole = 0;
+	uint32_t slot = 0;
+	uint32_t home = 0;
+
+	if(mainStructure.hashCap == 0) {
+		return (-1);
+	}
+	hole = hash_slot(&mainStructure.nameArena[mainStructure.fileTable[index].nameOffset]);
+	if(mainStructure.nameHash[hole] != index + 1) {
+		return (-1);
+	}
+	mainStructure.nameHash[hole] = 0;
+	mainStructure.numNames--;
+
+	//an entry can move into the hole if the hole is between its home slot and it
+	slot = (hole + 1) & mask;
+	while(mainStructure.nameHash[slot] != 0) {
+		home = hash_name(&mainStructure.nameArena[mainStructure.fileTable[mainStructure.nameHash[slot] - 1].nameOffset]) & mask;
+		if(((slot - home) & mask) >= ((slot - hole) & mask)) {
+			mainStructure.nameHash[hole] = mainStructure.nameHash[slot];
+			mainStructure.nameHash[slot] = 0;
+			hole = slot;
+		}
+		slot = (slot + 1) & mask;
+	}
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lookup_file
+// Description  : Get the index of a file from its name
+//
+// Inputs       : name - the file name
+// Outputs      : index of the file if found, -1 if not
+
+int64_t lookup_file(char *name) {
+	uint32_t entry = 0;
+
+	if(mainStructure.hashCap == 0) {
+		return (-1);
+	}
+	entry = mainStructure.nameHash[hash_slot(name)];
+
+	return ((entry == 0) ? -1 : (int64_t) entry - 1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : find_handle
+// Description  : Get the state of an open file from its handle
+//
+// Inputs       : fd - the file handle
+// Outputs      : the open file if the handle is in use, NULL if not
+
+struct OpenFile *find_handle(int16_t fd) {
+	if(fd < 0 || (uint32_t) fd >= mainStructure.openCap || mainStructure.openTable[fd].used == false) {
+		return (NULL);
+	}
+
+	return (&mainStructure.openTable[fd]);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : find_file
+// Description  : Get the index of the file open under a handle
+//
+// Inputs       : fd - the file handle
+// Outputs      : index of the file if found, -1 if failure
+
+int64_t find_file(int16_t fd) {
+	struct OpenFile *open = find_handle(fd);
+
+	return ((open == NULL) ? -1 : (int64_t) open->file);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : alloc_handle
+// Description  : Take an unused handle for a file, growing the open table
+//                when every handle is in use
+//
+// Inputs       : index - index of the file being opened
+// Outputs      : the handle if successful, -1 if failure
+
+int16_t alloc_handle(uint32_t index) {
+	struct OpenFile *grown = NULL;
+	uint32_t new_cap = 0;
+	int16_t fd = 0;
+
+	if(mainStructure.freeHandle == -1) {
+		//handles are int16_t
+		if(mainStructure.openCap == CART_MAX_OPEN_FILES) {
+			return (-1);
+		}
+		new_cap = (mainStructure.openCap == 0) ? 64 : mainStructure.openCap * 2;
+		if(new_cap > CART_MAX_OPEN_FILES) {
+			new_cap = CART_MAX_OPEN_FILES;
+		}
+		grown = realloc(mainStructure.openTable, new_cap * sizeof(struct OpenFile));
+		if(grown == NULL) {
+			return (-1);
+		}
+
+		//chain the new entries onto the free list, lowest handle first
+		for(uint32_t i = mainStructure.openCap; i < new_cap; i++) {
+			grown[i].used = false;
+			grown[i].wbuf = NULL;
+			grown[i].file = (i + 1 < new_cap) ? i + 1 : (uint32_t) -1;
+		}
+		mainStructure.freeHandle = mainStructure.openCap;
+		mainStructure.openTable = grown;
+		mainStructure.openCap = new_cap;
+	}
+
+	fd = mainStructure.freeHandle;
+	mainStructure.freeHandle = (int32_t) mainStructure.openTable[fd].file;
+	mainStructure.openTable[fd].used = true;
+	mainStructure.openTable[fd].file = index;
+	mainStructure.openTable[fd].location = 0;
+
+	return (fd);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : free_handle
+// Description  : Put a handle back on the list of unused handles
+//
+// Inputs       : fd - the file handle
+// Outputs      : 0 if successful
+
+int free_handle(int16_t fd) {
+	free(mainStructure.openTable[fd].wbuf);
+	mainStructure.openTable[fd].wbuf = NULL;
+	mainStructure.openTable[fd].used = false;
+	mainStructure.openTable[fd].file = (uint32_t) mainStructure.freeHandle;
+	mainStructure.freeHandle = fd;
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fill_write_buffer
+// Description  : Read the frame of a partial block into the buffer of a
+//                handle around the bytes written to it
+//
+// Inputs       : open - the handle
+// Outputs      : 0 if successful, -1 if failure
+
+int fill_write_buffer(struct OpenFile *open) {
+	struct WriteBuffer *wbuf = open->wbuf;
+	struct FileStructure *file = &mainStructure.fileTable[open->file];
+	char framebuf[CART_FRAME_SIZE];
+
+	if(read_frame_from_bus(file->frames[wbuf->block], framebuf) == -1) {
+		return (-1);
+	}
+	memcpy(&framebuf[wbuf->from], &wbuf->data[wbuf->from], wbuf->to - wbuf->from);
+	memcpy(wbuf->data, framebuf, CART_FRAME_SIZE);
+	wbuf->partial = false;
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : flush_write_buffer
+// Description  : Write the block gathered in the buffer of a handle to its frame
+//
+// Inputs       : open - the handle
+// Outputs      : 0 if successful, -1 if failure
+
+int flush_write_buffer(struct OpenFile *open) {
+	struct WriteBuffer *wbuf = open->wbuf;
+	struct FileStructure *file = &mainStructure.fileTable[open->file];
+
+	if(wbuf == NULL || wbuf->dirty == false) {
+		return (0);
+	}
+
+	//a setting changed since the block was started and it needs the whole frame now
+	if(wbuf->partial == true && part_write_ok(file, wbuf->block) == false && fill_write_buffer(open) == -1) {
+		return (-1);
+	}
+
+	//the map record of a fresh frame is logged once the block is written, the
+	//buffer is clean first since logging can take a checkpoint that flushes it
+	wbuf->dirty = false;
+	file->buffered--;
+	mainStructure.numDirty--;
+	if((wbuf->partial == true && write_data_part(file->frames[wbuf->block], wbuf->data, wbuf->from, wbuf->to) == -1) ||
+			(wbuf->partial == false && store_block(open->file, wbuf->block, wbuf->data, wbuf->fresh) == -1)) {
+		wbuf->dirty = true;
+		file->buffered++;
+		mainStructure.numDirty++;
+		return (-1);
+	}
+	wbuf->fresh = false;
+	wbuf->partial = false;
+
+	//a compressed block is only logged with its pack frame, if the length
+	//gets there first the block reads as it was before or as a hole
+	if(wbuf->grew == true) {
+		if(journal_length(open->file, file->length) == -1) {
+			return (-1);
+		}
+		wbuf->grew = false;
+	}
+
+	//the defragmenter passed over the file while the block was buffered
+	if(defrag.skipped == true) {
+		defrag.skipped = false;
+		defrag.clean = false;
+	}
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : flush_write_buffers
+// Description  : Write the blocks gathered by every handle
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int flush_write_buffers(void) {
+	for(uint32_t i = 0; i < mainStructure.openCap && mainStructure.numDirty > 0; i++) {
+		if(mainStructure.openTable[i].used == true && flush_write_buffer(&mainStructure.openTable[i]) == -1) {
+			return (-1);
+		}
+	}
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : flush_file_buffers
+// Description  : Write the blocks gathered by the other handles of a file,
+//                so a handle sees what was written through the others
+//
+// Inputs       : index - index of the file
+//                except - handle left alone, NULL to write them all
+// Outputs      : 0 if successful, -1 if failure
+
+int flush_file_buffers(uint32_t index, struct OpenFile *except) {
+	struct FileStructure *file = &mainStructure.fileTable[index];
+	struct OpenFile *open = NULL;
+	uint32_t own = (except != NULL && except->wbuf != NULL && except->wbuf->dirty == true) ? 1 : 0;
+
+	//nearly always only the handle itself has a buffered block
+	for(uint32_t i = 0; i < mainStructure.openCap && file->buffered > own; i++) {
+		open = &mainStructure.openTable[i];
+		if(open != except && open->used == true && open->file == index && flush_write_buffer(open) == -1) {
+			return (-1);
+		}
+	}
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : buffer_write
+// Description  : Add a write to the buffer of a handle, starting the buffer
+//                from the contents of the block, the frame is written once
+//                the write reaches its end
+//
+// Inputs       : open - the handle
+//                block - block of the file written
+//                fresh - the frame of the block was just allocated
+//                offset - where the write starts in the block
+//                data - the bytes to write
+//                bytes - number of bytes
+// Outputs      : 0 if successful, -1 if failure
+
+int buffer_write(struct OpenFile *open, uint32_t block, bool fresh, int offset, char *data, int bytes) {
+	struct FileStructure *file = &mainStructure.fileTable[open->file];
+	struct WriteBuffer *wbuf = open->wbuf;
+	uint16_t frame = (block < file->numFrames) ? file->frames[block] : FRAME_HOLE;
+	char *cachebuf = NULL; //buffer used to check the cache
+
+	if(wbuf == NULL) {
+		wbuf = malloc(sizeof(struct WriteBuffer));
+		if(wbuf == NULL) {
+			return (-1);
+		}
+		wbuf->dirty = false;
+		wbuf->fresh = false;
+		wbuf->grew = false;
+		wbuf->partial = false;
+		open->wbuf = wbuf;
+	}
+
+	//start from what the block holds now
+	if(wbuf->dirty == false) {
+		wbuf->partial = false;
+		cachebuf = (frame == FRAME_HOLE) ? NULL : get_cart_cache(FRAME_CART(frame), FRAME_NUM(frame));
+		if(frame != FRAME_HOLE && BLOCK_PACKED(file, block) == true) {
+			if(read_packed_block(file, block, wbuf->data) == -1) {
+				return (-1);
+			}
+		}
+		else if(cachebuf != NULL) {
+			memcpy(wbuf->data, cachebuf, CART_FRAME_SIZE);
+		}
+		//only the bytes written go out when the server can put them in place
+		else if(frame != FRAME_HOLE && fresh == false && block * CART_FRAME_SIZE < file->length &&
+				part_write_ok(file, block) == true) {
+			wbuf->partial = true;
+			wbuf->from = offset;
+			wbuf->to = offset;
+		}
+		else if(frame != FRAME_HOLE && fresh == false && block * CART_FRAME_SIZE < file->length) {
+			if(read_frame_from_bus(frame, wbuf->data) == -1) {
+				return (-1);
+			}
+		}
+		else {
+			memset(wbuf->data, 0, CART_FRAME_SIZE);
+		}
+		wbuf->block = block;
+		wbuf->dirty = true;
+		wbuf->fresh = fresh;
+		wbuf->grew = false;
+		file->buffered++;
+		mainStructure.numDirty++;
+	}
+
+	//the bytes of a partial block have to stay one run, a gap is read from the frame
+	if(wbuf->partial == true && (offset > wbuf->to || offset + bytes < wbuf->from) && fill_write_buffer(open) == -1) {
+		return (-1);
+	}
+	memcpy(&wbuf->data[offset], data, bytes);
+	if(wbuf->partial == true) {
+		wbuf->from = (offset < wbuf->from) ? offset : wbuf->from;
+		wbuf->to = (offset + bytes > wbuf->to) ? offset + bytes : wbuf->to;
+	}
+
+	//the frame is full, write it out
+	if(offset + bytes == CART_FRAME_SIZE) {
+		return (flush_write_buffer(open));
+	}
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : init_file_entries
+// Description  : Initialize file entries up to a given count, growing the
+//                file table as needed
+//
+// Inputs       : count - number of file entries that must be initialized
+// Outputs      : 0 if successful, -1 if failure
+
+int init_file_entries(uint32_t count) {
+	struct FileStructure *file = NULL;
+	struct FileStructure *grown = NULL;
+	uint32_t new_cap = mainStructure.fileCap;
+
+	//double the table until the entries fit
+	while(count > new_cap) {
+		new_cap = (new_cap == 0) ? 64 : new_cap * 2;
+	}
+	if(new_cap != mainStructure.fileCap) {
+		grown = realloc(mainStructure.fileTable, new_cap * sizeof(struct FileStructure));
+		if(grown == NULL) {
+			return (-1);
+		}
+		mainStructure.fileTable = grown;
+		mainStructure.fileCap = new_cap;
+	}
+
+	while(mainStructure.files_initialized < count) {
+		file = &mainStructure.fileTable[mainStructure.files_initialized];
+		file->filled = false;
+		file->open = 0;
+		file->frames = NULL;
+		file->slots = NULL;
+		file->numFrames = 0;
+		file->capFrames = 0;
+		file->tailFrame = FRAME_HOLE;
+		file->buffered = 0;
+		mainStructure.files_initialized++;
+	}
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : new_file_index
+// Description  : Get an empty file entry, reusing the entry of an unlinked
+//                file if there is one
+//
+// Inputs       : none
+// Outputs      : index of the entry if successful, -1 if failure
+
+int64_t new_file_index(void) {
+	uint32_t index = 0;
+
+	while(mainStructure.numFreeFiles > 0) {
+		index = mainStructure.freeFiles[--mainStructure.numFreeFiles];
+		//replay may have filled it again
+		if(index < mainStructure.files_initialized && mainStructure.fileTable[index].filled == false) {
+			return (index);
+		}
+	}
+
+	index = mainStructure.files_initialized;
+	if(index >= CART_MAX_FILE_ENTRIES || init_file_entries(index + 1) == -1) {
+		return (-1);
+	}
+
+	return (index);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : add_free_file
+// Description  : Remember an empty file entry so a create can reuse it
+//
+// Inputs       : index - index of the entry
+// Outputs      : 0 if successful, -1 if failure
+
+int add_free_file(uint32_t index) {
+	uint32_t new_cap = mainStructure.capFreeFiles;
+	uint32_t *grown = NULL;
+
+	if(mainStructure.numFreeFiles == new_cap) {
+		new_cap = (new_cap == 0) ? 64 : new_cap * 2;
+		grown = realloc(mainStructure.freeFiles, new_cap * sizeof(uint32_t));
+		if(grown == NULL) {
+			return (-1);
+		}
+		mainStructure.freeFiles = grown;
+		mainStructure.capFreeFiles = new_cap;
+	}
+	mainStructure.freeFiles[mainStructure.numFreeFiles++] = index;
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : load_file_entry
+// Description  : Fill a file entry with a file found in the metadata
+//
+// Inputs       : index - index of the file entry
+//                name - the file name
+// Outputs      : 0 if successful, -1 if failure
+
+int load_file_entry(uint32_t index, char *name) {
+	struct FileStructure *file = NULL;
+	int64_t name_offset = 0;
+
+	if(index >= CART_MAX_FILE_ENTRIES || init_file_entries(index + 1) == -1) {
+		return (-1);
+	}
+
+	//the entry may already be there when a record is replayed twice
+	file = &mainStructure.fileTable[index];
+	if(file->filled == true) {
+		return (0);
+	}
+
+	name_offset = add_name(name);
+	if(name_offset == -1) {
+		return (-1);
+	}
+	file->nameOffset = name_offset;
+	file->filled = true;
+	file->open = 0;
+	file->length = 0;
+	file->numFrames = 0;
+	file->tailFrame = FRAME_HOLE;
+	file->buffered = 0;
+
+	return (hash_insert(index));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : set_file_frame
+// Description  : Point a block of a file at a frame, growing the frame map
+//                with holes up to the block if needed
+//
+// Inputs       : index - index of the file entry
+//                block - block of the file
+//                frame - global frame number
+// Outputs      : 0 if successful, -1 if failure
+
+int set_file_frame(uint32_t index, uint32_t block, uint16_t frame) {
+	struct FileStructure *file = NULL;
+
+	if(index >= mainStructure.files_initialized || mainStructure.fileTable[index].filled == false ||
+			block >= CART_MAX_FILE_BLOCKS || !FILE_FRAME_OK(frame)) {
+		return (-1);
+	}
+	file = &mainStructure.fileTable[index];
+
+	if(block < file->numFrames) {
+		file->frames[block] = frame;
+		if(file->slots != NULL) {
+			file->slots[block] = 0;
+		}
+		return (0);
+	}
+
+	//the blocks between the end of the map and this one were never written
+	while(file->numFrames < block) {
+		if(append_frame(file, FRAME_HOLE) == -1) {
+			return (-1);
+		}
+	}
+
+	return (append_frame(file, frame));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : slot_valid
+// Description  : Check a slot read from the metadata stays in its shared frame,
+//                or in the data frame after it when it runs past the end
+//
+// Inputs       : frame - shared frame the block starts in
+//                slot - where the block is in the frame, 0 if it is not packed
+// Outputs      : true if the slot can be used, false if it is damaged
+
+bool slot_valid(uint16_t frame, uint32_t slot) {
+	if(slot == 0) {
+		return (true);
+	}
+	if(frame == FRAME_HOLE || !FILE_FRAME_OK(frame) || SLOT_OFFSET(slot) >= CART_FRAME_SIZE ||
+			SLOT_BYTES(slot) == 0 || SLOT_BYTES(slot) > CART_FRAME_SIZE) {
+		return (false);
+	}
+
+	return (SLOT_OFFSET(slot) + SLOT_BYTES(slot) <= CART_FRAME_SIZE || FILE_FRAME_OK(frame + 1));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : set_file_slot
+// Description  : Point a block of a file at its place in a shared frame
+//
+// Inputs       : index - index of the file entry
+//                block - block of the file
+//                frame - shared frame the block starts in
+//                slot - where the block is in the frame
+// Outputs      : 0 if successful, -1 if failure
+
+int set_file_slot(uint32_t index, uint32_t block, uint16_t frame, uint32_t slot) {
+	struct FileStructure *file = NULL;
+
+	if(slot_valid(frame, slot) == false || set_file_frame(index, block, frame) == -1) {
+		return (-1);
+	}
+	file = &mainStructure.fileTable[index];
+
+	//the slots are only there once a block of the file is compressed
+	if(file->slots == NULL) {
+		file->slots = calloc(file->capFrames, sizeof(uint32_t));
+		if(file->slots == NULL) {
+			return (-1);
+		}
+	}
+	file->slots[block] = slot;
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : file_allocated_frames
+// Description  : Count the blocks of a file that have a frame of their own
+//
+// Inputs       : file - the file
+// Outputs      : number of frames
+
+uint32_t file_allocated_frames(struct FileStructure *file) {
+	uint32_t count = 0;
+
+	for(uint32_t i = 0; i < file->numFrames; i++) {
+		if(file->frames[i] != FRAME_HOLE && BLOCK_PACKED(file, i) == false) {
+			count++;
+		}
+	}
+
+	return (count);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : file_cart_count
+// Description  : Count the cartridges holding frames of a file
+//
+// Inputs       : file - the file
+// Outputs      : number of cartridges
+
+uint32_t file_cart_count(struct FileStructure *file) {
+	uint64_t seen = 0; //one bit per cartridge
+	uint32_t count = 0;
+
+	for(uint32_t i = 0; i < file->numFrames; i++) {
+		if(file->frames[i] != FRAME_HOLE && ((seen >> FRAME_CART(file->frames[i])) & 1) == 0) {
+			seen |= ((uint64_t) 1) << FRAME_CART(file->frames[i]);
+			count++;
+		}
+	}
+
+	return (count);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : file_packed_blocks
+// Description  : Count the blocks of a file stored compressed
+//
+// Inputs       : file - the file
+// Outputs      : number of blocks
+
+uint32_t file_packed_blocks(struct FileStructure *file) {
+	uint32_t count = 0;
+
+	for(uint32_t i = 0; file->slots != NULL && i < file->numFrames; i++) {
+		if(file->slots[i] != 0) {
+			count++;
+		}
+	}
+
+	return (count);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : file_stored_bytes
+// Description  : Count the bytes a file takes on the cartridges, whole
+//                frames, compressed blocks and the packed last block
+//
+// Inputs       : file - the file
+// Outputs      : number of bytes
+
+uint64_t file_stored_bytes(struct FileStructure *file) {
+	uint64_t bytes = (uint64_t) file_allocated_frames(file) * CART_FRAME_SIZE;
+
+	for(uint32_t i = 0; file->slots != NULL && i < file->numFrames; i++) {
+		if(file->slots[i] != 0) {
+			bytes += SLOT_BYTES(file->slots[i]);
+		}
+	}
+	if(file->tailFrame != FRAME_HOLE) {
+		bytes += file->length % CART_FRAME_SIZE;
+	}
+
+	return (bytes);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : file_cart_near
+// Description  : Find the cartridge of the nearest written block before a
+//                block, so that a new frame for it goes next to the file,
+//                when striping it is the cartridge of the block's stripe
+//
+// Inputs       : file - the file
+//                block - the block getting a frame
+// Outputs      : the cartridge, 0 if no block before it was written
+
+CartridgeIndex file_cart_near(struct FileStructure *file, uint32_t block) {
+	uint32_t first = 0; //first cartridge of the stripes of the file
+
+	//the files start their stripes on different cartridges
+	if(stripe_width > 1) {
+		first = ((file - mainStructure.fileTable) * stripe_width) % CART_DATA_CARTRIDGES;
+		return ((first + block % stripe_width) % CART_DATA_CARTRIDGES);
+	}
+
+	if(block > file->numFrames) {
+		block = file->numFrames;
+	}
+	while(block > 0) {
+		block--;
+		if(file->frames[block] != FRAME_HOLE) {
+			return (FRAME_CART(file->frames[block]));
+		}
+	}
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fingerprint_frame
+// Description  : Hash the contents of a frame for the dedup index, four
+//                independent lanes of 64 bit multiply and rotate so the
+//                loop pipelines, mixed together at the end
+//
+// Inputs       : data - contents of the frame
+// Outputs      : the fingerprint
+
+uint64_t fingerprint_frame(const char *data) {
+	uint64_t lane[4] = {DEDUP_PRIME1 + DEDUP_PRIME2, DEDUP_PRIME2, 0, 0 - DEDUP_PRIME1};
+	uint64_t word = 0;
+	uint64_t print = 0;
+
+	for(int i = 0; i < CART_FRAME_SIZE; i += 32) {
+		for(int k = 0; k < 4; k++) {
+			memcpy(&word, &data[i + k * 8], sizeof(word));
+			lane[k] = ROTL64(lane[k] + word * DEDUP_PRIME2, 31) * DEDUP_PRIME1;
+		}
+	}
+
+	//fold the lanes and spread every bit over the result
+	print = ROTL64(lane[0], 1) + ROTL64(lane[1], 7) + ROTL64(lane[2], 12) + ROTL64(lane[3], 18);
+	print ^= print >> 33;
+	print *= DEDUP_PRIME2;
+	print ^= print >> 29;
+	print *= DEDUP_PRIME3;
+	print ^= print >> 32;
+
+	return (print);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : dedup_release
+// Description  : Free the dedup index, it is built again as blocks are
+//                written and read
+//
+// Inputs       : none
+// Outputs      : 0 if successful
+
+int dedup_release(void) {
+	free(dedup.heads);
+	free(dedup.next);
+	free(dedup.prints);
+	free(dedup.sigs);
+	dedup.heads = NULL;
+	dedup.next = NULL;
+	dedup.prints = NULL;
+	dedup.sigs = NULL;
+	memset(dedup.indexed, 0, sizeof(dedup.indexed));
+	dedup.count = 0;
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : dedup_alloc
+// Description  : Allocate the dedup index the first time it is used
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int dedup_alloc(void) {
+	//an index built without signatures cannot verify, it is built again
+	if(dedup.heads != NULL && dedup_mode == CART_DEDUP_VERIFY && dedup.sigs == NULL) {
+		dedup_release();
+	}
+	if(dedup.heads != NULL) {
+		return (0);
+	}
+
+	dedup.heads = malloc(DEDUP_BUCKETS * sizeof(uint16_t));
+	dedup.next = malloc(CART_TOTAL_FRAMES * sizeof(uint16_t));
+	dedup.prints = malloc(CART_TOTAL_FRAMES * sizeof(uint64_t));
+	if(dedup_mode == CART_DEDUP_VERIFY) {
+		dedup.sigs = malloc(CART_TOTAL_FRAMES * DEDUP_SIG_SIZE);
+	}
+	if(dedup.heads == NULL || dedup.next == NULL || dedup.prints == NULL ||
+			(dedup_mode == CART_DEDUP_VERIFY && dedup.sigs == NULL)) {
+		dedup_release();
+		return (-1);
+	}
+	memset(dedup.heads, 0xff, DEDUP_BUCKETS * sizeof(uint16_t));
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : dedup_forget
+// Description  : Take a frame out of the dedup index, done before it is
+//                written again or freed
+//
+// Inputs       : frame - global frame number
+// Outputs      : 0 if successful
+
+int dedup_forget(uint16_t frame) {
+	uint64_t bit = ((uint64_t) 1) << (frame % 64);
+	uint16_t *link = NULL;
+
+	if(dedup.heads == NULL || (dedup.indexed[frame / 64] & bit) == 0) {
+		return (0);
+	}
+
+	//unlink it from its bucket
+	link = &dedup.heads[dedup.prints[frame] & (DEDUP_BUCKETS - 1)];
+	while(*link != frame) {
+		link = &dedup.next[*link];
+	}
+	*link = dedup.next[frame];
+	dedup.indexed[frame / 64] &= ~bit;
+	dedup.count--;
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : dedup_remember
+// Description  : Add a frame that is on the cartridge to the dedup index
+//
+// Inputs       : frame - global frame number
+//                data - contents of the frame
+//                print - fingerprint of the contents
+// Outputs      : 0 if successful
+
+int dedup_remember(uint16_t frame, char *data, uint64_t print) {
+	uint32_t bucket = print & (DEDUP_BUCKETS - 1);
+	uint32_t sigsz = DEDUP_SIG_SIZE;
+
+	if(dedup.heads == NULL) {
+		return (0);
+	}
+	dedup_forget(frame);
+
+	dedup.prints[frame] = print;
+	dedup.next[frame] = dedup.heads[bucket];
+	dedup.heads[bucket] = frame;
+	if(dedup.sigs != NULL) {
+		memset(&dedup.sigs[frame * DEDUP_SIG_SIZE], 0, DEDUP_SIG_SIZE);
+		generate_md5_signature(data, CART_FRAME_SIZE, &dedup.sigs[frame * DEDUP_SIG_SIZE], &sigsz);
+	}
+	dedup.indexed[frame / 64] |= ((uint64_t) 1) << (frame % 64);
+	dedup.count++;
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : dedup_find
+// Description  : Look for a frame holding the same bytes as a block. A cached
+//                frame is compared byte for byte, otherwise the fingerprint
+//                is trusted, checked against the MD5 signature when verifying
+//
+// Inputs       : data - contents of the block
+//                print - fingerprint of the contents
+// Outputs      : global frame number, -1 if none
+
+int32_t dedup_find(char *data, uint64_t print) {
+	char sig[DEDUP_SIG_SIZE];
+	uint32_t sigsz = DEDUP_SIG_SIZE;
+	bool signed_data = false; //sig holds the signature of the block
+	char *cachebuf = NULL; //buffer used to check the cache
+	uint16_t frame = 0;
+
+	if(dedup.heads == NULL) {
+		return (-1);
+	}
+
+	for(frame = dedup.heads[print & (DEDUP_BUCKETS - 1)]; frame != FRAME_HOLE; frame = dedup.next[frame]) {
+		if(dedup.prints[frame] != print) {
+			continue;
+		}
+		cachebuf = get_cart_cache(FRAME_CART(frame), FRAME_NUM(frame));
+		if(cachebuf != NULL) {
+			if(memcmp(cachebuf, data, CART_FRAME_SIZE) == 0) {
+				return (frame);
+			}
+			continue;
+		}
+		//when verifying a frame is only shared if its signature matches too
+		if(dedup_mode == CART_DEDUP_VERIFY) {
+			if(dedup.sigs == NULL) {
+				return (-1);
+			}
+			if(signed_data == false) {
+				memset(sig, 0, DEDUP_SIG_SIZE);
+				generate_md5_signature(data, CART_FRAME_SIZE, sig, &sigsz);
+				signed_data = true;
+			}
+			if(memcmp(sig, &dedup.sigs[frame * DEDUP_SIG_SIZE], DEDUP_SIG_SIZE) == 0) {
+				return (frame);
+			}
+			continue;
+		}
+		return (frame);
+	}
+
+	return (-1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : share_frame
+// Description  : Count one more block pointing at a frame
+//
+// Inputs       : frame - global frame number
+// Outputs      : 0 if successful, -1 if failure
+
+int share_frame(uint16_t frame) {
+	if(mainStructure.frameShares == NULL) {
+		mainStructure.frameShares = calloc(CART_TOTAL_FRAMES, sizeof(uint32_t));
+		if(mainStructure.frameShares == NULL) {
+			return (-1);
+		}
+	}
+
+	if(mainStructure.frameShares[frame] == 0) {
+		mainStructure.numSharedFrames++;
+	}
+	mainStructure.frameShares[frame]++;
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : unshare_frame
+// Description  : Count one less block pointing at a frame, if it was shared
+//
+// Inputs       : frame - global frame number
+// Outputs      : true if other blocks still point at it, false if not
+
+bool unshare_frame(uint16_t frame) {
+	if(FRAME_SHARED(frame) == false) {
+		return (false);
+	}
+
+	mainStructure.frameShares[frame]--;
+	if(mainStructure.frameShares[frame] == 0) {
+		mainStructure.numSharedFrames--;
+	}
+
+	return (true);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : zero_file_tail
+// Description  : Zero the bytes after the end of a file in its last frame, so
+//                that growing the file past them reads zeros. Truncate and a
+//                crash before the length was logged can leave old data there
+//
+// Inputs       : file - the file
+// Outputs      : 0 if successful, -1 if failure
+
+int zero_file_tail(struct FileStructure *file) {
+	uint32_t block = file->length / CART_FRAME_SIZE;
+	uint32_t offset = file->length % CART_FRAME_SIZE;
+	char tempbuf[CART_FRAME_SIZE]; //temporary buffer for calculations
+	char *cachebuf = NULL; //buffer used to check cache
+	uint16_t frame = 0;
+
+	//nothing to do if the end is on a frame boundary or in a hole
+	if(offset == 0 || block >= file->numFrames || file->frames[block] == FRAME_HOLE) {
+		return (0);
+	}
+	frame = file->frames[block];
+
+	//a compressed block is stored again
+	if(BLOCK_PACKED(file, block) == true) {
+		if(read_packed_block(file, block, tempbuf) == -1) {
+			return (-1);
+		}
+		memset(&tempbuf[offset], 0, CART_FRAME_SIZE - offset);
+		return (store_block(file - mainStructure.fileTable, block, tempbuf, false));
+	}
+
+	cachebuf = get_cart_cache(FRAME_CART(frame), FRAME_NUM(frame));
+	if(cachebuf == NULL) {
+		if(read_frame_from_bus(frame, tempbuf) == -1) {
+			return (-1);
+		}
+		cachebuf = tempbuf;
+	}
+
+	//other blocks point at the frame too, the block gets a copy
+	if(FRAME_SHARED(frame) == true) {
+		if(cachebuf != tempbuf) {
+			memcpy(tempbuf, cachebuf, CART_FRAME_SIZE);
+		}
+		memset(&tempbuf[offset], 0, CART_FRAME_SIZE - offset);
+		return (store_block(file - mainStructure.fileTable, block, tempbuf, false));
+	}
+
+	dedup_forget(frame);
+	memset(&cachebuf[offset], 0, CART_FRAME_SIZE - offset);
+	if(write_data_frame(frame, cachebuf) == -1) {
+		return (-1);
+	}
+
+	if(cachebuf == tempbuf) {
+		insert_into_cache(frame, tempbuf);
+	}
+	else {
+		update_cache(FRAME_CART(frame), FRAME_NUM(frame), cachebuf);
+	}
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : reserve_pending
+// Description  : Make room in the list of frames waiting to be freed
+//
+// Inputs       : count - number of frames about to be added
+// Outputs      : 0 if successful, -1 if failure
+
+int reserve_pending(uint32_t count) {
+	uint32_t new_cap = mainStructure.capPending;
+	uint16_t *grown = NULL;
+
+	while(mainStructure.numPending + count > new_cap) {
+		new_cap = (new_cap == 0) ? 64 : new_cap * 2;
+	}
+	if(new_cap != mainStructure.capPending) {
+		grown = realloc(mainStructure.pendingFree, new_cap * sizeof(uint16_t));
+		if(grown == NULL) {
+			return (-1);
+		}
+		mainStructure.pendingFree = grown;
+		mainStructure.capPending = new_cap;
+	}
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : release_file_frames
+// Description  : Take the blocks of a file from a given block on out of its
+//                frame map and the cache, the frames are only freed once the
+//                change is committed so a crash cannot hand them to another
+//                file while the old metadata still points at them
+//
+// Inputs       : file - the file
+//                keep - number of blocks to keep
+// Outputs      : number of frames released if successful, -1 if failure
+
+int32_t release_file_frames(struct FileStructure *file, uint32_t keep) {
+	uint32_t count = 0;
+	uint16_t frame = 0;
+
+	if(keep >= file->numFrames) {
+		return (0);
+	}
+	for(uint32_t i = keep; i < file->numFrames; i++) {
+		if(file->frames[i] != FRAME_HOLE && BLOCK_PACKED(file, i) == false) {
+			count++;
+		}
+	}
+
+	if(reserve_pending(count) == -1) {
+		return (-1);
+	}
+
+	//drop all of the frames from the cache in one pass, compressed blocks
+	//give their bytes back to their shared frames and a frame other blocks
+	//point at stays
+	count = 0;
+	for(uint32_t i = keep; i < file->numFrames; i++) {
+		frame = file->frames[i];
+		if(frame == FRAME_HOLE) {
+			continue;
+		}
+		if(BLOCK_PACKED(file, i) == true) {
+			if(drop_slot(frame, file->slots[i]) == -1) {
+				return (-1);
+			}
+			continue;
+		}
+		if(unshare_frame(frame) == true) {
+			continue;
+		}
+		dedup_forget(frame);
+		count++;
+		frameMarked[frame / 64] |= ((uint64_t) 1) << (frame % 64);
+		mainStructure.pendingFree[mainStructure.numPending++] = frame;
+	}
+	delete_cart_cache_marked(frameMarked);
+	for(uint32_t i = keep; i < file->numFrames; i++) {
+		if(file->frames[i] != FRAME_HOLE) {
+			frameMarked[file->frames[i] / 64] = 0;
+		}
+	}
+	file->numFrames = keep;
+
+	return (count);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : free_pending_frames
+// Description  : Free the frames released by unlink and truncate, called once
+//                their records are on the metadata cartridge
+//
+// Inputs       : none
+// Outputs      : 0 if successful
+
+int free_pending_frames(void) {
+	for(uint32_t i = 0; i < mainStructure.numPending; i++) {
+		free_frame(mainStructure.pendingFree[i]);
+	}
+	mainStructure.numPending = 0;
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : claim_shared
+// Description  : Count a packed last block or compressed block in the bytes
+//                used of its shared frame
+//
+// Inputs       : frame - the shared frame
+//                length - bytes of the block in the frame
+// Outputs      : 0 if successful, -1 if failure
+
+int claim_shared(uint16_t frame, uint16_t length) {
+	uint16_t **live = &mainStructure.tailLive[FRAME_CART(frame)];
+
+	if(*live == NULL) {
+		*live = calloc(CART_CARTRIDGE_SIZE, sizeof(uint16_t));
+		if(*live == NULL) {
+			return (-1);
+		}
+	}
+
+	if((*live)[FRAME_NUM(frame)] == 0) {
+		mainStructure.numTailFrames++;
+	}
+	(*live)[FRAME_NUM(frame)] += length;
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : drop_shared
+// Description  : Take the bytes of a block out of the bytes used of its
+//                shared frame, the frame is freed once the last block in it
+//                is gone and that is committed
+//
+// Inputs       : frame - the shared frame
+//                length - bytes of the block in the frame
+// Outputs      : 0 if successful, -1 if failure
+
+int drop_shared(uint16_t frame, uint16_t length) {
+	uint16_t *live = NULL;
+
+	if(reserve_pending(1) == -1) {
+		return (-1);
+	}
+
+	live = &mainStructure.tailLive[FRAME_CART(frame)][FRAME_NUM(frame)];
+	*live -= length;
+	if(*live == 0) {
+		mainStructure.pendingFree[mainStructure.numPending++] = frame;
+		delete_cart_cache(FRAME_CART(frame), FRAME_NUM(frame));
+		mainStructure.numTailFrames--;
+		if(mainStructure.tailOpen == frame) {
+			mainStructure.tailOpen = -1;
+		}
+		//nothing waiting in the pack frame uses it either, start a new one
+		if(pack.frame == frame) {
+			pack.frame = -1;
+		}
+	}
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : drop_tail
+// Description  : Take the packed last block of a file out of its shared frame
+//
+// Inputs       : file - the file
+// Outputs      : 0 if successful, -1 if failure
+
+int drop_tail(struct FileStructure *file) {
+	uint16_t frame = file->tailFrame;
+
+	if(frame == FRAME_HOLE) {
+		return (0);
+	}
+	file->tailFrame = FRAME_HOLE;
+
+	return (drop_shared(frame, file->length % CART_FRAME_SIZE));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : journal_tail
+// Description  : Add a record of where the last block of a file is packed
+//
+// Inputs       : index - index of the file entry
+//                frame - the shared frame, FRAME_HOLE if it is not packed
+//                offset - where the block starts in the shared frame
+// Outputs      : 0 if successful, -1 if failure
+
+int journal_tail(uint32_t index, uint16_t frame, uint16_t offset) {
+	char record[8];
+
+	memcpy(&record[0], &index, sizeof(index));
+	memcpy(&record[4], &frame, sizeof(frame));
+	memcpy(&record[6], &offset, sizeof(offset));
+
+	return (journal_append(JREC_TAIL, record, sizeof(record)));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : pack_tail
+// Description  : Move a short last block of a file out of its own frame and
+//                into a shared frame after the last blocks of other files,
+//                so one frame holds several small files
+//
+// Inputs       : index - index of the file entry
+// Outputs      : 0 if successful, -1 if failure
+
+int pack_tail(uint32_t index) {
+	struct FileStructure *file = &mainStructure.fileTable[index];
+	uint32_t block = file->length / CART_FRAME_SIZE;
+	uint16_t length = file->length % CART_FRAME_SIZE;
+	char tailbuf[CART_FRAME_SIZE]; //the last block
+	char tempbuf[CART_FRAME_SIZE]; //the shared frame when it is not in the cache
+	char *cachebuf = NULL; //buffer used to check the cache
+	char *shared = NULL; //contents of the shared frame
+	int32_t frame = 0;
+	uint16_t offset = 0;
+	bool fresh = false; //the shared frame was just allocated
+
+	//only a short last block with a frame of its own is packed
+	if(length == 0 || length > tail_pack_max || file->tailFrame != FRAME_HOLE ||
+			block + 1 != file->numFrames || file->frames[block] == FRAME_HOLE || BLOCK_PACKED(file, block) == true) {
+		return (0);
+	}
+
+	//get the last block
+	cachebuf = get_cart_cache(FRAME_CART(file->frames[block]), FRAME_NUM(file->frames[block]));
+	if(cachebuf != NULL) {
+		memcpy(tailbuf, cachebuf, length);
+	}
+	else if(read_frame_from_bus(file->frames[block], tailbuf) == -1) {
+		return (-1);
+	}
+
+	//add it after the tails in the open shared frame, or start a new one
+	frame = mainStructure.tailOpen;
+	if(frame == -1 || mainStructure.tailEnd + length > CART_FRAME_SIZE) {
+		frame = alloc_frame(FRAME_CART(file->frames[block]));
+		if(frame == -1) {
+			return (0);
+		}
+		fresh = true;
+	}
+	offset = fresh ? 0 : mainStructure.tailEnd;
+
+	cachebuf = fresh ? NULL : get_cart_cache(FRAME_CART(frame), FRAME_NUM(frame));
+	if(cachebuf != NULL) {
+		shared = cachebuf;
+	}
+	else {
+		shared = tempbuf;
+		if(fresh == true) {
+			memset(tempbuf, 0, CART_FRAME_SIZE);
+		}
+		else if(read_frame_from_bus(frame, tempbuf) == -1) {
+			return (-1);
+		}
+	}
+	memcpy(&shared[offset], tailbuf, length);
+	if(write_data_frame(frame, shared) == -1) {
+		if(fresh == true) {
+			free_frame(frame);
+		}
+		return (-1);
+	}
+	if(cachebuf != NULL) {
+		update_cache(FRAME_CART(frame), FRAME_NUM(frame), cachebuf);
+	}
+	else {
+		insert_into_cache(frame, tempbuf);
+	}
+
+	//point the file at the shared frame, its own frame is freed once that is committed
+	if(claim_shared(frame, length) == -1) {
+		return (-1);
+	}
+	mainStructure.tailOpen = frame;
+	mainStructure.tailEnd = offset + length;
+	file->tailFrame = frame;
+	file->tailOffset = offset;
+	//the block keeps its own frame if the move is not logged
+	if(journal_tail(index, frame, offset) == -1) {
+		drop_tail(file);
+		return (-1);
+	}
+	if(release_file_frames(file, block) == -1) {
+		return (-1);
+	}
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : unpack_tail
+// Description  : Give the packed last block of a file a frame of its own
+//                again, done before the block is written or the length changes
+//
+// Inputs       : index - index of the file entry
+// Outputs      : 0 if successful, -1 if failure
+
+int unpack_tail(uint32_t index) {
+	struct FileStructure *file = &mainStructure.fileTable[index];
+	uint32_t block = file->length / CART_FRAME_SIZE;
+	uint16_t length = file->length % CART_FRAME_SIZE;
+	char tailbuf[CART_FRAME_SIZE]; //the last block in a frame of its own
+	char tempbuf[CART_FRAME_SIZE]; //the shared frame when it is not in the cache
+	char *cachebuf = NULL; //buffer used to check the cache
+	int32_t new_frame = 0;
+
+	if(file->tailFrame == FRAME_HOLE) {
+		return (0);
+	}
+
+	//copy the block out of the shared frame
+	memset(tailbuf, 0, CART_FRAME_SIZE);
+	cachebuf = get_cart_cache(FRAME_CART(file->tailFrame), FRAME_NUM(file->tailFrame));
+	if(cachebuf == NULL) {
+		if(read_frame_from_bus(file->tailFrame, tempbuf) == -1) {
+			return (-1);
+		}
+		cachebuf = tempbuf;
+	}
+	memcpy(tailbuf, &cachebuf[file->tailOffset], length);
+
+	//write it to a frame of its own
+	new_frame = alloc_frame(file_cart_near(file, block));
+	if(new_frame == -1) {
+		return (-1);
+	}
+	if(write_data_frame(new_frame, tailbuf) == -1) {
+		free_frame(new_frame);
+		return (-1);
+	}
+	insert_into_cache(new_frame, tailbuf);
+
+	//log the move, the shared frame keeps the block until that is committed
+	if(journal_tail(index, FRAME_HOLE, 0) == -1) {
+		delete_cart_cache(FRAME_CART(new_frame), FRAME_NUM(new_frame));
+		free_frame(new_frame);
+		return (-1);
+	}
+	if(drop_tail(file) == -1 || set_file_frame(index, block, new_frame) == -1) {
+		return (-1);
+	}
+
+	return (journal_map(index, block, new_frame));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cache_frame
+// Description  : Put the new contents of a frame in the cache, replacing the
+//                cached copy if there is one
+//
+// Inputs       : frame - global frame number
+//                buf - contents of the frame
+// Outputs      : 0 if successful
+
+int cache_frame(uint16_t frame, char *buf) {
+	char *cachebuf = get_cart_cache(FRAME_CART(frame), FRAME_NUM(frame));
+
+	if(cachebuf == NULL) {
+		return (insert_into_cache(frame, buf));
+	}
+	memcpy(cachebuf, buf, CART_FRAME_SIZE);
+	update_cache(FRAME_CART(frame), FRAME_NUM(frame), cachebuf);
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : claim_frame
+// Description  : Take a given frame if it is free
+//
+// Inputs       : frame - global frame number
+// Outputs      : 0 if successful, -1 if the frame is in use
+
+int claim_frame(uint16_t frame) {
+	uint64_t bit = ((uint64_t) 1) << (frame % 64);
+
+	if(mainStructure.frameUsed[frame / 64] & bit) {
+		return (-1);
+	}
+	mainStructure.frameUsed[frame / 64] |= bit;
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : claim_slot
+// Description  : Count a compressed block in the bytes used of the shared
+//                frames it is in
+//
+// Inputs       : frame - shared frame the block starts in
+//                slot - where the block is in the frame
+// Outputs      : 0 if successful, -1 if failure
+
+int claim_slot(uint16_t frame, uint32_t slot) {
+	uint16_t first = CART_FRAME_SIZE - SLOT_OFFSET(slot);
+
+	if(first >= SLOT_BYTES(slot)) {
+		return (claim_shared(frame, SLOT_BYTES(slot)));
+	}
+	if(claim_shared(frame, first) == -1) {
+		return (-1);
+	}
+
+	return (claim_shared(frame + 1, SLOT_BYTES(slot) - first));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : drop_slot
+// Description  : Take a compressed block out of the shared frames it is in
+//
+// Inputs       : frame - shared frame the block starts in
+//                slot - where the block is in the frame
+// Outputs      : 0 if successful, -1 if failure
+
+int drop_slot(uint16_t frame, uint32_t slot) {
+	uint16_t first = CART_FRAME_SIZE - SLOT_OFFSET(slot);
+
+	if(first >= SLOT_BYTES(slot)) {
+		return (drop_shared(frame, SLOT_BYTES(slot)));
+	}
+	if(drop_shared(frame, first) == -1) {
+		return (-1);
+	}
+
+	return (drop_shared(frame + 1, SLOT_BYTES(slot) - first));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : release_place
+// Description  : Let go of where a block was stored before it moved, called
+//                once the new place is logged, a frame of its own is freed
+//                once that is committed
+//
+// Inputs       : frame - frame of the old place, FRAME_HOLE if none
+//                slot - slot of the old place, 0 if it was a frame of its own
+// Outputs      : 0 if successful, -1 if failure
+
+int release_place(uint16_t frame, uint32_t slot) {
+	if(frame == FRAME_HOLE) {
+		return (0);
+	}
+	if(slot != 0) {
+		return (drop_slot(frame, slot));
+	}
+	if(unshare_frame(frame) == true) {
+		return (0);
+	}
+	dedup_forget(frame);
+
+	if(reserve_pending(1) == -1) {
+		return (-1);
+	}
+	mainStructure.pendingFree[mainStructure.numPending++] = frame;
+	delete_cart_cache(FRAME_CART(frame), FRAME_NUM(frame));
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cancel_packed
+// Description  : Drop the entry of a block waiting in the pack frame when the
+//                block is stored again, the new place takes over the place
+//                the block had before that entry
+//
+// Inputs       : index - index of the file entry
+//                block - block of the file
+//                frame - frame of the current place, set to the one before it
+//                slot - slot of the current place, set to the one before it
+// Outputs      : 0 if successful, -1 if failure
+
+int cancel_packed(uint32_t index, uint32_t block, uint16_t *frame, uint32_t *slot) {
+	struct PackedBlock *entry = NULL;
+
+	if(*slot == 0) {
+		return (0);
+	}
+	for(int i = 0; i < pack.count; i++) {
+		entry = &pack.blocks[i];
+		if(entry->file == index && entry->block == block) {
+			entry->file = PACK_CANCELLED;
+			*frame = entry->oldFrame;
+			*slot = entry->oldSlot;
+			return (drop_slot(entry->frame, entry->slot));
+		}
+	}
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : log_packed_blocks
+// Description  : Log the new places of the blocks written with the pack
+//                frame and let go of their old places
+//
+// Inputs       : keep - blocks at the end that are not written yet
+// Outputs      : 0 if successful, -1 if failure
+
+int log_packed_blocks(int keep) {
+	struct PackedBlock entry;
+	char record[14];
+
+	//an entry is cancelled before it is logged, a checkpoint taken while
+	//logging it writes out the rest
+	for(int i = 0; i < pack.count - keep; i++) {
+		entry = pack.blocks[i];
+		if(entry.file == PACK_CANCELLED) {
+			continue;
+		}
+		pack.blocks[i].file = PACK_CANCELLED;
+
+		memcpy(&record[0], &entry.file, sizeof(entry.file));
+		memcpy(&record[4], &entry.block, sizeof(entry.block));
+		memcpy(&record[8], &entry.frame, sizeof(entry.frame));
+		memcpy(&record[10], &entry.slot, sizeof(entry.slot));
+		if(journal_append(JREC_PACK, record, sizeof(record)) == -1 ||
+				release_place(entry.oldFrame, entry.oldSlot) == -1) {
+			return (-1);
+		}
+	}
+
+	if(pack.count > keep) {
+		memmove(&pack.blocks[0], &pack.blocks[pack.count - keep], keep * sizeof(struct PackedBlock));
+		pack.count = keep;
+	}
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : flush_pack_frame
+// Description  : Write the pack frame and log the blocks in it, the frame
+//                stays open for more blocks
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int flush_pack_frame(void) {
+	if(pack.frame == -1 || pack.count == 0) {
+		return (0);
+	}
+
+	if(write_data_frame(pack.frame, pack.data) == -1) {
+		return (-1);
+	}
+	cache_frame(pack.frame, pack.data);
+
+	return (log_packed_blocks(0));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : pack_holds_file
+// Description  : Check if blocks of a file are waiting in the pack frame
+//
+// Inputs       : index - index of the file entry
+// Outputs      : true if there are, false if not
+
+bool pack_holds_file(uint32_t index) {
+	for(int i = 0; i < pack.count; i++) {
+		if(pack.blocks[i].file == index) {
+			return (true);
+		}
+	}
+
+	return (false);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shared_frame
+// Description  : Get the contents of a shared frame, from the pack frame, the
+//                cache or the cartridge, keeping it in the cache since it
+//                holds blocks of other files too
+//
+// Inputs       : frame - global frame number
+//                tempbuf - buffer for the frame when it is read from the bus
+// Outputs      : the contents, NULL if failure
+
+char *shared_frame(uint16_t frame, char *tempbuf) {
+	char *cachebuf = NULL;
+
+	if(pack.frame == frame) {
+		return (pack.data);
+	}
+	cachebuf = get_cart_cache(FRAME_CART(frame), FRAME_NUM(frame));
+	if(cachebuf != NULL) {
+		return (cachebuf);
+	}
+
+	if(read_frame_from_bus(frame, tempbuf) == -1) {
+		return (NULL);
+	}
+	insert_into_cache(frame, tempbuf);
+
+	return (tempbuf);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : read_packed_block
+// Description  : Get the contents of a block stored compressed
+//
+// Inputs       : file - the file
+//                block - block of the file
+//                buf - where the whole block goes
+// Outputs      : 0 if successful, -1 if failure
+
+int read_packed_block(struct FileStructure *file, uint32_t block, char *buf) {
+	char packed[CART_FRAME_SIZE]; //the compressed block
+	char tempbuf[CART_FRAME_SIZE]; //a shared frame that is not in the cache
+	char *shared = NULL;
+	uint16_t frame = file->frames[block];
+	uint16_t offset = SLOT_OFFSET(file->slots[block]);
+	uint16_t bytes = SLOT_BYTES(file->slots[block]);
+	uint16_t first = (CART_FRAME_SIZE - offset < bytes) ? CART_FRAME_SIZE - offset : bytes;
+
+	//the block may go on in the next frame
+	if((shared = shared_frame(frame, tempbuf)) == NULL) {
+		return (-1);
+	}
+	memcpy(packed, &shared[offset], first);
+	if(first < bytes) {
+		if((shared = shared_frame(frame + 1, tempbuf)) == NULL) {
+			return (-1);
+		}
+		memcpy(&packed[first], shared, bytes - first);
+	}
+
+	if(cart_decompress(packed, bytes, buf, CART_FRAME_SIZE) != CART_FRAME_SIZE) {
+		logMessage(LOG_ERROR_LEVEL, "CART driver found a damaged compressed block in frame %u", frame);
+		return (-1);
+	}
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : pack_block
+// Description  : Compress a block and add it to the pack frame after the
+//                blocks already there, a block that does not fit runs on into
+//                the next frame when that one is free, otherwise a new pack
+//                frame is started. Its new place is logged once the frame
+//                holding the end of it is written
+//
+// Inputs       : index - index of the file entry
+//                block - block of the file
+//                data - contents of the block
+// Outputs      : 1 if the block was packed, 0 if it does not compress, -1 if failure
+
+int pack_block(uint32_t index, uint32_t block, char *data) {
+	struct FileStructure *file = &mainStructure.fileTable[index];
+	struct PackedBlock *entry = NULL;
+	char packed[PACK_MAX_BYTES]; //the compressed block
+	int32_t bytes = cart_compress(data, CART_FRAME_SIZE, packed, PACK_MAX_BYTES);
+	uint16_t old_frame = (block < file->numFrames) ? file->frames[block] : FRAME_HOLE;
+	uint32_t old_slot = (old_frame != FRAME_HOLE && file->slots != NULL) ? file->slots[block] : 0;
+	uint16_t first = 0;
+	int32_t frame = 0;
+	bool spans = false; //the block goes on in the next frame
+
+	//not worth it, the block keeps a frame of its own
+	if(bytes == -1) {
+		return (0);
+	}
+
+	//an entry still waiting for the block is replaced
+	if(cancel_packed(index, block, &old_frame, &old_slot) == -1) {
+		return (-1);
+	}
+
+	//no room left in the pack frame
+	if(pack.frame != -1 && (pack.end + bytes > CART_FRAME_SIZE || pack.count == PACK_MAX_BLOCKS)) {
+		if(pack.end < CART_FRAME_SIZE && pack.count < PACK_MAX_BLOCKS &&
+				FRAME_NUM(pack.frame) + 1 < CART_CARTRIDGE_SIZE && claim_frame(pack.frame + 1) == 0) {
+			spans = true;
+		}
+		else {
+			if(flush_pack_frame() == -1) {
+				return (-1);
+			}
+			pack.frame = -1;
+		}
+	}
+	if(pack.frame == -1) {
+		frame = alloc_frame(file_cart_near(file, block));
+		if(frame == -1) {
+			return (0);
+		}
+		pack.frame = frame;
+		pack.end = 0;
+		memset(pack.data, 0, CART_FRAME_SIZE);
+	}
+
+	//point the block at its new place, the old one is let go once that is logged
+	entry = &pack.blocks[pack.count];
+	entry->file = index;
+	entry->block = block;
+	entry->frame = pack.frame;
+	entry->slot = SLOT(pack.end, bytes);
+	entry->oldFrame = old_frame;
+	entry->oldSlot = old_slot;
+	if(set_file_slot(index, block, entry->frame, entry->slot) == -1 || claim_slot(entry->frame, entry->slot) == -1) {
+		return (-1);
+	}
+	pack.count++;
+
+	first = spans ? CART_FRAME_SIZE - pack.end : bytes;
+	memcpy(&pack.data[pack.end], packed, first);
+	pack.end += first;
+	if(spans == false) {
+		return (1);
+	}
+
+	//write out the full frame and carry on in the next one, the blocks that
+	//ended in the full frame can be logged
+	if(write_data_frame(pack.frame, pack.data) == -1) {
+		return (-1);
+	}
+	cache_frame(pack.frame, pack.data);
+	pack.frame++;
+	memset(pack.data, 0, CART_FRAME_SIZE);
+	memcpy(pack.data, &packed[first], bytes - first);
+	pack.end = bytes - first;
+	if(log_packed_blocks(1) == -1) {
+		return (-1);
+	}
+
+	return (1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : dedup_block
+// Description  : Fingerprint a block and point it at a frame already holding
+//                the same bytes if there is one, so nothing is written
+//
+// Inputs       : index - index of the file entry
+//                block - block of the file
+//                data - contents of the block
+//                fresh - the frame of the block was just allocated, its map
+//                        record is not logged yet
+//                print - set to the fingerprint of the block
+// Outputs      : 1 if the block points at a frame, 0 if it has to be written, -1 if failure
+
+int dedup_block(uint32_t index, uint32_t block, char *data, bool fresh, uint64_t *print) {
+	struct FileStructure *file = &mainStructure.fileTable[index];
+	uint16_t old_frame = (block < file->numFrames) ? file->frames[block] : FRAME_HOLE;
+	uint32_t old_slot = (old_frame != FRAME_HOLE && file->slots != NULL) ? file->slots[block] : 0;
+	struct timespec start, end;
+	int32_t frame = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	*print = fingerprint_frame(data);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	dedup.nsec += (end.tv_sec - start.tv_sec) * 1000000000LL + (end.tv_nsec - start.tv_nsec);
+	dedup.blocks++;
+
+	//without an index every block is written
+	if(dedup_alloc() == -1 || (frame = dedup_find(data, *print)) == -1) {
+		return (0);
+	}
+	dedup.duplicates++;
+
+	//the frame of the block already holds these bytes
+	if(frame == old_frame && old_slot == 0) {
+		if(fresh == true && journal_map(index, block, frame) == -1) {
+			return (-1);
+		}
+		return (1);
+	}
+
+	//point the block at the frame, its old place is let go once that is logged
+	if(cancel_packed(index, block, &old_frame, &old_slot) == -1 || share_frame(frame) == -1) {
+		return (-1);
+	}
+	if(set_file_frame(index, block, frame) == -1) {
+		unshare_frame(frame);
+		return (-1);
+	}
+	if(journal_map(index, block, frame) == -1) {
+		return (-1);
+	}
+
+	return (release_place(old_frame, old_slot) == -1 ? -1 : 1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : store_block
+// Description  : Write the whole contents of a block. With dedup on a block
+//                matching a stored frame points at it, otherwise it is
+//                compressed into the pack frame when compression is on and it
+//                pays off, or written to the frame of the block. A block
+//                without a frame of its own, or in a frame other blocks point
+//                at, gets one
+//
+// Inputs       : index - index of the file entry
+//                block - block of the file
+//                data - contents of the block
+//                fresh - the frame of the block was just allocated, its map
+//                        record is not logged yet
+// Outputs      : 0 if successful, -1 if failure
+
+int store_block(uint32_t index, uint32_t block, char *data, bool fresh) {
+	struct FileStructure *file = &mainStructure.fileTable[index];
+	uint16_t frame = (block < file->numFrames) ? file->frames[block] : FRAME_HOLE;
+	uint16_t old_frame = FRAME_HOLE;
+	uint32_t old_slot = (frame != FRAME_HOLE && file->slots != NULL) ? file->slots[block] : 0;
+	int32_t new_frame = 0;
+	int ret = 0;
+	uint64_t print = 0; //fingerprint of the block when dedup is on
+
+	if(dedup_mode != CART_DEDUP_OFF && (ret = dedup_block(index, block, data, fresh, &print)) != 0) {
+		return ((ret == -1) ? -1 : 0);
+	}
+
+	//a last block still being filled would leave a dead slot behind every
+	//time it grows, it is compressed once the file has gone past it
+	if(compress_blocks == true && (uint64_t) (block + 1) * CART_FRAME_SIZE <= file->length &&
+			(ret = pack_block(index, block, data)) != 0) {
+		return ((ret == -1) ? -1 : 0);
+	}
+
+	//the block is in a hole, in a shared frame or in a frame other blocks
+	//point at too, give it a frame of its own
+	if(frame == FRAME_HOLE || old_slot != 0 || FRAME_SHARED(frame) == true) {
+		old_frame = frame;
+		if(cancel_packed(index, block, &old_frame, &old_slot) == -1) {
+			return (-1);
+		}
+		new_frame = alloc_frame(file_cart_near(file, block));
+		if(new_frame == -1) {
+			return (-1);
+		}
+		if(set_file_frame(index, block, new_frame) == -1) {
+			free_frame(new_frame);
+			return (-1);
+		}
+		frame = new_frame;
+		fresh = true;
+	}
+	//the old contents leave the index before the frame is written over
+	else {
+		dedup_forget(frame);
+	}
+
+	if(write_data_frame(frame, data) == -1) {
+		return (-1);
+	}
+	cache_frame(frame, data);
+	if(dedup_mode != CART_DEDUP_OFF) {
+		dedup_remember(frame, data, print);
+	}
+
+	//the block is on the cartridge, log the metadata pointing at it
+	if(fresh == true && journal_map(index, block, frame) == -1) {
+		return (-1);
+	}
+
+	return (release_place(old_frame, old_slot));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : unload_file_entry
+// Description  : Empty the entry of an unlinked file so it can be reused
+//
+// Inputs       : index - index of the file entry
+// Outputs      : 0 if successful, -1 if failure
+
+int unload_file_entry(uint32_t index) {
+	struct FileStructure *file = NULL;
+
+	if(index >= mainStructure.files_initialized) {
+		return (-1);
+	}
+
+	//the entry may already be empty when a record is replayed twice
+	file = &mainStructure.fileTable[index];
+	if(file->filled == false) {
+		return (0);
+	}
+
+	hash_remove(index);
+	mainStructure.arenaDead += strlen(&mainStructure.nameArena[file->nameOffset]) + 1;
+	free(file->frames);
+	free(file->slots);
+	file->frames = NULL;
+	file->slots = NULL;
+	file->numFrames = 0;
+	file->capFrames = 0;
+	file->tailFrame = FRAME_HOLE;
+	file->filled = false;
+	file->open = 0;
+
+	return (add_free_file(index));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : abort_checkpoint
+// Description  : Free the frames taken for a checkpoint that was not written
+//
+// Inputs       : frames - the frames
+//                count - number of frames
+// Outputs      : -1
+
+int abort_checkpoint(uint16_t *frames, uint32_t count) {
+	for(uint32_t i = 0; i < count; i++) {
+		free_frame(frames[i]);
+	}
+	free(frames);
+	journal.checkpointing = false;
+
+	return (-1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : write_checkpoint
+// Description  : Write all of the metadata to free data frames and list them
+//                in the unused checkpoint area, then point the superblock at
+//                it, free the frames of the old checkpoint and start a new
+//                journal
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int write_checkpoint(void) {
+	char *ckpt = NULL; //serialized metadata
+	char *cursor = NULL; //where the next field goes
+	char *list = NULL; //contents of the checkpoint area
+	uint16_t *frames = NULL; //data frames the checkpoint goes to
+	uint16_t list_frames[META_CKPT_FRAMES]; //frames of the checkpoint area used
+	uint32_t list_count = 0;
+	char superbuf[CART_FRAME_SIZE];
+	struct SuperBlock super;
+	struct FileStructure *file = NULL;
+	uint32_t area = 1 - journal.ckptArea;
+	uint64_t zeroed = 0;
+	uint32_t num_files = 0;
+	uint32_t index = 0;
+	uint8_t name_length = 0;
+	uint32_t bytes = 0;
+	uint32_t num_frames = 0;
+	uint32_t num_packed = 0;
+	uint32_t num_sums = 0;
+	uint16_t sum_frame = 0;
+	uint32_t list_bytes = 0;
+	int32_t frame = 0;
+
+	//nothing was journaled since the last checkpoint, so it is still current
+	if(journal.generation != 0 && journal.frame == 0 && journal.used == sizeof(struct JournalHeader)) {
+		return (0);
+	}
+
+	//the checkpoint saves the buffered blocks, they have to be on the cartridges
+	journal.checkpointing = true;
+	if(flush_write_buffers() == -1 || flush_pack_frame() == -1) {
+		journal.checkpointing = false;
+		return (-1);
+	}
+
+	//work out the size: zeroed cartridges, number of files, then every file
+	bytes = sizeof(zeroed) + sizeof(num_files);
+	for(uint32_t i = 0; i < mainStructure.files_initialized; i++) {
+		file = &mainStructure.fileTable[i];
+		if(file->filled == true) {
+			bytes += 21 + strlen(&mainStructure.nameArena[file->nameOffset]) + file->numFrames * sizeof(uint16_t) +
+				file_packed_blocks(file) * 8;
+			num_files++;
+		}
+	}
+
+	//then the checksum of every frame that has one, a frame that may not
+	//match its checksum since a crash goes without until it is written
+	for(int i = 0; sums.known != NULL && i < CART_TOTAL_FRAMES / 64; i++) {
+		num_sums += __builtin_popcountll(sums.known[i] & ~sums.unsettled[i]);
+	}
+	bytes += sizeof(num_sums) + num_sums * (sizeof(uint16_t) + sizeof(uint32_t));
+	num_frames = (bytes + CART_FRAME_SIZE - 1) / CART_FRAME_SIZE;
+	list_bytes = sizeof(num_frames) + num_frames * sizeof(uint16_t);
+	if(list_bytes > META_CKPT_FRAMES * CART_FRAME_SIZE) {
+		logMessage(LOG_ERROR_LEVEL, "CART driver metadata does not fit in the checkpoint area");
+		journal.checkpointing = false;
+		return (-1);
+	}
+	for(int i = 0; sums.known != NULL && i < CART_TOTAL_FRAMES / 64; i++) {
+		sums.known[i] &= ~sums.unsettled[i];
+		sums.unsettled[i] = 0;
+	}
+
+	//take the frames, cartridges zeroed meanwhile are saved in the checkpoint
+	journal.checkpointing = true;
+	frames = malloc(num_frames * sizeof(uint16_t));
+	if(frames == NULL) {
+		journal.checkpointing = false;
+		return (-1);
+	}
+	for(uint32_t i = 0; i < num_frames; i++) {
+		frame = alloc_frame(0);
+		if(frame == -1) {
+			logMessage(LOG_ERROR_LEVEL, "CART driver has no free frames for the metadata checkpoint");
+			return (abort_checkpoint(frames, i));
+		}
+		frames[i] = frame;
+	}
+
+	ckpt = calloc(num_frames, CART_FRAME_SIZE);
+	list = calloc((list_bytes + CART_FRAME_SIZE - 1) / CART_FRAME_SIZE, CART_FRAME_SIZE);
+	if(ckpt == NULL || list == NULL) {
+		free(ckpt);
+		free(list);
+		return (abort_checkpoint(frames, num_frames));
+	}
+
+	for(int i = 0; i < CART_MAX_CARTRIDGES; i++) {
+		if(mainStructure.cart_ready[i] == true) {
+			zeroed |= ((uint64_t) 1) << i;
+		}
+	}
+	cursor = ckpt;
+	memcpy(cursor, &zeroed, sizeof(zeroed));
+	cursor += sizeof(zeroed);
+	memcpy(cursor, &num_files, sizeof(num_files));
+	cursor += sizeof(num_files);
+
+	//index, name, length, frame map, packed last block and compressed blocks of
+	//every file, then the frame checksums
+	for(uint32_t i = 0; i < mainStructure.files_initialized; i++) {
+		file = &mainStructure.fileTable[i];
+		if(file->filled == false) {
+			continue;
+		}
+		index = i;
+		name_length = strlen(&mainStructure.nameArena[file->nameOffset]);
+		memcpy(cursor, &index, sizeof(index));
+		cursor += sizeof(index);
+		memcpy(cursor, &name_length, sizeof(name_length));
+		cursor += sizeof(name_length);
+		memcpy(cursor, &mainStructure.nameArena[file->nameOffset], name_length);
+		cursor += name_length;
+		memcpy(cursor, &file->length, sizeof(file->length));
+		cursor += sizeof(file->length);
+		memcpy(cursor, &file->numFrames, sizeof(file->numFrames));
+		cursor += sizeof(file->numFrames);
+		memcpy(cursor, file->frames, file->numFrames * sizeof(uint16_t));
+		cursor += file->numFrames * sizeof(uint16_t);
+		memcpy(cursor, &file->tailFrame, sizeof(file->tailFrame));
+		cursor += sizeof(file->tailFrame);
+		memcpy(cursor, &file->tailOffset, sizeof(file->tailOffset));
+		cursor += sizeof(file->tailOffset);
+		num_packed = file_packed_blocks(file);
+		memcpy(cursor, &num_packed, sizeof(num_packed));
+		cursor += sizeof(num_packed);
+		for(uint32_t j = 0; num_packed > 0 && j < file->numFrames; j++) {
+			if(file->slots[j] != 0) {
+				memcpy(cursor, &j, sizeof(j));
+				memcpy(cursor + sizeof(j), &file->slots[j], sizeof(file->slots[j]));
+				cursor += sizeof(j) + sizeof(file->slots[j]);
+			}
+		}
+	}
+	memcpy(cursor, &num_sums, sizeof(num_sums));
+	cursor += sizeof(num_sums);
+	for(uint32_t i = 0; i < CART_TOTAL_FRAMES; i++) {
+		if(FRAME_SUM_KNOWN(i)) {
+			sum_frame = i;
+			memcpy(cursor, &sum_frame, sizeof(sum_frame));
+			memcpy(cursor + sizeof(sum_frame), &sums.crcs[i], sizeof(uint32_t));
+			cursor += sizeof(sum_frame) + sizeof(uint32_t);
+		}
+	}
+
+	//write the checkpoint frames, then the list of them
+	memcpy(list, &num_frames, sizeof(num_frames));
+	memcpy(&list[sizeof(num_frames)], frames, num_frames * sizeof(uint16_t));
+	for(list_count = 0; list_count * CART_FRAME_SIZE < list_bytes; list_count++) {
+		list_frames[list_count] = META_FRAME(META_CKPT_START(area) + list_count);
+	}
+	if(bus_frame_run(CART_OP_WRFRME, frames, ckpt, num_frames) == -1 ||
+			bus_frame_run(CART_OP_WRFRME, list_frames, list, list_count) == -1) {
+		free(ckpt);
+		free(list);
+		return (abort_checkpoint(frames, num_frames));
+	}
+	free(ckpt);
+	free(list);
+
+	//switch the superblock over to the new checkpoint
+	memset(superbuf, 0, CART_FRAME_SIZE);
+	super.magic = CART_FS_MAGIC;
+	super.generation = journal.generation + 1;
+	super.ckptArea = area;
+	super.ckptBytes = bytes;
+	memcpy(superbuf, &super, sizeof(super));
+	if(write_frame_to_bus(META_FRAME(META_SUPERBLOCK), superbuf) == -1) {
+		return (abort_checkpoint(frames, num_frames));
+	}
+
+	//the old checkpoint is not needed any more
+	for(uint32_t i = 0; i < journal.numCkptFrames; i++) {
+		free_frame(journal.ckptFrames[i]);
+	}
+	free(journal.ckptFrames);
+	journal.ckptFrames = frames;
+	journal.numCkptFrames = num_frames;
+	journal.checkpointing = false;
+
+	//records from older generations are ignored from now on
+	journal.generation = super.generation;
+	journal.ckptArea = area;
+	journal.frame = 0;
+	journal.used = sizeof(struct JournalHeader);
+	journal.dirty = false;
+	if(sums.known != NULL) {
+		memcpy(sums.saved, sums.known, (CART_TOTAL_FRAMES / 64) * sizeof(uint64_t));
+		memset(sums.journaled, 0, (CART_TOTAL_FRAMES / 64) * sizeof(uint64_t));
+	}
+	free_pending_frames();
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : journal_flush
+// Description  : Write the journal frame being filled to the metadata
+//                cartridge, committing every record added so far
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int journal_flush(void) {
+	struct JournalHeader header;
+
+	//nothing new since the last commit
+	if(journal.dirty == false) {
+		return (0);
+	}
+
+	header.magic = CART_JOURNAL_MAGIC;
+	header.generation = journal.generation;
+	header.index = journal.frame;
+	header.used = journal.used;
+	header.unused = 0;
+	memcpy(journal.buf, &header, sizeof(header));
+
+	if(write_frame_to_bus(META_FRAME(META_JOURNAL_START + journal.frame), journal.buf) == -1) {
+		return (-1);
+	}
+	journal.dirty = false;
+	free_pending_frames();
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : journal_append
+// Description  : Add a record to the metadata journal, the record is only
+//                written when the journal frame fills up or is flushed
+//
+// Inputs       : type - the type of record
+//                data - the fields of the record
+//                size - size of the fields
+// Outputs      : 0 if successful, -1 if failure
+
+int journal_append(JournalRecordType type, void *data, int size) {
+
+	//the checkpoint being written already has the change
+	if(journal.checkpointing == true) {
+		return (0);
+	}
+
+	//frame is full, commit it and move on to the next journal frame
+	if(journal.used + 1 + size > CART_FRAME_SIZE) {
+		if(journal_flush() == -1) {
+			return (-1);
+		}
+		journal.frame++;
+		journal.used = sizeof(struct JournalHeader);
+
+		//journal ring is full, start a new journal after a checkpoint, the
+		//record is added to it too since its change may not be made yet
+		if(journal.frame == META_JOURNAL_FRAMES) {
+			if(write_checkpoint() == -1) {
+				return (-1);
+			}
+		}
+	}
+
+	journal.buf[journal.used] = type;
+	memcpy(&journal.buf[journal.used + 1], data, size);
+	journal.used += 1 + size;
+	journal.dirty = true;
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : journal_map
+// Description  : Add the record for a block of a file being pointed at a frame
+//
+// Inputs       : index - index of the file entry
+//                block - block of the file
+//                frame - global frame number
+// Outputs      : 0 if successful, -1 if failure
+
+int journal_map(uint32_t index, uint32_t block, uint16_t frame) {
+	char record[10];
+
+	memcpy(&record[0], &index, sizeof(index));
+	memcpy(&record[4], &block, sizeof(block));
+	memcpy(&record[8], &frame, sizeof(frame));
+
+	return (journal_append(JREC_MAP, record, sizeof(record)));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : journal_length
+// Description  : Add the record for the length of a file changing
+//
+// Inputs       : index - index of the file entry
+//                length - new length of the file
+// Outputs      : 0 if successful, -1 if failure
+
+int journal_length(uint32_t index, uint32_t length) {
+	char record[8];
+
+	memcpy(&record[0], &index, sizeof(index));
+	memcpy(&record[4], &length, sizeof(length));
+
+	return (journal_append(JREC_LENGTH, record, sizeof(record)));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : journal_record_size
+// Description  : Work out how long the journal record at a position is, the
+//                whole record has to be in the bytes of the frame
+//
+// Inputs       : records - the records of the frame
+//                pos - where the record starts
+//                size - number of bytes of records
+// Outputs      : size of the record, -1 if it is unknown or cut short
+
+int journal_record_size(char *records, int pos, int size) {
+	uint8_t name_length = 0;
+	int record = 0;
+
+	switch(records[pos]) {
+		case JREC_CREATE:
+			if(pos + 6 > size) {
+				return (-1);
+			}
+			//the name has to fit in a path
+			memcpy(&name_length, &records[pos + 5], sizeof(name_length));
+			if(name_length >= CART_MAX_PATH_LENGTH) {
+				return (-1);
+			}
+			record = 6 + name_length;
+			break;
+		case JREC_MAP:
+			record = 11;
+			break;
+		case JREC_LENGTH:
+		case JREC_TAIL:
+			record = 9;
+			break;
+		case JREC_ZEROED:
+			record = 1 + sizeof(CartridgeIndex);
+			break;
+		case JREC_UNLINK:
+			record = 5;
+			break;
+		case JREC_TRUNCATE:
+			record = 13;
+			break;
+		case JREC_PACK:
+			record = 15;
+			break;
+		case JREC_CRC:
+			record = 7;
+			break;
+		default:
+			return (-1);
+	}
+
+	if(pos + record > size) {
+		return (-1);
+	}
+
+	return (record);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : replay_journal_frame
+// Description  : Apply the records of one journal frame to the metadata
+//
+// Inputs       : records - the records of the frame
+//                size - number of bytes of records
+// Outputs      : 0 if successful, -1 if failure
+
+int replay_journal_frame(char *records, int size) {
+	char name[CART_MAX_PATH_LENGTH];
+	int pos = 0;
+	int record = 0;
+	uint32_t index = 0;
+	uint32_t block = 0;
+	uint32_t length = 0;
+	uint16_t frame = 0;
+	uint16_t offset = 0;
+	uint32_t slot = 0;
+	uint8_t name_length = 0;
+	CartridgeIndex cart = 0;
+	struct FileStructure *file = NULL;
+
+	while(pos < size) {
+		record = journal_record_size(records, pos, size);
+		if(record == -1) {
+			return (-1);
+		}
+
+		switch(records[pos]) {
+			case JREC_CREATE:
+				memcpy(&index, &records[pos + 1], sizeof(index));
+				memcpy(&name_length, &records[pos + 5], sizeof(name_length));
+				memcpy(name, &records[pos + 6], name_length);
+				name[name_length] = 0x0;
+				if(load_file_entry(index, name) == -1) {
+					return (-1);
+				}
+				break;
+
+			case JREC_MAP:
+				memcpy(&index, &records[pos + 1], sizeof(index));
+				memcpy(&block, &records[pos + 5], sizeof(block));
+				memcpy(&frame, &records[pos + 9], sizeof(frame));
+				if(set_file_frame(index, block, frame) == -1) {
+					return (-1);
+				}
+				break;
+
+			case JREC_LENGTH:
+				memcpy(&index, &records[pos + 1], sizeof(index));
+				memcpy(&length, &records[pos + 5], sizeof(length));
+				if(index >= mainStructure.files_initialized) {
+					return (-1);
+				}
+				mainStructure.fileTable[index].length = length;
+				break;
+
+			case JREC_ZEROED:
+				memcpy(&cart, &records[pos + 1], sizeof(cart));
+				if(cart >= CART_MAX_CARTRIDGES) {
+					return (-1);
+				}
+				mainStructure.cart_ready[cart] = true;
+				break;
+
+			case JREC_UNLINK:
+				memcpy(&index, &records[pos + 1], sizeof(index));
+				if(unload_file_entry(index) == -1) {
+					return (-1);
+				}
+				break;
+
+			case JREC_TRUNCATE:
+				memcpy(&index, &records[pos + 1], sizeof(index));
+				memcpy(&block, &records[pos + 5], sizeof(block));
+				memcpy(&length, &records[pos + 9], sizeof(length));
+				if(index >= mainStructure.files_initialized || mainStructure.fileTable[index].filled == false) {
+					return (-1);
+				}
+				if(block < mainStructure.fileTable[index].numFrames) {
+					mainStructure.fileTable[index].numFrames = block;
+				}
+				mainStructure.fileTable[index].length = length;
+				break;
+
+			case JREC_TAIL:
+				memcpy(&index, &records[pos + 1], sizeof(index));
+				memcpy(&frame, &records[pos + 5], sizeof(frame));
+				memcpy(&offset, &records[pos + 7], sizeof(offset));
+				if(index >= mainStructure.files_initialized || mainStructure.fileTable[index].filled == false ||
+						!FILE_FRAME_OK(frame) || offset >= CART_FRAME_SIZE) {
+					return (-1);
+				}
+				file = &mainStructure.fileTable[index];
+				file->tailFrame = frame;
+				file->tailOffset = offset;
+				//a packed last block is not in the frame map
+				if(frame != FRAME_HOLE && file->numFrames > file->length / CART_FRAME_SIZE) {
+					file->numFrames = file->length / CART_FRAME_SIZE;
+				}
+				break;
+
+			case JREC_PACK:
+				memcpy(&index, &records[pos + 1], sizeof(index));
+				memcpy(&block, &records[pos + 5], sizeof(block));
+				memcpy(&frame, &records[pos + 9], sizeof(frame));
+				memcpy(&slot, &records[pos + 11], sizeof(slot));
+				if(set_file_slot(index, block, frame, slot) == -1) {
+					return (-1);
+				}
+				break;
+
+			//the frame was written after the checkpoint, maybe more than once,
+			//it is taken as it is the next time it is read
+			case JREC_CRC:
+				if(sums_alloc() == -1) {
+					return (-1);
+				}
+				memcpy(&frame, &records[pos + 1], sizeof(frame));
+				memcpy(&sums.crcs[frame], &records[pos + 3], sizeof(uint32_t));
+				SET_FRAME_BIT(sums.known, frame);
+				SET_FRAME_BIT(sums.journaled, frame);
+				SET_FRAME_BIT(sums.unsettled, frame);
+				break;
+
+			//unknown record, the frame is damaged
+			default:
+				return (-1);
+		}
+		pos += record;
+	}
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : format_filesystem
+// Description  : Zero the metadata cartridge and write an empty checkpoint
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int format_filesystem(void) {
+	//zero the metadata cartridge
+	if(load_cartridge(FRAME_CART(META_FRAME(0))) == -1 ||
+			driver_bus_request(CART_OP_BZERO, FRAME_CART(META_FRAME(0)), 0, NULL) == -1) {
+		return (-1);
+	}
+
+	//the first checkpoint goes to area 0 with generation 1
+	journal.generation = 0;
+	journal.ckptArea = 1;
+	free(journal.ckptFrames);
+	journal.ckptFrames = NULL;
+	journal.numCkptFrames = 0;
+
+	return (write_checkpoint());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : read_checkpoint_field
+// Description  : Copy the next field of a checkpoint and move past it, the
+//                field has to be in the bytes of the checkpoint
+//
+// Inputs       : cursor - where the field starts, moved past it
+//                end - end of the checkpoint bytes
+//                field - where to copy the field
+//                bytes - size of the field
+// Outputs      : 0 if successful, -1 if the checkpoint ends first
+
+int read_checkpoint_field(char **cursor, char *end, void *field, size_t bytes) {
+	if(bytes > (size_t) (end - *cursor)) {
+		return (-1);
+	}
+	memcpy(field, *cursor, bytes);
+	*cursor += bytes;
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : load_checkpoint
+// Description  : Load the zeroed cartridges, the files and the frame checksums
+//                of a checkpoint, checking every index and count it holds
+//
+// Inputs       : ckpt - the checkpoint
+//                bytes - number of bytes of the checkpoint
+// Outputs      : 0 if successful, -1 if the checkpoint is damaged
+
+int load_checkpoint(char *ckpt, uint32_t bytes) {
+	struct FileStructure *file = NULL;
+	char *cursor = ckpt;
+	char *end = ckpt + bytes;
+	char name[CART_MAX_PATH_LENGTH];
+	uint64_t zeroed = 0;
+	uint32_t num_files = 0;
+	uint32_t num_packed = 0;
+	uint32_t num_sums = 0;
+	uint32_t index = 0;
+	uint32_t block = 0;
+	uint32_t slot = 0;
+	uint16_t frame_number = 0;
+	uint8_t name_length = 0;
+
+	if(read_checkpoint_field(&cursor, end, &zeroed, sizeof(zeroed)) == -1 ||
+			read_checkpoint_field(&cursor, end, &num_files, sizeof(num_files)) == -1) {
+		return (-1);
+	}
+	for(int i = 0; i < CART_MAX_CARTRIDGES; i++) {
+		mainStructure.cart_ready[i] = (zeroed >> i) & 1;
+	}
+	for(uint32_t i = 0; i < num_files; i++) {
+		if(read_checkpoint_field(&cursor, end, &index, sizeof(index)) == -1 ||
+				read_checkpoint_field(&cursor, end, &name_length, sizeof(name_length)) == -1 ||
+				name_length >= CART_MAX_PATH_LENGTH ||
+				read_checkpoint_field(&cursor, end, name, name_length) == -1) {
+			return (-1);
+		}
+		name[name_length] = 0x0;
+		if(load_file_entry(index, name) == -1) {
+			return (-1);
+		}
+		file = &mainStructure.fileTable[index];
+		if(read_checkpoint_field(&cursor, end, &file->length, sizeof(file->length)) == -1 ||
+				read_checkpoint_field(&cursor, end, &file->numFrames, sizeof(file->numFrames)) == -1 ||
+				file->numFrames > CART_MAX_FILE_BLOCKS ||
+				file->numFrames * sizeof(uint16_t) > (size_t) (end - cursor)) {
+			file->numFrames = 0;
+			return (-1);
+		}
+		file->capFrames = (file->numFrames == 0) ? 8 : file->numFrames;
+		file->frames = malloc(file->capFrames * sizeof(uint16_t));
+		if(file->frames == NULL) {
+			return (-1);
+		}
+		read_checkpoint_field(&cursor, end, file->frames, file->numFrames * sizeof(uint16_t));
+		for(uint32_t j = 0; j < file->numFrames; j++) {
+			if(!FILE_FRAME_OK(file->frames[j])) {
+				return (-1);
+			}
+		}
+		if(read_checkpoint_field(&cursor, end, &file->tailFrame, sizeof(file->tailFrame)) == -1 ||
+				read_checkpoint_field(&cursor, end, &file->tailOffset, sizeof(file->tailOffset)) == -1 ||
+				read_checkpoint_field(&cursor, end, &num_packed, sizeof(num_packed)) == -1 ||
+				!FILE_FRAME_OK(file->tailFrame) || file->tailOffset >= CART_FRAME_SIZE ||
+				num_packed > file->numFrames) {
+			return (-1);
+		}
+		if(num_packed > 0) {
+			file->slots = calloc(file->capFrames, sizeof(uint32_t));
+			if(file->slots == NULL) {
+				return (-1);
+			}
+		}
+		for(uint32_t j = 0; j < num_packed; j++) {
+			if(read_checkpoint_field(&cursor, end, &block, sizeof(block)) == -1 ||
+					read_checkpoint_field(&cursor, end, &slot, sizeof(slot)) == -1 ||
+					block >= file->numFrames || slot_valid(file->frames[block], slot) == false) {
+				return (-1);
+			}
+			file->slots[block] = slot;
+		}
+	}
+
+	//checksums of the frames, the journal brings them up to date, any 16 bit
+	//frame number is in the tables
+	sums_release();
+	if(read_checkpoint_field(&cursor, end, &num_sums, sizeof(num_sums)) == -1 ||
+			(num_sums > 0 && sums_alloc() == -1)) {
+		return (-1);
+	}
+	for(uint32_t i = 0; i < num_sums; i++) {
+		if(read_checkpoint_field(&cursor, end, &frame_number, sizeof(frame_number)) == -1 ||
+				read_checkpoint_field(&cursor, end, &sums.crcs[frame_number], sizeof(uint32_t)) == -1) {
+			return (-1);
+		}
+		SET_FRAME_BIT(sums.known, frame_number);
+	}
+	if(sums.known != NULL) {
+		memcpy(sums.saved, sums.known, (CART_TOTAL_FRAMES / 64) * sizeof(uint64_t));
+	}
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : mount_filesystem
+// Description  : Load the metadata left on the cartridges by an earlier
+//                poweroff, or format them if there is none
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int mount_filesystem(void) {
+	char frame[CART_FRAME_SIZE];
+	struct SuperBlock super;
+	struct JournalHeader header;
+	struct FileStructure *file = NULL;
+	struct timeval start, now;
+	char *ckpt = NULL;
+	uint16_t *frames = NULL;
+	uint16_t list_frames[META_CKPT_FRAMES];
+	uint32_t list_count = 0;
+	uint32_t meta_frames = 0;
+	uint32_t num_frames = 0;
+	uint32_t num_files = 0;
+
+	gettimeofday(&start, NULL);
+
+	//look for a superblock
+	if(read_frame_from_bus(META_FRAME(META_SUPERBLOCK), frame) == -1) {
+		return (-1);
+	}
+	meta_frames++;
+	memcpy(&super, frame, sizeof(super));
+	if(super.magic != CART_FS_MAGIC || super.ckptArea > 1) {
+		logMessage(LOG_INFO_LEVEL, "CART driver found no filesystem, formatting");
+		return (format_filesystem());
+	}
+
+	//read the list of checkpoint frames from the checkpoint area
+	if(read_frame_from_bus(META_FRAME(META_CKPT_START(super.ckptArea)), frame) == -1) {
+		return (-1);
+	}
+	meta_frames++;
+	memcpy(&num_frames, frame, sizeof(num_frames));
+	if(num_frames * CART_FRAME_SIZE < super.ckptBytes ||
+			sizeof(num_frames) + num_frames * sizeof(uint16_t) > META_CKPT_FRAMES * CART_FRAME_SIZE) {
+		logMessage(LOG_ERROR_LEVEL, "CART driver checkpoint area is damaged");
+		return (-1);
+	}
+	frames = malloc(num_frames * sizeof(uint16_t) + CART_FRAME_SIZE);
+	ckpt = calloc(num_frames, CART_FRAME_SIZE);
+	if(frames == NULL || ckpt == NULL) {
+		free(frames);
+		free(ckpt);
+		return (-1);
+	}
+	memcpy(frames, &frame[sizeof(num_frames)], CART_FRAME_SIZE - sizeof(num_frames));
+	for(uint32_t i = 1; i * CART_FRAME_SIZE < sizeof(num_frames) + num_frames * sizeof(uint16_t); i++) {
+		list_frames[list_count++] = META_FRAME(META_CKPT_START(super.ckptArea) + i);
+	}
+
+	//read the rest of the list, then the checkpoint, nothing has a checksum yet
+	if(bus_frame_run(CART_OP_RDFRME, list_frames, (char *) frames + CART_FRAME_SIZE - sizeof(num_frames), list_count) == -1 ||
+			bus_frame_run(CART_OP_RDFRME, frames, ckpt, num_frames) == -1) {
+		free(frames);
+		free(ckpt);
+		return (-1);
+	}
+	meta_frames += list_count + num_frames;
+	free(journal.ckptFrames);
+	journal.ckptFrames = frames;
+	journal.numCkptFrames = num_frames;
+
+	//load the zeroed cartridges, every file and the checksums of the frames
+	if(load_checkpoint(ckpt, super.ckptBytes) == -1) {
+		logMessage(LOG_ERROR_LEVEL, "CART driver checkpoint is damaged, not mounting");
+		free(ckpt);
+		return (-1);
+	}
+	free(ckpt);
+
+	//replay the journal frames written since the checkpoint
+	journal.generation = super.generation;
+	journal.ckptArea = super.ckptArea;
+	journal.frame = 0;
+	journal.used = sizeof(struct JournalHeader);
+	journal.dirty = false;
+	for(uint32_t i = 0; i < META_JOURNAL_FRAMES; i++) {
+		if(read_frame_from_bus(META_FRAME(META_JOURNAL_START + i), frame) == -1) {
+			return (-1);
+		}
+		meta_frames++;
+		memcpy(&header, frame, sizeof(header));
+		if(header.magic != CART_JOURNAL_MAGIC || header.generation != journal.generation || header.index != i ||
+				header.used > CART_FRAME_SIZE) {
+			break;
+		}
+		//a frame replayed part way leaves the metadata half changed, do not mount it
+		if(replay_journal_frame(&frame[sizeof(header)], header.used - sizeof(header)) == -1) {
+			logMessage(LOG_ERROR_LEVEL, "CART driver journal frame %u is damaged, not mounting", i);
+			return (-1);
+		}
+
+		//keep appending to the last journal frame
+		memcpy(journal.buf, frame, CART_FRAME_SIZE);
+		journal.frame = i;
+		journal.used = header.used;
+	}
+
+	//start the zeroed cartridges empty, except for the checkpoint frames
+	for(int i = 0; i < CART_DATA_CARTRIDGES; i++) {
+		if(mainStructure.cart_ready[i] == true) {
+			memset(&mainStructure.frameUsed[i * (CART_CARTRIDGE_SIZE / 64)], 0, CART_CARTRIDGE_SIZE / 8);
+		}
+	}
+	for(uint32_t j = 0; j < journal.numCkptFrames; j++) {
+		mainStructure.frameUsed[journal.ckptFrames[j] / 64] |= ((uint64_t) 1) << (journal.ckptFrames[j] % 64);
+	}
+
+	//mark the frames of every file as used, and list the empty entries
+	num_files = 0;
+	mainStructure.numFreeFiles = 0;
+	for(uint32_t i = mainStructure.files_initialized; i > 0; i--) {
+		file = &mainStructure.fileTable[i - 1];
+		if(file->filled == false) {
+			if(add_free_file(i - 1) == -1) {
+				return (-1);
+			}
+			continue;
+		}
+		for(uint32_t j = 0; j < file->numFrames; j++) {
+			if(file->frames[j] == FRAME_HOLE) {
+				continue;
+			}
+			//a frame of its own already marked is pointed at by another block too
+			if(BLOCK_PACKED(file, j) == false &&
+					(mainStructure.frameUsed[file->frames[j] / 64] & (((uint64_t) 1) << (file->frames[j] % 64))) &&
+					share_frame(file->frames[j]) == -1) {
+				return (-1);
+			}
+			mainStructure.frameUsed[file->frames[j] / 64] |= ((uint64_t) 1) << (file->frames[j] % 64);
+			//a compressed block may go on in the next frame
+			if(BLOCK_PACKED(file, j) == true) {
+				if(SLOT_OFFSET(file->slots[j]) + SLOT_BYTES(file->slots[j]) > CART_FRAME_SIZE) {
+					claim_frame(file->frames[j] + 1);
+				}
+				if(claim_slot(file->frames[j], file->slots[j]) == -1) {
+					return (-1);
+				}
+			}
+		}
+		if(file->tailFrame != FRAME_HOLE) {
+			mainStructure.frameUsed[file->tailFrame / 64] |= ((uint64_t) 1) << (file->tailFrame % 64);
+			if(claim_shared(file->tailFrame, file->length % CART_FRAME_SIZE) == -1) {
+				return (-1);
+			}
+		}
+		num_files++;
+	}
+
+	//frames let go of since the checksums were saved have none
+	for(int i = 0; sums.known != NULL && i < CART_TOTAL_FRAMES / 64; i++) {
+		sums.known[i] &= mainStructure.frameUsed[i];
+		sums.journaled[i] &= mainStructure.frameUsed[i];
+		sums.unsettled[i] &= mainStructure.frameUsed[i];
+	}
+
+	gettimeofday(&now, NULL);
+	logMessage(LOG_INFO_LEVEL, "CART driver mounted %u files from %u metadata frames in %ld usec",
+		num_files, meta_frames, compareTimes(&start, &now));
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : file_cart_loads
+// Description  : Count the cartridge loads needed to read a file from start
+//                to end, one for every run of frames on the same cartridge
+//
+// Inputs       : file - the file
+// Outputs      : number of loads
+
+uint32_t file_cart_loads(struct FileStructure *file) {
+	uint32_t loads = 0;
+	uint16_t last = FRAME_HOLE; //last frame of the file before this block
+
+	//holes are read without going to a cartridge
+	for(uint32_t i = 0; i < file->numFrames; i++) {
+		if(file->frames[i] == FRAME_HOLE) {
+			continue;
+		}
+		if(last == FRAME_HOLE || FRAME_CART(file->frames[i]) != FRAME_CART(last)) {
+			loads++;
+		}
+		last = file->frames[i];
+	}
+
+	return (loads);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : file_is_fragmented
+// Description  : Check if some cartridge sized run of blocks of a file is
+//                spread over more than one cartridge
+//
+// Inputs       : file - the file
+// Outputs      : true if the file can be made contiguous, false if not
+
+bool file_is_fragmented(struct FileStructure *file) {
+	uint16_t last = FRAME_HOLE; //last frame of the run before this block
+
+	//striped files are spread over the cartridges on purpose
+	if(stripe_width > 1) {
+		return (false);
+	}
+
+	for(uint32_t i = 0; i < file->numFrames; i++) {
+		if(i % CART_CARTRIDGE_SIZE == 0) {
+			last = FRAME_HOLE;
+		}
+		//compressed blocks and frames other blocks point at stay where they are
+		if(file->frames[i] == FRAME_HOLE || BLOCK_PACKED(file, i) == true || FRAME_SHARED(file->frames[i]) == true) {
+			continue;
+		}
+		if(last != FRAME_HOLE && FRAME_CART(file->frames[i]) != FRAME_CART(last)) {
+			return (true);
+		}
+		last = file->frames[i];
+	}
+
+	return (false);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : defrag_pick_target
+// Description  : Choose the cartridge to gather a run of blocks on, the one
+//                already holding most of them that has room for the rest
+//
+// Inputs       : file - the file
+//                start - first block of the run
+//                end - block after the last block of the run
+// Outputs      : the cartridge, -1 if no cartridge has room
+
+int32_t defrag_pick_target(struct FileStructure *file, uint32_t start, uint32_t end) {
+	int count[CART_MAX_CARTRIDGES];
+	int needed = 0; //blocks of the run that are not holes
+	int32_t target = -1;
+
+	memset(count, 0, sizeof(count));
+	for(uint32_t i = start; i < end; i++) {
+		if(file->frames[i] != FRAME_HOLE && BLOCK_PACKED(file, i) == false && FRAME_SHARED(file->frames[i]) == false) {
+			count[FRAME_CART(file->frames[i])]++;
+			needed++;
+		}
+	}
+
+	for(int cart = 0; cart < CART_DATA_CARTRIDGES; cart++) {
+		if(count[cart] + free_frames_in_cart(cart) >= needed) {
+			if(target == -1 || count[cart] > count[target]) {
+				target = cart;
+			}
+		}
+	}
+
+	return (target);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : defrag_commit_batch
+// Description  : Read the frames of the batch that were not cached, write
+//                them all to the target cartridge, point the file at the
+//                copies and free the old frames once the new mappings are in
+//                the journal
+//
+// Inputs       : none
+// Outputs      : number of frames moved if successful, -1 if failure
+
+int32_t defrag_commit_batch(void) {
+	struct FileStructure *file = &mainStructure.fileTable[batch.file];
+	uint16_t frames[DEFRAG_BATCH];
+	void *bufs[DEFRAG_BATCH];
+	uint32_t crcs[DEFRAG_BATCH];
+	int32_t new_frame = 0;
+	int moved = 0;
+	int n = 0;
+	bool logged = true;
+
+	//read the frames that were not in the cache together
+	for(int i = 0; i < batch.count; i++) {
+		if(batch.cached[i] == false) {
+			frames[n] = batch.old[i];
+			bufs[n++] = batch.data[i];
+		}
+	}
+	if(bus_frames(CART_OP_RDFRME, frames, bufs, n) == -1) {
+		batch.count = 0;
+		return (-1);
+	}
+	for(int i = 0; i < batch.count; i++) {
+		if(batch.cached[i] == false && sums.on == true && FRAME_SUM_KNOWN(batch.old[i]) &&
+				verify_frame(batch.old[i], batch.data[i]) == -1) {
+			batch.count = 0;
+			return (-1);
+		}
+	}
+
+	//take the new frames and log their checksums, then write them together
+	for(moved = 0; moved < batch.count; moved++) {
+		new_frame = alloc_frame_in_cart(batch.target);
+		if(new_frame == -1) {
+			break;
+		}
+		if(log_data_frame(new_frame, batch.data[moved], &crcs[moved]) == -1) {
+			free_frame(new_frame);
+			break;
+		}
+		frames[moved] = new_frame;
+	}
+	if(bus_frame_run(CART_OP_WRFRME, frames, batch.data[0], moved) == -1) {
+		for(int i = 0; i < moved; i++) {
+			free_frame(frames[i]);
+		}
+		moved = 0;
+	}
+
+	for(int i = 0; i < moved; i++) {
+		settle_data_frame(frames[i], crcs[i]);
+
+		//keep a cached copy under its new frame
+		if(get_cart_cache(FRAME_CART(batch.old[i]), FRAME_NUM(batch.old[i])) != NULL) {
+			delete_cart_cache(FRAME_CART(batch.old[i]), FRAME_NUM(batch.old[i]));
+			insert_into_cache(frames[i], batch.data[i]);
+		}
+
+		file->frames[batch.block[i]] = frames[i];
+		if(journal_map(batch.file, batch.block[i], frames[i]) == -1) {
+			logged = false;
+		}
+	}
+	batch.count = 0;
+
+	//the old frames are only reused once the new mappings are on the cartridges
+	if(moved > 0) {
+		if(logged == false || journal_flush() == -1) {
+			return (-1);
+		}
+		for(int i = 0; i < moved; i++) {
+			dedup_forget(batch.old[i]);
+			free_frame(batch.old[i]);
+		}
+	}
+
+	return (moved);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : defrag_add_to_batch
+// Description  : Add a block of a file to the batch of frames to move,
+//                writing the batch out first if it is full or going elsewhere
+//
+// Inputs       : index - index of the file in the file table
+//                block - block of the file to move
+//                target - cartridge to move the block to
+// Outputs      : frames moved by writing out the batch, -1 if failure
+
+int32_t defrag_add_to_batch(uint32_t index, uint32_t block, CartridgeIndex target) {
+	uint16_t frame = mainStructure.fileTable[index].frames[block];
+	char *cachebuf = NULL; //buffer used to check the cache
+	int32_t moved = 0;
+
+	if(batch.count == DEFRAG_BATCH || (batch.count > 0 && (batch.file != index || batch.target != target))) {
+		moved = defrag_commit_batch();
+		if(moved == -1) {
+			return (-1);
+		}
+	}
+
+	//the frames of the batch are only allocated once a frame is moved
+	if(batch.data == NULL) {
+		batch.data = malloc(DEFRAG_BATCH * CART_FRAME_SIZE);
+		if(batch.data == NULL) {
+			return (-1);
+		}
+	}
+
+	//take the frame from the cache if it is there, the others are read when
+	//the batch is written out
+	cachebuf = get_cart_cache(FRAME_CART(frame), FRAME_NUM(frame));
+	batch.cached[batch.count] = (cachebuf != NULL);
+	if(cachebuf != NULL) {
+		memcpy(batch.data[batch.count], cachebuf, CART_FRAME_SIZE);
+	}
+
+	batch.file = index;
+	batch.target = target;
+	batch.block[batch.count] = block;
+	batch.old[batch.count] = frame;
+	batch.count++;
+
+	return (moved);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_defrag
+// Description  : Move up to "budget" frames so that every cartridge sized run
+//                of blocks of a file sits on a single cartridge, continuing
+//                where the last call stopped
+//
+// Inputs       : budget - most frames to move
+// Outputs      : number of frames moved, 0 when nothing is left to do, -1 if
+//                failure
+
+int32_t cart_defrag(uint32_t budget) {
+	uint32_t picked = 0; //frames picked to be moved
+	int32_t moved = 0; //frames actually moved
+	int32_t ret = 0;
+	uint32_t scanned = 0; //files looked at while searching for fragmented ones
+	struct FileStructure *file = NULL;
+
+	//fail if the cart is not on
+	if(mainStructure.cart_is_on == false) {
+		return (-1);
+	}
+
+	while(picked < budget) {
+		//find the next fragmented file
+		if(defrag.file == -1) {
+			while(scanned < mainStructure.files_initialized) {
+				if(defrag.next_file >= mainStructure.files_initialized) {
+					defrag.next_file = 0;
+				}
+				file = &mainStructure.fileTable[defrag.next_file];
+				scanned++;
+				//a file with buffered writes is left until they are written
+				if(file->filled == true && file->buffered > 0 && file_is_fragmented(file) == true) {
+					defrag.skipped = true;
+				}
+				else if(file->filled == true && file->buffered == 0 && file_is_fragmented(file) == true) {
+					defrag.file = defrag.next_file;
+					defrag.block = 0;
+					defrag.segment_end = 0;
+					break;
+				}
+				defrag.next_file++;
+			}
+
+			//every file has been looked at
+			if(defrag.file == -1) {
+				break;
+			}
+		}
+
+		file = &mainStructure.fileTable[defrag.file];
+
+		//done with this file, or come back to it once its writes are on the cartridge
+		if(file->filled == true && file->buffered > 0) {
+			defrag.skipped = true;
+		}
+		if(file->filled == false || file->buffered > 0 || defrag.block >= file->numFrames) {
+			defrag.next_file = defrag.file + 1;
+			defrag.file = -1;
+			continue;
+		}
+
+		//choose where the next run of blocks goes, the frames already picked
+		//have to be written first so the free space is counted right
+		if(defrag.block >= defrag.segment_end) {
+			if(batch.count > 0) {
+				if((ret = defrag_commit_batch()) == -1) {
+					return (-1);
+				}
+				moved += ret;
+			}
+			defrag.segment_end = defrag.block + CART_CARTRIDGE_SIZE;
+			if(defrag.segment_end > file->numFrames) {
+				defrag.segment_end = file->numFrames;
+			}
+			defrag.target = defrag_pick_target(file, defrag.block, defrag.segment_end);
+		}
+
+		if(defrag.target != -1 && file->frames[defrag.block] != FRAME_HOLE && BLOCK_PACKED(file, defrag.block) == false &&
+				FRAME_SHARED(file->frames[defrag.block]) == false && FRAME_CART(file->frames[defrag.block]) != defrag.target) {
+			if((ret = defrag_add_to_batch(defrag.file, defrag.block, defrag.target)) == -1) {
+				batch.count = 0;
+				return (-1);
+			}
+			moved += ret;
+			picked++;
+		}
+		defrag.block++;
+	}
+
+	//write out the rest of the batch, nothing is kept between calls
+	if(batch.count > 0) {
+		if((ret = defrag_commit_batch()) == -1) {
+			return (-1);
+		}
+		moved += ret;
+	}
+
+	//nothing to move until a file grows onto another cartridge
+	if(picked == 0) {
+		defrag.clean = true;
+	}
+	defrag.moved += moved;
+
+	return (moved);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_set_defrag_budget
+// Description  : Set how many frames are moved in the background after every
+//                read and write, 0 turns background defragmenting off
+//
+// Inputs       : budget - frames to move per call
+// Outputs      : 0 if successful
+
+int32_t cart_set_defrag_budget(uint32_t budget) {
+	defrag.budget = budget;
+	defrag.clean = false;
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_set_tail_packing
+// Description  : Set the longest last block of a file that is packed into a
+//                shared frame when the file is closed, 0 turns packing off
+//
+// Inputs       : max - bytes, at most one frame
+// Outputs      : 0 if successful, -1 if failure
+
+int32_t cart_set_tail_packing(uint32_t max) {
+	if(max >= CART_FRAME_SIZE) {
+		return (-1);
+	}
+	tail_pack_max = max;
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_set_compression
+// Description  : Turn on or off compressing the blocks written from now on,
+//                blocks already stored stay as they are until written again
+//
+// Inputs       : on - 0 to turn it off, anything else to turn it on
+// Outputs      : 0 if successful, -1 if failure
+
+int32_t cart_set_compression(uint32_t on) {
+	//blocks waiting in the pack frame are written before it is left alone
+	if(on == 0 && mainStructure.cart_is_on == true && flush_pack_frame() == -1) {
+		return (-1);
+	}
+	compress_blocks = (on != 0);
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_set_stripes
+// Description  : Set how many cartridges the blocks written from now on are
+//                spread over, block b of a file going on the b % width'th
+//                cartridge of its stripe, blocks already stored stay where
+//                they are
+//
+// Inputs       : width - cartridges, 0 or 1 keeps the blocks of a file together
+// Outputs      : 0 if successful, -1 if failure
+
+int32_t cart_set_stripes(uint32_t width) {
+	if(width > CART_DATA_CARTRIDGES) {
+		return (-1);
+	}
+	stripe_width = (width == 0) ? 1 : width;
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_set_partial_writes
+// Description  : Turn on or off sending only the bytes of a small write to a
+//                block that is not cached, on servers taking partial frame
+//                writes. It is only used with checksums, compression and
+//                dedup off, they need the whole frame
+//
+// Inputs       : on - 0 to turn it off, anything else to turn it on
+// Outputs      : 0 if successful
+
+int32_t cart_set_partial_writes(uint32_t on) {
+	partial_writes = (on != 0);
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_set_dedup
+// Description  : Set how the blocks written from now on are deduplicated,
+//                frames already shared stay shared
+//
+// Inputs       : mode - CART_DEDUP_OFF, CART_DEDUP_ON or CART_DEDUP_VERIFY
+// Outputs      : 0 if successful, -1 if failure
+
+int32_t cart_set_dedup(uint32_t mode) {
+	if(mode > CART_DEDUP_VERIFY) {
+		return (-1);
+	}
+
+	//the index is built again for the new mode, with signatures when verifying
+	if(mode != dedup_mode) {
+		dedup_release();
+		dedup_mode = mode;
+	}
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_dedup_stats
+// Description  : Get the deduplication counts since poweron
+//
+// Inputs       : stat - where the counts go
+// Outputs      : 0 if successful, -1 if failure
+
+int32_t cart_dedup_stats(CartDedupStat *stat) {
+	if(stat == NULL) {
+		return (-1);
+	}
+
+	stat->blocks = dedup.blocks;
+	stat->duplicates = dedup.duplicates;
+	stat->nsec = dedup.nsec;
+	stat->shared = mainStructure.numSharedFrames;
+	stat->indexed = dedup.count;
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_set_checksums
+// Description  : Turn on or off checksumming the frames, frames written while
+//                it is off have no checksum and are not checked later
+//
+// Inputs       : on - 1 to checksum, 0 not to
+// Outputs      : 0 if successful
+
+int32_t cart_set_checksums(uint32_t on) {
+	sums.on = (on != 0);
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_checksum_stats
+// Description  : Get the checksum counts since poweron
+//
+// Inputs       : stat - where the counts go
+// Outputs      : 0 if successful, -1 if failure
+
+int32_t cart_checksum_stats(CartChecksumStat *stat) {
+	if(stat == NULL) {
+		return (-1);
+	}
+
+	stat->computed = sums.computed;
+	stat->verified = sums.verified;
+	stat->retried = sums.retried;
+	stat->failed = sums.failed;
+	stat->adopted = sums.adopted;
+	stat->nsec = sums.nsec;
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_frames_used
+// Description  : Count the frames in use on the data cartridges
+//
+// Inputs       : none
+// Outputs      : number of frames, -1 if failure
+
+int32_t cart_frames_used(void) {
+	int32_t used = 0;
+
+	//fail if the cart is not on
+	if(mainStructure.cart_is_on == false) {
+		return (-1);
+	}
+
+	for(int cart = 0; cart < CART_DATA_CARTRIDGES; cart++) {
+		used += CART_CARTRIDGE_SIZE - free_frames_in_cart(cart);
+	}
+
+	return (used);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : defrag_background
+// Description  : Spend the background budget once a read or write is done
+//
+// Inputs       : none
+// Outputs      : 0 if successful
+
+int defrag_background(void) {
+	if(defrag.budget > 0 && defrag.clean == false) {
+		cart_defrag(defrag.budget);
+	}
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_fragmentation_report
+// Description  : Log how fragmented the files are
+//
+// Inputs       : none
+// Outputs      : cartridge loads to read every file once, -1 if failure
+
+int32_t cart_fragmentation_report(void) {
+	uint64_t frames = 0;
+	uint64_t loads = 0;
+	uint64_t ideal = 0;
+	int files = 0;
+	int fragmented = 0;
+	int packed = 0;
+	uint64_t compressed = 0;
+	uint64_t stored = 0;
+
+	//fail if the cart is not on
+	if(mainStructure.cart_is_on == false) {
+		return (-1);
+	}
+
+	for(uint32_t i = 0; i < mainStructure.files_initialized; i++) {
+		struct FileStructure *file = &mainStructure.fileTable[i];
+		if(file->filled == false) {
+			continue;
+		}
+		files++;
+		frames += file_allocated_frames(file);
+		loads += file_cart_loads(file);
+		ideal += (file_allocated_frames(file) + CART_CARTRIDGE_SIZE - 1) / CART_CARTRIDGE_SIZE;
+		if(file_is_fragmented(file) == true) {
+			fragmented++;
+		}
+		if(file->tailFrame != FRAME_HOLE) {
+			packed++;
+		}
+		compressed += file_packed_blocks(file);
+		stored += file_stored_bytes(file) - (uint64_t) file_allocated_frames(file) * CART_FRAME_SIZE;
+	}
+
+	logMessage(LOG_INFO_LEVEL, "CART fragmentation: %d files (%d fragmented), %lu frames, %lu cartridge loads to read all files (best %lu), %lu frames moved",
+		files, fragmented, frames, loads, ideal, defrag.moved);
+	logMessage(LOG_INFO_LEVEL, "CART tail packing: %d last blocks packed and %lu blocks compressed, %lu bytes in %u shared frames",
+		packed, compressed, stored, mainStructure.numTailFrames);
+
+	return (loads);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_bus_counts
+// Description  : Get the number of bus operations of each kind since poweron
+//
+// Inputs       : counts - array filled with the counts, indexed by opcode
+// Outputs      : 0 if successful
+
+int32_t cart_bus_counts(uint64_t counts[CART_OP_MAXVAL]) {
+	memcpy(counts, bus_ops, sizeof(bus_ops));
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_bus_report
+// Description  : Log the bus operations the driver sent since poweron
+//
+// Inputs       : none
+// Outputs      : 0 if successful
+
+int32_t cart_bus_report(void) {
+	logMessage(LOG_INFO_LEVEL, "** Start Driver Bus Metrics **");
+	logMessage(LOG_INFO_LEVEL, "INITMS operations %lu", bus_ops[CART_OP_INITMS]);
+	logMessage(LOG_INFO_LEVEL, "BZERO  operations %lu", bus_ops[CART_OP_BZERO]);
+	logMessage(LOG_INFO_LEVEL, "LDCART operations %lu", bus_ops[CART_OP_LDCART]);
+	logMessage(LOG_INFO_LEVEL, "RDFRME operations %lu", bus_ops[CART_OP_RDFRME]);
+	logMessage(LOG_INFO_LEVEL, "WRFRME operations %lu", bus_ops[CART_OP_WRFRME]);
+	logMessage(LOG_INFO_LEVEL, "POWOFF operations %lu", bus_ops[CART_OP_POWOFF]);
+	logMessage(LOG_INFO_LEVEL, "WRPART operations %lu (%lu bytes)", bus_parts, bus_part_bytes);
+	logMessage(LOG_INFO_LEVEL, "** End Driver Bus Metrics **");
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : note_first_io
+// Description  : Log the time from poweron to the first completed I/O
+//
+// Inputs       : none
+// Outputs      : 0 if successful
+
+int note_first_io(void) {
+	struct timeval now;
+
+	if(first_io_done == false) {
+		gettimeofday(&now, NULL);
+		logMessage(LOG_INFO_LEVEL, "CART driver time to first I/O: %ld usec", compareTimes(&poweron_time, &now));
+		first_io_done = true;
+	}
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_memory_report
+// Description  : Log how much memory each driver structure is using
+//
+// Inputs       : none
+// Outputs      : total bytes used by the driver structures
+
+int32_t cart_memory_report(void) {
+	uint64_t table_bytes = 0;
+	uint64_t map_bytes = 0;
+	uint64_t frames_used = 0;
+	uint64_t tail_bytes = 0;
+	uint64_t buffer_bytes = 0;
+	uint64_t dedup_bytes = 0;
+	uint64_t total = 0;
+
+	//add up the frame maps of the files
+	for(uint32_t i = 0; i < mainStructure.files_initialized; i++) {
+		map_bytes += mainStructure.fileTable[i].capFrames * sizeof(uint16_t);
+		if(mainStructure.fileTable[i].slots != NULL) {
+			map_bytes += mainStructure.fileTable[i].capFrames * sizeof(uint32_t);
+		}
+		frames_used += file_allocated_frames(&mainStructure.fileTable[i]);
+	}
+	table_bytes = mainStructure.fileCap * sizeof(struct FileStructure) + mainStructure.capFreeFiles * sizeof(uint32_t) +
+		mainStructure.hashCap * sizeof(uint32_t);
+	for(int i = 0; i < CART_MAX_CARTRIDGES; i++) {
+		if(mainStructure.tailLive[i] != NULL) {
+			tail_bytes += CART_CARTRIDGE_SIZE * sizeof(uint16_t);
+		}
+	}
+	for(uint32_t i = 0; i < mainStructure.openCap; i++) {
+		if(mainStructure.openTable[i].used == true && mainStructure.openTable[i].wbuf != NULL) {
+			buffer_bytes += sizeof(struct WriteBuffer);
+		}
+	}
+	if(mainStructure.frameShares != NULL) {
+		dedup_bytes += CART_TOTAL_FRAMES * sizeof(uint32_t);
+	}
+	if(dedup.heads != NULL) {
+		dedup_bytes += DEDUP_BUCKETS * sizeof(uint16_t) + CART_TOTAL_FRAMES * (sizeof(uint16_t) + sizeof(uint64_t));
+	}
+	if(dedup.sigs != NULL) {
+		dedup_bytes += CART_TOTAL_FRAMES * DEDUP_SIG_SIZE;
+	}
+	total = sizeof(mainStructure) + table_bytes + mainStructure.openCap * sizeof(struct OpenFile) + map_bytes +
+		mainStructure.arenaSize + mainStructure.capPending * sizeof(uint16_t) + tail_bytes + buffer_bytes + sizeof(pack) +
+		sizeof(dedup) + dedup_bytes + sizeof(sums) + sizeof(fetch);
+
+	logMessage(LOG_INFO_LEVEL, "** Start Driver Memory Report **");
+	logMessage(LOG_INFO_LEVEL, "file table    : %lu bytes (%u files, %u entries of %lu bytes, %u name slots)",
+		table_bytes, mainStructure.numNames, mainStructure.fileCap, sizeof(struct FileStructure), mainStructure.hashCap);
+	logMessage(LOG_INFO_LEVEL, "open table    : %lu bytes (%u handles)", mainStructure.openCap * sizeof(struct OpenFile),
+		mainStructure.openCap);
+	logMessage(LOG_INFO_LEVEL, "write buffers : %lu bytes (%u dirty)", buffer_bytes, mainStructure.numDirty);
+	logMessage(LOG_INFO_LEVEL, "pack frame    : %lu bytes (%d compressed blocks waiting)", sizeof(pack), pack.count);
+	logMessage(LOG_INFO_LEVEL, "frame bitmap  : %lu bytes (%d frames)", sizeof(mainStructure.frameUsed), CART_TOTAL_FRAMES);
+	logMessage(LOG_INFO_LEVEL, "frame maps    : %lu bytes (%lu frames in use)", map_bytes, frames_used);
+	logMessage(LOG_INFO_LEVEL, "name arena    : %u bytes (%u used, %u unlinked)", mainStructure.arenaSize,
+		mainStructure.arenaUsed, mainStructure.arenaDead);
+	logMessage(LOG_INFO_LEVEL, "pending frees : %lu bytes (%u frames)", mainStructure.capPending * sizeof(uint16_t),
+		mainStructure.numPending);
+	logMessage(LOG_INFO_LEVEL, "tail space    : %lu bytes (%u shared frames)", tail_bytes, mainStructure.numTailFrames);
+	logMessage(LOG_INFO_LEVEL, "dedup index   : %lu bytes (%u frames indexed, %u shared)", sizeof(dedup) + dedup_bytes,
+		dedup.count, mainStructure.numSharedFrames);
+	logMessage(LOG_INFO_LEVEL, "checksums     : %lu bytes (%lu frames checked, %lu failed)", sizeof(sums), sums.verified,
+		sums.failed);
+	logMessage(LOG_INFO_LEVEL, "read batch    : %lu bytes (%d frames, stripes over %u cartridges)", sizeof(fetch), READ_BATCH,
+		stripe_width);
+	logMessage(LOG_INFO_LEVEL, "driver total  : %lu bytes", total);
+	logMessage(LOG_INFO_LEVEL, "** End Driver Memory Report **");
+
+	return (total);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : release_file_tables
+// Description  : Free the file table, the frame maps, the name arena and the
+//                tables that go with them
+//
+// Inputs       : none
+// Outputs      : 0 if successful
+
+int release_file_tables(void) {
+	for(uint32_t i = 0; i < mainStructure.files_initialized; i++) {
+		free(mainStructure.fileTable[i].frames);
+		free(mainStructure.fileTable[i].slots);
+	}
+	for(uint32_t i = 0; i < mainStructure.openCap; i++) {
+		free(mainStructure.openTable[i].wbuf);
+	}
+	free(mainStructure.fileTable);
+	free(mainStructure.freeFiles);
+	free(mainStructure.nameHash);
+	free(mainStructure.openTable);
+	free(mainStructure.nameArena);
+	free(mainStructure.pendingFree);
+	for(int i = 0; i < CART_MAX_CARTRIDGES; i++) {
+		free(mainStructure.tailLive[i]);
+		mainStructure.tailLive[i] = NULL;
+	}
+	free(mainStructure.frameShares);
+	dedup_release();
+	sums_release();
+	free(batch.data);
+	free(fetch.data);
+	batch.data = NULL;
+	batch.count = 0;
+	fetch.data = NULL;
+	fetch.count = 0;
+
+	mainStructure.fileTable = NULL;
+	mainStructure.files_initialized = 0;
+	mainStructure.fileCap = 0;
+	mainStructure.freeFiles = NULL;
+	mainStructure.numFreeFiles = 0;
+	mainStructure.capFreeFiles = 0;
+	mainStructure.nameHash = NULL;
+	mainStructure.hashCap = 0;
+	mainStructure.numNames = 0;
+	mainStructure.openTable = NULL;
+	mainStructure.openCap = 0;
+	mainStructure.freeHandle = -1;
+	mainStructure.numDirty = 0;
+	mainStructure.nameArena = NULL;
+	mainStructure.arenaUsed = 0;
+	mainStructure.arenaSize = 0;
+	mainStructure.arenaDead = 0;
+	mainStructure.pendingFree = NULL;
+	mainStructure.numPending = 0;
+	mainStructure.capPending = 0;
+	mainStructure.tailOpen = -1;
+	mainStructure.tailEnd = 0;
+	mainStructure.numTailFrames = 0;
+	mainStructure.frameShares = NULL;
+	mainStructure.numSharedFrames = 0;
+	pack.frame = -1;
+	pack.end = 0;
+	pack.count = 0;
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_poweron
+// Description  : Startup up the CART interface, initialize filesystem
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int32_t cart_poweron(void) {
+ 	//initialize cart
+ 	init_cart_cache();
+
+ 	//check if the cart is on already
+ 	if(mainStructure.cart_is_on == true) {
+ 		return (-1);
+ 	}
+ 	//if it is not on, power it on already
+ 	else {
+ 		gettimeofday(&poweron_time, NULL);
+ 		first_io_done = false;
+
+ 		//file entries are initialized when they are first used, cartridges
+ 		//are zeroed the first time a frame is allocated from them
+ 		release_file_tables();
+ 		memset(mainStructure.cart_ready, 0, sizeof(mainStructure.cart_ready));
+
+ 		//turn on the cart structure
+ 		mainStructure.cart_is_on = true;
+
+ 		//power on the cart
+		memset(bus_ops, 0, sizeof(bus_ops));
+		bus_parts = 0;
+		bus_part_bytes = 0;
+		dedup.blocks = 0;
+		dedup.duplicates = 0;
+		dedup.nsec = 0;
+		sums.computed = 0;
+		sums.verified = 0;
+		sums.retried = 0;
+		sums.failed = 0;
+		sums.adopted = 0;
+		sums.nsec = 0;
+		forget_loaded_carts();
+		defrag.file = -1;
+		defrag.next_file = 0;
+		defrag.moved = 0;
+		if(driver_bus_request(CART_OP_INITMS, 0, 0, NULL) == -1) {
+			logMessage(LOG_ERROR_LEVEL, "CART driver failed to initialize the memory system");
+			mainStructure.cart_is_on = false;
+			return (-1);
+		}
+
+		//load the files left on the cartridges
+		if(mount_filesystem() == -1) {
+			logMessage(LOG_ERROR_LEVEL, "CART driver failed to mount the filesystem");
+			mainStructure.cart_is_on = false;
+			return (-1);
+		}
+	}
+
+	// Return successfully
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_poweroff
+// Description  : Shut down the CART interface, close all files
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int32_t cart_poweroff(void) {
+	bool saved = true; //the buffered writes and the metadata made it to the cartridges
+
+	//write out the buffered writes while the cache is still there
+	if(mainStructure.cart_is_on == true && (flush_write_buffers() == -1 || flush_pack_frame() == -1)) {
+		logMessage(LOG_ERROR_LEVEL, "CART driver failed to write the buffered writes");
+		saved = false;
+	}
+
+	//close the cache
+	close_cart_cache();
+
+	//fail if the cart is not open
+	if(mainStructure.cart_is_on == false) {
+		return (-1);
+	}
+	//power off the cart
+	else {
+		cart_memory_report();
+		cart_fragmentation_report();
+
+		//save the metadata so the files are there at the next poweron
+		if(write_checkpoint() == -1) {
+			logMessage(LOG_ERROR_LEVEL, "CART driver failed to write the metadata checkpoint");
+			saved = false;
+		}
+
+		//power off the cart
+		driver_bus_request(CART_OP_POWOFF, 0, 0, NULL);
+		forget_loaded_carts();
+		cart_bus_report();
+
+		//close the cart structure
+		mainStructure.cart_is_on = false;
+
+		//release the file tables, they are loaded again at the next poweron
+		release_file_tables();
+		free(journal.ckptFrames);
+		journal.ckptFrames = NULL;
+		journal.numCkptFrames = 0;
+		memset(mainStructure.cart_ready, 0, sizeof(mainStructure.cart_ready));
+	}
+
+	//the cart is off either way, but what was not saved is lost
+	if(saved == false) {
+		return (-1);
+	}
+
+	// Return successfully
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_open
+// Description  : This function opens the file and returns a file handle
+//
+// Inputs       : path - filename of the file to open
+// Outputs      : file handle if successful, -1 if failure
+
+int16_t cart_open(char *path) {
+
+	int64_t index = 0;
+	int16_t fd = 0;
+	char record[5 + CART_MAX_PATH_LENGTH];
+	uint32_t record_index = 0;
+	uint8_t name_length = 0;
+	struct FileStructure *file = NULL;
+
+	//fail if the name is too long
+	if(strlen(path) >= CART_MAX_PATH_LENGTH) {
+		return (-1);
+	}
+
+	index = lookup_file(path);
+	if(index != -1) {
+		file = &mainStructure.fileTable[index];
+
+	}
+	//if file doesn't exist, then create it in an empty spot
+	else {
+		index = new_file_index();
+		if(index == -1 || load_file_entry(index, path) == -1) {
+			return (-1);
+		}
+
+		//log the new file, the index is followed by the name
+		record_index = index;
+		name_length = strlen(path);
+		memcpy(&record[0], &record_index, sizeof(record_index));
+		memcpy(&record[4], &name_length, sizeof(name_length));
+		memcpy(&record[5], path, name_length);
+		if(journal_append(JREC_CREATE, record, 5 + name_length) == -1) {
+			unload_file_entry(index);
+			return (-1);
+		}
+		file = &mainStructure.fileTable[index];
+	}
+
+	//the handle starts at the beginning of the file
+	fd = alloc_handle(index);
+	if(fd == -1) {
+		return (-1);
+	}
+	file->open++;
+
+	//return handle
+	return (fd);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_close
+// Description  : This function closes the file
+//
+// Inputs       : fd - the file descriptor
+// Outputs      : 0 if successful, -1 if failure
+
+int16_t cart_close(int16_t fd) {
+	struct OpenFile *open = find_handle(fd);
+
+	//fail if handle is not valid
+	if (open == NULL) {
+		return(-1);
+	}
+	//close the file, packing a short last block with those of other files
+	else {
+		if(flush_write_buffer(open) == -1 || (pack_holds_file(open->file) == true && flush_pack_frame() == -1)) {
+			return (-1);
+		}
+		//the last block is only packed once no other handle is using the file
+		mainStructure.fileTable[open->file].open--;
+		if(tail_pack_max > 0 && mainStructure.fileTable[open->file].open == 0 && pack_tail(open->file) == -1) {
+			logMessage(LOG_ERROR_LEVEL, "CART driver failed to pack the last block of a file");
+		}
+		free_handle(fd);
+	}
+
+	//commit the metadata changes made so far
+	if(journal_flush() == -1) {
+		return (-1);
+	}
+
+	// Return successfully
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fetch_blocks
+// Description  : Read the frames of a run of blocks that have to come from
+//                the bus into the read batch, all the frames of a cartridge
+//                before moving to the next one, starting with the loaded
+//                ones, the shards read their cartridges at the same time
+//
+// Inputs       : open - the handle reading
+//                first - first block of the run
+//                count - number of blocks, at most READ_BATCH
+// Outputs      : 0 if successful, -1 if failure
+
+int fetch_blocks(struct OpenFile *open, uint32_t first, uint32_t count) {
+	struct FileStructure *file = &mainStructure.fileTable[open->file];
+	uint32_t order[READ_BATCH]; //blocks of the batch read from the bus, by cartridge
+	uint16_t frames[READ_BATCH];
+	void *bufs[READ_BATCH];
+	CartridgeIndex cart = 0;
+	uint32_t n = 0;
+	uint32_t block = 0;
+	uint32_t key = 0;
+	uint32_t j = 0;
+	uint16_t prev = 0;
+
+	//the frames of the batch are only allocated once a read needs them
+	if(fetch.data == NULL) {
+		fetch.data = malloc(READ_BATCH * CART_FRAME_SIZE);
+		if(fetch.data == NULL) {
+			return (-1);
+		}
+	}
+
+	fetch.first = first;
+	fetch.count = count;
+	for(uint32_t i = 0; i < count; i++) {
+		block = first + i;
+		fetch.fetched[i] = false;
+
+		//holes, compressed and shared last blocks, buffered and cached blocks are read as before
+		if(block >= file->numFrames || file->frames[block] == FRAME_HOLE || BLOCK_PACKED(file, block) == true ||
+				(file->tailFrame != FRAME_HOLE && block == file->length / CART_FRAME_SIZE) ||
+				(open->wbuf != NULL && open->wbuf->dirty == true && open->wbuf->block == block) ||
+				get_cart_cache(FRAME_CART(file->frames[block]), FRAME_NUM(file->frames[block])) != NULL) {
+			continue;
+		}
+
+		//insertion sort on the cartridge, the loaded one first, in block order within a cartridge
+		cart = FRAME_CART(file->frames[block]);
+		key = (loaded_cart[client_cart_shard(cart)] == cart) ? 0 : cart + 1;
+		for(j = n; j > 0; j--) {
+			prev = FRAME_CART(file->frames[first + order[j - 1]]);
+			if(((loaded_cart[client_cart_shard(prev)] == prev) ? 0 : prev + 1u) <= key) {
+				break;
+			}
+			order[j] = order[j - 1];
+		}
+		order[j] = i;
+		n++;
+	}
+
+	//the reads of the batch, each shard loads its cartridges in turn
+	for(uint32_t i = 0; i < n; i++) {
+		frames[i] = file->frames[first + order[i]];
+		bufs[i] = fetch.data[order[i]];
+	}
+	if(bus_frames(CART_OP_RDFRME, frames, bufs, n) == -1) {
+		fetch.count = 0;
+		return (-1);
+	}
+
+	//the frames with a checksum are checked like any read
+	for(uint32_t i = 0; i < n; i++) {
+		block = first + order[i];
+		if(sums.on == true && FRAME_SUM_KNOWN(file->frames[block]) && verify_frame(file->frames[block], fetch.data[order[i]]) == -1) {
+			fetch.count = 0;
+			return (-1);
+		}
+		fetch.fetched[order[i]] = true;
+	}
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : read_at
+// Description  : Read bytes of an open file from a given offset, the block
+//                of every frame is worked out from the offset
+//
+// Inputs       : open - the open file
+//                buf - pointer to buffer to read into
+//                count - number of bytes to read
+//                loc - offset in the file of the first byte
+// Outputs      : bytes read if successful, -1 if failure
+
+int32_t read_at(struct OpenFile *open, void *buf, int32_t count, uint32_t loc) {
+	//define variables
+	struct FileStructure *file = &mainStructure.fileTable[open->file];
+	int32_t read_frame = (loc) / CART_FRAME_SIZE; //what block of the file i am reading
+	int32_t start_read_bit = (loc % CART_FRAME_SIZE); //where i wanna start reading in frame
+	int32_t bytes_left_to_read = count; //keep track of how many bytes to read
+	int32_t bytes_reading_now = 0; //keep track of the amount of bytes to read per iteration
+	int start_buf_read_bit = 0; //keep track of what is currently read from the buffer
+	char tempbuf[CART_FRAME_SIZE]; //temporary buffer for calculations
+	char *cachebuf = NULL; //buffer used to check cache
+	uint16_t frame = 0; //global frame number of the block being read
+	uint16_t base = 0; //where the block starts in its frame, not 0 for a packed last block
+	char *framebuf = NULL; //frame of the block read from the bus
+	uint32_t blocks_left = 0; //blocks the rest of the read touches
+
+	//a batch left by an earlier read may be stale
+	fetch.count = 0;
+
+	//writes through other handles of the file go out before reading, and a
+	//partial block of this one since the rest of it is not in the buffer
+	if(flush_file_buffers(open->file, open) == -1 ||
+			(open->wbuf != NULL && open->wbuf->partial == true && flush_write_buffer(open) == -1)) {
+		return (-1);
+	}
+
+	//nothing to read at or past the end of the file
+	if(loc >= file->length || count <= 0) {
+		return (0);
+	}
+
+	//if reading past end of the file, read until the end of the file
+	if(count + loc > file->length) {
+		bytes_left_to_read = file->length - loc;
+		count = bytes_left_to_read;
+	}
+
+	//begin reading
+	while(bytes_left_to_read > 0) {
+		//check how many bytes left to read
+		if (start_read_bit + bytes_left_to_read > CART_FRAME_SIZE) {
+			bytes_reading_now = (CART_FRAME_SIZE - start_read_bit);
+		}
+		else {
+			bytes_reading_now = bytes_left_to_read;
+		}
+
+		//a read of several blocks fetches them a batch at a time, by cartridge
+		blocks_left = (start_read_bit + bytes_left_to_read + CART_FRAME_SIZE - 1) / CART_FRAME_SIZE;
+		if(blocks_left > 1 && ((uint32_t) read_frame < fetch.first || (uint32_t) read_frame >= fetch.first + fetch.count)) {
+			if(fetch_blocks(open, read_frame, (blocks_left < READ_BATCH) ? blocks_left : READ_BATCH) == -1) {
+				return (-1);
+			}
+		}
+
+		//look up the frame of this block
+		frame = (read_frame < (int32_t) file->numFrames) ? file->frames[read_frame] : FRAME_HOLE;
+		base = 0;
+		if(file->tailFrame != FRAME_HOLE && read_frame == (int32_t) (file->length / CART_FRAME_SIZE)) {
+			frame = file->tailFrame;
+			base = file->tailOffset;
+		}
+
+		//used to check if the frame is already in the cache
+		cachebuf = (frame == FRAME_HOLE) ? NULL : get_cart_cache(FRAME_CART(frame), FRAME_NUM(frame));
+
+		//bytes written through this handle that are still in its buffer
+		if(open->wbuf != NULL && open->wbuf->dirty == true && open->wbuf->block == (uint32_t) read_frame) {
+			memcpy(&((char *)buf)[start_buf_read_bit], &open->wbuf->data[start_read_bit], bytes_reading_now);
+		}
+		//a block that was never written reads as zeros
+		else if(frame == FRAME_HOLE) {
+			memset(&((char *)buf)[start_buf_read_bit], 0, bytes_reading_now);
+		}
+		//a compressed block is expanded from its shared frame
+		else if(read_frame < (int32_t) file->numFrames && BLOCK_PACKED(file, read_frame) == true) {
+			if(read_packed_block(file, read_frame, tempbuf) == -1) {
+				return (-1);
+			}
+			memcpy(&((char *)buf)[start_buf_read_bit], &tempbuf[start_read_bit], bytes_reading_now);
+		}
+		//if the frame is in the cache, just read it into the buffer
+		else if(cachebuf != NULL) {
+			memcpy(&((char *)buf)[start_buf_read_bit], &cachebuf[base + start_read_bit], bytes_reading_now);
+		}
+		//if the frame is not in the cache, go into memory unless the batch has it
+		else {
+			framebuf = tempbuf;
+			if(fetch.count > 0 && (uint32_t) read_frame >= fetch.first && (uint32_t) read_frame < fetch.first + fetch.count &&
+					fetch.fetched[read_frame - fetch.first] == true) {
+				framebuf = fetch.data[read_frame - fetch.first];
+			}
+			else if(read_frame_from_bus(frame, tempbuf) == -1) {
+				return (-1);
+			}
+
+			//read into buf
+			memcpy(&((char *)buf)[start_buf_read_bit], &framebuf[base + start_read_bit], bytes_reading_now);
+
+			//a shared frame holds the last blocks of other files too, keep it
+			if(frame == file->tailFrame) {
+				insert_into_cache(frame, framebuf);
+			}
+			//a frame stored before poweron is found by later writes of the same bytes
+			else if(dedup_mode != CART_DEDUP_OFF && dedup_alloc() == 0) {
+				dedup_remember(frame, framebuf, fingerprint_frame(framebuf));
+			}
+		}
+		
+		//update variables 
+		start_buf_read_bit += bytes_reading_now;
+		bytes_left_to_read -= bytes_reading_now;
+		start_read_bit = 0;
+		read_frame++;
+	}
+
+	note_first_io();
+	defrag_background();
+
+	// Return successfully
+	return (count);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_read
+// Description  : Reads "count" bytes from the file handle "fh" into the 
+//                buffer "buf"
+//
+// Inputs       : fd - filename of the file to read from
+//                buf - pointer to buffer to read into
+//                count - number of bytes to read
+// Outputs      : bytes read if successful, -1 if failure
+
+int32_t cart_read(int16_t fd, void *buf, int32_t count) {
+	struct OpenFile *open = find_handle(fd);
+	int32_t bytes = 0;
+
+	//if handle is not valid, fail
+	if(open == NULL) {
+		return (-1);
+	}
+
+	//read at the position of the handle and move past what was read
+	bytes = read_at(open, buf, count, open->location);
+	if(bytes > 0) {
+		open->location += bytes;
+	}
+
+	return (bytes);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_pread
+// Description  : Reads "count" bytes from a given offset of the file handle
+//                "fh" into the buffer "buf", the position of the handle is
+//                left where it is
+//
+// Inputs       : fd - filename of the file to read from
+//                buf - pointer to buffer to read into
+//                count - number of bytes to read
+//                off - offset in the file to read from
+// Outputs      : bytes read if successful, -1 if failure
+
+int32_t cart_pread(int16_t fd, void *buf, int32_t count, uint32_t off) {
+	struct OpenFile *open = find_handle(fd);
+
+	//if handle is not valid, fail
+	if(open == NULL) {
+		return (-1);
+	}
+
+	return (read_at(open, buf, count, off));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : write_at
+// Description  : Write bytes to an open file at a given offset, the block
+//                of every frame is worked out from the offset
+//
+// Inputs       : open - the open file
+//                buf - pointer to buffer to write from
+//                count - number of bytes to write
+//                loc - offset in the file of the first byte
+// Outputs      : bytes written if successful, -1 if failure
+
+int32_t write_at(struct OpenFile *open, void *buf, int32_t count, uint32_t loc) {
+
+	//START THE REAL WRITING STUFF
+	uint32_t index_of_file = open->file;
+	struct FileStructure *file = &mainStructure.fileTable[index_of_file];
+	uint32_t write_frame = (loc) / CART_FRAME_SIZE; //what block of the file i am writing
+	int start_write_bit = (loc % CART_FRAME_SIZE); //where i wanna start writing in frame
+	int32_t bytes_left_to_write = count; //keep track of bytes left to write
+	int bytes_writing_now = 0; //amount of bytes writing per iteration
+	int buf_starting_point = 0;	//starting of memcpy for the buffer that is getting passed
+	char tempbuf[CART_FRAME_SIZE]; //temporary buffer for memcpy
+	char *cachebuf = NULL; //buffer used to check the cache
+	int32_t new_frame = 0; //frame allocated when the file grows
+	uint16_t frame = 0; //global frame number of the block being written
+	bool fresh = false; //frame was just allocated, there is nothing to read from it
+	bool gathered = false; //the bytes went to the buffer of the handle
+	bool packed = false; //the block is stored compressed in a shared frame
+	bool shared = false; //other blocks point at the frame of the block too
+	CartridgeIndex near = 0; //cartridge of the written block before this one
+
+	uint32_t old_length = 0; //length before the write, logged if it changes
+
+	//blocks buffered by other handles of the file go out first, they would
+	//overwrite this write or grow the file behind it
+	if(flush_file_buffers(index_of_file, open) == -1) {
+		return (-1);
+	}
+	old_length = file->length;
+
+	//a packed last block gets its own frame back before it is written or moved
+	if(file->tailFrame != FRAME_HOLE && count > 0 &&
+			(uint64_t) loc + count > (file->length / CART_FRAME_SIZE) * CART_FRAME_SIZE) {
+		if(unpack_tail(index_of_file) == -1) {
+			return (-1);
+		}
+	}
+
+	//writing past the end leaves a hole, old data after the end must not show in it
+	if(loc > file->length && (flush_write_buffer(open) == -1 || zero_file_tail(file) == -1)) {
+		return (-1);
+	}
+
+	//begin writing
+	while(bytes_left_to_write > 0) {
+
+		//figure out how many bytes im going to write per iteration
+		if (start_write_bit + bytes_left_to_write > CART_FRAME_SIZE) {
+			bytes_writing_now = (CART_FRAME_SIZE - start_write_bit);
+		}
+		else {
+			bytes_writing_now = bytes_left_to_write;
+		}
+
+		//add a frame to the file when writing past its last block or into a hole,
+		//compressed and deduplicated blocks get their place when the buffer is written
+		fresh = false;
+		packed = (write_frame < file->numFrames && file->frames[write_frame] != FRAME_HOLE &&
+			BLOCK_PACKED(file, write_frame) == true);
+		shared = (write_frame < file->numFrames && file->frames[write_frame] != FRAME_HOLE &&
+			FRAME_SHARED(file->frames[write_frame]) == true);
+		if(compress_blocks == false && dedup_mode == CART_DEDUP_OFF && packed == false &&
+				(write_frame >= file->numFrames || file->frames[write_frame] == FRAME_HOLE)) {
+			near = file_cart_near(file, write_frame);
+			new_frame = alloc_frame(near);
+			if(new_frame == -1) {
+				return (-1);
+			}
+			if(set_file_frame(index_of_file, write_frame, new_frame) == -1) {
+				free_frame(new_frame);
+				return (-1);
+			}
+			//the file moved onto another cartridge, there is something to defragment
+			if(FRAME_CART(new_frame) != near) {
+				defrag.clean = false;
+			}
+			fresh = true;
+		}
+		frame = (write_frame < file->numFrames) ? file->frames[write_frame] : FRAME_HOLE;
+
+		//gather writes that stop short of the end of the frame in the buffer of the handle
+		if(open->wbuf != NULL && open->wbuf->dirty == true && open->wbuf->block != write_frame) {
+			if(flush_write_buffer(open) == -1) {
+				return (-1);
+			}
+		}
+		gathered = compress_blocks == true || dedup_mode != CART_DEDUP_OFF || packed == true || shared == true ||
+			(open->wbuf != NULL && open->wbuf->dirty == true) ||
+			start_write_bit + bytes_writing_now < CART_FRAME_SIZE;
+		if(gathered == true) {
+			if(buffer_write(open, write_frame, fresh, start_write_bit, &((char *)buf)[buf_starting_point], bytes_writing_now) == -1) {
+				return (-1);
+			}
+		}
+		//the end of a block that is not cached goes out on its own when the server can put it in place
+		else if(fresh == false && bytes_writing_now < CART_FRAME_SIZE && write_frame * CART_FRAME_SIZE < file->length &&
+				get_cart_cache(FRAME_CART(frame), FRAME_NUM(frame)) == NULL && part_write_ok(file, write_frame) == true) {
+			memcpy(&tempbuf[start_write_bit], &((char *)buf)[buf_starting_point], bytes_writing_now);
+			if(write_data_part(frame, tempbuf, start_write_bit, CART_FRAME_SIZE) == -1) {
+				return (-1);
+			}
+		}
+		//check if that frame is in the cache already
+		else if((cachebuf = get_cart_cache(FRAME_CART(frame), FRAME_NUM(frame))) == NULL) {
+			//read the frame if the write does not cover all the data in it
+			if(fresh == false && bytes_writing_now < CART_FRAME_SIZE && write_frame * CART_FRAME_SIZE < file->length) {
+				if(read_frame_from_bus(frame, tempbuf) == -1) {
+					return (-1);
+				}
+			}
+			else {
+				memset(tempbuf, 0, CART_FRAME_SIZE);
+			}
+
+			memcpy(&tempbuf[start_write_bit], &((char *)buf)[buf_starting_point], bytes_writing_now);
+
+			//write to the frame
+			if(write_data_frame(frame, tempbuf) == -1) {
+				return (-1);
 			}
+
+			//insert the new frame into the cache
+			insert_into_cache(frame, tempbuf);
 		}
 		//frame is already in the cache
 		else {
 			//write into the buffer
 			memcpy(&cachebuf[start_write_bit], &((char *)buf)[buf_starting_point], bytes_writing_now);
 
-			//load the cart
-			ky1 = CART_OP_LDCART;
-			ct1 = tempPtr->cart_num;
-			action_code = create_cart_opcode(ky1, ky2, rt1, ct1, fm1);
-			client_cart_bus_request(action_code, NULL);
-			extract_cart_opcode(action_code, &ky1, &ky2, &rt1, &ct1, &fm1);
-
 			//write to the frame
-			ky1 = CART_OP_WRFRME;
-			fm1 = tempPtr->frame_num;
-			action_code = create_cart_opcode(ky1, ky2, rt1, ct1, fm1);
-			client_cart_bus_request(action_code, cachebuf);
-			extract_cart_opcode(action_code, &ky1, &ky2, &rt1, &ct1, &fm1);
+			if(write_data_frame(frame, cachebuf) == -1) {
+				return (-1);
+			}
 
 			//update the time and buffer of the frame inside the cache
-			update_cache(tempPtr->cart_num, tempPtr->frame_num, cachebuf);
+			update_cache(FRAME_CART(frame), FRAME_NUM(frame), cachebuf);
 		}
 
-		//update location
-		mainStructure.fileTable[index_of_file].location += bytes_writing_now;
+		//log the frame of a new block once its data is on the cartridge
+		if(fresh == true && gathered == false && journal_map(index_of_file, write_frame, frame) == -1) {
+			return (-1);
+		}
+
+		//move on past the bytes written
+		loc += bytes_writing_now;
 		//reduce the bytes left to write
 		bytes_left_to_write -= bytes_writing_now;
 
 		//update length if necessary
-		if (mainStructure.fileTable[index_of_file].location > mainStructure.fileTable[index_of_file].length) {
-			mainStructure.fileTable[index_of_file].length = mainStructure.fileTable[index_of_file].location;
+		if (loc > file->length) {
+			file->length = loc;
 		}
 
 		//update variables
-		tempPtr->bytesUsed = start_write_bit + bytes_writing_now;
 		buf_starting_point += bytes_writing_now;
 		start_write_bit = 0;
+		write_frame++;
+	}
 
-		//if bytes used = 1024 and next frame is null
-		if (tempPtr->bytesUsed == 1024 && tempPtr->nextFrame == NULL) {
-			//find free frame and link
-			for(CartridgeIndex i = tempPtr->cart_num; i < CART_MAX_CARTRIDGES; i++) {
-				for(CartFrameIndex j = 0; j < CART_CARTRIDGE_SIZE; j++) {
-					if (mainStructure.infoTable[i][j].handle == -1) {
-						tempPtr->nextFrame = &mainStructure.infoTable[i][j];
-						mainStructure.infoTable[i][j].handle = tempPtr->handle; //change handle
-						tempPtr = tempPtr->nextFrame; //move pointer
-						done2 = true;
-						break;
-					}
-				}
-				//break if found frame already
-				if(done2 == true) {
-					break;
-				}
-			}
-		} 
-		else if (tempPtr->bytesUsed == 1024 && tempPtr->nextFrame != NULL){
-			//point to next frame
-			tempPtr = tempPtr->nextFrame;
+	//log the new length of the file, with the buffered block if there is one
+	if(file->length != old_length) {
+		if(open->wbuf != NULL && open->wbuf->dirty == true) {
+			open->wbuf->grew = true;
+		}
+		else if(journal_length(index_of_file, file->length) == -1) {
+			return (-1);
 		}
 	}
 
+	note_first_io();
+	defrag_background();
+
 	// Return successfully
 	return (count);
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_write
+// Description  : Writes "count" bytes to the file handle "fh" from the 
+//                buffer  "buf"
+//
+// Inputs       : fd - filename of the file to write to
+//                buf - pointer to buffer to write from
+//                count - number of bytes to write
+// Outputs      : bytes written if successful, -1 if failure
+
+int32_t cart_write(int16_t fd, void *buf, int32_t count) {
+	struct OpenFile *open = find_handle(fd);
+	int32_t bytes = 0;
+
+	//if handle is not valid, fail
+	if(open == NULL) {
+		return (-1);
+	}
+
+	//write at the position of the handle and move past what was written
+	bytes = write_at(open, buf, count, open->location);
+	if(bytes > 0) {
+		open->location += bytes;
+	}
+
+	return (bytes);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_pwrite
+// Description  : Writes "count" bytes to a given offset of the file handle
+//                "fh" from the buffer "buf", the position of the handle is
+//                left where it is
+//
+// Inputs       : fd - filename of the file to write to
+//                buf - pointer to buffer to write from
+//                count - number of bytes to write
+//                off - offset in the file to write at
+// Outputs      : bytes written if successful, -1 if failure
+
+int32_t cart_pwrite(int16_t fd, void *buf, int32_t count, uint32_t off) {
+	struct OpenFile *open = find_handle(fd);
+
+	//if handle is not valid, fail
+	if(open == NULL) {
+		return (-1);
+	}
+
+	return (write_at(open, buf, count, off));
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : cart_seek
-// Description  : Seek to specific point in the file
+// Description  : Seek to specific point in the file, a write past the end
+//                of the file leaves a hole that reads as zeros
 //
 // Inputs       : fd - filename of the file to write to
 //                loc - offfset of file in relation to beginning of file
 // Outputs      : 0 if successful, -1 if failure
 
 int32_t cart_seek(int16_t fd, uint32_t loc) {
-	bool handle_is_valid = false;
-	int index_of_file = 0;
+	struct OpenFile *open = find_handle(fd);
 
-	for(int i = 0; i < CART_MAX_TOTAL_FILES; i++) {
-		if(mainStructure.fileTable[i].handle == fd) {
-			index_of_file = i;
-			handle_is_valid = true;
-			break;
-		}
-	}
 	//check if handle is valid
-	if (handle_is_valid == false) {
-		return (-1);
-	}
-	//check if trying to seek greater than length of file
-	else if (loc > mainStructure.fileTable[index_of_file].length) {
+	if (open == NULL) {
 		return (-1);
 	}
-	//check if file is open
-	else if (mainStructure.fileTable[index_of_file].open == false) {
+	//write out the buffered block when seeking away from it
+	else if (open->wbuf != NULL && open->wbuf->dirty == true && loc / CART_FRAME_SIZE != open->wbuf->block &&
+			flush_write_buffer(open) == -1) {
 		return (-1);
 	}
 	//change location pointer
 	else {
-		mainStructure.fileTable[index_of_file].location = loc;
+		open->location = loc;
 	}
 	
 	// Return successfully
 	return (0);
-}
\ No newline at end of file
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_stat
+// Description  : Get the length and number of frames of a file
+//
+// Inputs       : path - filename of the file
+//                stat - filled with the information about the file
+// Outputs      : 0 if successful, -1 if there is no such file
+
+int32_t cart_stat(char *path, CartFileStat *stat) {
+	int64_t index = 0;
+
+	//fail if the cart is not on
+	if(mainStructure.cart_is_on == false) {
+		return (-1);
+	}
+
+	index = lookup_file(path);
+	if(index == -1) {
+		return (-1);
+	}
+	stat->length = mainStructure.fileTable[index].length;
+	stat->frames = file_allocated_frames(&mainStructure.fileTable[index]);
+	stat->stored = file_stored_bytes(&mainStructure.fileTable[index]);
+	stat->carts = file_cart_count(&mainStructure.fileTable[index]);
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_unlink
+// Description  : Delete a file that is not open, its frames and its file
+//                entry are reused by later writes and creates
+//
+// Inputs       : path - filename of the file to delete
+// Outputs      : 0 if successful, -1 if failure
+
+int32_t cart_unlink(char *path) {
+	struct FileStructure *file = NULL;
+	int64_t found = 0;
+	uint32_t index = 0;
+
+	//fail if the cart is not on
+	if(mainStructure.cart_is_on == false) {
+		return (-1);
+	}
+
+	//fail if there is no such file or it is still open
+	found = lookup_file(path);
+	if(found == -1 || mainStructure.fileTable[found].open > 0) {
+		return (-1);
+	}
+	index = found;
+	file = &mainStructure.fileTable[index];
+
+	//compressed blocks of the file waiting in the pack frame are logged first
+	if(pack_holds_file(index) == true && flush_pack_frame() == -1) {
+		return (-1);
+	}
+
+	//log the unlink before releasing the frames, they are freed once it is committed
+	if(journal_append(JREC_UNLINK, &index, sizeof(index)) == -1) {
+		return (-1);
+	}
+	if(release_file_frames(file, 0) == -1 || drop_tail(file) == -1) {
+		return (-1);
+	}
+	unload_file_entry(index);
+
+	//commit the unlink so the frames can be reused
+	return (journal_flush());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_truncate
+// Description  : Change the length of an open file, frames past the new end
+//                are released, a longer file ends in a hole
+//
+// Inputs       : fd - the file handle
+//                length - new length of the file
+// Outputs      : 0 if successful, -1 if failure
+
+int32_t cart_truncate(int16_t fd, uint32_t length) {
+	struct OpenFile *open = find_handle(fd);
+	struct FileStructure *file = NULL;
+	char record[12];
+	uint32_t index = 0;
+	uint32_t keep = 0;
+
+	//fail if the handle is not valid
+	if(open == NULL) {
+		return (-1);
+	}
+	index = open->file;
+	file = &mainStructure.fileTable[index];
+
+	//the buffered blocks of every handle may be cut off or zeroed, compressed
+	//blocks waiting in the pack frame are logged before the truncate
+	if(flush_file_buffers(index, NULL) == -1 || (pack_holds_file(index) == true && flush_pack_frame() == -1)) {
+		return (-1);
+	}
+
+	//the last block moves, give it a frame of its own first
+	if(length != file->length && unpack_tail(index) == -1) {
+		return (-1);
+	}
+
+	//longer, the new part of the file is a hole with no frames
+	if(length > file->length) {
+		if(zero_file_tail(file) == -1) {
+			return (-1);
+		}
+		file->length = length;
+		return (journal_length(index, length));
+	}
+
+	//shorter, log the new end then release the blocks past it
+	keep = (length + CART_FRAME_SIZE - 1) / CART_FRAME_SIZE;
+	memcpy(&record[0], &index, sizeof(index));
+	memcpy(&record[4], &keep, sizeof(keep));
+	memcpy(&record[8], &length, sizeof(length));
+	if(journal_append(JREC_TRUNCATE, record, sizeof(record)) == -1) {
+		return (-1);
+	}
+	if(release_file_frames(file, keep) == -1) {
+		return (-1);
+	}
+	file->length = length;
+	if(open->location > length) {
+		open->location = length;
+	}
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_sync
+// Description  : Write out the buffered writes and commit the metadata
+//                changes made so far to the cartridges
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int32_t cart_sync(void) {
+	//fail if the cart is not on
+	if(mainStructure.cart_is_on == false) {
+		return (-1);
+	}
+
+	if(flush_write_buffers() == -1 || flush_pack_frame() == -1) {
+		return (-1);
+	}
+
+	return (journal_flush());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_flush
+// Description  : Write out the small writes gathered by a handle, and the
+//                pack frame if blocks of the file are waiting in it
+//
+// Inputs       : fd - the file handle
+// Outputs      : 0 if successful, -1 if failure
+
+int32_t cart_flush(int16_t fd) {
+	struct OpenFile *open = find_handle(fd);
+
+	//fail if the handle is not valid
+	if(open == NULL || flush_write_buffer(open) == -1) {
+		return (-1);
+	}
+
+	if(pack_holds_file(open->file) == true) {
+		return (flush_pack_frame());
+	}
+
+	return (0);
+}
@@ -13,10 +13,41 @@
 
 // Include files
 #include <stdint.h>
+#include <cart_controller.h>
 
 // Defines
-#define CART_MAX_TOTAL_FILES 1024 // Maximum number of files ever
+#define CART_MAX_OPEN_FILES 32767 // Maximum number of files open at once
 #define CART_MAX_PATH_LENGTH 128 // Maximum length of filename length
+#define CART_DEDUP_OFF 0 // Store every block written
+#define CART_DEDUP_ON 1 // Point blocks at a stored frame with the same fingerprint
+#define CART_DEDUP_VERIFY 2 // Also check the MD5 signature before sharing a frame
+
+// Information about a file
+typedef struct {
+	uint32_t length; // Length of the file in bytes
+	uint32_t frames; // Number of frames holding the file
+	uint32_t stored; // Bytes the file takes on the cartridges
+	uint32_t carts; // Number of cartridges holding frames of the file
+} CartFileStat;
+
+// Deduplication counts since poweron
+typedef struct {
+	uint64_t blocks; // Blocks fingerprinted
+	uint64_t duplicates; // Blocks stored by pointing at a frame with the same bytes
+	uint64_t nsec; // Time spent computing fingerprints
+	uint32_t shared; // Frames used by more than one block
+	uint32_t indexed; // Frames in the fingerprint index
+} CartDedupStat;
+
+// Frame checksum counts since poweron
+typedef struct {
+	uint64_t computed; // Frames checksummed as they were written
+	uint64_t verified; // Frames read from the bus and checked
+	uint64_t retried; // Frames read again after a mismatch
+	uint64_t failed; // Frames still wrong after the second read
+	uint64_t adopted; // Frames written just before a crash, taken as they are
+	uint64_t nsec; // Time spent computing checksums
+} CartChecksumStat;
 
 //
 // Interface functions
@@ -28,7 +59,7 @@ int32_t cart_poweroff(void);
 	// Shut down the CART interface, close all files
 
 int16_t cart_open(char *path);
-	// This function opens the file and returns a file handle
+	// This function opens the file and returns a new file handle, a file can be open through several handles
 
 int16_t cart_close(int16_t fd);
 	// This function closes the file
@@ -39,9 +70,75 @@ int32_t cart_read(int16_t fd, void *buf, int32_t count);
 int32_t cart_write(int16_t fd, void *buf, int32_t count);
 	// Writes "count" bytes to the file handle "fh" from the buffer  "buf"
 
+int32_t cart_pread(int16_t fd, void *buf, int32_t count, uint32_t off);
+	// Reads "count" bytes from offset "off" without moving the file position
+
+int32_t cart_pwrite(int16_t fd, void *buf, int32_t count, uint32_t off);
+	// Writes "count" bytes at offset "off" without moving the file position
+
 int32_t cart_seek(int16_t fd, uint32_t loc);
 	// Seek to specific point in the file
 
+int32_t cart_stat(char *path, CartFileStat *stat);
+	// Get the length and number of frames of a file
+
+int32_t cart_unlink(char *path);
+	// Delete a file that is not open and reuse its frames
+
+int32_t cart_truncate(int16_t fd, uint32_t length);
+	// Change the length of an open file, releasing the frames past the end
+
+int32_t cart_sync(void);
+	// Write out the buffered writes and commit the metadata changes made so far
+
+int32_t cart_flush(int16_t fd);
+	// Write out the small writes gathered by a file handle
+
+int32_t cart_memory_report(void);
+	// Log the memory used by each of the driver structures, returns the total
+
+int32_t cart_defrag(uint32_t budget);
+	// Move up to "budget" frames to put the files on as few cartridges as possible
+
+int32_t cart_set_defrag_budget(uint32_t budget);
+	// Set the frames moved in the background after every read and write
+
+int32_t cart_set_tail_packing(uint32_t max);
+	// Set the longest last block packed into a shared frame at close, 0 is off
+
+int32_t cart_set_compression(uint32_t on);
+	// Turn on or off compressing the blocks as they are written
+
+int32_t cart_set_stripes(uint32_t width);
+	// Spread the blocks written from now on round-robin over "width" cartridges, 1 is off
+
+int32_t cart_set_partial_writes(uint32_t on);
+	// Turn on or off sending only the bytes of small writes to blocks that are not cached
+
+int32_t cart_set_dedup(uint32_t mode);
+	// Set how written blocks are deduplicated, one of the CART_DEDUP modes
+
+int32_t cart_dedup_stats(CartDedupStat *stat);
+	// Get the deduplication counts since poweron
+
+int32_t cart_set_checksums(uint32_t on);
+	// Turn on or off checksumming written frames and checking them when read
+
+int32_t cart_checksum_stats(CartChecksumStat *stat);
+	// Get the checksum counts since poweron
+
+int32_t cart_frames_used(void);
+	// Count the frames in use on the data cartridges
+
+int32_t cart_fragmentation_report(void);
+	// Log how fragmented the files are, returns the loads to read every file
+
+int32_t cart_bus_counts(uint64_t counts[CART_OP_MAXVAL]);
+	// Get the bus operations sent since poweron, indexed by opcode
+
+int32_t cart_bus_report(void);
+	// Log the bus operations sent since poweron
+
 
 #endif
 
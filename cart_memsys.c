@@ -0,0 +1,523 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : cart_memsys.c
+//  Description    : This is the implementation of the CART memory system.
+//                   The 64 cartridges are one image file mapped into memory,
+//                   cartridge c starts at c * 1 MB and frame f of it f KB
+//                   further, the same layout as the backing store of the
+//                   bundled server. Every user of the bus has a cartridge
+//                   loaded of its own, a lock per cartridge keeps users of
+//                   the same cartridge from seeing half written frames.
+//                   cart_io_bus is the bus of a program that keeps the
+//                   cartridges itself, without a server.
+//
+//  Author         : [**Jason Ling**]
+//  Last Modified  : [**December 10, 2016**]
+//
+
+// Includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+// Project includes
+#include <cmpsc311_log.h>
+#include <cart_memsys.h>
+#include <cart_network.h>
+
+// Defines
+#define CART_MEMSYS_RT1 (((CartXferRegister) 1) << 47)
+#define CART_MEMSYS_UNIT_IMAGE "cart_memsys_unit.bck"
+
+//
+// Global data
+
+//image file, mapped the first time a user initializes the memory system
+static char image_path[256] = CART_MEMSYS_IMAGE;
+static char *image = NULL;
+static pthread_mutex_t image_lock = PTHREAD_MUTEX_INITIALIZER;
+
+//a lock for every cartridge
+static pthread_mutex_t cart_locks[CART_MAX_CARTRIDGES] = {[0 ... CART_MAX_CARTRIDGES - 1] = PTHREAD_MUTEX_INITIALIZER};
+
+//the program itself as the one user of cart_io_bus
+static CartBusState io_bus_state = {0, CART_NO_CARTRIDGE, 0};
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_memsys_set_image
+// Description  : Set the image file the cartridges are kept in
+//
+// Inputs       : path - the file, NULL for the default one
+// Outputs      : 0 if successful, -1 if the image is already open
+
+int cart_memsys_set_image(const char *path) {
+	if(image != NULL || (path != NULL && strlen(path) >= sizeof(image_path))) {
+		return (-1);
+	}
+
+	strcpy(image_path, (path == NULL) ? CART_MEMSYS_IMAGE : path);
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_memsys_open
+// Description  : Map the image file, a missing or short file is grown with
+//                zeroed frames. It stays mapped until cart_memsys_close,
+//                another user initializing the memory system shares it
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int cart_memsys_open(void) {
+	int fd = -1;
+
+	pthread_mutex_lock(&image_lock);
+	if(image != NULL) {
+		pthread_mutex_unlock(&image_lock);
+		return (0);
+	}
+
+	fd = open(image_path, O_RDWR | O_CREAT, 0600);
+	if(fd == -1 || ftruncate(fd, CART_MEMSYS_SIZE) == -1) {
+		logMessage(LOG_ERROR_LEVEL, "Failure opening cart image [%s], error=[%s]", image_path, strerror(errno));
+		if(fd != -1) {
+			close(fd);
+		}
+		pthread_mutex_unlock(&image_lock);
+		return (-1);
+	}
+
+	//the mapping keeps the file open
+	image = mmap(NULL, CART_MEMSYS_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(image == MAP_FAILED) {
+		logMessage(LOG_ERROR_LEVEL, "Failure mapping cart image [%s], error=[%s]", image_path, strerror(errno));
+		image = NULL;
+		pthread_mutex_unlock(&image_lock);
+		return (-1);
+	}
+
+	logMessage(LOG_INFO_LEVEL, "Cartridge image [%s] mapped.", image_path);
+	pthread_mutex_unlock(&image_lock);
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_memsys_sync
+// Description  : Write the changed frames out to the image file
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int cart_memsys_sync(void) {
+	if(image == NULL) {
+		return (0);
+	}
+
+	if(msync(image, CART_MEMSYS_SIZE, MS_SYNC) == -1) {
+		logMessage(LOG_ERROR_LEVEL, "Failure writing cart image [%s], error=[%s]", image_path, strerror(errno));
+		return (-1);
+	}
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_memsys_close
+// Description  : Write out and unmap the image file, no user may be using it
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int cart_memsys_close(void) {
+	int ret = 0;
+
+	pthread_mutex_lock(&image_lock);
+	if(image != NULL) {
+		ret = cart_memsys_sync();
+		munmap(image, CART_MEMSYS_SIZE);
+		image = NULL;
+	}
+	pthread_mutex_unlock(&image_lock);
+
+	return (ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_memsys_reset
+// Description  : Start the state of a new user of the bus
+//
+// Inputs       : state - the state of the user
+// Outputs      : none
+
+void cart_memsys_reset(CartBusState *state) {
+	state->on = 0;
+	state->loaded = CART_NO_CARTRIDGE;
+	state->ranges = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_memsys_range
+// Description  : Get the number of frames a range request moves. Ranges are
+//                only taken from a user its transport agreed protocol v2
+//                with, up to the length it was told
+//
+// Inputs       : state - the state of the user
+//                reg - the request registers
+// Outputs      : the number of frames, 0 if it is not a range request the
+//                user may make
+
+int cart_memsys_range(CartBusState *state, CartXferRegister reg) {
+	uint8_t op = (reg >> 56) & 0xff;
+	int frames = reg & CART_RANGE_MASK;
+
+	if((op != CART_OP_RDRANGE && op != CART_OP_WRRANGE) || frames == 0 || frames > state->ranges) {
+		return (0);
+	}
+
+	return (frames);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_memsys_part
+// Description  : Get the size of what follows a partial write, the offset
+//                of its bytes and the bytes. Like ranges they are only
+//                taken on protocol v2
+//
+// Inputs       : state - the state of the user
+//                reg - the request registers
+// Outputs      : the size, 0 if it is not a partial write the user may make
+
+int cart_memsys_part(CartBusState *state, CartXferRegister reg) {
+	uint8_t op = (reg >> 56) & 0xff;
+	int bytes = reg & CART_RANGE_MASK;
+
+	if(op != CART_OP_WRPART || bytes == 0 || bytes > CART_FRAME_SIZE || state->ranges == 0) {
+		return (0);
+	}
+
+	return (CART_PART_HEADER + bytes);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_memsys_bus
+// Description  : Carry out one bus operation for a user. INITMS opens the
+//                image if no other user has and POWOFF writes it out, in
+//                between the user loads its own cartridges and reads and
+//                writes their frames, or ranges and parts of frames of any
+//                cartridge without loading it
+//
+// Inputs       : state - the state of the user
+//                reg - the request registers
+//                buf - the frame for RDFRME/WRFRME, the frames one after
+//                      another for RDRANGE/WRRANGE, the offset and the
+//                      bytes for WRPART
+// Outputs      : the request registers, with RT1 set if the operation failed
+
+CartXferRegister cart_memsys_bus(CartBusState *state, CartXferRegister reg, void *buf) {
+	uint8_t op = (reg >> 56) & 0xff;
+	CartridgeIndex cart = (CartridgeIndex) ((reg >> 31) & 0xffff);
+	CartFrameIndex frame = (CartFrameIndex) ((reg >> 15) & 0xffff);
+	int frames = cart_memsys_range(state, reg);
+	int part = cart_memsys_part(state, reg);
+	uint16_t offset = 0;
+	char *where = NULL;
+	int ret = -1;
+
+	reg &= ~CART_MEMSYS_RT1;
+
+	//everything but INITMS needs the memory system on for the user
+	if(op != CART_OP_INITMS && (state->on == 0 || image == NULL)) {
+		return (reg | CART_MEMSYS_RT1);
+	}
+
+	switch(op) {
+	case CART_OP_INITMS:
+		ret = cart_memsys_open();
+		state->on = (ret == 0);
+		state->loaded = CART_NO_CARTRIDGE;
+		state->ranges = 0;
+		break;
+
+	case CART_OP_BZERO:
+		if(state->loaded != CART_NO_CARTRIDGE) {
+			where = &image[(uint64_t) state->loaded * CART_CARTRIDGE_SIZE * CART_FRAME_SIZE];
+			pthread_mutex_lock(&cart_locks[state->loaded]);
+			memset(where, 0, CART_CARTRIDGE_SIZE * CART_FRAME_SIZE);
+			pthread_mutex_unlock(&cart_locks[state->loaded]);
+			ret = 0;
+		}
+		break;
+
+	case CART_OP_LDCART:
+		if(cart < CART_MAX_CARTRIDGES) {
+			state->loaded = cart;
+			ret = 0;
+		}
+		break;
+
+	case CART_OP_RDFRME:
+	case CART_OP_WRFRME:
+		if(state->loaded == CART_NO_CARTRIDGE || frame >= CART_CARTRIDGE_SIZE || buf == NULL) {
+			break;
+		}
+		where = &image[((uint64_t) state->loaded * CART_CARTRIDGE_SIZE + frame) * CART_FRAME_SIZE];
+		pthread_mutex_lock(&cart_locks[state->loaded]);
+		if(op == CART_OP_RDFRME) {
+			memcpy(buf, where, CART_FRAME_SIZE);
+		}
+		else {
+			memcpy(where, buf, CART_FRAME_SIZE);
+		}
+		pthread_mutex_unlock(&cart_locks[state->loaded]);
+		ret = 0;
+		break;
+
+	case CART_OP_RDRANGE:
+	case CART_OP_WRRANGE:
+		if(frames == 0 || cart >= CART_MAX_CARTRIDGES || frame + frames > CART_CARTRIDGE_SIZE || buf == NULL) {
+			break;
+		}
+		where = &image[((uint64_t) cart * CART_CARTRIDGE_SIZE + frame) * CART_FRAME_SIZE];
+		pthread_mutex_lock(&cart_locks[cart]);
+		if(op == CART_OP_RDRANGE) {
+			memcpy(buf, where, frames * CART_FRAME_SIZE);
+		}
+		else {
+			memcpy(where, buf, frames * CART_FRAME_SIZE);
+		}
+		pthread_mutex_unlock(&cart_locks[cart]);
+		ret = 0;
+		break;
+
+	case CART_OP_WRPART:
+		if(part == 0 || cart >= CART_MAX_CARTRIDGES || frame >= CART_CARTRIDGE_SIZE || buf == NULL) {
+			break;
+		}
+		offset = (((uint8_t *) buf)[0] << 8) | ((uint8_t *) buf)[1];
+		if(offset + part - CART_PART_HEADER > CART_FRAME_SIZE) {
+			break;
+		}
+		where = &image[((uint64_t) cart * CART_CARTRIDGE_SIZE + frame) * CART_FRAME_SIZE + offset];
+		pthread_mutex_lock(&cart_locks[cart]);
+		memcpy(where, (char *) buf + CART_PART_HEADER, part - CART_PART_HEADER);
+		pthread_mutex_unlock(&cart_locks[cart]);
+		ret = 0;
+		break;
+
+	case CART_OP_POWOFF:
+		ret = cart_memsys_sync();
+		cart_memsys_reset(state);
+		break;
+
+	default:
+		logMessage(LOG_ERROR_LEVEL, "CART BUS FAULT: unknown op instruction [%x]", op);
+		break;
+	}
+
+	return ((ret == 0) ? reg : (reg | CART_MEMSYS_RT1));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_io_bus
+// Description  : The bus of a program keeping the cartridges in its own
+//                process, every request is carried out on the image right
+//                away. POWOFF writes the image out, so the frames are there
+//                for the next run
+//
+// Inputs       : reg - the request registers
+//                buf - the frame for RDFRME/WRFRME
+// Outputs      : the request registers, with RT1 set if the operation failed
+
+CartXferRegister cart_io_bus(CartXferRegister reg, void *buf) {
+	return (cart_memsys_bus(&io_bus_state, reg, buf));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : memsys_unit_request
+// Description  : Build the registers of a request for the unit test
+//
+// Inputs       : op - the opcode
+//                cart - cartridge register
+//                frame - frame register
+// Outputs      : the registers
+
+static CartXferRegister memsys_unit_request(CartOpCodes op, CartridgeIndex cart, CartFrameIndex frame) {
+	return ((((CartXferRegister) op) << 56) | (((CartXferRegister) cart) << 31) | (((CartXferRegister) frame) << 15));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : memsys_unit_checks
+// Description  : Check the bus operations: two users with their own loaded
+//                cartridges, zeroing, bad requests and the frames still
+//                there after a reopen
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+static int memsys_unit_checks(void) {
+	CartBusState one, two;
+	char frame[CART_FRAME_SIZE], back[CART_FRAME_SIZE];
+	char range[4 * CART_FRAME_SIZE], range_back[4 * CART_FRAME_SIZE];
+	CartridgeIndex cart = 0;
+	CartFrameIndex frm = 0;
+
+	cart_memsys_reset(&one);
+	cart_memsys_reset(&two);
+
+	//nothing works before the memory system is on
+	if(!(cart_memsys_bus(&one, memsys_unit_request(CART_OP_LDCART, 0, 0), NULL) & CART_MEMSYS_RT1) ||
+			(cart_memsys_bus(&one, memsys_unit_request(CART_OP_INITMS, 0, 0), NULL) & CART_MEMSYS_RT1) ||
+			(cart_memsys_bus(&two, memsys_unit_request(CART_OP_INITMS, 0, 0), NULL) & CART_MEMSYS_RT1)) {
+		logMessage(LOG_ERROR_LEVEL, "Memsys unit test: bad initialization");
+		return (-1);
+	}
+
+	//each user writes frames of the cartridge it loaded, the other one reads them
+	for(int i = 0; i < 200; i++) {
+		cart = rand() % CART_MAX_CARTRIDGES;
+		frm = rand() % CART_CARTRIDGE_SIZE;
+		memset(frame, i, CART_FRAME_SIZE);
+		memcpy(frame, &i, sizeof(i));
+		if((cart_memsys_bus(&one, memsys_unit_request(CART_OP_LDCART, cart, 0), NULL) & CART_MEMSYS_RT1) ||
+				(cart_memsys_bus(&one, memsys_unit_request(CART_OP_WRFRME, 0, frm), frame) & CART_MEMSYS_RT1) ||
+				(cart_memsys_bus(&two, memsys_unit_request(CART_OP_LDCART, cart, 0), NULL) & CART_MEMSYS_RT1) ||
+				(cart_memsys_bus(&two, memsys_unit_request(CART_OP_RDFRME, 0, frm), back) & CART_MEMSYS_RT1) ||
+				memcmp(frame, back, CART_FRAME_SIZE) != 0) {
+			logMessage(LOG_ERROR_LEVEL, "Memsys unit test: frame %u of cartridge %u did not come back", frm, cart);
+			return (-1);
+		}
+	}
+
+	//a user loading another cartridge does not move the other one
+	memset(frame, 0x5a, CART_FRAME_SIZE);
+	if((cart_memsys_bus(&one, memsys_unit_request(CART_OP_LDCART, 3, 0), NULL) & CART_MEMSYS_RT1) ||
+			(cart_memsys_bus(&two, memsys_unit_request(CART_OP_LDCART, 4, 0), NULL) & CART_MEMSYS_RT1) ||
+			(cart_memsys_bus(&one, memsys_unit_request(CART_OP_WRFRME, 0, 7), frame) & CART_MEMSYS_RT1) ||
+			(cart_memsys_bus(&two, memsys_unit_request(CART_OP_BZERO, 0, 0), NULL) & CART_MEMSYS_RT1) ||
+			(cart_memsys_bus(&one, memsys_unit_request(CART_OP_RDFRME, 0, 7), back) & CART_MEMSYS_RT1) ||
+			memcmp(frame, back, CART_FRAME_SIZE) != 0) {
+		logMessage(LOG_ERROR_LEVEL, "Memsys unit test: the users got their cartridges mixed up");
+		return (-1);
+	}
+	memset(frame, 0, CART_FRAME_SIZE);
+	if((cart_memsys_bus(&two, memsys_unit_request(CART_OP_RDFRME, 0, 7), back) & CART_MEMSYS_RT1) ||
+			memcmp(frame, back, CART_FRAME_SIZE) != 0) {
+		logMessage(LOG_ERROR_LEVEL, "Memsys unit test: zeroed cartridge still holds data");
+		return (-1);
+	}
+
+	//ranges are turned down on protocol v1, on v2 they move the frames of
+	//any cartridge and leave the loaded one alone
+	for(int i = 0; i < (int) sizeof(range); i++) {
+		range[i] = rand();
+	}
+	if(!(cart_memsys_bus(&one, memsys_unit_request(CART_OP_WRRANGE, 9, 20) | 4, range) & CART_MEMSYS_RT1)) {
+		logMessage(LOG_ERROR_LEVEL, "Memsys unit test: a range was taken on protocol v1");
+		return (-1);
+	}
+	one.ranges = 4;
+	two.ranges = 4;
+	memset(frame, 0x5a, CART_FRAME_SIZE);
+	if((cart_memsys_bus(&one, memsys_unit_request(CART_OP_WRRANGE, 9, 20) | 4, range) & CART_MEMSYS_RT1) ||
+			(cart_memsys_bus(&two, memsys_unit_request(CART_OP_RDRANGE, 9, 20) | 4, range_back) & CART_MEMSYS_RT1) ||
+			memcmp(range, range_back, sizeof(range)) != 0 ||
+			(cart_memsys_bus(&two, memsys_unit_request(CART_OP_LDCART, 9, 0), NULL) & CART_MEMSYS_RT1) ||
+			(cart_memsys_bus(&two, memsys_unit_request(CART_OP_RDFRME, 0, 22), back) & CART_MEMSYS_RT1) ||
+			memcmp(&range[2 * CART_FRAME_SIZE], back, CART_FRAME_SIZE) != 0 ||
+			(cart_memsys_bus(&one, memsys_unit_request(CART_OP_RDFRME, 0, 7), back) & CART_MEMSYS_RT1) ||
+			memcmp(frame, back, CART_FRAME_SIZE) != 0) {
+		logMessage(LOG_ERROR_LEVEL, "Memsys unit test: a range did not come back");
+		return (-1);
+	}
+	if(!(cart_memsys_bus(&one, memsys_unit_request(CART_OP_RDRANGE, 9, CART_CARTRIDGE_SIZE - 2) | 4, range_back) & CART_MEMSYS_RT1) ||
+			!(cart_memsys_bus(&one, memsys_unit_request(CART_OP_RDRANGE, 9, 0) | 5, range_back) & CART_MEMSYS_RT1) ||
+			!(cart_memsys_bus(&one, memsys_unit_request(CART_OP_RDRANGE, 9, 0), range_back) & CART_MEMSYS_RT1)) {
+		logMessage(LOG_ERROR_LEVEL, "Memsys unit test: a bad range was carried out");
+		return (-1);
+	}
+
+	//a partial write changes its bytes only, one running past the frame is turned down
+	range[0] = 0;
+	range[1] = 100;
+	memset(&range_back[2 * CART_FRAME_SIZE + 100], 0x33, 10);
+	memset(&range[CART_PART_HEADER], 0x33, 10);
+	if((cart_memsys_bus(&one, memsys_unit_request(CART_OP_WRPART, 9, 22) | 10, range) & CART_MEMSYS_RT1) ||
+			(cart_memsys_bus(&two, memsys_unit_request(CART_OP_RDFRME, 0, 22), back) & CART_MEMSYS_RT1) ||
+			memcmp(&range_back[2 * CART_FRAME_SIZE], back, CART_FRAME_SIZE) != 0 ||
+			!(cart_memsys_bus(&one, memsys_unit_request(CART_OP_WRPART, 9, 22) | (CART_FRAME_SIZE - 99), range) & CART_MEMSYS_RT1)) {
+		logMessage(LOG_ERROR_LEVEL, "Memsys unit test: a partial write went wrong");
+		return (-1);
+	}
+
+	//bad cartridges, frames and opcodes are turned down
+	if(!(cart_memsys_bus(&one, memsys_unit_request(CART_OP_LDCART, CART_MAX_CARTRIDGES, 0), NULL) & CART_MEMSYS_RT1) ||
+			!(cart_memsys_bus(&one, memsys_unit_request(CART_OP_RDFRME, 0, CART_CARTRIDGE_SIZE), back) & CART_MEMSYS_RT1) ||
+			!(cart_memsys_bus(&one, memsys_unit_request(CART_OP_MAXVAL, 0, 0), NULL) & CART_MEMSYS_RT1)) {
+		logMessage(LOG_ERROR_LEVEL, "Memsys unit test: a bad request was carried out");
+		return (-1);
+	}
+
+	//the frames are still there after the image is closed and opened again
+	memset(frame, 0x5a, CART_FRAME_SIZE);
+	if((cart_memsys_bus(&one, memsys_unit_request(CART_OP_POWOFF, 0, 0), NULL) & CART_MEMSYS_RT1) ||
+			!(cart_memsys_bus(&one, memsys_unit_request(CART_OP_LDCART, 3, 0), NULL) & CART_MEMSYS_RT1) ||
+			cart_memsys_close() == -1 ||
+			(cart_memsys_bus(&one, memsys_unit_request(CART_OP_INITMS, 0, 0), NULL) & CART_MEMSYS_RT1) ||
+			(cart_memsys_bus(&one, memsys_unit_request(CART_OP_LDCART, 3, 0), NULL) & CART_MEMSYS_RT1) ||
+			(cart_memsys_bus(&one, memsys_unit_request(CART_OP_RDFRME, 0, 7), back) & CART_MEMSYS_RT1) ||
+			memcmp(frame, back, CART_FRAME_SIZE) != 0) {
+		logMessage(LOG_ERROR_LEVEL, "Memsys unit test: frames lost over a reopen");
+		return (-1);
+	}
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cartMemsysUnitTest
+// Description  : Run a UNIT test of the bus operations on a scratch image
+//                that is removed afterwards
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int cartMemsysUnitTest(void) {
+	int ret = 0;
+
+	if(image != NULL || cart_memsys_set_image(CART_MEMSYS_UNIT_IMAGE) == -1) {
+		logMessage(LOG_ERROR_LEVEL, "Memsys unit test: the image is in use");
+		return (-1);
+	}
+	unlink(CART_MEMSYS_UNIT_IMAGE);
+
+	ret = memsys_unit_checks();
+	cart_memsys_close();
+	unlink(CART_MEMSYS_UNIT_IMAGE);
+	cart_memsys_set_image(NULL);
+
+	if(ret == 0) {
+		logMessage(LOG_INFO_LEVEL, "Memsys unit test completed successfully.");
+	}
+	return (ret);
+}
@@ -0,0 +1,66 @@
+#ifndef CART_MEMSYS_INCLUDED
+#define CART_MEMSYS_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : cart_memsys.h
+//  Description    : This is the header file for the CART memory system, the
+//                   cartridges behind the bus. They are kept in an image
+//                   file mapped into memory, laid out like the backing store
+//                   of the bundled server so either one can use it.
+//
+//  Author         : [**Jason Ling**]
+//  Last Modified  : [**December 10, 2016**]
+//
+
+// Includes
+#include <stdint.h>
+#include <cart_controller.h>
+
+// Defines
+#define CART_MEMSYS_IMAGE "cart_memsys.bck" // Image file used unless told otherwise
+#define CART_MEMSYS_SIZE ((uint64_t) CART_MAX_CARTRIDGES * CART_CARTRIDGE_SIZE * CART_FRAME_SIZE)
+
+// State of one user of the bus, every connection of a server has its own
+typedef struct {
+	int            on;     // The user initialized the memory system
+	CartridgeIndex loaded; // Cartridge loaded for the user, CART_NO_CARTRIDGE if none
+	int            ranges; // Most frames of a range request, 0 on protocol v1
+} CartBusState;
+
+//
+// Interface functions
+
+int cart_memsys_set_image(const char *path);
+	// Set the image file the cartridges are kept in, before it is opened
+
+int cart_memsys_open(void);
+	// Map the image file, creating it with zeroed cartridges if it is missing
+
+int cart_memsys_sync(void);
+	// Write the changed frames out to the image file
+
+int cart_memsys_close(void);
+	// Write out and unmap the image file
+
+void cart_memsys_reset(CartBusState *state);
+	// Start the state of a new user, nothing initialized or loaded
+
+CartXferRegister cart_memsys_bus(CartBusState *state, CartXferRegister reg, void *buf);
+	// Carry out one bus operation for a user, returns the register with RT1 set on failure
+
+int cart_memsys_range(CartBusState *state, CartXferRegister reg);
+	// Get the number of frames a range request moves, 0 if it is not one the user may make
+
+int cart_memsys_part(CartBusState *state, CartXferRegister reg);
+	// Get the size of what follows a partial write, 0 if it is not one the user may make
+
+// cart_io_bus (cart_controller.h) carries them out for the program itself
+
+//
+// Unit test
+
+int cartMemsysUnitTest(void);
+	// Run a UNIT test of the bus operations
+
+#endif
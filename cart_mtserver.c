@@ -0,0 +1,604 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : cart_mtserver.c
+//  Description   : This is the server side of the CART communication
+//                  protocol, built from source. The main thread accepts the
+//                  connections and hands them round-robin to worker threads,
+//                  each worker answers its connections from an epoll loop.
+//                  A connection has a cartridge loaded of its own, so
+//                  several clients (or the shards of one client) can use
+//                  the cartridges at the same time. Requests sent back to
+//                  back are answered together with one read and one write,
+//                  a client on protocol v2 can move a range of frames or
+//                  write part of a frame with one request.
+//                  Clients on the same host can also use the channels of a
+//                  shared memory region, each answered by a thread of its own.
+//
+//   Author       : Jason Ling
+//  Last Modified : Saturday, December 10
+//
+
+// Include Files
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+// Project Include Files
+#include <cart_network.h>
+#include <cart_memsys.h>
+#include <cart_shm.h>
+#include <cmpsc311_util.h>
+#include <cmpsc311_log.h>
+
+// Defines
+#define CART_MTSERVER_ARGUMENTS "huvl:p:t:f:m:"
+#define CART_MTSERVER_THREADS 4
+#define CART_MTSERVER_MAX_THREADS 64
+#define CART_MTSERVER_EVENTS 64
+#define CART_MTSERVER_REQUEST_MAX (CART_NET_HEADER_SIZE + CART_FRAME_SIZE)
+#define CART_MTSERVER_BUFFER (64 * CART_MTSERVER_REQUEST_MAX)
+#define USAGE \
+	"USAGE: cart_mtserver [-h] [-u] [-v] [-l <logfile>] [-p <port>] [-t <threads>] [-f <image>] [-m <name>]\n" \
+	"\n" \
+	"where:\n" \
+	"    -h - help mode (display this message)\n" \
+	"    -u - run the unit tests\n" \
+	"    -v - verbose output\n" \
+	"    -l - write log messages to the filename <logfile>\n" \
+	"    -p - port number to listen on (default 21785)\n" \
+	"    -t - number of worker threads (default 4)\n" \
+	"    -f - image file holding the cartridges (default cart_memsys.bck)\n" \
+	"    -m - also serve clients through the shared memory region /<name>\n" \
+	"\n" \
+
+//A client connection, answered by one worker
+struct CartConnection {
+	int socket; //the connection
+	char address[INET_ADDRSTRLEN]; //address of the client
+	unsigned short port; //port of the client
+	CartBusState bus; //memory system on and cartridge loaded for the connection
+	char in[CART_MTSERVER_BUFFER]; //requests received and not answered yet
+	uint32_t in_used;
+	char out[CART_MTSERVER_BUFFER]; //answers not sent yet
+	uint32_t out_sent;
+	uint32_t out_used;
+	uint32_t events; //what the worker waits for on the socket
+};
+
+//A worker thread and the connections it answers
+struct CartWorker {
+	pthread_t thread;
+	int epoll; //the connections of the worker
+	uint64_t requests; //requests answered
+};
+
+//A thread answering a shared memory channel
+struct CartShmWorker {
+	pthread_t thread;
+	CartShmChannel *channel; //the channel
+	uint64_t requests; //requests answered
+};
+
+//
+//  Global data
+int                cart_network_shutdown = 0;   // Flag indicating shutdown
+unsigned char     *cart_network_address = NULL; // Address of CART server
+unsigned short     cart_network_port = 0;       // Port of CART server
+
+struct CartWorker workers[CART_MTSERVER_MAX_THREADS];
+int num_workers = CART_MTSERVER_THREADS;
+
+char shm_name[CART_SHM_NAME_SIZE] = ""; //shared memory region, empty for none
+CartShmRegion *shm_region = NULL;
+struct CartShmWorker shm_workers[CART_SHM_CHANNELS];
+
+//
+// Functional Prototypes
+
+int answer_requests(struct CartWorker *worker, struct CartConnection *conn); // answer the complete requests received
+int send_answers(struct CartConnection *conn);       // send the answers waiting
+int serve_connection(struct CartWorker *worker, struct CartConnection *conn); // answer a connection that is ready
+int close_connection(struct CartWorker *worker, struct CartConnection *conn); // drop a connection
+void *worker_loop(void *arg);                         // event loop of a worker thread
+void *shm_worker_loop(void *arg);                     // answer loop of a shared memory channel
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : main
+// Description  : The main function for the CART server
+//
+// Inputs       : argc - the number of command line parameters
+//                argv - the parameters
+// Outputs      : 0 if successful, -1 if failure
+
+int main( int argc, char *argv[] ) {
+
+	// Local variables
+	int ch, verbose = 0, log_initialized = 0, unit_tests = 0;
+
+	// Process the command line parameters
+	while ((ch = getopt(argc, argv, CART_MTSERVER_ARGUMENTS)) != -1) {
+
+		switch (ch) {
+		case 'h': // Help, print usage
+			fprintf( stderr, USAGE );
+			return( -1 );
+
+		case 'u': // Unit test Flag
+			unit_tests = 1;
+			break;
+
+		case 'v': // Verbose Flag
+			verbose = 1;
+			break;
+
+		case 'l': // Set the log filename
+			initializeLogWithFilename( optarg );
+			log_initialized = 1;
+			break;
+
+		case 'p': // Set the network port number
+			if ( sscanf(optarg, "%hu", &cart_network_port) != 1 ) {
+			    logMessage( LOG_ERROR_LEVEL, "Bad  port number [%s]", optarg );
+			    return( -1 );
+			}
+			break;
+
+		case 't': // Set the number of worker threads
+			if ( (sscanf(optarg, "%d", &num_workers) != 1) || (num_workers < 1) ||
+					(num_workers > CART_MTSERVER_MAX_THREADS) ) {
+			    logMessage( LOG_ERROR_LEVEL, "Bad number of threads [%s]", optarg );
+			    return( -1 );
+			}
+			break;
+
+		case 'f': // Set the image file
+			if ( cart_memsys_set_image(optarg) == -1 ) {
+			    logMessage( LOG_ERROR_LEVEL, "Bad image file [%s]", optarg );
+			    return( -1 );
+			}
+			break;
+
+		case 'm': // Serve a shared memory region
+			if ( (snprintf(shm_name, sizeof(shm_name), "/%s", optarg) >= (int) sizeof(shm_name)) ||
+					(strchr(optarg, '/') != NULL) ) {
+			    logMessage( LOG_ERROR_LEVEL, "Bad shared memory name [%s]", optarg );
+			    return( -1 );
+			}
+			break;
+
+		default:  // Default (unknown)
+			fprintf( stderr, "Unknown command line option (%c), aborting.\n", ch );
+			return( -1 );
+		}
+	}
+
+	// Setup the log as needed
+	if ( ! log_initialized ) {
+		initializeLogWithFilehandle( CMPSC311_LOG_STDERR );
+	}
+	if ( verbose ) {
+		enableLogLevels( LOG_INFO_LEVEL );
+	}
+
+	// If exgtracting file from data
+	if ( unit_tests ) {
+		enableLogLevels( LOG_INFO_LEVEL );
+		if ( cartMemsysUnitTest() ) {
+			logMessage( LOG_ERROR_LEVEL, "Memsys unit tests failed.\n\n" );
+			return( -1 );
+		}
+		logMessage( LOG_INFO_LEVEL, "Unit tests completed successfully.\n\n" );
+		return( 0 );
+	}
+
+	// Run the server until it is stopped
+	return( cart_server() );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : stop_server
+// Description  : Signal handler asking the server to shut down
+//
+// Inputs       : sig - the signal
+// Outputs      : none
+
+void stop_server(int sig) {
+	cart_network_shutdown = 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : answer_requests
+// Description  : Answer the complete requests at the front of the input
+//                buffer while their answers fit in the output buffer. A
+//                client asking for protocol v2 at INITMS is told the most
+//                frames of a range it may send
+//
+// Inputs       : worker - the worker of the connection
+//                conn - the connection
+// Outputs      : number of requests answered
+
+int answer_requests(struct CartWorker *worker, struct CartConnection *conn) {
+	CartXferRegister reg = 0, resp = 0;
+	uint32_t pos = 0;
+	uint32_t size = 0;
+	int answered = 0;
+	int frames_in = 0, frames_out = 0;
+	uint8_t op = 0;
+	char *frame = NULL;
+
+	while(conn->in_used - pos >= CART_NET_HEADER_SIZE) {
+		memcpy(&reg, &conn->in[pos], sizeof(reg));
+		reg = ntohll64(reg);
+		op = reg >> 56;
+
+		//a write is complete once its frames or bytes are in, a read needs
+		//room for its frames in the answers
+		frames_in = (op == CART_OP_WRFRME) ? 1 : ((op == CART_OP_WRRANGE) ? cart_memsys_range(&conn->bus, reg) : 0);
+		frames_out = (op == CART_OP_RDFRME) ? 1 : ((op == CART_OP_RDRANGE) ? cart_memsys_range(&conn->bus, reg) : 0);
+		size = CART_NET_HEADER_SIZE + frames_in * CART_FRAME_SIZE + cart_memsys_part(&conn->bus, reg);
+		if(conn->in_used - pos < size || conn->out_used + CART_NET_HEADER_SIZE + frames_out * CART_FRAME_SIZE > CART_MTSERVER_BUFFER) {
+			break;
+		}
+
+		//a read answers with the frames, zeroed if the read failed
+		frame = &conn->out[conn->out_used + CART_NET_HEADER_SIZE];
+		resp = cart_memsys_bus(&conn->bus, reg, (size > CART_NET_HEADER_SIZE) ? &conn->in[pos + CART_NET_HEADER_SIZE] : frame);
+		if(frames_out > 0 && ((resp >> 47) & 1)) {
+			memset(frame, 0, frames_out * CART_FRAME_SIZE);
+		}
+		if(op == CART_OP_INITMS && ((resp >> 47) & 1) == 0 && ((reg >> 48) & 0xff) == CART_PROTOCOL_V2) {
+			conn->bus.ranges = CART_RANGE_MAX;
+			resp = (resp & ~((CartXferRegister) CART_RANGE_MASK)) | CART_RANGE_MAX;
+		}
+		resp = htonll64(resp);
+		memcpy(&conn->out[conn->out_used], &resp, sizeof(resp));
+		conn->out_used += CART_NET_HEADER_SIZE + frames_out * CART_FRAME_SIZE;
+
+		pos += size;
+		answered++;
+	}
+
+	//keep the part of a request that is still coming
+	memmove(conn->in, &conn->in[pos], conn->in_used - pos);
+	conn->in_used -= pos;
+	worker->requests += answered;
+
+	return (answered);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : send_answers
+// Description  : Send as much of the waiting answers as the socket takes
+//
+// Inputs       : conn - the connection
+// Outputs      : 0 if successful, -1 if the connection failed
+
+int send_answers(struct CartConnection *conn) {
+	ssize_t sent = 0;
+
+	while(conn->out_sent < conn->out_used) {
+		sent = write(conn->socket, &conn->out[conn->out_sent], conn->out_used - conn->out_sent);
+		if(sent == -1 && errno == EINTR) {
+			continue;
+		}
+		if(sent == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			return (0);
+		}
+		if(sent <= 0) {
+			logMessage(LOG_ERROR_LEVEL, "CART send failed : [%s]", strerror(errno));
+			return (-1);
+		}
+		conn->out_sent += sent;
+	}
+
+	conn->out_sent = 0;
+	conn->out_used = 0;
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : serve_connection
+// Description  : Answer a connection the worker was woken up for: send the
+//                waiting answers, read more requests if they are all gone,
+//                then answer what came in. A connection with answers the
+//                client is not taking is not read until it takes them
+//
+// Inputs       : worker - the worker of the connection
+//                conn - the connection
+// Outputs      : 0 if successful, -1 if the connection is closed or failed
+
+int serve_connection(struct CartWorker *worker, struct CartConnection *conn) {
+	struct epoll_event event;
+	ssize_t got = 0;
+
+	if(send_answers(conn) == -1) {
+		return (-1);
+	}
+
+	if(conn->out_used == 0) {
+		got = read(conn->socket, &conn->in[conn->in_used], CART_MTSERVER_BUFFER - conn->in_used);
+		if(got == 0) {
+			return (-1);
+		}
+		if(got == -1 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+			logMessage(LOG_ERROR_LEVEL, "CART receive failed : [%s]", strerror(errno));
+			return (-1);
+		}
+		if(got > 0) {
+			conn->in_used += got;
+		}
+	}
+
+	//answer until the requests run out or the client stops taking answers
+	while(answer_requests(worker, conn) > 0) {
+		if(send_answers(conn) == -1) {
+			return (-1);
+		}
+		if(conn->out_used > 0) {
+			break;
+		}
+	}
+
+	//wait for room to send, or for more requests
+	event.events = (conn->out_used > 0) ? EPOLLOUT : EPOLLIN;
+	event.data.ptr = conn;
+	if(event.events != conn->events) {
+		if(epoll_ctl(worker->epoll, EPOLL_CTL_MOD, conn->socket, &event) == -1) {
+			return (-1);
+		}
+		conn->events = event.events;
+	}
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : close_connection
+// Description  : Drop a connection, the cartridges keep what it wrote
+//
+// Inputs       : worker - the worker of the connection
+//                conn - the connection
+// Outputs      : 0 if successful
+
+int close_connection(struct CartWorker *worker, struct CartConnection *conn) {
+	logMessage(LOG_INFO_LEVEL, "Closing client connection [%s/%d]", conn->address, conn->port);
+	epoll_ctl(worker->epoll, EPOLL_CTL_DEL, conn->socket, NULL);
+	close(conn->socket);
+	free(conn);
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : worker_loop
+// Description  : Answer the connections of a worker as they become ready,
+//                until the server shuts down
+//
+// Inputs       : arg - the worker
+// Outputs      : NULL
+
+void *worker_loop(void *arg) {
+	struct CartWorker *worker = arg;
+	struct epoll_event events[CART_MTSERVER_EVENTS];
+	struct CartConnection *conn = NULL;
+	int ready = 0;
+
+	while(cart_network_shutdown == 0) {
+		//wake up now and then to see if the server is shutting down
+		ready = epoll_wait(worker->epoll, events, CART_MTSERVER_EVENTS, 500);
+		for(int i = 0; i < ready; i++) {
+			conn = events[i].data.ptr;
+			if((events[i].events & EPOLLERR) || serve_connection(worker, conn) == -1) {
+				close_connection(worker, conn);
+			}
+		}
+	}
+
+	return (NULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shm_worker_loop
+// Description  : Answer the requests a client puts in a shared memory
+//                channel, in place in their slots, until the server shuts
+//                down. A new client claiming the channel starts with
+//                nothing initialized or loaded
+//
+// Inputs       : arg - the worker of the channel
+// Outputs      : NULL
+
+void *shm_worker_loop(void *arg) {
+	struct CartShmWorker *worker = arg;
+	CartShmChannel *channel = worker->channel;
+	CartShmSlot *slot = NULL;
+	CartBusState bus;
+	uint32_t session = 0;
+	uint32_t posted = 0;
+	uint32_t next = 0;
+	uint8_t op = 0;
+
+	cart_memsys_reset(&bus);
+	while(cart_network_shutdown == 0) {
+		//wake up now and then to see if the server is shutting down
+		if(cart_shm_wait(&channel->posted, next, &channel->server_sleeping, 500) == -1) {
+			continue;
+		}
+		posted = __atomic_load_n(&channel->posted, __ATOMIC_ACQUIRE);
+		if(__atomic_load_n(&channel->session, __ATOMIC_ACQUIRE) != session) {
+			session = channel->session;
+			cart_memsys_reset(&bus);
+		}
+
+		//every answer is handed over as soon as it is ready
+		while(next != posted) {
+			slot = &channel->slot[next % CART_SHM_SLOTS];
+			op = slot->reg >> 56;
+			slot->reg = cart_memsys_bus(&bus, slot->reg, slot->frame);
+			if(op == CART_OP_RDFRME && ((slot->reg >> 47) & 1)) {
+				memset(slot->frame, 0, CART_FRAME_SIZE);
+			}
+			next++;
+			worker->requests++;
+			cart_shm_post(&channel->answered, next, &channel->client_sleeping);
+		}
+	}
+
+	return (NULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_server
+// Description  : Listen for clients and hand every connection to a worker,
+//                until the server is stopped with SIGINT or SIGTERM
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int cart_server(void) {
+	struct sockaddr_in saddr, caddr;
+	socklen_t clen = sizeof(caddr);
+	struct sigaction action;
+	struct epoll_event event;
+	struct CartConnection *conn = NULL;
+	uint64_t requests = 0;
+	int server = -1;
+	int sock = -1;
+	int next = 0;
+	int one = 1;
+
+	//a signal interrupts accept, the workers see the flag in time
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = stop_server;
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	server = socket(PF_INET, SOCK_STREAM, 0);
+	if(server == -1) {
+		logMessage(LOG_ERROR_LEVEL, "CART socket() create failed : [%s]", strerror(errno));
+		return (-1);
+	}
+	if(setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) == -1) {
+		logMessage(LOG_ERROR_LEVEL, "CART set socket option create failed : [%s]", strerror(errno));
+		close(server);
+		return (-1);
+	}
+	memset(&saddr, 0, sizeof(saddr));
+	saddr.sin_family = AF_INET;
+	saddr.sin_port = htons((cart_network_port == 0) ? CART_DEFAULT_PORT : cart_network_port);
+	saddr.sin_addr.s_addr = htonl(INADDR_ANY);
+	if(bind(server, (struct sockaddr *) &saddr, sizeof(saddr)) == -1) {
+		logMessage(LOG_ERROR_LEVEL, "CART bind() create failed : [%s]", strerror(errno));
+		close(server);
+		return (-1);
+	}
+	if(listen(server, CART_MAX_BACKLOG) == -1) {
+		logMessage(LOG_ERROR_LEVEL, "CART listen() create failed : [%s]", strerror(errno));
+		close(server);
+		return (-1);
+	}
+
+	for(int w = 0; w < num_workers; w++) {
+		workers[w].requests = 0;
+		workers[w].epoll = epoll_create1(0);
+		if(workers[w].epoll == -1 || pthread_create(&workers[w].thread, NULL, worker_loop, &workers[w]) != 0) {
+			logMessage(LOG_ERROR_LEVEL, "CART server could not start worker %d, aborting.", w);
+			return (-1);
+		}
+	}
+	logMessage(LOG_INFO_LEVEL, "CART server listening on port %u with %d workers", ntohs(saddr.sin_port), num_workers);
+
+	//a thread for every channel, sleeping until a client uses it
+	if(shm_name[0] != '\0') {
+		shm_region = cart_shm_create(shm_name);
+		if(shm_region == NULL) {
+			logMessage(LOG_ERROR_LEVEL, "CART server could not create shared memory [%s], aborting.", shm_name);
+			return (-1);
+		}
+		for(int c = 0; c < CART_SHM_CHANNELS; c++) {
+			shm_workers[c].channel = &shm_region->channel[c];
+			shm_workers[c].requests = 0;
+			if(pthread_create(&shm_workers[c].thread, NULL, shm_worker_loop, &shm_workers[c]) != 0) {
+				logMessage(LOG_ERROR_LEVEL, "CART server could not start channel %d, aborting.", c);
+				return (-1);
+			}
+		}
+		logMessage(LOG_INFO_LEVEL, "CART server serving %d channels of shared memory [%s]", CART_SHM_CHANNELS, shm_name);
+	}
+
+	while(cart_network_shutdown == 0) {
+		clen = sizeof(caddr);
+		sock = accept(server, (struct sockaddr *) &caddr, &clen);
+		if(sock == -1) {
+			if(errno != EINTR) {
+				logMessage(LOG_ERROR_LEVEL, "CART server accept failed, aborting.");
+				cart_network_shutdown = 1;
+			}
+			continue;
+		}
+
+		//the answers go out as soon as they are ready
+		fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+		setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		conn = calloc(1, sizeof(struct CartConnection));
+		if(conn == NULL) {
+			close(sock);
+			continue;
+		}
+		conn->socket = sock;
+		inet_ntop(AF_INET, &caddr.sin_addr, conn->address, sizeof(conn->address));
+		conn->port = ntohs(caddr.sin_port);
+		cart_memsys_reset(&conn->bus);
+		conn->events = EPOLLIN;
+		logMessage(LOG_INFO_LEVEL, "Server new client connection [%s/%d]", conn->address, conn->port);
+
+		event.events = EPOLLIN;
+		event.data.ptr = conn;
+		if(epoll_ctl(workers[next].epoll, EPOLL_CTL_ADD, sock, &event) == -1) {
+			close(sock);
+			free(conn);
+			continue;
+		}
+		next = (next + 1) % num_workers;
+	}
+
+	logMessage(LOG_INFO_LEVEL, "Shutting down CART server ...");
+	close(server);
+	for(int w = 0; w < num_workers; w++) {
+		pthread_join(workers[w].thread, NULL);
+		close(workers[w].epoll);
+		requests += workers[w].requests;
+	}
+	if(shm_region != NULL) {
+		for(int c = 0; c < CART_SHM_CHANNELS; c++) {
+			pthread_join(shm_workers[c].thread, NULL);
+			requests += shm_workers[c].requests;
+		}
+		cart_shm_remove(shm_name, shm_region);
+	}
+	logMessage(LOG_INFO_LEVEL, "CART server answered %lu requests", requests);
+
+	return (cart_memsys_close());
+}
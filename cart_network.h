@@ -20,6 +20,25 @@
 #define CART_NET_HEADER_SIZE sizeof(CartXferRegister)
 #define CART_DEFAULT_IP "127.0.0.1"
 #define CART_DEFAULT_PORT 21785
+#define CART_MAX_SERVERS 16
+#define CART_MAX_SHARDS 64 // Connections, a pool of them to every server
+#define CART_MAX_PIPELINE 64
+
+// Protocol version 2, asked for with KY2 of INITMS. A server speaking it
+// answers with KY2 kept and the most frames of a range in the low bits, a
+// version 1 server leaves them zero. A range request names its cartridge in
+// CT1, its first frame in FM1 and the number of frames in the low bits, it
+// is answered once, the frames follow the request of a write and the
+// answer of a read. A partial write is followed by the offset of its bytes
+// in the frame, most significant byte first, and the bytes
+#define CART_PROTOCOL_V1 1
+#define CART_PROTOCOL_V2 2
+#define CART_OP_RDRANGE 0x10 // Read frames [FM1, FM1 + n) of cartridge CT1
+#define CART_OP_WRRANGE 0x11 // Write them
+#define CART_OP_WRPART 0x12  // Write bytes of frame FM1 of cartridge CT1, as many as the low bits
+#define CART_RANGE_MASK 0x7fff
+#define CART_RANGE_MAX 64
+#define CART_PART_HEADER 2 // Offset of the bytes of a partial write
 
 // Global data
 extern int            cart_network_shutdown; // Flag indicating shutdown
@@ -32,6 +51,42 @@ extern unsigned short cart_network_port;     // Port of CART server
 CartXferRegister client_cart_bus_request(CartXferRegister reg, void *buf);
 	// This is the implementation of the client operation (cart_client.c)
 
+int client_cart_bus_batch(CartXferRegister *regs, void **bufs, CartXferRegister *resps, int count);
+	// Send a batch of requests, the shards work on theirs at the same time, pipelined
+
+int client_cart_set_pipeline(int depth);
+	// Set how many requests of a batch are in flight on a connection
+
+int client_cart_set_protocol(int version);
+	// Ask the servers for this protocol version at the next INITMS, v1 servers stay on v1
+
+int client_cart_partial(CartridgeIndex cart);
+	// Check if the connection of a cartridge takes partial frame writes
+
+int client_cart_traffic(uint64_t *sent, uint64_t *received);
+	// Get the bytes sent to and received from the servers
+
+int client_cart_set_uring(int on);
+	// Send the requests through an io_uring, the sockets if the kernel has none
+
+int client_cart_set_shards(char *list);
+	// Spread the cartridges over the "host:port,..." servers, NULL for the one server
+
+int client_cart_set_pool(int size);
+	// Open size connections to every server, the cartridges are spread over all of them
+
+int client_cart_shards(void);
+	// Get the number of connections the cartridges are spread over
+
+int client_cart_shard(CartridgeIndex cart);
+	// Find the connection a cartridge is used through
+
+int client_cart_set_shm(char *name);
+	// Reach the server on this host through its shared memory region, NULL for TCP
+
+int client_cart_set_local(char *image);
+	// Keep the cartridges in this process in the image file, NULL for the server
+
 int cart_server( void );
 	// This is the implementation of the server application (cart_server.c)
 
@@ -0,0 +1,239 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : cart_shm.c
+//  Description    : This is the implementation of the shared memory transport
+//                   of the CART bus. The server creates a region of
+//                   channels, a client claims one and the two move the
+//                   posted and answered counters of the channel on. A side
+//                   with nothing to do spins for a moment and then sleeps on
+//                   the counter with a futex, the other side only makes the
+//                   wake up call when it is sleeping.
+//
+//  Author         : [**Jason Ling**]
+//  Last Modified  : [**December 11, 2016**]
+//
+
+// Includes
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+// Project includes
+#include <cmpsc311_log.h>
+#include <cart_shm.h>
+
+// Defines
+#define CART_SHM_SPIN 200 // Looks at a counter before sleeping on it
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_shm_create
+// Description  : Create the region of a server, a region left behind by a
+//                server that died is replaced, its clients see it is gone
+//
+// Inputs       : name - name of the region, "/name"
+// Outputs      : the region if successful, NULL if failure
+
+CartShmRegion *cart_shm_create(const char *name) {
+	CartShmRegion *region = NULL;
+	int fd = -1;
+
+	shm_unlink(name);
+	fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+	if(fd == -1 || ftruncate(fd, sizeof(CartShmRegion)) == -1) {
+		logMessage(LOG_ERROR_LEVEL, "Failure creating shared memory [%s], error=[%s]", name, strerror(errno));
+		if(fd != -1) {
+			close(fd);
+			shm_unlink(name);
+		}
+		return (NULL);
+	}
+
+	//the new region is zeroed, every channel is free
+	region = mmap(NULL, sizeof(CartShmRegion), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(region == MAP_FAILED) {
+		logMessage(LOG_ERROR_LEVEL, "Failure mapping shared memory [%s], error=[%s]", name, strerror(errno));
+		shm_unlink(name);
+		return (NULL);
+	}
+
+	region->server = getpid();
+	__atomic_store_n(&region->magic, CART_SHM_MAGIC, __ATOMIC_RELEASE);
+
+	return (region);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_shm_attach
+// Description  : Map the region of a running server
+//
+// Inputs       : name - name of the region, "/name"
+// Outputs      : the region if successful, NULL if failure
+
+CartShmRegion *cart_shm_attach(const char *name) {
+	CartShmRegion *region = NULL;
+	struct stat st;
+	int fd = -1;
+
+	fd = shm_open(name, O_RDWR, 0);
+	if(fd == -1 || fstat(fd, &st) == -1 || st.st_size != sizeof(CartShmRegion)) {
+		logMessage(LOG_ERROR_LEVEL, "Failure opening shared memory [%s], error=[%s]", name, strerror(errno));
+		if(fd != -1) {
+			close(fd);
+		}
+		return (NULL);
+	}
+
+	region = mmap(NULL, sizeof(CartShmRegion), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(region == MAP_FAILED) {
+		logMessage(LOG_ERROR_LEVEL, "Failure mapping shared memory [%s], error=[%s]", name, strerror(errno));
+		return (NULL);
+	}
+	if(__atomic_load_n(&region->magic, __ATOMIC_ACQUIRE) != CART_SHM_MAGIC) {
+		logMessage(LOG_ERROR_LEVEL, "Shared memory [%s] is not a CART region", name);
+		munmap(region, sizeof(CartShmRegion));
+		return (NULL);
+	}
+
+	return (region);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_shm_detach
+// Description  : Unmap a region
+//
+// Inputs       : region - the region
+// Outputs      : 0 if successful, -1 if failure
+
+int cart_shm_detach(CartShmRegion *region) {
+	return (munmap(region, sizeof(CartShmRegion)));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_shm_remove
+// Description  : Unmap the region of a server and remove its name, clients
+//                still attached keep their mapping until they detach
+//
+// Inputs       : name - name of the region
+//                region - the region
+// Outputs      : 0 if successful, -1 if failure
+
+int cart_shm_remove(const char *name, CartShmRegion *region) {
+	int ret = cart_shm_detach(region);
+
+	if(shm_unlink(name) == -1) {
+		ret = -1;
+	}
+
+	return (ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_shm_claim
+// Description  : Claim a channel for the calling process, a channel owned
+//                by a process that is gone is free again
+//
+// Inputs       : region - the region
+// Outputs      : the channel if successful, NULL if they are all in use
+
+CartShmChannel *cart_shm_claim(CartShmRegion *region) {
+	CartShmChannel *channel = NULL;
+	uint32_t owner = 0;
+
+	for(int c = 0; c < CART_SHM_CHANNELS; c++) {
+		channel = &region->channel[c];
+		owner = __atomic_load_n(&channel->owner, __ATOMIC_ACQUIRE);
+		if(owner != 0 && (kill(owner, 0) == 0 || errno != ESRCH)) {
+			continue;
+		}
+		if(__atomic_compare_exchange_n(&channel->owner, &owner, getpid(), 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+			//the server starts the new client with nothing initialized or loaded
+			__atomic_add_fetch(&channel->session, 1, __ATOMIC_RELEASE);
+			return (channel);
+		}
+	}
+
+	return (NULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_shm_release
+// Description  : Give a channel back
+//
+// Inputs       : channel - the channel
+// Outputs      : 0 if successful
+
+int cart_shm_release(CartShmChannel *channel) {
+	__atomic_store_n(&channel->owner, 0, __ATOMIC_RELEASE);
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_shm_wait
+// Description  : Wait for a counter to move past a value, spinning for a
+//                moment before sleeping on it
+//
+// Inputs       : counter - the counter
+//                seen - the value it had
+//                sleeping - flag telling the other side to wake this one
+//                timeout - milliseconds to wait
+// Outputs      : 0 if the counter moved, -1 if the time ran out
+
+int cart_shm_wait(uint32_t *counter, uint32_t seen, uint32_t *sleeping, int timeout) {
+	struct timespec wait = {timeout / 1000, (timeout % 1000) * 1000000L};
+
+	for(int i = 0; i < CART_SHM_SPIN; i++) {
+		if(__atomic_load_n(counter, __ATOMIC_ACQUIRE) != seen) {
+			return (0);
+		}
+	}
+
+	//the flag goes up before the last look, a post after it sees the flag
+	__atomic_store_n(sleeping, 1, __ATOMIC_SEQ_CST);
+	while(__atomic_load_n(counter, __ATOMIC_SEQ_CST) == seen) {
+		if(syscall(SYS_futex, counter, FUTEX_WAIT, seen, &wait, NULL, 0) == -1 && errno == ETIMEDOUT) {
+			__atomic_store_n(sleeping, 0, __ATOMIC_SEQ_CST);
+			return ((__atomic_load_n(counter, __ATOMIC_ACQUIRE) != seen) ? 0 : -1);
+		}
+	}
+	__atomic_store_n(sleeping, 0, __ATOMIC_SEQ_CST);
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_shm_post
+// Description  : Move a counter on, the slots it covers are ready for the
+//                other side, and wake the other side if it is sleeping
+//
+// Inputs       : counter - the counter
+//                value - its new value
+//                sleeping - flag of the other side
+// Outputs      : none
+
+void cart_shm_post(uint32_t *counter, uint32_t value, uint32_t *sleeping) {
+	__atomic_store_n(counter, value, __ATOMIC_SEQ_CST);
+	if(__atomic_exchange_n(sleeping, 0, __ATOMIC_SEQ_CST) != 0) {
+		syscall(SYS_futex, counter, FUTEX_WAKE, 1, NULL, NULL, 0);
+	}
+}
@@ -0,0 +1,79 @@
+#ifndef CART_SHM_INCLUDED
+#define CART_SHM_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : cart_shm.h
+//  Description    : This is the header file for the shared memory transport
+//                   of the CART bus, for a client on the same host as the
+//                   server. A client claims a channel of the region, puts
+//                   its requests and frames in the slots of the channel and
+//                   the server answers them in place.
+//
+//  Author         : [**Jason Ling**]
+//  Last Modified  : [**December 11, 2016**]
+//
+
+// Includes
+#include <stdint.h>
+#include <sys/types.h>
+#include <cart_network.h>
+
+// Defines
+#define CART_SHM_MAGIC 0x43415254 // "CART"
+#define CART_SHM_CHANNELS 8       // Clients the region can take at the same time
+#define CART_SHM_SLOTS CART_MAX_PIPELINE
+#define CART_SHM_NAME_SIZE 64
+
+// A request, the server replaces the register with the response
+typedef struct {
+	CartXferRegister reg;             // Request, then response registers
+	char             frame[CART_FRAME_SIZE]; // Frame of a WRFRME or RDFRME
+} CartShmSlot;
+
+// One client, request n is in slot n % CART_SHM_SLOTS
+typedef struct {
+	uint32_t    owner;                           // Process id of the client, 0 if free
+	uint32_t    session;                         // Changed by every client claiming the channel
+	uint32_t    posted __attribute__((aligned(64)));   // Requests put in the slots by the client
+	uint32_t    server_sleeping;                 // The server waits for posted to change
+	uint32_t    answered __attribute__((aligned(64))); // Requests answered by the server
+	uint32_t    client_sleeping;                 // The client waits for answered to change
+	CartShmSlot slot[CART_SHM_SLOTS] __attribute__((aligned(64)));
+} CartShmChannel;
+
+// The shared region, created by the server
+typedef struct {
+	uint32_t       magic;     // CART_SHM_MAGIC once the region is ready
+	uint32_t       server;    // Process id of the server
+	CartShmChannel channel[CART_SHM_CHANNELS];
+} CartShmRegion;
+
+//
+// Interface functions
+
+CartShmRegion *cart_shm_create(const char *name);
+	// Create the region of a server, replacing an old one of the same name
+
+CartShmRegion *cart_shm_attach(const char *name);
+	// Map the region of a running server
+
+int cart_shm_detach(CartShmRegion *region);
+	// Unmap a region
+
+int cart_shm_remove(const char *name, CartShmRegion *region);
+	// Unmap the region of a server and remove its name
+
+CartShmChannel *cart_shm_claim(CartShmRegion *region);
+	// Claim a free channel for the calling process
+
+int cart_shm_release(CartShmChannel *channel);
+	// Give a channel back
+
+int cart_shm_wait(uint32_t *counter, uint32_t seen, uint32_t *sleeping, int timeout);
+	// Wait for a counter to move past seen, -1 if timeout milliseconds pass first
+
+void cart_shm_post(uint32_t *counter, uint32_t value, uint32_t *sleeping);
+	// Move a counter on and wake the side sleeping on it
+
+#endif
@@ -24,6 +24,8 @@
 // Project Includes
 #include <cart_driver.h>
 #include <cart_cache.h>
+#include <cart_compress.h>
+#include <cart_crc.h>
 #include <cart_network.h>
 #include <cmpsc311_log.h>
 #include <cmpsc311_util.h>
@@ -31,9 +33,9 @@
 // Defines
 #define CART_WORKLOAD_DIR "workload"
 #define CART_SIM_MAX_OPEN_FILES 128
-#define CART_ARGUMENTS "huvl:c:i:p:"
+#define CART_ARGUMENTS "huvzDKUl:c:i:p:d:s:S:N:m:f:P:"
 #define USAGE \
-	"USAGE: cart_sim [-h] [-v] [-l <logfile>] [-c <sz>] <workload-file>\n" \
+	"USAGE: cart_sim [-h] [-v] [-l <logfile>] [-c <sz>] [-d <frames>] [-s <carts>] [-S <servers>] [-N <connections>] [-m <name>] [-f <image>] [-P <depth>] [-U] [-z] [-D] [-K] <workload-file>\n" \
 	"\n" \
 	"where:\n" \
 	"    -h - help mode (display this message)\n" \
@@ -42,6 +44,17 @@
 	"    -c - set the cart block cache to size <sz> (disabled for assign #2)\n" \
 	"    -i - IP address of server to connect to.\n" \
 	"    -p - port number of server to connect to.\n" \
+	"    -d - defragment <frames> frames after every read and write\n" \
+	"    -s - stripe the files round-robin over <carts> cartridges\n" \
+	"    -S - spread the cartridges over the host:port,... <servers>\n" \
+	"    -N - open <connections> to every server, the cartridges spread over them\n" \
+	"    -m - reach the server on this host through its shared memory <name>\n" \
+	"    -f - keep the cartridges in this process, in the file <image>\n" \
+	"    -P - keep up to <depth> requests in flight on each connection\n" \
+	"    -U - send the requests through io_uring, the sockets if there is none\n" \
+	"    -z - compress the blocks as they are written\n" \
+	"    -D - deduplicate the blocks as they are written\n" \
+	"    -K - do not checksum the frames\n" \
 	"\n" \
 	"    <workload-file> - file contain the workload to simulate\n" \
 	"\n" \
@@ -77,8 +90,8 @@ int validate_file(char *fname, int16_t mfh);  // Validate a file in the filesyst
 int main( int argc, char *argv[] ) {
 
 	// Local variables
-	int ch, verbose = 0, log_initialized = 0, unit_tests = 0;
-	uint32_t cache_size = 0;
+	int ch, verbose = 0, log_initialized = 0, unit_tests = 0, compress = 0, checksums = 1, depth = 1, pool = 1;
+	uint32_t cache_size = 0, defrag_budget = 0, dedup = CART_DEDUP_OFF, stripes = 1;
 
 	// Process the command line parameters
 	while ((ch = getopt(argc, argv, CART_ARGUMENTS)) != -1) {
@@ -122,6 +135,71 @@ int main( int argc, char *argv[] ) {
 			}
             break;			
 
+		case 'z': // Compress the blocks
+			compress = 1;
+			break;
+
+		case 'D': // Deduplicate the blocks
+			dedup = CART_DEDUP_ON;
+			break;
+
+		case 'K': // Do not checksum the frames
+			checksums = 0;
+			break;
+
+		case 'd': // Set the background defragment budget
+			if ( sscanf( optarg, "%u", &defrag_budget ) != 1 ) {
+			    logMessage( LOG_ERROR_LEVEL, "Bad defragment budget [%s]", optarg );
+			    return(-1);
+			}
+			break;
+
+		case 's': // Set the stripe width
+			if ( sscanf( optarg, "%u", &stripes ) != 1 ) {
+			    logMessage( LOG_ERROR_LEVEL, "Bad stripe width [%s]", optarg );
+			    return(-1);
+			}
+			break;
+
+		case 'S': // Spread the cartridges over several servers
+			if ( client_cart_set_shards(optarg) == -1 ) {
+			    logMessage( LOG_ERROR_LEVEL, "Bad server list [%s]", optarg );
+			    return(-1);
+			}
+			break;
+
+		case 'N': // Pool of connections to every server
+			if ( sscanf( optarg, "%d", &pool ) != 1 || client_cart_set_pool(pool) == -1 ) {
+			    logMessage( LOG_ERROR_LEVEL, "Bad pool size [%s]", optarg );
+			    return(-1);
+			}
+			break;
+
+		case 'U': // Send the requests through io_uring
+			client_cart_set_uring(1);
+			break;
+
+		case 'm': // Reach the server through shared memory
+			if ( client_cart_set_shm(optarg) == -1 ) {
+			    logMessage( LOG_ERROR_LEVEL, "Bad shared memory name [%s]", optarg );
+			    return(-1);
+			}
+			break;
+
+		case 'f': // Keep the cartridges in this process
+			if ( client_cart_set_local(optarg) == -1 ) {
+			    logMessage( LOG_ERROR_LEVEL, "Bad cartridge image [%s]", optarg );
+			    return(-1);
+			}
+			break;
+
+		case 'P': // Pipeline the requests
+			if ( sscanf( optarg, "%d", &depth ) != 1 || client_cart_set_pipeline(depth) == -1 ) {
+			    logMessage( LOG_ERROR_LEVEL, "Bad pipeline depth [%s]", optarg );
+			    return(-1);
+			}
+			break;
+
 		default:  // Default (unknown)
 			fprintf( stderr, "Unknown command line option (%c), aborting.\n", ch );
 			return( -1 );
@@ -140,6 +218,14 @@ int main( int argc, char *argv[] ) {
 	if (cache_size != 0) {
 		set_cart_cache_size(cache_size);
 	}
+	cart_set_defrag_budget(defrag_budget);
+	cart_set_compression(compress);
+	cart_set_dedup(dedup);
+	cart_set_checksums(checksums);
+	if ( cart_set_stripes(stripes) == -1 ) {
+		logMessage( LOG_ERROR_LEVEL, "Bad stripe width [%u]", stripes );
+		return( -1 );
+	}
 
 	// If exgtracting file from data
 	if (unit_tests) {
@@ -147,7 +233,7 @@ int main( int argc, char *argv[] ) {
 		// Run the unit tests
 		enableLogLevels( LOG_INFO_LEVEL );
 		logMessage(LOG_INFO_LEVEL, "Running unit tests ....\n\n");
-		if ( (cartCacheUnitTest() == 0) && (cartCacheUnitTest() == 0) ) {
+		if ( (cartCacheUnitTest() == 0) && (cartCompressUnitTest() == 0) && (cartCrcUnitTest() == 0) ) {
 			logMessage(LOG_INFO_LEVEL, "Unit tests completed successfully.\n\n");
 		} else {
 			logMessage(LOG_ERROR_LEVEL, "Unit tests failed, aborting.\n\n");
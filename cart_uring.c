@@ -0,0 +1,227 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : cart_uring.c
+//  Description    : This is the implementation of the io_uring rings of the
+//                   CART client. A ring is the submission and completion
+//                   queues mapped from the kernel, entries are filled in at
+//                   the tail of the submission queue and handed over with
+//                   one io_uring_enter, which also waits for completions.
+//
+//  Author         : [**Jason Ling**]
+//  Last Modified  : [**December 12, 2016**]
+//
+
+// Includes
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+
+// Project includes
+#include <cmpsc311_log.h>
+#include <cart_uring.h>
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_uring_setup
+// Description  : Create a ring and map its queues
+//
+// Inputs       : ring - the ring
+//                entries - room for this many submissions
+// Outputs      : 0 if successful, -1 if io_uring is not available
+
+int cart_uring_setup(CartUring *ring, unsigned entries) {
+	struct io_uring_params params;
+	char *sq = NULL, *cq = NULL;
+
+	memset(ring, 0, sizeof(CartUring));
+	memset(&params, 0, sizeof(params));
+	ring->fd = syscall(SYS_io_uring_setup, entries, &params);
+	if(ring->fd == -1) {
+		return (-1);
+	}
+
+	//the two queues share one mapping on the kernels that can
+	ring->sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	ring->cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	if(params.features & IORING_FEAT_SINGLE_MMAP) {
+		if(ring->cq_size > ring->sq_size) {
+			ring->sq_size = ring->cq_size;
+		}
+		ring->cq_size = ring->sq_size;
+	}
+	ring->sq_ring = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	if(ring->sq_ring == MAP_FAILED) {
+		ring->sq_ring = NULL;
+		cart_uring_close(ring);
+		return (-1);
+	}
+	if(params.features & IORING_FEAT_SINGLE_MMAP) {
+		ring->cq_ring = ring->sq_ring;
+	}
+	else {
+		ring->cq_ring = mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+		if(ring->cq_ring == MAP_FAILED) {
+			ring->cq_ring = NULL;
+			cart_uring_close(ring);
+			return (-1);
+		}
+	}
+	ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if(ring->sqes == MAP_FAILED) {
+		ring->sqes = NULL;
+		cart_uring_close(ring);
+		return (-1);
+	}
+
+	sq = ring->sq_ring;
+	cq = ring->cq_ring;
+	ring->sq_head = (unsigned *) (sq + params.sq_off.head);
+	ring->sq_tail = (unsigned *) (sq + params.sq_off.tail);
+	ring->sq_mask = (unsigned *) (sq + params.sq_off.ring_mask);
+	ring->sq_array = (unsigned *) (sq + params.sq_off.array);
+	ring->cq_head = (unsigned *) (cq + params.cq_off.head);
+	ring->cq_tail = (unsigned *) (cq + params.cq_off.tail);
+	ring->cq_mask = (unsigned *) (cq + params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+	ring->entries = params.sq_entries;
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_uring_register
+// Description  : Register the memory the fixed reads and writes use, the
+//                kernel maps it once instead of on every operation
+//
+// Inputs       : ring - the ring
+//                base - the memory
+//                len - its size
+// Outputs      : 0 if successful, -1 if failure
+
+int cart_uring_register(CartUring *ring, void *base, size_t len) {
+	struct iovec iov = {base, len};
+
+	if(syscall(SYS_io_uring_register, ring->fd, IORING_REGISTER_BUFFERS, &iov, 1) == -1) {
+		logMessage(LOG_ERROR_LEVEL, "Failure registering io_uring buffers, error=[%s]", strerror(errno));
+		return (-1);
+	}
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_uring_sqe
+// Description  : Get the next free submission entry, it is handed to the
+//                kernel by the next cart_uring_submit
+//
+// Inputs       : ring - the ring
+// Outputs      : the entry, cleared, NULL if the queue is full
+
+struct io_uring_sqe *cart_uring_sqe(CartUring *ring) {
+	unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+	unsigned tail = *ring->sq_tail + ring->queued;
+	struct io_uring_sqe *sqe = NULL;
+
+	if(tail - head >= ring->entries) {
+		return (NULL);
+	}
+
+	sqe = &ring->sqes[tail & *ring->sq_mask];
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	ring->sq_array[tail & *ring->sq_mask] = tail & *ring->sq_mask;
+	ring->queued++;
+
+	return (sqe);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_uring_submit
+// Description  : Hand the entries filled in to the kernel and wait for
+//                completions, in one system call
+//
+// Inputs       : ring - the ring
+//                wait - completions to wait for, 0 not to wait
+// Outputs      : 0 if successful, -1 if failure
+
+int cart_uring_submit(CartUring *ring, unsigned wait) {
+	unsigned submit = ring->queued;
+	int done = 0;
+
+	__atomic_store_n(ring->sq_tail, *ring->sq_tail + ring->queued, __ATOMIC_RELEASE);
+	ring->queued = 0;
+
+	do {
+		ring->enters++;
+		done = syscall(SYS_io_uring_enter, ring->fd, submit, wait, (wait > 0) ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+		if(done == -1 && errno != EINTR) {
+			logMessage(LOG_ERROR_LEVEL, "Failure entering io_uring, error=[%s]", strerror(errno));
+			return (-1);
+		}
+		if(done > 0) {
+			submit -= done;
+		}
+	} while(done == -1 || submit > 0);
+
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_uring_reap
+// Description  : Take the next completion off the completion queue
+//
+// Inputs       : ring - the ring
+//                cqe - where the completion goes
+// Outputs      : 1 if there was one, 0 if the queue is empty
+
+int cart_uring_reap(CartUring *ring, struct io_uring_cqe *cqe) {
+	unsigned head = *ring->cq_head;
+
+	if(head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+		return (0);
+	}
+
+	*cqe = ring->cqes[head & *ring->cq_mask];
+	__atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+
+	return (1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_uring_close
+// Description  : Unmap the queues of a ring and close it, its registered
+//                buffers go with it
+//
+// Inputs       : ring - the ring
+// Outputs      : 0 if successful
+
+int cart_uring_close(CartUring *ring) {
+	if(ring->sqes != NULL) {
+		munmap(ring->sqes, ring->sqes_size);
+	}
+	if(ring->cq_ring != NULL && ring->cq_ring != ring->sq_ring) {
+		munmap(ring->cq_ring, ring->cq_size);
+	}
+	if(ring->sq_ring != NULL) {
+		munmap(ring->sq_ring, ring->sq_size);
+	}
+	if(ring->fd != -1) {
+		close(ring->fd);
+	}
+	memset(ring, 0, sizeof(CartUring));
+	ring->fd = -1;
+
+	return (0);
+}
@@ -0,0 +1,64 @@
+#ifndef CART_URING_INCLUDED
+#define CART_URING_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : cart_uring.h
+//  Description    : This is the header file for the io_uring rings the CART
+//                   client sends its requests through, set up with the raw
+//                   system calls so nothing beyond the kernel headers is
+//                   needed.
+//
+//  Author         : [**Jason Ling**]
+//  Last Modified  : [**December 12, 2016**]
+//
+
+// Includes
+#include <stddef.h>
+#include <stdint.h>
+#include <linux/io_uring.h>
+
+// A ring shared with the kernel
+typedef struct {
+	int                  fd;        // The ring, -1 if there is none
+	unsigned            *sq_head;   // Submission queue, the kernel moves the head
+	unsigned            *sq_tail;
+	unsigned            *sq_mask;
+	unsigned            *sq_array;
+	struct io_uring_sqe *sqes;
+	unsigned            *cq_head;   // Completion queue, the kernel moves the tail
+	unsigned            *cq_tail;
+	unsigned            *cq_mask;
+	struct io_uring_cqe *cqes;
+	void                *sq_ring;   // Mappings of the ring
+	size_t               sq_size;
+	void                *cq_ring;
+	size_t               cq_size;
+	size_t               sqes_size;
+	unsigned             entries;   // Submission queue entries
+	unsigned             queued;    // Entries filled in and not submitted yet
+	uint64_t             enters;    // Calls to io_uring_enter
+} CartUring;
+
+//
+// Interface functions
+
+int cart_uring_setup(CartUring *ring, unsigned entries);
+	// Create a ring with room for entries submissions
+
+int cart_uring_register(CartUring *ring, void *base, size_t len);
+	// Register the memory the fixed reads and writes use, buffer index 0
+
+struct io_uring_sqe *cart_uring_sqe(CartUring *ring);
+	// Get the next free submission entry, cleared, NULL if the queue is full
+
+int cart_uring_submit(CartUring *ring, unsigned wait);
+	// Submit the entries filled in and wait for wait completions
+
+int cart_uring_reap(CartUring *ring, struct io_uring_cqe *cqe);
+	// Take the next completion, 1 if there was one, 0 if not
+
+int cart_uring_close(CartUring *ring);
+	// Tear a ring down
+
+#endif